@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <array>
 #include <glm/geometric.hpp>
 #include <glm/glm.hpp>
@@ -8,6 +9,24 @@
 
 enum class AXIS{ X_AXIS, Y_AXIS, Z_AXIS };
 
+// 基于预计算方向倒数的 slab 测试，供扁平化的 BVH 使用；命中时 t_enter 为进入时刻
+inline bool slab_test(const float box_min[3], const float box_max[3], const glm::vec3& orig, const glm::vec3& inv_dir, 
+                      float t_min, float t_max, float& t_enter)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        float t0 = (box_min[a] - orig[a]) * inv_dir[a];
+        float t1 = (box_max[a] - orig[a]) * inv_dir[a];
+        if (t1 < t0) std::swap(t0, t1);
+        // NaN（起点恰在平行平面上）时保持区间不变
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_min > t_max) return false;
+    }
+    t_enter = t_min;
+    return true;
+}
+
 class AABB
 {
     Interval _slab_x;
@@ -55,6 +74,7 @@ public:
     inline Interval get_slab_x() const { return _slab_x; }
     inline Interval get_slab_y() const { return _slab_y; }
     inline Interval get_slab_z() const { return _slab_z; }
+    inline Interval get_slab(int axis) const { return axis == 0 ? _slab_x : (axis == 1 ? _slab_y : _slab_z); }
 
     void set(const std::array<Interval, 3>& ranges)
     {
@@ -86,8 +106,8 @@ public:
     float area() const
     {
         auto x = _slab_x.length();
-        auto y = _slab_x.length();
-        auto z = _slab_x.length();
+        auto y = _slab_y.length();
+        auto z = _slab_z.length();
         return x * y + x * z + y * z;
     }
 
@@ -138,4 +158,29 @@ inline AABB operator+(const glm::vec3& offset, const AABB& box)
         box.get_slab_y() + offset.y, 
         box.get_slab_z() + offset.z
     };
-}
\ No newline at end of file
+}
+
+// 两个包围盒的交集，不相交时某一轴的区间为空（_min > _max）
+inline AABB intersection(const AABB& _1, const AABB& _2)
+{
+    std::array<Interval, 3> ranges;
+    for (int a = 0; a < 3; a++)
+    {
+        Interval s1 = _1.get_slab(a), s2 = _2.get_slab(a);
+        ranges[a] = { std::fmax(s1._min, s2._min), std::fmin(s1._max, s2._max) };
+    }
+    return ranges;
+}
+
+// 交集的表面积（与 AABB::area 同样取一半），不相交时为 0
+inline float overlap_area(const AABB& _1, const AABB& _2)
+{
+    float length[3];
+    for (int a = 0; a < 3; a++)
+    {
+        Interval s1 = _1.get_slab(a), s2 = _2.get_slab(a);
+        length[a] = std::fmin(s1._max, s2._max) - std::fmax(s1._min, s2._min);
+        if (length[a] < 0.f) return 0.f;
+    }
+    return length[0] * length[1] + length[0] * length[2] + length[1] * length[2];
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+/**
+ * @brief 单调增长的内存池：对象按分配顺序连续存放，释放为空操作，析构时一次性归还全部内存
+ *
+ * 在 ArenaScope 内通过 make_object 创建的 shared_ptr，其对象与控制块都位于池中，池必须比这些指针活得更久。
+ */
+class Arena : public std::pmr::memory_resource
+{
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    struct Block
+    {
+        std::unique_ptr<std::byte[]> _data;
+        size_t _size;
+    };
+    std::vector<Block> _blocks;
+    std::byte* _cursor{nullptr};
+    size_t _left{0};
+    size_t _block_size;
+    size_t _bytes_used{0};
+    size_t _allocations{0};
+
+protected:
+    virtual void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(_cursor) % alignment) % alignment;
+        if (!_cursor || padding + bytes > _left)
+        {
+            size_t size = std::max(_block_size, bytes + alignment);
+            _blocks.push_back({ std::unique_ptr<std::byte[]>(new std::byte[size]), size });
+            _cursor = _blocks.back()._data.get();
+            _left = size;
+            padding = (alignment - reinterpret_cast<std::uintptr_t>(_cursor) % alignment) % alignment;
+        }
+        void* p = _cursor + padding;
+        _cursor += padding + bytes;
+        _left -= padding + bytes;
+        _bytes_used += bytes;
+        _allocations++;
+        return p;
+    }
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment) override {}
+    virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    explicit Arena(size_t block_size = DEFAULT_BLOCK_SIZE) : _block_size{block_size} {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 一次性释放所有内存块，调用前必须确保池中对象都已销毁
+    void release()
+    {
+        _blocks.clear();
+        _cursor = nullptr;
+        _left = 0;
+        _bytes_used = 0;
+        _allocations = 0;
+    }
+
+    inline size_t bytes_used() const { return _bytes_used; }
+    inline size_t bytes_reserved() const 
+    {
+        size_t total = 0;
+        for (const auto& block : _blocks) total += block._size;
+        return total;
+    }
+    inline size_t allocation_count() const { return _allocations; }
+};
+
+// 直接转发到全局堆的计数资源，用于对比 Arena 与逐个堆分配的内存占用
+class HeapCounter : public std::pmr::memory_resource
+{
+    size_t _bytes_used{0};
+    size_t _allocations{0};
+protected:
+    virtual void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        _bytes_used += bytes;
+        _allocations++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    virtual void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    virtual bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+public:
+    inline size_t bytes_used() const { return _bytes_used; }
+    inline size_t allocation_count() const { return _allocations; }
+};
+
+// 作用域内通过 make_object 创建的对象都从指定的内存资源分配
+class ArenaScope
+{
+    static inline thread_local std::pmr::memory_resource* _current{nullptr};
+    std::pmr::memory_resource* _previous;
+public:
+    explicit ArenaScope(std::pmr::memory_resource& resource) : _previous{_current} { _current = &resource; }
+    ~ArenaScope() { _current = _previous; }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+    static std::pmr::memory_resource* current() { return _current; }
+};
+
+// 当前线程存在 ArenaScope 时从其资源分配对象与控制块，否则退化为 std::make_shared
+template<typename T, typename... Args>
+std::shared_ptr<T> make_object(Args&&... args)
+{
+    if (auto resource = ArenaScope::current()) 
+    {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(resource), std::forward<Args>(args)...);
+    }
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
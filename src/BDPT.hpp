@@ -0,0 +1,458 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Integrator.hpp"
+#include "Camera.hpp"
+#include "Environment.hpp"
+#include "LightBVH.hpp"
+#include "Material.hpp"
+#include "PhotonMap.hpp"
+#include "Rasterizer.hpp"
+
+// 子路径上的顶点：相机、光源上的采样点或表面命中点
+struct PathVertex
+{
+    enum class Type { CAMERA, LIGHT, SURFACE };
+    Type _type{Type::SURFACE};
+    glm::vec3 _point;
+    glm::vec3 _normal{ 0.f, 0.f, 0.f }; // 几何法线，相机顶点为零向量
+    glm::vec3 _beta;                    // 子路径到该顶点为止的吞吐量
+    HitRecord _record;                  // 表面顶点的命中信息
+    Ray _ray_in;                        // 到达表面顶点的光线
+    float _pdf_fwd{0.f};                // 沿子路径的生成方向采样到该顶点的面积 PDF
+    float _pdf_rev{0.f};                // 从另一端反向采样到该顶点的面积 PDF
+    bool _delta{false};                 // 只有 delta 分布的表面，不能参与连接
+    int _light{-1};                     // 光源顶点或自发光表面在光源列表中的下标
+
+    inline bool on_surface() const { return _type != Type::CAMERA; }
+    inline bool connectible() const { return !_delta; }
+    // 指向子路径上前一顶点的单位向量
+    inline glm::vec3 backward() const { return -glm::normalize(_ray_in.direction()); }
+};
+
+/**
+ * @brief 针孔相机的重要性函数 We 与方向 PDF
+ *
+ * 以整幅图像在单位距离处的面积 A 归一化：We = 1 / (A cos⁴θ)，方向 PDF 为 1 / (A cos³θ)。
+ * 每个相机样本对应一条光子子路径，落在像素上的贡献直接累加后与相机样本一起除以样本数
+ */
+struct PinholeSensor
+{
+    PinholeFrame _frame;
+    glm::vec3 _forward;
+    float _area;
+    int _width;
+    int _height;
+
+    PinholeSensor(const PinholeFrame& frame, int width, int height) : _frame{frame}, _width{width}, _height{height}
+    {
+        glm::vec3 to_plane = frame._pixel00 - frame._center;
+        _forward = glm::normalize(glm::cross(frame._delta_u, frame._delta_v));
+        if (glm::dot(_forward, to_plane) < 0.f) _forward = -_forward;
+        float distance = glm::dot(to_plane, _forward);
+        _area = glm::length(frame._delta_u) * width * glm::length(frame._delta_v) * height / (distance * distance);
+    }
+
+    // 单位方向 direction 落在图像内时给出其像素坐标与 cosθ
+    bool raster(const glm::vec3& direction, glm::vec2& screen, float& cos_theta) const
+    {
+        cos_theta = glm::dot(direction, _forward);
+        if (cos_theta <= 0.f || !_frame.project(_frame._center + direction, screen)) return false;
+        return screen.x >= -.5f && screen.x < _width - .5f && screen.y >= -.5f && screen.y < _height - .5f;
+    }
+
+    inline float importance(float cos_theta) const { return 1.f / (_area * cos_theta * cos_theta * cos_theta * cos_theta); }
+
+    float pdf(const glm::vec3& direction) const
+    {
+        glm::vec2 screen;
+        float cos_theta;
+        if (!raster(direction, screen, cos_theta)) return 0.f;
+        return 1.f / (_area * cos_theta * cos_theta * cos_theta);
+    }
+};
+
+/**
+ * @brief 双向路径追踪（Veach 1997）：相机与光源各生成一条子路径，所有 (s, t) 连接策略按幂启发式做 MIS
+ *
+ * s 为光子子路径的顶点数，t 为相机子路径的顶点数。t = 1 的策略把光子子路径连接到相机，
+ * 贡献落在任意像素上，每个线程先累加到自己的缓冲中，区域渲染结束后合并到 film，不需要原子操作。
+ * 光源按功率选择，在面光源上均匀取点并按双面余弦分布发射。环境光只能由相机子路径逃逸时取得，
+ * 其 MIS 权重为 1。与 Camera::render 相同，路径最多 max_depth 段
+ */
+class BDPTIntegrator : public Integrator
+{
+    LightPowerDistribution _power; // 光子子路径按功率选择光源
+
+    // 连接后路径的最大弹射次数 s + t - 2
+    inline int max_bounces() const { return _max_depth - 1; }
+
+    // 立体角 PDF 转为 to 处的面积 PDF
+    static float convert_density(float pdf, const PathVertex& from, const PathVertex& to)
+    {
+        glm::vec3 w = to._point - from._point;
+        float dist2 = glm::dot(w, w);
+        if (dist2 <= 0.f) return 0.f;
+        if (to.on_surface()) pdf *= std::fabs(glm::dot(to._normal, w)) / std::sqrt(dist2);
+        return pdf / dist2;
+    }
+
+    /**
+     * @brief 表面顶点处的 BSDF f(wo, wi)，wo 指向相机一侧，wi 指向光源一侧
+     *
+     * 由 eval 除去 wi 的余弦得到。粗糙电介质的折射不对称，光子子路径上也按这一方向取值
+     */
+    static glm::vec3 bsdf(const PathVertex& v, const glm::vec3& wo, const glm::vec3& wi)
+    {
+        float cos_i = std::fabs(glm::dot(v._normal, wi));
+        if (cos_i <= 1e-6f) return glm::vec3{ 0.f, 0.f, 0.f };
+        return v._record._material->eval(Ray{ v._point, -wo }, v._record, wi) / cos_i;
+    }
+
+    // 光源顶点或自发光表面朝 to 发射的面积 PDF
+    static float pdf_light(const PathVertex& v, const PathVertex& to)
+    {
+        glm::vec3 w = to._point - v._point;
+        float dist2 = glm::dot(w, w);
+        if (dist2 <= 0.f) return 0.f;
+        float dist = std::sqrt(dist2);
+        float pdf = std::fabs(glm::dot(v._normal, w)) / dist / (2.f * pi);
+        if (to.on_surface()) pdf *= std::fabs(glm::dot(to._normal, w)) / dist;
+        return pdf / dist2;
+    }
+
+    // 光子子路径从 v 出发的面积 PDF，v 不是可采样光源时为 0
+    float pdf_light_origin(const PathVertex& v) const
+    {
+        if (v._light < 0 || _power.empty()) return 0.f;
+        return _power.pmf(v._light) / _lights->light(static_cast<std::uint32_t>(v._light))._area;
+    }
+
+    // 由 prev 到达 v 后采样到 next 的面积 PDF，v 为相机或光源顶点时不需要 prev
+    float pdf(const PathVertex& v, const PathVertex* prev, const PathVertex& next, const PinholeSensor& sensor) const
+    {
+        if (v._type == PathVertex::Type::LIGHT) return pdf_light(v, next);
+        glm::vec3 wn = next._point - v._point;
+        if (glm::dot(wn, wn) <= 0.f) return 0.f;
+        wn = glm::normalize(wn);
+        float density;
+        if (v._type == PathVertex::Type::CAMERA) density = sensor.pdf(wn);
+        else density = v._record._material->pdf(Ray{ v._point, glm::normalize(v._point - prev->_point) }, v._record, wn);
+        return convert_density(density, v, next);
+    }
+
+    static bool visible(HitTable& world, const glm::vec3& from, const glm::vec3& to)
+    {
+        glm::vec3 w = to - from;
+        float dist = glm::length(w);
+        Ray shadow{ from, w / dist };
+        shadow.update_t_max(dist * (1.f - 1e-3f));
+        HitRecord occluder;
+        return !world.hit(shadow, occluder);
+    }
+
+    /**
+     * @brief 从 ray 出发随机游走，在 path 末尾追加至多 max_vertices 个表面顶点
+     *
+     * importance 为真时是光子子路径，吞吐量按伴随 BSDF 更新。pdf 为 ray 方向的立体角 PDF，
+     * 相机子路径逃逸时把环境光贡献累加到 escaped
+     */
+    void random_walk(HitTable& world, Ray ray, glm::vec3 beta, float pdf, int max_vertices, bool importance,
+        std::vector<PathVertex>& path, glm::vec3& escaped) const
+    {
+        for (int bounces = 0; bounces < max_vertices; bounces++)
+        {
+            HitRecord record;
+            if (!world.hit(ray, record))
+            {
+                if (!importance) escaped += beta * _environment->eval(glm::normalize(ray.direction()));
+                return;
+            }
+            record.resolve(ray);
+            PathVertex vertex;
+            vertex._point = record._point;
+            vertex._normal = record._normal;
+            vertex._beta = beta;
+            vertex._record = record;
+            vertex._ray_in = ray;
+            vertex._delta = record._material->is_specular();
+            vertex._light = record._light;
+            vertex._pdf_fwd = convert_density(pdf, path.back(), vertex);
+            path.push_back(vertex);
+            if (bounces + 1 >= max_vertices) return;
+
+            auto scatter = record._material->scatter(ray, record);
+            if (!scatter) return;
+            const PathVertex& current = path.back();
+            glm::vec3 wi = glm::normalize(scatter._scattered_ray.direction());
+            float pdf_rev = 0.f;
+            if (current._delta)
+            {
+                pdf = 0.f;
+                beta *= scatter._attenuation;
+            }
+            else
+            {
+                pdf = scatter._pdf;
+                if (pdf <= 0.f) return;
+                pdf_rev = record._material->pdf(Ray{ record._point, -wi }, record, current.backward());
+                if (importance) beta *= bsdf(current, wi, current.backward()) * (std::fabs(glm::dot(current._normal, wi)) / pdf);
+                else beta *= scatter._attenuation;
+            }
+            if (is_zero_vec(beta)) return;
+            PathVertex& prev = path[path.size() - 2];
+            prev._pdf_rev = convert_density(pdf_rev, current, prev);
+            scatter._scattered_ray.set_cone(ray.get_cone_width(record._t), ray.get_cone_spread() + bounce_cone_spread);
+            ray = scatter._scattered_ray;
+        }
+    }
+
+    // 按功率选择光源，均匀取点并按双面余弦分布发射，生成光子子路径
+    void light_subpath(HitTable& world, std::vector<PathVertex>& path) const
+    {
+        path.clear();
+        if (_power.empty()) return;
+        float pmf;
+        std::uint32_t index = _power.sample(RANDOM.get_float(0.f, 1.f), pmf);
+        const AreaLight& light = _lights->light(index);
+        float a = RANDOM.get_float(0.f, 1.f);
+        float b = RANDOM.get_float(0.f, 1.f);
+        glm::vec3 point = light._Q + a * light._u + b * light._v;
+        glm::vec3 side = RANDOM.get_float(0.f, 1.f) < .5f ? light._normal : -light._normal;
+        glm::vec3 direction = glm::normalize(RANDOM.cosine_weighted_random_hemisphere(side));
+        float cos_theta = std::fabs(glm::dot(light._normal, direction));
+        float pdf_dir = cos_theta / (2.f * pi);
+        if (pdf_dir <= 0.f) return;
+        glm::vec3 radiance = light._material->emitted({ a, b }, point, 0.f);
+
+        PathVertex vertex;
+        vertex._type = PathVertex::Type::LIGHT;
+        vertex._point = point;
+        vertex._normal = light._normal;
+        vertex._beta = radiance;
+        vertex._pdf_fwd = pmf / light._area;
+        vertex._light = static_cast<int>(index);
+        path.push_back(vertex);
+        glm::vec3 beta = radiance * (cos_theta / (vertex._pdf_fwd * pdf_dir));
+        glm::vec3 unused{ 0.f, 0.f, 0.f };
+        random_walk(world, Ray{ point, direction }, beta, pdf_dir, max_bounces(), true, path, unused);
+    }
+
+    /**
+     * @brief 连接策略 (s, t) 的 MIS 权重
+     *
+     * 只需要各顶点的前向与反向面积 PDF 之比：连接边两端及其前一顶点的反向 PDF 由连接方向重新计算，
+     * sampled 为 s = 1 或 t = 1 时新采样的光源或相机顶点。delta 顶点的 PDF 记为 1 参与比值，
+     * 但不能作为连接端点的策略不计入
+     */
+    float mis_weight(const std::vector<PathVertex>& light_path, const std::vector<PathVertex>& camera_path,
+        const PathVertex* sampled, int s, int t, const PinholeSensor& sensor) const
+    {
+        if (s + t == 2) return 1.f;
+        const PathVertex* qs = s > 0 ? (s == 1 ? sampled : &light_path[s - 1]) : nullptr;
+        const PathVertex* pt = t == 1 ? sampled : &camera_path[t - 1];
+        const PathVertex* qs_minus = s > 1 ? &light_path[s - 2] : nullptr;
+        const PathVertex* pt_minus = t > 1 ? &camera_path[t - 2] : nullptr;
+        // 命中的自发光表面不是可采样光源时，只有 s = 0 能生成这条路径
+        if (s == 0 && pt->_light < 0) return 1.f;
+
+        float pt_rev = s > 0 ? pdf(*qs, qs_minus, *pt, sensor) : pdf_light_origin(*pt);
+        float pt_minus_rev = 0.f, qs_rev = 0.f, qs_minus_rev = 0.f;
+        if (pt_minus) pt_minus_rev = s > 0 ? pdf(*pt, qs, *pt_minus, sensor) : pdf_light(*pt, *pt_minus);
+        if (qs) qs_rev = pdf(*pt, pt_minus, *qs, sensor);
+        if (qs_minus) qs_minus_rev = pdf(*qs, pt, *qs_minus, sensor);
+
+        auto remap = [](float f) { return f != 0.f ? f : 1.f; };
+        float sum = 0.f;
+        float ratio = 1.f;
+        for (int i = t - 1; i > 0; i--)
+        {
+            float rev = i == t - 1 ? pt_rev : (i == t - 2 ? pt_minus_rev : camera_path[i]._pdf_rev);
+            ratio *= remap(rev) / remap(camera_path[i]._pdf_fwd);
+            bool delta = i != t - 1 && camera_path[i]._delta;
+            if (!delta && !camera_path[i - 1]._delta) sum += ratio * ratio;
+        }
+        ratio = 1.f;
+        for (int i = s - 1; i >= 0; i--)
+        {
+            float rev = i == s - 1 ? qs_rev : (i == s - 2 ? qs_minus_rev : light_path[i]._pdf_rev);
+            float fwd = i == s - 1 ? qs->_pdf_fwd : light_path[i]._pdf_fwd;
+            ratio *= remap(rev) / remap(fwd);
+            bool delta = i != s - 1 && light_path[i]._delta;
+            // 面光源不是 delta 光源
+            bool delta_prev = i > 0 && light_path[i - 1]._delta;
+            if (!delta && !delta_prev) sum += ratio * ratio;
+        }
+        return 1.f / (1.f + sum);
+    }
+
+    // 按策略 (s, t) 连接两条子路径，t = 1 时 screen 为贡献所在的像素坐标
+    glm::vec3 connect(HitTable& world, const std::vector<PathVertex>& light_path, const std::vector<PathVertex>& camera_path,
+        int s, int t, const PinholeSensor& sensor, glm::vec2& screen) const
+    {
+        const glm::vec3 black{ 0.f, 0.f, 0.f };
+        glm::vec3 L;
+        PathVertex sampled;
+        if (s == 0)
+        {
+            // 相机子路径自己命中了光源
+            const PathVertex& pt = camera_path[t - 1];
+            if (!pt._record._material->is_emissive()) return black;
+            L = pt._beta * pt._record._material->emitted(pt._record._uv, pt._point, pt._record._footprint);
+        }
+        else if (t == 1)
+        {
+            // 光子子路径连接到相机
+            const PathVertex& qs = light_path[s - 1];
+            if (!qs.connectible()) return black;
+            glm::vec3 w = sensor._frame._center - qs._point;
+            float dist2 = glm::dot(w, w);
+            glm::vec3 direction = w / std::sqrt(dist2);
+            float cos_theta;
+            if (!sensor.raster(-direction, screen, cos_theta)) return black;
+            sampled._type = PathVertex::Type::CAMERA;
+            sampled._point = sensor._frame._center;
+            sampled._beta = glm::vec3(sensor.importance(cos_theta) * cos_theta / dist2);
+            L = qs._beta * bsdf(qs, direction, qs.backward()) * std::fabs(glm::dot(qs._normal, direction)) * sampled._beta;
+            if (is_zero_vec(L) || !visible(world, qs._point, sampled._point)) return black;
+        }
+        else if (s == 1)
+        {
+            // 相机子路径连接到新采样的光源点
+            const PathVertex& pt = camera_path[t - 1];
+            if (!pt.connectible() || _power.empty()) return black;
+            float pmf;
+            std::uint32_t index = _power.sample(RANDOM.get_float(0.f, 1.f), pmf);
+            const AreaLight& light = _lights->light(index);
+            float a = RANDOM.get_float(0.f, 1.f);
+            float b = RANDOM.get_float(0.f, 1.f);
+            glm::vec3 point = light._Q + a * light._u + b * light._v;
+            glm::vec3 w = point - pt._point;
+            float dist2 = glm::dot(w, w);
+            if (dist2 <= 0.f) return black;
+            glm::vec3 direction = w / std::sqrt(dist2);
+            float cos_light = std::fabs(glm::dot(light._normal, direction));
+            if (cos_light <= 1e-6f) return black;
+            sampled._type = PathVertex::Type::LIGHT;
+            sampled._point = point;
+            sampled._normal = light._normal;
+            sampled._light = static_cast<int>(index);
+            sampled._beta = light._material->emitted({ a, b }, point, 0.f) * (cos_light * light._area / (pmf * dist2));
+            sampled._pdf_fwd = pdf_light_origin(sampled);
+            L = pt._beta * bsdf(pt, pt.backward(), direction) * std::fabs(glm::dot(pt._normal, direction)) * sampled._beta;
+            if (is_zero_vec(L) || !visible(world, pt._point, point)) return black;
+        }
+        else
+        {
+            const PathVertex& qs = light_path[s - 1];
+            const PathVertex& pt = camera_path[t - 1];
+            if (!qs.connectible() || !pt.connectible()) return black;
+            glm::vec3 w = pt._point - qs._point;
+            float dist2 = glm::dot(w, w);
+            if (dist2 <= 0.f) return black;
+            glm::vec3 direction = w / std::sqrt(dist2);
+            L = qs._beta * bsdf(qs, direction, qs.backward()) * bsdf(pt, pt.backward(), -direction) * pt._beta;
+            if (is_zero_vec(L)) return black;
+            L *= std::fabs(glm::dot(qs._normal, direction)) * std::fabs(glm::dot(pt._normal, direction)) / dist2;
+            if (!visible(world, qs._point, pt._point)) return black;
+        }
+        return L * mis_weight(light_path, camera_path, &sampled, s, t, sensor);
+    }
+
+    // 像素样本的估计值，t = 1 策略的贡献累加到 splats
+    glm::vec3 sample(Camera& camera, HitTable& world, int x, int y, const PinholeSensor& sensor,
+        std::vector<PathVertex>& camera_path, std::vector<PathVertex>& light_path, std::vector<glm::vec3>& splats) const
+    {
+        Ray ray = camera.get_ray(static_cast<float>(x), static_cast<float>(y));
+        camera_path.clear();
+        PathVertex vertex;
+        vertex._type = PathVertex::Type::CAMERA;
+        vertex._point = sensor._frame._center;
+        vertex._beta = glm::vec3{ 1.f, 1.f, 1.f };
+        camera_path.push_back(vertex);
+        glm::vec3 radiance{ 0.f, 0.f, 0.f };
+        random_walk(world, ray, vertex._beta, sensor.pdf(glm::normalize(ray.direction())), _max_depth, false, camera_path, radiance);
+        light_subpath(world, light_path);
+
+        for (int t = 1; t <= static_cast<int>(camera_path.size()); t++)
+        {
+            for (int s = 0; s <= static_cast<int>(light_path.size()); s++)
+            {
+                int depth = s + t - 2;
+                if ((s == 1 && t == 1) || depth < 0 || depth > max_bounces()) continue;
+                glm::vec2 screen;
+                glm::vec3 L = connect(world, light_path, camera_path, s, t, sensor, screen);
+                if (t != 1)
+                {
+                    radiance += L;
+                    continue;
+                }
+                if (is_zero_vec(L)) continue;
+                int px = std::min(static_cast<int>(std::floor(screen.x + .5f)), sensor._width - 1);
+                int py = std::min(static_cast<int>(std::floor(screen.y + .5f)), sensor._height - 1);
+                splats[static_cast<size_t>(py) * sensor._width + px] += L;
+            }
+        }
+        return radiance;
+    }
+
+public:
+    using Integrator::render;
+
+    /**
+     * @brief 渲染区域内编号为 [sample_begin, sample_end) 的样本
+     *
+     * 落到区域外像素的光子贡献只加到和而不计样本数，所有区域都渲染了相同的样本区间后每个像素的均值才正确
+     */
+    virtual void render(Camera& camera, Film& film, const Region& region, int sample_begin, int sample_end, HitTable& world) override
+    {
+        LightingScope lighting{*this, camera};
+        _power.build(_lights.get());
+        PinholeSensor sensor{ camera.pinhole_frame(), film.width(), film.height() };
+#pragma omp parallel
+        {
+            std::vector<glm::vec3> splats(static_cast<size_t>(film.width()) * film.height(), glm::vec3{ 0.f, 0.f, 0.f });
+            std::vector<PathVertex> camera_path, light_path;
+            camera_path.reserve(_max_depth + 1);
+            light_path.reserve(_max_depth);
+#pragma omp for schedule(dynamic, 1)
+            for (int y = region._y0; y < region._y1; y++)
+            {
+                for (int x = region._x0; x < region._x1; x++)
+                {
+                    glm::vec3 color{ 0.f, 0.f, 0.f };
+                    for (int ct = sample_begin; ct < sample_end; ct++)
+                    {
+                        RANDOM.start_sample(x, y, ct);
+                        color += sample(camera, world, x, y, sensor, camera_path, light_path, splats);
+                    }
+                    film.add(x, y, color, sample_end - sample_begin);
+                }
+            }
+            // 各线程的缓冲依次合并，omp for 结束时的隐式屏障保证此时所有行都已写完
+#pragma omp critical
+            for (int y = 0; y < film.height(); y++)
+            {
+                for (int x = 0; x < film.width(); x++)
+                {
+                    film.add(x, y, splats[film.index(x, y)], 0);
+                }
+            }
+        }
+    }
+};
+
+// 按名称创建积分器，名称未知时返回 nullptr
+inline IntegratorPtr make_integrator(const std::string& name)
+{
+    if (name == "path") return std::make_shared<PathIntegrator>();
+    if (name == "bdpt") return std::make_shared<BDPTIntegrator>();
+    if (name == "photon") return std::make_shared<PhotonIntegrator>();
+    return nullptr;
+}
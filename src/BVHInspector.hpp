@@ -0,0 +1,260 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "BVHTopology.hpp"
+#include "BVHReport.hpp"
+
+/**
+ * @brief 一个 BVH 的质量指标
+ *
+ * SAH 代价按 BVHnode 的口径，内部节点与每个图元的代价都取 1，各节点面积相对根节点归一化；
+ * 兄弟重叠为所有内部节点两个子节点包围盒交集的面积之和，同样相对根节点归一化。
+ */
+struct BVHQuality
+{
+    std::string _name;
+    size_t _nodes{0};
+    size_t _bytes{0};
+    size_t _leaves{0};
+    size_t _references{0};
+    double _sah_cost{0.};
+    double _sibling_overlap{0.};
+    std::vector<size_t> _depth_histogram; // 各深度的叶节点数
+    std::vector<size_t> _leaf_sizes;      // 下标为叶节点的图元数
+    double _node_tests{0.};               // 每条光线的平均包围盒测试次数
+    double _primitive_tests{0.};          // 每条光线的平均图元求交次数
+    double _hit_rate{0.};
+};
+
+/**
+ * @brief 在快照上由近到远遍历一条光线，统计包围盒测试与图元求交次数
+ *
+ * 所有布局使用同一种遍历顺序（两个子节点都命中时先访问较近者），因此次数只反映树本身的质量。
+ */
+inline bool trace_topology(const BVHTopology& topology, Ray& r, size_t& node_tests, size_t& primitive_tests)
+{
+    if (topology._nodes.empty()) return false;
+    const glm::vec3 orig = r.origin();
+    const glm::vec3 dir = r.direction();
+    const glm::vec3 inv_dir{ 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+    auto test = [&](const BVHTopology::Node& node, float& t_enter)
+    {
+        if (!node._boxed)
+        {
+            t_enter = -std::numeric_limits<float>::infinity();
+            return true;
+        }
+        node_tests++;
+        float box_min[3], box_max[3];
+        for (int a = 0; a < 3; a++)
+        {
+            box_min[a] = node._box.get_slab(a)._min;
+            box_max[a] = node._box.get_slab(a)._max;
+        }
+        return slab_test(box_min, box_max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), t_enter);
+    };
+    float t_enter;
+    if (!test(topology._nodes[0], t_enter)) return false;
+    std::vector<std::uint32_t> stack{ 0 };
+    HitRecord record;
+    bool hit_anything = false;
+    while (!stack.empty())
+    {
+        const BVHTopology::Node& node = topology._nodes[stack.back()];
+        stack.pop_back();
+        for (auto i = node._begin; i != node._end; i++)
+        {
+            primitive_tests++;
+            if (topology._primitives[i]->hit(r, record)) hit_anything = true;
+        }
+        float t[2];
+        bool child_hit[2];
+        for (int c = 0; c < 2; c++)
+        {
+            child_hit[c] = node._child[c] != BVHTopology::NONE && test(topology._nodes[node._child[c]], t[c]);
+        }
+        // 先压入较远的子节点，使较近者先出栈
+        if (child_hit[0] && child_hit[1] && t[0] <= t[1])
+        {
+            stack.push_back(node._child[1]);
+            stack.push_back(node._child[0]);
+        }
+        else
+        {
+            for (int c = 0; c < 2; c++) if (child_hit[c]) stack.push_back(node._child[c]);
+        }
+    }
+    return hit_anything;
+}
+
+// 统计树的结构指标，并用同一组光线测量遍历次数
+inline BVHQuality inspect_bvh(const std::string& name, const BVHTopology& topology, const std::vector<Ray>& rays)
+{
+    BVHQuality quality;
+    quality._name = name;
+    quality._nodes = topology._node_count;
+    quality._bytes = topology._bytes;
+    quality._references = topology._primitives.size();
+    if (topology._nodes.empty()) return quality;
+    const double root_area = topology._nodes[0]._box.area();
+    double sah = 0., overlap = 0.;
+    std::vector<std::pair<std::uint32_t, int>> stack{ { 0, 0 } };
+    while (!stack.empty())
+    {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        const BVHTopology::Node& node = topology._nodes[index];
+        size_t primitives = node._end - node._begin;
+        if (primitives > 0)
+        {
+            sah += node._box.area() * primitives;
+            quality._leaves++;
+            if (quality._depth_histogram.size() <= static_cast<size_t>(depth)) quality._depth_histogram.resize(depth + 1, 0);
+            quality._depth_histogram[depth]++;
+            if (quality._leaf_sizes.size() <= primitives) quality._leaf_sizes.resize(primitives + 1, 0);
+            quality._leaf_sizes[primitives]++;
+        }
+        if (node.is_leaf()) continue;
+        sah += node._box.area();
+        if (node._child[0] != BVHTopology::NONE && node._child[1] != BVHTopology::NONE)
+        {
+            overlap += overlap_area(topology._nodes[node._child[0]]._box, topology._nodes[node._child[1]]._box);
+        }
+        for (auto child : node._child) if (child != BVHTopology::NONE) stack.push_back({ child, depth + 1 });
+    }
+    quality._sah_cost = root_area > 0. ? sah / root_area : 0.;
+    quality._sibling_overlap = root_area > 0. ? overlap / root_area : 0.;
+
+    size_t node_tests = 0, primitive_tests = 0, hits = 0;
+    for (const auto& ray : rays)
+    {
+        Ray r = ray;
+        if (trace_topology(topology, r, node_tests, primitive_tests)) hits++;
+    }
+    if (!rays.empty())
+    {
+        quality._node_tests = double(node_tests) / rays.size();
+        quality._primitive_tests = double(primitive_tests) / rays.size();
+        quality._hit_rate = double(hits) / rays.size();
+    }
+    return quality;
+}
+
+// 以 JSON 数组写出各个 BVH 的质量指标
+inline void write_bvh_json(const std::string& scene, size_t ray_count, const std::vector<BVHQuality>& qualities, std::ostream& out)
+{
+    auto list = [&out](const std::vector<size_t>& values)
+    {
+        out << "[";
+        for (size_t i = 0; i < values.size(); i++) out << (i ? ", " : "") << values[i];
+        out << "]";
+    };
+    out << std::setprecision(6) << "{\n  \"scene\": \"" << scene << "\",\n  \"rays\": " << ray_count << ",\n  \"structures\": [\n";
+    for (size_t i = 0; i < qualities.size(); i++)
+    {
+        const BVHQuality& q = qualities[i];
+        out << "    {\n"
+            << "      \"name\": \"" << q._name << "\",\n"
+            << "      \"nodes\": " << q._nodes << ",\n"
+            << "      \"bytes\": " << q._bytes << ",\n"
+            << "      \"bytes_per_node\": " << (q._nodes ? double(q._bytes) / q._nodes : 0.) << ",\n"
+            << "      \"leaves\": " << q._leaves << ",\n"
+            << "      \"references\": " << q._references << ",\n"
+            << "      \"sah_cost\": " << q._sah_cost << ",\n"
+            << "      \"sibling_overlap\": " << q._sibling_overlap << ",\n"
+            << "      \"max_depth\": " << (q._depth_histogram.empty() ? 0 : q._depth_histogram.size() - 1) << ",\n"
+            << "      \"leaf_depth_histogram\": ";
+        list(q._depth_histogram);
+        out << ",\n      \"leaf_size_histogram\": ";
+        list(q._leaf_sizes);
+        out << ",\n"
+            << "      \"node_tests_per_ray\": " << q._node_tests << ",\n"
+            << "      \"primitive_tests_per_ray\": " << q._primitive_tests << ",\n"
+            << "      \"hit_rate\": " << q._hit_rate << "\n"
+            << "    }" << (i + 1 < qualities.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+/**
+ * @brief 把单独测试的节点包围盒写成 OBJ 线框，每一层一个组（level_0 为根节点）
+ */
+inline bool write_bvh_obj(const BVHTopology& topology, const std::string& filename)
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    // 逐层收集节点，使同一层的包围盒位于同一个组中
+    std::vector<std::uint32_t> level;
+    if (!topology._nodes.empty()) level.push_back(0);
+    size_t vertices = 0;
+    for (int depth = 0; !level.empty(); depth++)
+    {
+        out << "g level_" << depth << "\n";
+        std::vector<std::uint32_t> next;
+        for (auto index : level)
+        {
+            const BVHTopology::Node& node = topology._nodes[index];
+            for (auto child : node._child) if (child != BVHTopology::NONE) next.push_back(child);
+            if (!node._boxed) continue;
+            Interval x = node._box.get_slab_x(), y = node._box.get_slab_y(), z = node._box.get_slab_z();
+            for (int corner = 0; corner < 8; corner++)
+            {
+                out << "v " << (corner & 1 ? x._max : x._min) << " " << (corner & 2 ? y._max : y._min) << " " << (corner & 4 ? z._max : z._min) << "\n";
+            }
+            // 12 条棱连接只在一个坐标上不同的两个角点
+            for (int corner = 0; corner < 8; corner++)
+            {
+                for (int bit = 1; bit < 8; bit <<= 1)
+                {
+                    if (!(corner & bit)) out << "l " << vertices + corner + 1 << " " << vertices + (corner | bit) + 1 << "\n";
+                }
+            }
+            vertices += 8;
+        }
+        level = std::move(next);
+    }
+    return static_cast<bool>(out);
+}
+
+/**
+ * @brief 对同一组图元分别构建 BVHnode、量化 BVH 与三种策略的 GeometryStore，在同一组随机光线下比较质量
+ *
+ * obj_prefix 非空时为每个结构写出 <obj_prefix>_<名称>.obj 线框
+ */
+inline bool inspect_builders(const std::string& scene, const HitTablePtrs& objects, size_t ray_count, const std::string& obj_prefix, std::ostream& out)
+{
+    HitTablePtrs sorted = objects;
+    BVHnode bvh{sorted};
+    QuantizedBVH16 q16{objects};
+    QuantizedBVH8 q8{objects};
+    GeometryStore median{objects, GeometryStore::MEDIAN};
+    GeometryStore sah{objects, GeometryStore::SAH};
+    GeometryStore sbvh{objects, GeometryStore::SPATIAL};
+    auto rays = random_rays(bvh.get_aabb(), ray_count);
+
+    std::vector<std::pair<std::string, BVHTopology>> topologies;
+    topologies.emplace_back("BVHnode", bvh.topology());
+    topologies.emplace_back("QuantizedBVH16", q16.topology());
+    topologies.emplace_back("QuantizedBVH8", q8.topology());
+    topologies.emplace_back("GeometryStore_median", median.topology());
+    topologies.emplace_back("GeometryStore_SAH", sah.topology());
+    topologies.emplace_back("GeometryStore_SBVH", sbvh.topology());
+    std::vector<BVHQuality> qualities;
+    for (const auto& [name, topology] : topologies)
+    {
+        qualities.push_back(inspect_bvh(name, topology, rays));
+        if (!obj_prefix.empty() && !write_bvh_obj(topology, obj_prefix + "_" + name + ".obj")) return false;
+    }
+    write_bvh_json(scene, ray_count, qualities, out);
+    return static_cast<bool>(out);
+}
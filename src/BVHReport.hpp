@@ -0,0 +1,385 @@
+#pragma once
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "HitTable.hpp"
+#include "BVHnode.hpp"
+#include "QuantizedBVH.hpp"
+#include "GeometryStore.hpp"
+#include "SphereCloud.hpp"
+#include "PagedGeometry.hpp"
+#include "Arena.hpp"
+#include "Scene.hpp"
+
+// 起点均匀分布在包围盒内、方向均匀分布在球面上的随机光线
+inline std::vector<Ray> random_rays(const AABB& box, size_t ray_count)
+{
+    std::vector<Ray> rays;
+    rays.reserve(ray_count);
+    for (size_t i = 0; i < ray_count; i++)
+    {
+        glm::vec3 origin
+        {
+            RANDOM.get_float(box.get_slab_x()._min, box.get_slab_x()._max),
+            RANDOM.get_float(box.get_slab_y()._min, box.get_slab_y()._max),
+            RANDOM.get_float(box.get_slab_z()._min, box.get_slab_z()._max)
+        };
+        rays.emplace_back(origin, RANDOM.get_unit_vec3());
+    }
+    return rays;
+}
+
+// 在场景包围盒内随机发射光线，比较不同 BVH 布局的节点内存与遍历速度
+inline void report_bvh_layouts(const HitTablePtrs& objects, size_t ray_count, std::ostream& out)
+{
+    HitTablePtrs sorted = objects;
+    auto uncompressed = std::make_shared<BVHnode>(sorted);
+    QuantizedBVH16 q16{objects};
+    QuantizedBVH8 q8{objects};
+    GeometryStore store{objects};
+
+    AABB box = uncompressed->get_aabb();
+    std::vector<Ray> rays = random_rays(box, ray_count);
+
+    auto measure = [&](const char* name, HitTable& bvh, size_t bytes, size_t nodes)
+    {
+        size_t hits = 0;
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (const auto& ray : rays)
+        {
+            Ray r = ray;
+            HitRecord record;
+            // 与相机光线一样，命中后计算一次表面属性
+            if (!bvh.hit(r, record)) continue;
+            record.resolve(r);
+            hits++;
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
+        out << std::left << std::setw(14) << name
+            << " nodes: " << std::setw(8) << nodes
+            << " bytes: " << std::setw(10) << bytes
+            << " bytes/node: " << std::setw(8) << std::fixed << std::setprecision(1) << (nodes ? double(bytes) / nodes : 0.)
+            << " Mrays/s: " << std::setprecision(3) << rays.size() / seconds * 1e-6
+            << " hits: " << hits << std::endl;
+    };
+    measure("BVHnode", *uncompressed, uncompressed->memory_footprint(), uncompressed->node_count());
+    measure("QuantizedBVH16", q16, q16.memory_footprint(), q16.node_count());
+    measure("QuantizedBVH8", q8, q8.memory_footprint(), q8.node_count());
+    measure("GeometryStore", store, store.memory_footprint(), store.node_count());
+}
+
+/**
+ * @brief 同一场景分别用中位数划分、SAH 物体划分与 SBVH 构建 GeometryStore，对比构建时间、引用复制、内存与遍历速度
+ */
+inline void report_spatial_splits(const char* scene, const HitTablePtrs& objects, size_t ray_count, std::ostream& out)
+{
+    auto seconds_since = [](std::chrono::high_resolution_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t).count();
+    };
+    std::vector<Ray> rays;
+    for (auto [name, builder] : { std::pair{ "median", GeometryStore::MEDIAN }, std::pair{ "SAH", GeometryStore::SAH }, std::pair{ "SBVH", GeometryStore::SPATIAL } })
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        GeometryStore store{objects, builder};
+        double build = seconds_since(t1);
+        if (rays.empty()) rays = random_rays(store.get_aabb(), ray_count);
+        size_t primitives = store.primitive_count(GeometryStore::SPHERE) + store.primitive_count(GeometryStore::QUAD) + store.primitive_count(GeometryStore::GENERIC);
+        size_t hits = 0;
+        auto t2 = std::chrono::high_resolution_clock::now();
+        for (const auto& ray : rays)
+        {
+            Ray r = ray;
+            HitRecord record;
+            if (!store.hit(r, record)) continue;
+            record.resolve(r);
+            hits++;
+        }
+        double seconds = seconds_since(t2);
+        out << std::left << std::setw(10) << scene << std::setw(7) << name << std::fixed
+            << " build ms: " << std::setw(8) << std::setprecision(1) << build * 1e3
+            << " nodes: " << std::setw(7) << store.node_count()
+            << " references/primitive: " << std::setprecision(2) << double(store.reference_count()) / primitives
+            << " bytes: " << std::setw(9) << store.memory_footprint()
+            << " Mrays/s: " << std::setprecision(3) << rays.size() / seconds * 1e-6
+            << " hits: " << hits << std::endl;
+    }
+}
+
+// 叶节点求交开销：同一组 Quad 逐个调用 Quad::hit 与打包成 QuadPacket 整包求交的对比
+inline void report_quad_leaf(size_t ray_count, std::ostream& out)
+{
+    // 单位立方体内随机朝向的 Quad 凑满一个叶节点
+    std::vector<Quad> quads;
+    auto white = std::make_shared<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    for (int i = 0; i < QuadPacket::WIDTH; i++)
+    {
+        glm::vec3 origin{ RANDOM.get_float(0.f, 1.f), RANDOM.get_float(0.f, 1.f), RANDOM.get_float(0.f, 1.f) };
+        quads.emplace_back(origin, RANDOM.get_unit_vec3() * .5f, RANDOM.get_unit_vec3() * .5f, white);
+    }
+    std::vector<QuadPacket> packets;
+    pack_quads(quads, 0, static_cast<std::uint32_t>(quads.size()), packets);
+
+    AABB box;
+    for (const auto& quad : quads) box = quad.get_aabb() + box;
+    auto rays = random_rays(box, ray_count);
+    auto seconds_since = [](std::chrono::high_resolution_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t).count();
+    };
+
+    size_t scalar_hits = 0;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (const auto& ray : rays)
+    {
+        Ray r = ray;
+        HitRecord record;
+        bool hit = false;
+        for (auto& quad : quads) hit |= quad.hit(r, record);
+        if (hit) record.resolve(r);
+        scalar_hits += hit;
+    }
+    double scalar = seconds_since(t1);
+
+    size_t packet_hits = 0;
+    auto t2 = std::chrono::high_resolution_clock::now();
+    for (const auto& ray : rays)
+    {
+        Ray r = ray;
+        HitRecord record;
+        bool hit = false;
+        float t = 0.f, alpha = 0.f, beta = 0.f;
+        for (const auto& packet : packets)
+        {
+            int lane = packet.intersect(r, t, alpha, beta);
+            if (lane < 0) continue;
+            quads[packet._index[lane]].record_hit(r, t, alpha, beta, record);
+            hit = true;
+        }
+        if (hit) record.resolve(r);
+        packet_hits += hit;
+    }
+    double packed = seconds_since(t2);
+
+    out << "quad leaf (" << quads.size() << " quads, packet width " << QuadPacket::WIDTH << ")"
+        << " scalar ns/ray: " << std::fixed << std::setprecision(1) << scalar / rays.size() * 1e9
+        << " packet ns/ray: " << packed / rays.size() * 1e9
+        << " speedup: " << std::setprecision(2) << scalar / packed
+        << " hits: " << scalar_hits << "/" << packet_hits << std::endl;
+}
+
+// 同一批小球分别作为独立 Sphere 对象放入 GeometryStore 与存入 SphereCloud，对比每球内存、构建与遍历速度
+inline void report_sphere_cloud(int count, size_t ray_count, std::ostream& out)
+{
+    auto seconds_since = [](std::chrono::high_resolution_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t).count();
+    };
+    std::vector<MaterialPtr> palette;
+    for (int i = 0; i < 8; i++) palette.push_back(std::make_shared<Lambertian>(RANDOM.get_color()));
+    HitTablePtrs spheres;
+    auto cloud = std::make_shared<SphereCloud>();
+    cloud->reserve(static_cast<size_t>(count));
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 center{ RANDOM.get_float(-10.f, 10.f), RANDOM.get_float(-10.f, 10.f), RANDOM.get_float(-10.f, 10.f) };
+        float radius = RANDOM.get_float(.02f, .06f);
+        auto sphere = std::make_shared<Sphere>(center, radius);
+        sphere->_material = palette[i % palette.size()];
+        spheres.push_back(sphere);
+        cloud->add(center, radius, sphere->_material);
+    }
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    GeometryStore store{spheres};
+    double store_build = seconds_since(t1);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    cloud->build();
+    double cloud_build = seconds_since(t2);
+    // GeometryStore 以外还需保留原始 Sphere 对象才能共享其材质，这里只计入库内的拷贝
+    size_t store_bytes = store.primitive_count(GeometryStore::SPHERE) * sizeof(Sphere) + store.memory_footprint();
+
+    auto rays = random_rays(cloud->get_aabb(), ray_count);
+    auto measure = [&](const char* name, HitTable& table, size_t bytes, double build)
+    {
+        size_t hits = 0;
+        auto t = std::chrono::high_resolution_clock::now();
+        for (const auto& ray : rays)
+        {
+            Ray r = ray;
+            HitRecord record;
+            if (!table.hit(r, record)) continue;
+            record.resolve(r);
+            hits++;
+        }
+        double seconds = seconds_since(t);
+        out << std::left << std::setw(14) << name
+            << " spheres: " << count
+            << " bytes/sphere: " << std::fixed << std::setprecision(1) << double(bytes) / count
+            << " build s: " << std::setprecision(3) << build
+            << " Mrays/s: " << rays.size() / seconds * 1e-6
+            << " hits: " << hits << std::endl;
+    };
+    measure("GeometryStore", store, store_bytes, store_build);
+    measure("SphereCloud", *cloud, cloud->memory_footprint(), cloud_build);
+}
+
+/**
+ * @brief 对比逐个堆分配与 Arena 分配构建 box_field 场景的内存、构建/销毁耗时、访存局部性与遍历速度
+ */
+inline void report_scene_allocation(int boxes, size_t ray_count, std::ostream& out)
+{
+    auto seconds_since = [](std::chrono::high_resolution_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t).count();
+    };
+    auto measure = [&](const char* name, std::pmr::memory_resource& resource, auto bytes_used, auto allocations, auto release)
+    {
+        RANDOM.start_sample(0, 0, 0);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        std::shared_ptr<BVHnode> bvh;
+        {
+            ArenaScope scope{resource};
+            auto world = box_field(boxes);
+            bvh = make_object<BVHnode>(world);
+        }
+        double build = seconds_since(t1);
+
+        // 统计父子节点落在同一 4KB 页内的比例
+        size_t near_edges = 0;
+        size_t edges = 0;
+        std::vector<const BVHnode*> stack{ bvh.get() };
+        while (!stack.empty())
+        {
+            const BVHnode* node = stack.back();
+            stack.pop_back();
+            for (const auto& child : { node->left(), node->right() })
+            {
+                auto d = reinterpret_cast<std::intptr_t>(child.get()) - reinterpret_cast<std::intptr_t>(node);
+                if ((d < 0 ? -d : d) < 4096) near_edges++;
+                edges++;
+                if (auto inner = dynamic_cast<const BVHnode*>(child.get())) stack.push_back(inner);
+            }
+        }
+
+        RANDOM.start_sample(0, 0, 1);
+        auto rays = random_rays(bvh->get_aabb(), ray_count);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        size_t hits = 0;
+        for (auto& ray : rays)
+        {
+            HitRecord record;
+            if (!bvh->hit(ray, record)) continue;
+            record.resolve(ray);
+            hits++;
+        }
+        double trace = seconds_since(t2);
+
+        auto t3 = std::chrono::high_resolution_clock::now();
+        bvh.reset();
+        release();
+        double teardown = seconds_since(t3);
+
+        out << std::left << std::setw(6) << name << std::fixed
+            << " build: " << std::setprecision(3) << build * 1e3 << " ms"
+            << "  teardown: " << teardown * 1e3 << " ms"
+            << "  bytes: " << bytes_used()
+            << "  allocations: " << allocations()
+            << "  child within 4KB: " << std::setprecision(1) << (edges ? 100. * near_edges / edges : 0.) << "%"
+            << "  Mrays/s: " << std::setprecision(3) << rays.size() / trace * 1e-6
+            << "  hits: " << hits << std::endl;
+    };
+    HeapCounter heap;
+    measure("heap", heap, [&] { return heap.bytes_used(); }, [&] { return heap.allocation_count(); }, [] {});
+    Arena arena;
+    size_t arena_bytes = 0, arena_allocations = 0;
+    measure("arena", arena, [&] { return arena_bytes; }, [&] { return arena_allocations; }, 
+        [&] { arena_bytes = arena.bytes_used(); arena_allocations = arena.allocation_count(); arena.release(); });
+}
+
+/**
+ * @brief 把 box_field 场景写成分页几何文件，对比常驻的 GeometryStore 与受限/不受限缓存下分页遍历的速度与读入量
+ *
+ * 相干光线为针孔相机按 16×16 tile 顺序发出的主光线，非相干光线为场景内的随机光线。
+ */
+inline bool report_paged_geometry(const std::string& filename, int boxes, size_t cache_bytes, size_t ray_count, std::ostream& out)
+{
+    auto seconds_since = [](std::chrono::high_resolution_clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - t).count();
+    };
+    Arena arena;
+    ArenaScope scope{arena};
+    RANDOM.start_sample(0, 0, 0);
+    auto world = box_field(boxes);
+    // 块内 BVH 按中位数划分，常驻的几何库用同样的策略构建以便对比
+    GeometryStore store{world, GeometryStore::MEDIAN};
+    PagedGeometryWriter writer;
+    for (const auto& object : static_cast<HitTablePtrs&>(world)) if (!writer.add(object)) return false;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    if (!writer.write(filename)) return false;
+    out << "wrote " << writer.size() << " quads to " << filename << " in " << std::fixed << std::setprecision(2) << seconds_since(t1) << " s" << std::endl;
+
+    // 从盒子阵列的一侧看向内部
+    const int side = static_cast<int>(std::sqrt(double(ray_count)));
+    const int tile = 16;
+    std::vector<Ray> coherent;
+    coherent.reserve(static_cast<size_t>(side) * side);
+    const glm::vec3 eye{ 50.f, 50.f, -40.f };
+    for (int ty = 0; ty < side; ty += tile)
+    for (int tx = 0; tx < side; tx += tile)
+    for (int y = ty; y < std::min(ty + tile, side); y++)
+    for (int x = tx; x < std::min(tx + tile, side); x++)
+    {
+        glm::vec3 target{ 100.f * (x + .5f) / side, 100.f * (y + .5f) / side, 0.f };
+        coherent.emplace_back(eye, glm::normalize(target - eye));
+    }
+    RANDOM.start_sample(0, 0, 1);
+    auto incoherent = random_rays(store.get_aabb(), coherent.size());
+
+    auto measure = [&](const char* rays_name, const std::vector<Ray>& rays, const char* name, HitTable& table, auto describe)
+    {
+        size_t hits = 0;
+        auto t = std::chrono::high_resolution_clock::now();
+        for (const auto& ray : rays)
+        {
+            Ray r = ray;
+            HitRecord record;
+            if (!table.hit(r, record)) continue;
+            record.resolve(r);
+            hits++;
+        }
+        double seconds = seconds_since(t);
+        out << std::left << std::setw(10) << rays_name << std::setw(16) << name << std::fixed
+            << " Mrays/s: " << std::setprecision(3) << rays.size() / seconds * 1e-6
+            << "  hits: " << hits;
+        describe();
+        out << std::endl;
+    };
+    for (const auto& [rays_name, rays] : { std::pair{ "coherent", &coherent }, std::pair{ "random", &incoherent } })
+    {
+        measure(rays_name, *rays, "resident", store, [&] { out << "  bytes: " << store.memory_footprint() + store.primitive_count(GeometryStore::QUAD) * sizeof(Quad); });
+        for (size_t budget : { cache_bytes, std::numeric_limits<size_t>::max() })
+        {
+            auto paged = PagedGeometry::open(filename, writer.palette(), budget);
+            if (!paged) return false;
+            bool bounded = budget == cache_bytes;
+            measure(rays_name, *rays, bounded ? "paged bounded" : "paged unbounded", *paged, [&]
+            {
+                auto stats = paged->cache_stats();
+                out << "  peak bytes: " << stats._peak_bytes + paged->resident_index_bytes()
+                    << "  loads: " << stats._loads << "/" << paged->chunk_count()
+                    << "  evictions: " << stats._evictions
+                    << "  waits: " << stats._waits
+                    << "  deferred: " << paged->deferred_chunks()
+                    << "  culled: " << paged->culled_chunks();
+            });
+        }
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "AABB.hpp"
+#include "HitTable.hpp"
+
+/**
+ * @brief 与具体存储布局无关的 BVH 快照，供质量检查比较不同的构建策略与布局
+ *
+ * 每个节点可以同时带有子节点与直接挂在其下的图元。_boxed 为 false 的节点在遍历时不单独测试包围盒
+ * （如 BVHnode 直接以图元作为子节点，只调用图元自身的求交），其包围盒只参与 SAH 代价与重叠统计。
+ * 空间划分复制的图元在 _primitives 中出现多次。
+ */
+struct BVHTopology
+{
+    static constexpr std::uint32_t NONE = 0xffffffffu;
+
+    struct Node
+    {
+        AABB _box;
+        std::uint32_t _child[2]{ NONE, NONE };
+        std::uint32_t _begin{0}; // 直接挂在该节点下的图元在 _primitives 中的区间
+        std::uint32_t _end{0};
+        bool _boxed{true};
+
+        inline bool is_leaf() const { return _child[0] == NONE && _child[1] == NONE; }
+    };
+
+    std::vector<Node> _nodes; // 0 号为根节点
+    std::vector<HitTable*> _primitives;
+    size_t _node_count{0}; // 结构自身统计的节点数与字节数，用于每节点字节数
+    size_t _bytes{0};
+
+    std::uint32_t add_node(const AABB& box, bool boxed = true)
+    {
+        _nodes.emplace_back();
+        _nodes.back()._box = box;
+        _nodes.back()._boxed = boxed;
+        _nodes.back()._begin = _nodes.back()._end = static_cast<std::uint32_t>(_primitives.size());
+        return static_cast<std::uint32_t>(_nodes.size() - 1);
+    }
+
+    // 向最后添加的节点追加图元
+    void add_primitive(HitTable* primitive)
+    {
+        _primitives.push_back(primitive);
+        _nodes.back()._end = static_cast<std::uint32_t>(_primitives.size());
+    }
+};
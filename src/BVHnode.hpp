@@ -2,9 +2,11 @@
 #include <algorithm>
 #include <cstddef>
 #include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include "HitTable.hpp"
 #include "AABB.hpp"
+#include "BVHTopology.hpp"
 
 
 static bool box_x_compare(const HitTablePtr a, const HitTablePtr b)
@@ -26,12 +28,52 @@ class BVHnode : public HitTable
     HitTablePtr _left;
     HitTablePtr _right;
     AABB _box;
+    float _cost{0.f};       // 子树的 SAH 代价（未归一化的表面积之和）
+    float _build_cost{0.f}; // 构建时的代价，refit 后与之比较判断子树是否退化
     static std::unordered_map<AXIS, box_compare> _compare;
+    static constexpr int REFIT_TASK_DEPTH = 6;
+    static constexpr float PRIMITIVE_COST = 1.f;
+
+    static float child_cost(const HitTablePtr& child)
+    {
+        if (auto node = dynamic_cast<BVHnode*>(child.get())) return node->_cost;
+        return child->get_aabb().area() * PRIMITIVE_COST;
+    }
+
+    void update_cost()
+    {
+        _cost = _box.area() + child_cost(_left) + (_right != _left ? child_cost(_right) : 0.f);
+    }
+
+    // 自底向上重算包围盒，较浅的层级把左子树作为 OpenMP 任务并行处理
+    void refit_task(int depth)
+    {
+        auto refit_child = [](const HitTablePtr& child, int child_depth)
+        {
+            if (auto node = dynamic_cast<BVHnode*>(child.get())) node->refit_task(child_depth);
+            else child->refit();
+        };
+        if (depth < REFIT_TASK_DEPTH && _right != _left)
+        {
+#pragma omp task default(shared)
+            refit_child(_left, depth + 1);
+            refit_child(_right, depth + 1);
+#pragma omp taskwait
+        }
+        else
+        {
+            refit_child(_left, depth + 1);
+            if (_right != _left) refit_child(_right, depth + 1);
+        }
+        _box = _left->get_aabb() + _right->get_aabb();
+        update_cost();
+    }
+
 public:
     BVHnode(HitTablePtrs& objects) : BVHnode{objects, 0, objects.size() } {}
     BVHnode(HitTablePtrs& objects, size_t begin, size_t end)
     {
-        for (int i = begin; i != end; i++)
+        for (size_t i = begin; i != end; i++)
         {
             _box = objects[i]->get_aabb() + _box;
         }
@@ -50,29 +92,139 @@ public:
         {
             std::sort(objects.begin() + begin, objects.begin() + end, _compare[_box.longest_axis()]);
             auto mid = begin + span / 2;
-            _left = std::make_shared<BVHnode>(objects, begin, mid);
-            _right = std::make_shared<BVHnode>(objects, mid, end);
+            _left = make_object<BVHnode>(objects, begin, mid);
+            _right = make_object<BVHnode>(objects, mid, end);
         }
+        update_cost();
+        _build_cost = _cost;
     }
     virtual bool hit(Ray& r, HitRecord& record) override
     {
         if (!_box.hit(r)) return false;
+        // 左子树命中后已收紧 t_max，右子树只会接受更近的命中，可直接写入同一记录
         bool hit_left = _left->hit(r, record);
-        bool hit_anything = hit_left;
-        if (hit_left) r.update_t_max(record._t);
-        HitRecord right_record;
-        if (_right->hit(r, right_record)) 
+        bool hit_right = _right->hit(r, record);
+        return hit_left || hit_right;
+    }
+
+    virtual AABB get_aabb() const override { return _box; }
+    virtual void collect_quads(std::vector<Quad*>& quads) override
+    {
+        _left->collect_quads(quads);
+        if (_right != _left) _right->collect_quads(quads);
+    }
+    virtual bool collect_raster(std::vector<Quad*>& quads, std::vector<Sphere*>& spheres) override
+    {
+        bool complete = _left->collect_raster(quads, spheres);
+        if (_right != _left) complete &= _right->collect_raster(quads, spheres);
+        return complete;
+    }
+    inline const HitTablePtr& left() const { return _left; }
+    inline const HitTablePtr& right() const { return _right; }
+    inline float cost() const { return _cost; }
+    inline float build_cost() const { return _build_cost; }
+
+    // 按叶节点顺序收集子树中的图元
+    void collect_primitives(HitTablePtrs& objects) const
+    {
+        for (const auto& child : { _left, _right })
+        {
+            if (child == _right && _right == _left) break;
+            if (auto node = dynamic_cast<BVHnode*>(child.get())) node->collect_primitives(objects);
+            else objects.push_back(child);
+        }
+    }
+
+    virtual void refit() override
+    {
+#pragma omp parallel
+#pragma omp single
+        refit_task(0);
+    }
+
+    /**
+     * @brief 自顶向下查找代价超过构建时 threshold 倍的子树并用其图元重建
+     * 
+     * @return 重建的子树数量
+     */
+    size_t rebuild_degraded(float threshold)
+    {
+        if (_cost > threshold * _build_cost)
+        {
+            HitTablePtrs objects;
+            collect_primitives(objects);
+            // 每帧都可能重建，arena 不回收内存，新节点从堆上分配，被替换的子树随引用计数释放
+            ArenaScope heap{*std::pmr::new_delete_resource()};
+            BVHnode rebuilt{objects};
+            _left = rebuilt._left;
+            _right = rebuilt._right;
+            _box = rebuilt._box;
+            _cost = rebuilt._cost;
+            _build_cost = rebuilt._build_cost;
+            return 1;
+        }
+        size_t count = 0;
+        if (auto left = dynamic_cast<BVHnode*>(_left.get())) count += left->rebuild_degraded(threshold);
+        if (auto right = dynamic_cast<BVHnode*>(_right.get()); right && _right != _left) count += right->rebuild_degraded(threshold);
+        if (count > 0)
+        {
+            _box = _left->get_aabb() + _right->get_aabb();
+            update_cost();
+        }
+        return count;
+    }
+
+    // 物体移动后的每帧更新：并行 refit，再重建退化的子树
+    size_t update(float threshold = 1.5f)
+    {
+        refit();
+        return rebuild_degraded(threshold);
+    }
+
+    // 子树中 BVHnode 的数量（不含图元）
+    size_t node_count() const
+    {
+        size_t count = 1;
+        if (auto left = std::dynamic_pointer_cast<BVHnode>(_left)) count += left->node_count();
+        if (auto right = std::dynamic_pointer_cast<BVHnode>(_right); right && right != _left) count += right->node_count();
+        return count;
+    }
+
+    // 以 BVHnode 为内部节点的快照，作为子节点的图元是不单独测试包围盒的叶节点
+    BVHTopology topology() const
+    {
+        BVHTopology topology;
+        topology._node_count = node_count();
+        topology._bytes = memory_footprint();
+        add_topology(topology);
+        return topology;
+    }
+
+    std::uint32_t add_topology(BVHTopology& topology) const
+    {
+        std::uint32_t index = topology.add_node(_box);
+        for (int c = 0; c < 2; c++)
         {
-            if (!hit_left || right_record._t < record._t) 
+            const HitTablePtr& child = c == 0 ? _left : _right;
+            if (c == 1 && _right == _left) break;
+            std::uint32_t child_index;
+            if (auto node = dynamic_cast<BVHnode*>(child.get())) child_index = node->add_topology(topology);
+            else
             {
-                record = right_record;
+                child_index = topology.add_node(child->get_aabb(), false);
+                topology.add_primitive(child.get());
             }
-            hit_anything = true;
+            topology._nodes[index]._child[c] = child_index;
         }
-        return hit_anything;
+        return index;
     }
 
-    virtual AABB get_aabb() const override { return _box; }
+    // 子树节点占用的字节数，每个节点额外携带一个 shared_ptr 控制块
+    size_t memory_footprint() const
+    {
+        constexpr size_t control_block = 2 * sizeof(long);
+        return node_count() * (sizeof(BVHnode) + control_block);
+    }
 
 };
 
@@ -1,13 +1,27 @@
 #pragma once
 #include "HitTable.hpp"
 #include "Utility.hpp"
+#include "Film.hpp"
+#include "ImageOutput.hpp"
 #include "tgaimage.hpp"
 #include "Material.hpp"
+#include "Environment.hpp"
+#include "LightBVH.hpp"
+#include "Guiding.hpp"
+#include "Rasterizer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <string>
 #include <glm/geometric.hpp>
 #include <glm/trigonometric.hpp>
 
-constexpr glm::vec3 white = glm::vec3{1.f, 1.f, 1.f};
-constexpr glm::vec3 blue = glm::vec3{.5f, .7f, 1.f};
+// 路径深度启发式：每次弹射后光锥额外扩散的角度，次级光线据此落到更粗的 mipmap 层
+constexpr float bounce_cone_spread = .05f;
+// 开启路径引导后，非 delta 顶点按引导分布采样方向的概率，其余仍按 BSDF 采样
+constexpr float guiding_fraction = .5f;
 
 class ScatterResult;
 
@@ -35,46 +49,153 @@ class Camera
     glm::vec3 _u, _v, _w;              // Camera frame basis vectors
     glm::vec3 _defocus_disk_u;       // Defocus disk horizontal radius
     glm::vec3 _defocus_disk_v;       // Defocus disk vertical radius
+    float _pixel_spread;             // Angle subtended by one pixel, seeds the ray cone
+    EnvironmentPtr _environment{std::make_shared<GradientSky>()}; // 未命中物体的光线的入射光
+    LightBVHPtr _lights;                                           // 场景中可采样的面光源，为空时只靠 BSDF 采样命中
+    GuidingField* _guiding{nullptr};                               // 引导渲染期间学习中的 SD-tree
 
-    glm::vec3 interpolate_color(float value, const glm::vec3& c1, const glm::vec3& c2)
+    // 像素内抖动后的样本位置，占用采样器的前两个维度
+    glm::vec2 pixel_sample(float x, float y)
     {
-        float _v = 1.f - value;
-        return glm::vec3
-        {
-            c1.r * value + c2.r * _v,
-            c1.g * value + c2.g * _v,
-            c1.b * value + c2.b * _v,
-        };
+        return { x + RANDOM.get_float(-0.5f, 0.5f), y + RANDOM.get_float(-0.5f, 0.5f) };
     }
 
-    Ray get_ray(float x, float y)
+    Ray primary_ray(const glm::vec2& p) const
     {
-        glm::vec3 width_vector = (x + RANDOM.get_float(-0.5f, 0.5f)) * _pixel_delta_u;
-        glm::vec3 height_vector = (y + RANDOM.get_float(-0.5f, 0.5f)) * _pixel_delta_v;
+        glm::vec3 width_vector = p.x * _pixel_delta_u;
+        glm::vec3 height_vector = p.y * _pixel_delta_v;
         glm::vec3 pixel_center = width_vector + height_vector + _pixel00_loc;
-        return {_center, pixel_center - _center};
+        Ray r{_center, pixel_center - _center};
+        r.set_cone(0.f, _pixel_spread);
+        return r;
     }
-    
-    glm::vec3 ray_color(Ray& light, HitTable& world, int depth)
+
+    // 方向采样的实际 PDF：有引导分布时为引导分布与 BSDF 的混合
+    float scatter_density(const Ray& light, const HitRecord& record, const glm::vec3& direction, const DTree* guide) const
+    {
+        float bsdf_pdf = record._material->pdf(light, record, direction);
+        if (!guide) return bsdf_pdf;
+        return guiding_fraction * guide->pdf(glm::normalize(direction)) + (1.f - guiding_fraction) * bsdf_pdf;
+    }
+
+    // 向环境光采样一个方向并做阴影测试，按幂启发式与方向采样做 MIS；last 表示路径不再延续，方向采样不会被追踪，权重取 1
+    glm::vec3 sample_environment(const Ray& light, const HitRecord& record, HitTable& world, const DTree* guide, bool last)
+    {
+        glm::vec3 direction;
+        float light_pdf;
+        glm::vec3 radiance = _environment->sample(direction, light_pdf);
+        if (light_pdf <= 0.f || is_zero_vec(radiance)) return glm::vec3{ 0.f, 0.f, 0.f };
+        glm::vec3 f = record._material->eval(light, record, direction);
+        if (is_zero_vec(f)) return glm::vec3{ 0.f, 0.f, 0.f };
+        Ray shadow{ record._point, direction };
+        HitRecord occluder;
+        if (world.hit(shadow, occluder)) return glm::vec3{ 0.f, 0.f, 0.f };
+        float weight = last ? 1.f : power_heuristic(light_pdf, scatter_density(light, record, direction, guide));
+        return f * radiance * (weight / light_pdf);
+    }
+
+    // 经光源层次选择一个面光源并采样其上一点，按幂启发式与方向采样做 MIS，last 的含义同上
+    glm::vec3 sample_lights(const Ray& light, const HitRecord& record, HitTable& world, const DTree* guide, bool last)
+    {
+        LightSample sample = _lights->sample(record._point, record._normal);
+        if (sample._pdf <= 0.f || is_zero_vec(sample._radiance)) return glm::vec3{ 0.f, 0.f, 0.f };
+        glm::vec3 f = record._material->eval(light, record, sample._direction);
+        if (is_zero_vec(f)) return glm::vec3{ 0.f, 0.f, 0.f };
+        Ray shadow{ record._point, sample._direction };
+        shadow.update_t_max(sample._distance * (1.f - 1e-3f));
+        HitRecord occluder;
+        if (world.hit(shadow, occluder)) return glm::vec3{ 0.f, 0.f, 0.f };
+        float weight = last ? 1.f : power_heuristic(sample._pdf, scatter_density(light, record, sample._direction, guide));
+        return f * sample._radiance * (weight / sample._pdf);
+    }
+
+    /**
+     * @brief 沿光线追踪一条路径
+     *
+     * scatter_pdf 为产生本条光线的方向采样的 PDF，0 表示 delta 分布或相机光线；
+     * 上一顶点 (光线起点, from_normal) 处做过光源采样时，命中同一光源的贡献按 MIS 加权。
+     * 路径引导开启时，非 delta 顶点以引导分布与 BSDF 的混合分布采样方向，
+     * 并把该方向上的入射光估计记录到所在空间格子中供下一轮学习
+     */
+    glm::vec3 ray_color(Ray& light, HitTable& world, int depth, float scatter_pdf = 0.f, const glm::vec3& from_normal = glm::vec3{ 0.f, 0.f, 0.f })
     {
         // 结束递归
         if (depth <= 0) return glm::vec3{ .0f, .0f, .0f };
         HitRecord record;
-        // 未命中物体 击中背景天空盒
-        if (!world.hit(light, record)) return sky_color(glm::normalize(light.direction()));
+        // 未命中物体 击中环境光
+        if (!world.hit(light, record)) return missed(light, scatter_pdf);
+        return shade(light, record, world, depth, scatter_pdf, from_normal);
+    }
+
+    glm::vec3 missed(const Ray& light, float scatter_pdf) const
+    {
+        glm::vec3 direction = glm::normalize(light.direction());
+        glm::vec3 radiance = _environment->eval(direction);
+        if (scatter_pdf > 0.f && _environment->importance_sampled()) radiance *= power_heuristic(scatter_pdf, _environment->pdf(direction));
+        return radiance;
+    }
+
+    // 由光线的最近命中 record 继续路径，主光线的命中也可以来自 G-buffer
+    glm::vec3 shade(Ray& light, HitRecord& record, HitTable& world, int depth, float scatter_pdf, const glm::vec3& from_normal)
+    {
+        // 遍历结束后只为最近命中计算表面属性，阴影光线则完全不需要
+        record.resolve(light);
         // 计算自发光项
-        glm::vec3 emitted = record._material->emitted(record._uv, record._point);
+        glm::vec3 emitted = record._material->emitted(record._uv, record._point, record._footprint);
+        if (scatter_pdf > 0.f && record._light >= 0 && _lights)
+        {
+            float light_pdf = _lights->pdf(light.origin(), from_normal, static_cast<std::uint32_t>(record._light), record._point);
+            emitted *= power_heuristic(scatter_pdf, light_pdf);
+        }
         // 计算散射光项
         auto scatter_result = record._material->scatter(light, record);
         if (!scatter_result) return emitted;
-        return emitted + scatter_result._attenuation * ray_color(scatter_result._scattered_ray, world, depth - 1);
+        GuidingCell* cell = nullptr;
+        const DTree* guide = nullptr;
+        if (_guiding && scatter_result._pdf > 0.f)
+        {
+            cell = &_guiding->lookup(record._point);
+            if (cell->_sampling.ready()) guide = &cell->_sampling;
+        }
+        // 非 delta 分布的材质额外对光源做显式采样
+        // 最后一个顶点的方向采样不会再被追踪，此时光源采样独占直接光照
+        bool last = depth <= 1;
+        glm::vec3 direct{ 0.f, 0.f, 0.f };
+        if (scatter_result._pdf > 0.f)
+        {
+            if (_environment->importance_sampled()) direct += sample_environment(light, record, world, guide, last);
+            if (_lights) direct += sample_lights(light, record, world, guide, last);
+        }
+        if (last) return emitted + direct;
+        // 按混合分布重新确定方向，权重统一为 f·cos / 混合 PDF
+        if (guide)
+        {
+            glm::vec3 direction = RANDOM.get_float(0.f, 1.f) < guiding_fraction ?
+                guide->sample() : glm::normalize(scatter_result._scattered_ray.direction());
+            float pdf = scatter_density(light, record, direction, guide);
+            glm::vec3 f = record._material->eval(light, record, direction);
+            if (pdf <= 0.f || is_zero_vec(f)) return emitted + direct;
+            scatter_result._scattered_ray = Ray{ record._point, direction };
+            scatter_result._attenuation = f / pdf;
+            scatter_result._pdf = pdf;
+        }
+        scatter_result._scattered_ray.set_cone(light.get_cone_width(record._t), light.get_cone_spread() + bounce_cone_spread);
+        glm::vec3 incident = ray_color(scatter_result._scattered_ray, world, depth - 1, scatter_result._pdf, record._normal);
+        // 记录值乘上余弦项，学到的分布近似被积函数中的 Li·cos 而非单纯的 Li
+        if (cell)
+        {
+            glm::vec3 direction = glm::normalize(scatter_result._scattered_ray.direction());
+            float cos_theta = std::fabs(glm::dot(direction, record._normal));
+            cell->_building.record(direction, luminance(incident) * cos_theta / scatter_result._pdf);
+            GuidingField::count(*cell);
+        }
+        return emitted + direct + scatter_result._attenuation * incident;
     }
-
-    glm::vec3 sky_color(const glm::vec3& direction) { return interpolate_color((1. + direction.y) * .5f, white, blue); }
     
-public:
-    Camera()
+    // 由视点、分辨率与视场角重新计算相机坐标系与像素网格
+    void update_frame()
     {
+        _aspect_ratio = static_cast<float>(_image_width) / _image_height;
         _center = _lookfrom;
 
         // Determine viewport dimensions.
@@ -95,6 +216,7 @@ public:
         // Calculate the horizontal and vertical delta vectors from pixel to pixel.
         _pixel_delta_u = viewport_u * (1.f / _image_width);
         _pixel_delta_v = viewport_v * (1.f / _image_height);
+        _pixel_spread = viewport_height / focus_dist / _image_height;
 
         // Calculate the location of the upper left pixel.
         auto viewport_upper_left = _center - (focus_dist * _w) - viewport_u * .5f - viewport_v * .5f;
@@ -106,30 +228,235 @@ public:
         _defocus_disk_v = _v * defocus_radius;
     }
 
-    void render(TGAImage& img, HitTableList& world)
+public:
+    Camera()
+    {
+        update_frame();
+    }
+
+    // 像素 (x, y) 内抖动的主光线，从采样器的前两个维度取样
+    Ray get_ray(float x, float y)
+    {
+        return primary_ray(pixel_sample(x, y));
+    }
+
+    /**
+     * @brief 渲染图像的一个区域中编号为 [sample_begin, sample_end) 的样本，并累加到 film
+     * 
+     * 每个样本的随机数只取决于 (像素, 样本编号, 维度)，因此任意切分区域与样本区间后合并的结果与整体渲染一致
+     */
+    void render(Film& film, const Region& region, int sample_begin, int sample_end, HitTable& world)
     {
 #pragma omp parallel for schedule(dynamic, 32)
-        for (int h = 0; h < _image_height; h++)
+        for (int h = region._y0; h < region._y1; h++)
         {
             int y = h;
-            for (int w = 0; w < _image_width; w++)
+            for (int w = region._x0; w < region._x1; w++)
             {
                 int x = w;
                 glm::vec3 color{0.f, 0.f, 0.f};
-                for (int ct = 0; ct < _samples_per_pixel; ct++)
+                for (int ct = sample_begin; ct < sample_end; ct++)
                 {
+                    RANDOM.start_sample(x, y, ct);
                     Ray r = get_ray(static_cast<float>(x), static_cast<float>(y));
                     color += ray_color(r, world, _max_depth);
                 }
-                color *= (1.f / _samples_per_pixel);
-                if (_enable_hdr) color = glm::vec3(color.x/(1.f+color.x), color.y/(1.f+color.y), color.z/(1.f+color.z));
-                if (_enable_gama) color = glm::pow(color, glm::vec3(1.0f / 2.2f));
-                img.set(x, y, color);
+                film.add(x, y, color, sample_end - sample_begin);
+            }
+        }
+    }
+
+    // 将累加缓冲的均值做色调映射与 gamma 校正后写入图像
+    void develop(const Film& film, TGAImage& img) const
+    {
+        ToneMap tone = tone_map();
+        for (int y = 0; y < film.height(); y++)
+        {
+            for (int x = 0; x < film.width(); x++)
+            {
+                img.set(x, y, tone(film.mean(x, y)));
+            }
+        }
+    }
+
+    Film render(HitTable& world)
+    {
+        Film film{_image_width, _image_height};
+        render(film, film.full_region(), 0, _samples_per_pixel, world);
+        return film;
+    }
+
+    /**
+     * @brief 分轮渲染整幅图像，每轮 pass_samples 个样本，距上次写出超过 interval 秒时写出断点
+     *
+     * 断点文件存在时从中断处继续，其分辨率、样本数、采样器或场景指纹 fingerprint 与当前设置不一致、
+     * 或者文件损坏时报错返回，不覆盖已有的断点。各轮的样本切分是固定的，
+     * 而样本的随机数只取决于 (像素, 样本编号)，因此续渲结果与不中断的渲染逐位相同
+     */
+    bool render(Film& film, HitTable& world, const std::string& checkpoint, double interval, std::uint64_t fingerprint, int pass_samples = 4)
+    {
+        CheckpointState expected;
+        expected._samples_total = static_cast<std::uint32_t>(_samples_per_pixel);
+        expected._pass_samples = static_cast<std::uint32_t>(std::max(pass_samples, 1));
+        expected._sampler = static_cast<std::uint32_t>(Random::get_sampler_type());
+        expected._fingerprint = fingerprint;
+
+        CheckpointState state = expected;
+        std::error_code error;
+        if (std::filesystem::exists(checkpoint, error))
+        {
+            if (!film.read_checkpoint(checkpoint, _image_width, _image_height, state)) return false;
+            const char* mismatch = nullptr;
+            if (state._samples_total != expected._samples_total) mismatch = "samples per pixel";
+            else if (state._pass_samples != expected._pass_samples) mismatch = "pass size";
+            else if (state._sampler != expected._sampler) mismatch = "sampler";
+            else if (state._fingerprint != expected._fingerprint) mismatch = "scene";
+            else if (state._samples_done > state._samples_total) mismatch = "progress";
+            if (mismatch)
+            {
+                std::cerr << "checkpoint " << checkpoint << " does not match the current " << mismatch 
+                          << ", remove it or choose another file\n";
+                return false;
+            }
+            std::cout << "resuming from " << checkpoint << " at sample " << state._samples_done << "/" << state._samples_total << std::endl;
+        }
+        else film = Film{_image_width, _image_height};
+
+        auto last = std::chrono::steady_clock::now();
+        while (state._samples_done < state._samples_total)
+        {
+            auto end = std::min(state._samples_done + state._pass_samples, state._samples_total);
+            render(film, film.full_region(), static_cast<int>(state._samples_done), static_cast<int>(end), world);
+            state._samples_done = end;
+            auto now = std::chrono::steady_clock::now();
+            if (state._samples_done < state._samples_total && std::chrono::duration<double>(now - last).count() < interval) continue;
+            if (!film.write_checkpoint(checkpoint, state)) return false;
+            last = now;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 带路径引导的渲染：各轮样本数依次翻倍，每轮结束后用本轮记录的辐射度更新 SD-tree
+     *
+     * 引导分布与 BSDF 混合采样，各轮结果都是无偏的，因此全部累加到 film 中。
+     * 学到的分布取决于之前各轮的结果，不能与按区域或样本区间切分的分布式渲染合并
+     */
+    Film render_guided(HitTable& world)
+    {
+        Film film{_image_width, _image_height};
+        GuidingField field{world.get_aabb()};
+        _guiding = &field;
+        int done = 0;
+        for (int pass = 1; done < _samples_per_pixel; pass *= 2)
+        {
+            int end = std::min(done + pass, _samples_per_pixel);
+            render(film, film.full_region(), done, end, world);
+            done = end;
+            if (done < _samples_per_pixel) field.update();
+        }
+        _guiding = nullptr;
+        std::cout << "guiding: " << field.iteration() << " updates, " << field.cell_count() << " spatial cells" << std::endl;
+        return film;
+    }
+
+    /**
+     * @brief 混合渲染：主可见性由分块光栅化写入 G-buffer，路径从 G-buffer 记录的表面开始追踪
+     *
+     * 每轮 pass_samples 个样本：先按样本编号从采样器取得子像素位置并光栅化，再逐样本着色。
+     * 样本位置与随机数维度都与 render 相同，结果只在浮点舍入上不同。normal 与 depth 非空时
+     * 累加 G-buffer 的法线与距离特征。场景中有无法光栅化的物体时退回逐光线追踪
+     */
+    Film render_hybrid(HitTable& world, Film* normal = nullptr, Film* depth = nullptr, int pass_samples = 8)
+    {
+        Film film{_image_width, _image_height};
+        Rasterizer rasterizer{world};
+        if (!rasterizer.complete())
+        {
+            std::cerr << "scene contains geometry the rasterizer can't draw, tracing primary rays instead\n";
+            render(film, film.full_region(), 0, _samples_per_pixel, world);
+            return film;
+        }
+        if (normal) *normal = Film{_image_width, _image_height};
+        if (depth) *depth = Film{_image_width, _image_height};
+        GBuffer gbuffer{_image_width, _image_height, std::max(pass_samples, 1)};
+        for (int begin = 0; begin < _samples_per_pixel; begin += gbuffer.samples())
+        {
+            int count = std::min(gbuffer.samples(), _samples_per_pixel - begin);
+            if (count != gbuffer.samples()) gbuffer.reset(_image_width, _image_height, count);
+#pragma omp parallel for schedule(dynamic, 32)
+            for (int y = 0; y < _image_height; y++)
+            {
+                for (int x = 0; x < _image_width; x++)
+                {
+                    for (int s = 0; s < count; s++)
+                    {
+                        RANDOM.start_sample(x, y, begin + s);
+                        gbuffer.position(x, y, s) = pixel_sample(static_cast<float>(x), static_cast<float>(y));
+                    }
+                }
+            }
+            rasterizer.draw(pinhole_frame(), gbuffer);
+            if (normal && depth) rasterizer.features(gbuffer, *normal, *depth);
+#pragma omp parallel for schedule(dynamic, 32)
+            for (int y = 0; y < _image_height; y++)
+            {
+                for (int x = 0; x < _image_width; x++)
+                {
+                    glm::vec3 color{0.f, 0.f, 0.f};
+                    for (int s = 0; s < count; s++)
+                    {
+                        // 重新取出前两个维度，后续维度与逐光线追踪一致
+                        RANDOM.start_sample(x, y, begin + s);
+                        Ray r = get_ray(static_cast<float>(x), static_cast<float>(y));
+                        HitRecord record;
+                        if (!rasterizer.fetch(gbuffer.at(x, y, s), r, record)) color += missed(r, 0.f);
+                        else color += shade(r, record, world, _max_depth, 0.f, glm::vec3{ 0.f, 0.f, 0.f });
+                    }
+                    film.add(x, y, color, static_cast<std::uint32_t>(count));
+                }
             }
         }
+        return film;
+    }
+
+    void render(TGAImage& img, HitTable& world)
+    {
+        develop(render(world), img);
+    }
+
+    inline void set_environment(EnvironmentPtr environment) { _environment = environment; }
+    inline EnvironmentPtr get_environment() const { return _environment; }
+    // 为场景建立光源层次，场景中没有自发光 Quad 时关闭光源采样
+    void set_lights(HitTable& world)
+    {
+        auto lights = std::make_shared<LightBVH>(world);
+        _lights = lights->empty() ? nullptr : lights;
+    }
+    // 复用已为同一场景建立的光源层次
+    inline void set_lights(LightBVHPtr lights) { _lights = lights; }
+    inline LightBVHPtr get_lights() const { return _lights; }
+    void set_view(const glm::vec3& lookfrom, const glm::vec3& lookat, float fov)
+    {
+        _lookfrom = lookfrom;
+        _lookat = lookat;
+        _fov = fov;
+        update_frame();
+    }
+    void set_resolution(int width, int height)
+    {
+        _image_width = width;
+        _image_height = height;
+        update_frame();
     }
+    inline ToneMap tone_map() const { return { _enable_hdr, _enable_gama }; }
+    // 主光线的像素网格，光栅化主可见性时使用；景深（defocus_angle）不为 0 时不适用
+    inline PinholeFrame pinhole_frame() const { return { _center, _pixel00_loc, _pixel_delta_u, _pixel_delta_v }; }
 
     inline int get_image_width() { return _image_width; }
     inline int get_image_height() { return _image_height; }
+    inline int get_samples_per_pixel() const { return _samples_per_pixel; }
+    inline int get_max_depth() const { return _max_depth; }
+    inline void set_samples_per_pixel(int spp) { _samples_per_pixel = spp; }
 
 };
\ No newline at end of file
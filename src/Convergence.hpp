@@ -0,0 +1,374 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Camera.hpp"
+#include "Integrator.hpp"
+#include "Film.hpp"
+#include "HitTable.hpp"
+#include "ImageOutput.hpp"
+
+// 与参考图比较的误差：线性辐射度上的 RMSE 与相对 MSE，以及色调映射后图像上的 FLIP 式感知误差
+struct ImageError
+{
+    double _rmse{0.};
+    double _relmse{0.};
+    double _flip{0.};
+};
+
+/**
+ * LDR-FLIP 感知误差（Andersson et al. 2020）的实现，观察条件取默认的每度 67 像素
+ *
+ * 颜色通路：在 YyCxCz 对立色空间中按各通道的对比敏感度函数做空间滤波，再在 Hunt 校正的
+ * L*a*b* 空间中计算 HyAB 色差并压缩到 [0, 1]；特征通路：比较亮度上的边缘与点特征强度，
+ * 特征差异越大颜色误差被放大得越多。
+ */
+class Flip
+{
+    static constexpr float pixels_per_degree = 67.f;
+    static constexpr float qc = .7f;
+    static constexpr float qf = .5f;
+    static constexpr float pc = .4f;
+    static constexpr float pt = .95f;
+
+    static glm::vec3 linear_rgb_to_xyz(const glm::vec3& c)
+    {
+        return { .4124564f * c.x + .3575761f * c.y + .1804375f * c.z,
+                 .2126729f * c.x + .7151522f * c.y + .0721750f * c.z,
+                 .0193339f * c.x + .1191920f * c.y + .9503041f * c.z };
+    }
+
+    static glm::vec3 xyz_to_linear_rgb(const glm::vec3& c)
+    {
+        return { 3.2404542f * c.x - 1.5371385f * c.y - .4985314f * c.z,
+                 -.9692660f * c.x + 1.8760108f * c.y + .0415560f * c.z,
+                 .0556434f * c.x - .2040259f * c.y + 1.0572252f * c.z };
+    }
+
+    // D65 白点，即线性 RGB (1, 1, 1) 的 XYZ
+    static glm::vec3 white() { return linear_rgb_to_xyz(glm::vec3{ 1.f, 1.f, 1.f }); }
+
+    static glm::vec3 xyz_to_ycxcz(const glm::vec3& c)
+    {
+        glm::vec3 n = c / white();
+        return { 116.f * n.y - 16.f, 500.f * (n.x - n.y), 200.f * (n.y - n.z) };
+    }
+
+    static glm::vec3 ycxcz_to_xyz(const glm::vec3& c)
+    {
+        float y = (c.x + 16.f) / 116.f;
+        return glm::vec3{ c.y / 500.f + y, y, y - c.z / 200.f } * white();
+    }
+
+    static glm::vec3 xyz_to_lab(const glm::vec3& c)
+    {
+        auto f = [](float t)
+        {
+            static constexpr float delta = 6.f / 29.f;
+            return t > delta * delta * delta ? std::cbrt(t) : t / (3.f * delta * delta) + 4.f / 29.f;
+        };
+        glm::vec3 n = c / white();
+        return { 116.f * f(n.y) - 16.f, 500.f * (f(n.x) - f(n.y)), 200.f * (f(n.y) - f(n.z)) };
+    }
+
+    // Hunt 效应：低亮度下色度被压低
+    static glm::vec3 hunt(const glm::vec3& lab) { return { lab.x, .01f * lab.x * lab.y, .01f * lab.x * lab.z }; }
+
+    static float hyab(const glm::vec3& a, const glm::vec3& b)
+    {
+        glm::vec3 d = a - b;
+        return std::fabs(d.x) + std::sqrt(d.y * d.y + d.z * d.z);
+    }
+
+    static float srgb_to_linear(float v)
+    {
+        return v <= .04045f ? v / 12.92f : std::pow((v + .055f) / 1.055f, 2.4f);
+    }
+
+    // 以钳制边界对单通道图像做 (2r+1)^2 的二维卷积
+    static std::vector<float> convolve(const std::vector<float>& image, int width, int height, const std::vector<float>& kernel, int radius)
+    {
+        std::vector<float> result(image.size(), 0.f);
+        int size = 2 * radius + 1;
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                float sum = 0.f;
+                for (int j = -radius; j <= radius; j++)
+                {
+                    int sy = std::clamp(y + j, 0, height - 1);
+                    for (int i = -radius; i <= radius; i++)
+                    {
+                        int sx = std::clamp(x + i, 0, width - 1);
+                        sum += kernel[(j + radius) * size + (i + radius)] * image[static_cast<size_t>(sy) * width + sx];
+                    }
+                }
+                result[static_cast<size_t>(y) * width + x] = sum;
+            }
+        }
+        return result;
+    }
+
+    // 对比敏感度函数的空间域形式：两个高斯之和，x2 为到中心距离的平方（单位：度²）
+    static std::vector<float> csf_kernel(float a1, float b1, float a2, float b2, int radius)
+    {
+        int size = 2 * radius + 1;
+        std::vector<float> kernel(static_cast<size_t>(size) * size);
+        float sum = 0.f;
+        for (int j = -radius; j <= radius; j++)
+        {
+            for (int i = -radius; i <= radius; i++)
+            {
+                float x2 = (i * i + j * j) / (pixels_per_degree * pixels_per_degree);
+                float g = a1 * std::sqrt(pi / b1) * std::exp(-pi * pi * x2 / b1) + a2 * std::sqrt(pi / b2) * std::exp(-pi * pi * x2 / b2);
+                kernel[(j + radius) * size + (i + radius)] = g;
+                sum += g;
+            }
+        }
+        for (auto& k : kernel) k /= sum;
+        return kernel;
+    }
+
+    // 高斯的一阶（edge）或二阶（point）导数核，正负部分各自归一化为 ±1；transpose 时沿 y 方向求导
+    static std::vector<float> feature_kernel(bool second, bool transpose, float sigma, int radius)
+    {
+        int size = 2 * radius + 1;
+        std::vector<float> kernel(static_cast<size_t>(size) * size);
+        float positive = 0.f, negative = 0.f;
+        for (int j = -radius; j <= radius; j++)
+        {
+            for (int i = -radius; i <= radius; i++)
+            {
+                float d = static_cast<float>(transpose ? j : i);
+                float g = std::exp(-(i * i + j * j) / (2.f * sigma * sigma));
+                float k = second ? (d * d / (sigma * sigma) - 1.f) * g : -d * g;
+                kernel[(j + radius) * size + (i + radius)] = k;
+                if (k > 0.f) positive += k;
+                else negative -= k;
+            }
+        }
+        for (auto& k : kernel) k /= k > 0.f ? positive : negative;
+        return kernel;
+    }
+
+    static void features(const std::vector<float>& luminance, int width, int height, std::vector<float>& edges, std::vector<float>& points)
+    {
+        float sigma = .5f * .082f * pixels_per_degree;
+        int radius = static_cast<int>(std::ceil(3.f * sigma));
+        auto ex = convolve(luminance, width, height, feature_kernel(false, false, sigma, radius), radius);
+        auto ey = convolve(luminance, width, height, feature_kernel(false, true, sigma, radius), radius);
+        auto px = convolve(luminance, width, height, feature_kernel(true, false, sigma, radius), radius);
+        auto py = convolve(luminance, width, height, feature_kernel(true, true, sigma, radius), radius);
+        edges.resize(luminance.size());
+        points.resize(luminance.size());
+        for (size_t i = 0; i < luminance.size(); i++)
+        {
+            edges[i] = std::sqrt(ex[i] * ex[i] + ey[i] * ey[i]);
+            points[i] = std::sqrt(px[i] * px[i] + py[i] * py[i]);
+        }
+    }
+
+    // 色调映射后的图像（sRGB 编码，[0,1]）经 CSF 滤波并转换到 Hunt 校正的 L*a*b*，同时返回特征通路用的亮度
+    static std::vector<glm::vec3> prepare(const std::vector<glm::vec3>& srgb, int width, int height, std::vector<float>& luminance)
+    {
+        static constexpr float b[3][2] = { { .0047f, 1e-5f }, { .0053f, 1e-5f }, { .04f, .025f } };
+        static constexpr float a[3][2] = { { 1.f, 0.f }, { 1.f, 0.f }, { 34.1f, 13.5f } };
+        int radius = static_cast<int>(std::ceil(3.f * std::sqrt(.04f / (2.f * pi * pi)) * pixels_per_degree));
+        std::vector<float> channels[3];
+        for (auto& channel : channels) channel.resize(srgb.size());
+        luminance.resize(srgb.size());
+        for (size_t i = 0; i < srgb.size(); i++)
+        {
+            glm::vec3 linear{ srgb_to_linear(srgb[i].x), srgb_to_linear(srgb[i].y), srgb_to_linear(srgb[i].z) };
+            glm::vec3 xyz = linear_rgb_to_xyz(linear);
+            glm::vec3 opponent = xyz_to_ycxcz(xyz);
+            for (int c = 0; c < 3; c++) channels[c][i] = opponent[c];
+            luminance[i] = xyz.y / white().y;
+        }
+        for (int c = 0; c < 3; c++) channels[c] = convolve(channels[c], width, height, csf_kernel(a[c][0], b[c][0], a[c][1], b[c][1], radius), radius);
+        std::vector<glm::vec3> lab(srgb.size());
+        for (size_t i = 0; i < srgb.size(); i++)
+        {
+            glm::vec3 rgb = glm::clamp(xyz_to_linear_rgb(ycxcz_to_xyz({ channels[0][i], channels[1][i], channels[2][i] })), 0.f, 1.f);
+            lab[i] = hunt(xyz_to_lab(linear_rgb_to_xyz(rgb)));
+        }
+        return lab;
+    }
+
+public:
+    // 两幅 sRGB 图像的平均 FLIP 误差
+    static double mean_error(const std::vector<glm::vec3>& reference, const std::vector<glm::vec3>& test, int width, int height)
+    {
+        std::vector<float> reference_luminance, test_luminance;
+        auto reference_lab = prepare(reference, width, height, reference_luminance);
+        auto test_lab = prepare(test, width, height, test_luminance);
+        std::vector<float> reference_edges, reference_points, test_edges, test_points;
+        features(reference_luminance, width, height, reference_edges, reference_points);
+        features(test_luminance, width, height, test_edges, test_points);
+
+        glm::vec3 green = hunt(xyz_to_lab(linear_rgb_to_xyz({ 0.f, 1.f, 0.f })));
+        glm::vec3 blue = hunt(xyz_to_lab(linear_rgb_to_xyz({ 0.f, 0.f, 1.f })));
+        float cmax = std::pow(hyab(green, blue), qc);
+        double total = 0.;
+        for (size_t i = 0; i < reference.size(); i++)
+        {
+            float color = std::pow(hyab(reference_lab[i], test_lab[i]), qc);
+            color = color < pc * cmax ? pt / (pc * cmax) * color : pt + (color - pc * cmax) / (cmax - pc * cmax) * (1.f - pt);
+            float feature = std::max(std::fabs(reference_edges[i] - test_edges[i]), std::fabs(reference_points[i] - test_points[i]));
+            feature = std::pow(std::min(feature / std::sqrt(2.f), 1.f), qf);
+            total += std::pow(color, 1.f - feature);
+        }
+        return total / reference.size();
+    }
+};
+
+inline ImageError compare_images(const Film& reference, const Film& test, const ToneMap& tone)
+{
+    ImageError error;
+    int width = reference.width(), height = reference.height();
+    std::vector<glm::vec3> reference_ldr, test_ldr;
+    reference_ldr.reserve(static_cast<size_t>(width) * height);
+    test_ldr.reserve(static_cast<size_t>(width) * height);
+    double squared = 0., relative = 0.;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            glm::vec3 r = reference.mean(x, y);
+            glm::vec3 t = test.mean(x, y);
+            for (int c = 0; c < 3; c++)
+            {
+                double d = t[c] - r[c];
+                squared += d * d;
+                relative += d * d / (static_cast<double>(r[c]) * r[c] + 1e-2);
+            }
+            reference_ldr.push_back(glm::clamp(tone(r), 0.f, 1.f));
+            test_ldr.push_back(glm::clamp(tone(t), 0.f, 1.f));
+        }
+    }
+    double count = 3. * width * height;
+    error._rmse = std::sqrt(squared / count);
+    error._relmse = relative / count;
+    error._flip = Flip::mean_error(reference_ldr, test_ldr, width, height);
+    return error;
+}
+
+// 收敛曲线上的一个测点：累计样本数、累计渲染时间与此时的误差
+struct ConvergencePoint
+{
+    int _spp{0};
+    double _seconds{0.};
+    ImageError _error;
+};
+
+// 收敛测试的分辨率、样本上限与时间预算，参考图须以相同分辨率渲染
+constexpr int convergence_resolution = 128;
+constexpr int convergence_max_spp = 1024;
+constexpr double convergence_budget = 20.;
+// 效率比基线低出这一比例即判定为退化
+constexpr double convergence_tolerance = .15;
+// 累计时间短于此值的测点计时噪声大，不计入效率
+constexpr double convergence_min_seconds = 1.;
+// 参考图从该样本编号起取样，与从 0 起的被测渲染不共享样本，误差不会因相关而被低估
+constexpr std::uint32_t reference_sample_offset = 1u << 24;
+
+inline bool render_reference(Integrator& integrator, Camera& camera, HitTable& world, int spp, const std::string& file)
+{
+    Film film{camera.get_image_width(), camera.get_image_height()};
+    integrator.render(camera, film, film.full_region(), static_cast<int>(reference_sample_offset), static_cast<int>(reference_sample_offset) + spp, world);
+    return write_image(file, film, camera.tone_map());
+}
+
+/**
+ * @brief 样本数按 1, 2, 4, ... 翻倍渐进渲染，每次翻倍后记录累计时间与相对参考图的误差
+ *
+ * 误差计算不计入时间。累计时间超过 budget 秒或样本数达到 max_spp 时停止。
+ */
+inline std::vector<ConvergencePoint> measure_convergence(Integrator& integrator, Camera& camera, HitTable& world, const Film& reference, double budget, int max_spp)
+{
+    std::vector<ConvergencePoint> points;
+    Film film{camera.get_image_width(), camera.get_image_height()};
+    double seconds = 0.;
+    for (int done = 0; done < max_spp && seconds < budget;)
+    {
+        int end = std::min(std::max(1, done * 2), max_spp);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        integrator.render(camera, film, film.full_region(), done, end, world);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        seconds += std::chrono::duration<double>(t2 - t1).count();
+        done = end;
+        points.push_back({ done, seconds, compare_images(reference, film, camera.tone_map()) });
+    }
+    return points;
+}
+
+/**
+ * @brief 效率 1 / (relMSE · 时间) 在累计时间不短于 min_seconds 的测点上的几何平均
+ *
+ * 无偏渲染收敛时 relMSE 与时间成反比，效率近似为常数。没有足够长的测点时使用全部测点
+ */
+inline double convergence_efficiency(const std::vector<ConvergencePoint>& points, double min_seconds = convergence_min_seconds)
+{
+    bool any_long = std::any_of(points.begin(), points.end(), [min_seconds](const ConvergencePoint& point) { return point._seconds >= min_seconds; });
+    double sum = 0.;
+    int count = 0;
+    for (const auto& point : points)
+    {
+        if (point._error._relmse <= 0. || point._seconds <= 0. || (any_long && point._seconds < min_seconds)) continue;
+        sum += -std::log(point._error._relmse * point._seconds);
+        count++;
+    }
+    return count ? std::exp(sum / count) : 0.;
+}
+
+/**
+ * @brief 与基线文件（每行 "场景 效率"）比较，任一场景的效率低于基线的 1 - tolerance 时返回 false
+ *
+ * 基线文件不存在时写入本次结果作为基线。效率与机器相关，基线应在同一台机器上生成。
+ */
+inline bool check_efficiency(const std::string& baseline, const std::map<std::string, double>& efficiency, double tolerance, std::ostream& out)
+{
+    std::ifstream in(baseline);
+    if (!in)
+    {
+        std::ofstream file(baseline);
+        for (const auto& [scene, value] : efficiency) file << scene << ' ' << value << '\n';
+        if (!file)
+        {
+            std::cerr << "can't write " << baseline << "\n";
+            return false;
+        }
+        out << "baseline written to " << baseline << std::endl;
+        return true;
+    }
+    std::map<std::string, double> expected;
+    std::string scene;
+    double value;
+    while (in >> scene >> value) expected[scene] = value;
+    bool ok = true;
+    for (const auto& [name, current] : efficiency)
+    {
+        auto found = expected.find(name);
+        if (found == expected.end())
+        {
+            out << name << ": no baseline" << std::endl;
+            continue;
+        }
+        double ratio = current / found->second;
+        bool regressed = ratio < 1. - tolerance;
+        out << name << ": efficiency " << std::scientific << std::setprecision(3) << current << " baseline " << found->second
+            << std::fixed << std::setprecision(2) << " ratio " << ratio << (regressed ? "  REGRESSED" : "") << std::endl;
+        ok = ok && !regressed;
+    }
+    return ok;
+}
@@ -0,0 +1,314 @@
+#pragma once
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Camera.hpp"
+#include "Film.hpp"
+#include "HitTable.hpp"
+#include "Integrator.hpp"
+
+/**
+ * 多进程分块渲染
+ *
+ * 协调进程把图像切分为 (区域, 样本区间) 任务，通过管道分发给若干 worker 子进程；
+ * worker 用所选的积分器渲染后写出部分结果文件（辐射度和 + 样本数），最后由 merge_partials 合并；
+ * 文件覆盖任务区域以及积分器写到区域外的像素。
+ * 协议为按行的文本：
+ *   协调者 -> worker : "render x0 y0 x1 y1 s0 s1 path" / "quit"
+ *   worker -> 协调者 : "done path" / "fail path"
+ */
+struct RenderTask
+{
+    Region _region;
+    int _sample_begin{0};
+    int _sample_end{0};
+    std::string _output;
+};
+
+inline std::string format_task(const RenderTask& task)
+{
+    std::ostringstream line;
+    line << "render " << task._region._x0 << ' ' << task._region._y0 << ' ' << task._region._x1 << ' ' << task._region._y1 << ' '
+         << task._sample_begin << ' ' << task._sample_end << ' ' << task._output << '\n';
+    return line.str();
+}
+
+inline bool parse_task(const std::string& line, RenderTask& task)
+{
+    std::istringstream in(line);
+    std::string command;
+    in >> command >> task._region._x0 >> task._region._y0 >> task._region._x1 >> task._region._y1
+       >> task._sample_begin >> task._sample_end >> task._output;
+    return command == "render" && !in.fail() && !task._output.empty();
+}
+
+// 按 tile_size 切分图像，并把 [0, spp) 均分为 sample_splits 段
+inline std::vector<RenderTask> split_tasks(int width, int height, int tile_size, int spp, int sample_splits, const std::string& directory)
+{
+    std::vector<RenderTask> tasks;
+    int index = 0;
+    for (int s = 0; s < sample_splits; s++)
+    {
+        int sample_begin = spp * s / sample_splits;
+        int sample_end = spp * (s + 1) / sample_splits;
+        if (sample_begin == sample_end) continue;
+        for (int y = 0; y < height; y += tile_size)
+        {
+            for (int x = 0; x < width; x += tile_size)
+            {
+                RenderTask task;
+                task._region = { x, y, std::min(x + tile_size, width), std::min(y + tile_size, height) };
+                task._sample_begin = sample_begin;
+                task._sample_end = sample_end;
+                task._output = directory + "/part_" + std::to_string(index++) + ".srtp";
+                tasks.push_back(task);
+            }
+        }
+    }
+    return tasks;
+}
+
+// worker 主循环：从 in 读取任务，用 integrator 渲染后在 out 上应答
+inline int run_worker(Integrator& integrator, Camera& camera, HitTable& world, std::istream& in, std::ostream& out)
+{
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line == "quit") break;
+        RenderTask task;
+        if (!parse_task(line, task))
+        {
+            std::cerr << "bad task : " << line << "\n";
+            out << "fail -" << std::endl;
+            continue;
+        }
+        Film film{camera.get_image_width(), camera.get_image_height()};
+        integrator.render(camera, film, task._region, task._sample_begin, task._sample_end, world);
+        bool ok = film.write_partial(task._output, film.bounds(task._region), task._sample_begin, task._sample_end);
+        out << (ok ? "done " : "fail ") << task._output << std::endl;
+    }
+    return 0;
+}
+
+inline bool merge_partials(const std::vector<std::string>& files, Film& film)
+{
+    for (const auto& file : files)
+    {
+        if (!film.merge_partial(file)) return false;
+    }
+    return true;
+}
+
+class Coordinator
+{
+    struct Worker
+    {
+        pid_t _pid{-1};
+        int _to{-1};
+        FILE* _from{nullptr};
+        int _task{-1};
+    };
+    std::vector<Worker> _workers;
+    std::string _executable;
+
+    static bool send(Worker& worker, const std::string& line)
+    {
+        const char* data = line.data();
+        size_t left = line.size();
+        while (left > 0)
+        {
+            ssize_t n = write(worker._to, data, left);
+            if (n <= 0) return false;
+            data += n;
+            left -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static void close_worker(Worker& worker)
+    {
+        if (worker._to >= 0) close(worker._to);
+        if (worker._from) fclose(worker._from);
+        worker._to = -1;
+        worker._from = nullptr;
+        if (worker._pid > 0) waitpid(worker._pid, nullptr, 0);
+        worker._pid = -1;
+    }
+
+public:
+    Coordinator(std::string executable) : _executable{std::move(executable)} {}
+    ~Coordinator() { shutdown(); }
+
+    /**
+     * @brief 启动 count 个 worker 子进程，每个进程限定 threads 个 OpenMP 线程
+     * 
+     * @param options 追加在 --worker 之后的全局选项（如采样器类型），保证各进程渲染设置一致
+     */
+    bool spawn(int count, int threads, const std::vector<std::string>& options = {})
+    {
+        std::signal(SIGPIPE, SIG_IGN);
+        for (int i = 0; i < count; i++)
+        {
+            int to[2], from[2];
+            if (pipe(to) != 0) return false;
+            if (pipe(from) != 0)
+            {
+                close(to[0]);
+                close(to[1]);
+                return false;
+            }
+            pid_t pid = fork();
+            if (pid < 0) return false;
+            if (pid == 0)
+            {
+                dup2(to[0], STDIN_FILENO);
+                dup2(from[1], STDOUT_FILENO);
+                close(to[0]);
+                close(to[1]);
+                close(from[0]);
+                close(from[1]);
+                // 关闭继承自父进程的其他 worker 管道，否则无法检测到它们退出
+                for (auto& other : _workers)
+                {
+                    close(other._to);
+                    close(fileno(other._from));
+                }
+                setenv("OMP_NUM_THREADS", std::to_string(threads).c_str(), 1);
+                std::vector<std::string> args{ _executable, "--worker" };
+                args.insert(args.end(), options.begin(), options.end());
+                std::vector<char*> argv;
+                for (auto& arg : args) argv.push_back(arg.data());
+                argv.push_back(nullptr);
+                // 从 PATH 启动时 argv[0] 不含路径，先执行本进程的映像，再按 PATH 查找
+                execv("/proc/self/exe", argv.data());
+                execvp(_executable.c_str(), argv.data());
+                _exit(127);
+            }
+            close(to[0]);
+            close(from[1]);
+            Worker worker;
+            worker._pid = pid;
+            worker._to = to[1];
+            worker._from = fdopen(from[0], "r");
+            _workers.push_back(worker);
+        }
+        return true;
+    }
+
+    /**
+     * @brief 动态分发任务直至全部完成，失败的任务会重新分配给仍存活的 worker
+     */
+    bool run(const std::vector<RenderTask>& tasks)
+    {
+        std::vector<int> pending;
+        for (int i = static_cast<int>(tasks.size()) - 1; i >= 0; i--) pending.push_back(i);
+        size_t finished = 0;
+        auto dispatch = [&](Worker& worker)
+        {
+            while (!pending.empty() && worker._from)
+            {
+                int task = pending.back();
+                if (send(worker, format_task(tasks[task])))
+                {
+                    pending.pop_back();
+                    worker._task = task;
+                    return;
+                }
+                close_worker(worker);
+            }
+        };
+        for (auto& worker : _workers) dispatch(worker);
+        while (finished < tasks.size())
+        {
+            std::vector<pollfd> fds;
+            std::vector<Worker*> busy;
+            for (auto& worker : _workers)
+            {
+                if (!worker._from || worker._task < 0) continue;
+                fds.push_back({ fileno(worker._from), POLLIN, 0 });
+                busy.push_back(&worker);
+            }
+            if (fds.empty())
+            {
+                std::cerr << "all workers exited with " << tasks.size() - finished << " tasks left\n";
+                return false;
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) return false;
+            for (size_t i = 0; i < fds.size(); i++)
+            {
+                if (!fds[i].revents) continue;
+                Worker& worker = *busy[i];
+                char buffer[4096];
+                bool ok = fgets(buffer, sizeof(buffer), worker._from) != nullptr && std::string{buffer}.rfind("done ", 0) == 0;
+                if (ok)
+                {
+                    finished++;
+                    std::cerr << "\rtiles " << finished << "/" << tasks.size() << std::flush;
+                }
+                else
+                {
+                    std::cerr << "\nworker " << worker._pid << " failed task " << worker._task << "\n";
+                    pending.push_back(worker._task);
+                    close_worker(worker);
+                }
+                worker._task = -1;
+                for (auto& idle : _workers)
+                {
+                    if (idle._from && idle._task < 0) dispatch(idle);
+                }
+            }
+        }
+        std::cerr << "\n";
+        return true;
+    }
+
+    void shutdown()
+    {
+        for (auto& worker : _workers)
+        {
+            if (worker._from) send(worker, "quit\n");
+            close_worker(worker);
+        }
+        _workers.clear();
+    }
+};
+
+/**
+ * @brief 在本机启动 workers 个进程完成整幅渲染，部分结果写入 directory 后合并到 film
+ */
+inline bool render_distributed(const std::string& executable, Camera& camera, int workers, int tile_size, int sample_splits,
+                               const std::string& directory, Film& film, const std::vector<std::string>& options = {})
+{
+    if (workers <= 0 || tile_size <= 0 || sample_splits <= 0)
+    {
+        std::cerr << "workers, tile size and sample splits must be positive\n";
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    if (ec)
+    {
+        std::cerr << "can't create directory " << directory << "\n";
+        return false;
+    }
+    auto tasks = split_tasks(camera.get_image_width(), camera.get_image_height(), tile_size, camera.get_samples_per_pixel(), sample_splits, directory);
+    int hardware = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    Coordinator coordinator{executable};
+    if (!coordinator.spawn(workers, std::max(1, hardware / workers), options)) return false;
+    if (!coordinator.run(tasks)) return false;
+    coordinator.shutdown();
+    std::vector<std::string> files;
+    for (const auto& task : tasks) files.push_back(task._output);
+    film = Film{camera.get_image_width(), camera.get_image_height()};
+    return merge_partials(files, film);
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Texture.hpp"
+#include "Utility.hpp"
+
+inline float luminance(const glm::vec3& c) { return .2126f * c.x + .7152f * c.y + .0722f * c.z; }
+
+// 幂启发式 MIS 权重（β = 2）
+inline float power_heuristic(float pdf_a, float pdf_b)
+{
+    float a = pdf_a * pdf_a;
+    float b = pdf_b * pdf_b;
+    return a + b > 0.f ? a / (a + b) : 0.f;
+}
+
+/**
+ * @brief Walker 别名表（Vose 构建法），O(1) 按权重采样离散分布
+ */
+class AliasTable
+{
+    std::vector<float> _prob;          // 落入本格时保留本格的概率
+    std::vector<std::uint32_t> _alias; // 否则改选的下标
+    std::vector<float> _pdf;           // 归一化后的离散概率
+public:
+    AliasTable() = default;
+    explicit AliasTable(const std::vector<float>& weights)
+    {
+        size_t n = weights.size();
+        _prob.assign(n, 1.f);
+        _alias.resize(n);
+        _pdf.assign(n, 0.f);
+        double total = 0.;
+        for (float w : weights) total += std::max(w, 0.f);
+        if (n == 0) return;
+        std::vector<double> scaled(n);
+        std::vector<std::uint32_t> small, large;
+        for (size_t i = 0; i < n; i++)
+        {
+            _alias[i] = static_cast<std::uint32_t>(i);
+            _pdf[i] = total > 0. ? static_cast<float>(std::max(weights[i], 0.f) / total) : 1.f / n;
+            scaled[i] = total > 0. ? std::max(weights[i], 0.f) / total * n : 1.;
+            (scaled[i] < 1. ? small : large).push_back(static_cast<std::uint32_t>(i));
+        }
+        while (!small.empty() && !large.empty())
+        {
+            auto s = small.back(); small.pop_back();
+            auto l = large.back(); large.pop_back();
+            _prob[s] = static_cast<float>(scaled[s]);
+            _alias[s] = l;
+            scaled[l] -= 1. - scaled[s];
+            (scaled[l] < 1. ? small : large).push_back(l);
+        }
+        // 剩余的格子因舍入误差略偏离 1，直接视为满格
+        for (auto i : small) _prob[i] = 1.f;
+        for (auto i : large) _prob[i] = 1.f;
+    }
+
+    inline size_t size() const { return _pdf.size(); }
+    inline float pdf(size_t index) const { return _pdf[index]; }
+
+    // u ∈ [0, 1)：整数部分选格子，小数部分决定取本格还是别名
+    std::uint32_t sample(float u) const
+    {
+        float x = u * _prob.size();
+        auto i = std::min(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(_prob.size() - 1));
+        return x - i < _prob[i] ? i : _alias[i];
+    }
+};
+
+/**
+ * @brief 环境光：未命中任何物体的光线的辐射度，可按方向采样以参与 MIS
+ */
+class Environment
+{
+public:
+    virtual ~Environment() = default;
+    // 方向 direction（单位向量）上的入射辐射度
+    virtual glm::vec3 eval(const glm::vec3& direction) const = 0;
+    // 采样一个方向，返回该方向的辐射度及立体角 PDF
+    virtual glm::vec3 sample(glm::vec3& direction, float& pdf) const = 0;
+    virtual float pdf(const glm::vec3& direction) const = 0;
+    // 采样分布是否贴合辐射度；均匀采样的环境光做显式采样得不偿失，只靠 BSDF 采样命中
+    virtual bool importance_sampled() const { return true; }
+};
+using EnvironmentPtr = std::shared_ptr<Environment>;
+
+// 由天顶向下渐变的天空，在整个球面上均匀采样
+class GradientSky : public Environment
+{
+    glm::vec3 _zenith;
+    glm::vec3 _nadir;
+public:
+    GradientSky(const glm::vec3& zenith = glm::vec3{1.f, 1.f, 1.f}, const glm::vec3& nadir = glm::vec3{.5f, .7f, 1.f})
+        : _zenith{zenith}, _nadir{nadir} {}
+    virtual glm::vec3 eval(const glm::vec3& direction) const override
+    {
+        float t = (1.f + direction.y) * .5f;
+        return _zenith * t + _nadir * (1.f - t);
+    }
+    virtual glm::vec3 sample(glm::vec3& direction, float& pdf) const override
+    {
+        float z = 1.f - 2.f * RANDOM.get_float(0.f, 1.f);
+        float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        float phi = 2.f * pi * RANDOM.get_float(0.f, 1.f);
+        direction = glm::vec3{ r * std::cos(phi), z, r * std::sin(phi) };
+        pdf = 1.f / (4.f * pi);
+        return eval(direction);
+    }
+    virtual float pdf(const glm::vec3& direction) const override { return 1.f / (4.f * pi); }
+    virtual bool importance_sampled() const override { return false; }
+};
+
+/**
+ * @brief 经纬度（equirectangular）格式的 HDR 环境贴图
+ *
+ * 以 亮度 × sinθ 为权重对所有像素建立别名表：先 O(1) 选出像素，再在像素内均匀取点。
+ * 像素内 (u, v) 均匀分布对应的立体角 PDF 为 p_i · W · H / (2π² sinθ)。
+ * u 沿方位角 φ 递增，v = 0 为 +Y 方向（天顶）。
+ */
+class EnvironmentMap : public Environment
+{
+    int _width{0};
+    int _height{0};
+    std::vector<glm::vec3> _pixels;
+    AliasTable _distribution;
+    float _scale{1.f};
+
+    inline const glm::vec3& texel(int x, int y) const { return _pixels[static_cast<size_t>(y) * _width + x]; }
+
+    inline void to_uv(const glm::vec3& d, float& u, float& v) const
+    {
+        u = (std::atan2(d.x, -d.z) + pi) / (2.f * pi);
+        v = std::acos(std::clamp(d.y, -1.f, 1.f)) / pi;
+    }
+
+    inline int pixel_index(float u, float v) const
+    {
+        int x = std::clamp(static_cast<int>(u * _width), 0, _width - 1);
+        int y = std::clamp(static_cast<int>(v * _height), 0, _height - 1);
+        return y * _width + x;
+    }
+
+public:
+    EnvironmentMap(int width, int height, std::vector<glm::vec3> pixels, float scale = 1.f)
+        : _width{width}, _height{height}, _pixels{std::move(pixels)}, _scale{scale}
+    {
+        std::vector<float> weights(_pixels.size());
+        for (int y = 0; y < _height; y++)
+        {
+            float sin_theta = std::sin(pi * (y + .5f) / _height);
+            for (int x = 0; x < _width; x++) weights[static_cast<size_t>(y) * _width + x] = luminance(texel(x, y)) * sin_theta;
+        }
+        _distribution = AliasTable{weights};
+    }
+
+    // 读取 HDR 文件（.hdr 等 stb 支持的格式），失败返回 nullptr
+    static std::shared_ptr<EnvironmentMap> load(const std::string& file, float scale = 1.f)
+    {
+        int width, height, channel;
+        float* data = stbi_loadf(file.c_str(), &width, &height, &channel, 3);
+        if (!data)
+        {
+            std::cerr << "can't load environment map " << file << "\n";
+            return nullptr;
+        }
+        std::vector<glm::vec3> pixels(static_cast<size_t>(width) * height);
+        for (size_t i = 0; i < pixels.size(); i++) pixels[i] = glm::vec3{ data[i * 3], data[i * 3 + 1], data[i * 3 + 2] };
+        stbi_image_free(data);
+        return std::make_shared<EnvironmentMap>(width, height, std::move(pixels), scale);
+    }
+
+    virtual glm::vec3 eval(const glm::vec3& direction) const override
+    {
+        float u, v;
+        to_uv(direction, u, v);
+        return _pixels[pixel_index(u, v)] * _scale;
+    }
+
+    virtual glm::vec3 sample(glm::vec3& direction, float& pdf) const override
+    {
+        auto index = _distribution.sample(RANDOM.get_float(0.f, 1.f));
+        int x = static_cast<int>(index % _width);
+        int y = static_cast<int>(index / _width);
+        float u = (x + RANDOM.get_float(0.f, 1.f)) / _width;
+        float v = (y + RANDOM.get_float(0.f, 1.f)) / _height;
+        float theta = v * pi;
+        float phi = u * 2.f * pi - pi;
+        float sin_theta = std::sin(theta);
+        direction = glm::vec3{ sin_theta * std::sin(phi), std::cos(theta), -sin_theta * std::cos(phi) };
+        pdf = sin_theta > 0.f ? _distribution.pdf(index) * _width * _height / (2.f * pi * pi * sin_theta) : 0.f;
+        return _pixels[index] * _scale;
+    }
+
+    virtual float pdf(const glm::vec3& direction) const override
+    {
+        float u, v;
+        to_uv(direction, u, v);
+        float sin_theta = std::sin(v * pi);
+        if (sin_theta <= 0.f) return 0.f;
+        return _distribution.pdf(pixel_index(u, v)) * _width * _height / (2.f * pi * pi * sin_theta);
+    }
+};
+
+/**
+ * @brief 生成带有小而亮的太阳的经纬度天空，用于没有 HDR 文件时测试环境光采样
+ *
+ * 太阳角半径约 1.5°，亮度远高于天空，仅靠 BSDF 采样几乎无法命中
+ */
+inline std::shared_ptr<EnvironmentMap> sun_sky(int width = 512, int height = 256)
+{
+    const glm::vec3 sun_direction = glm::normalize(glm::vec3{ .6f, .5f, -.6f });
+    const float sun_cos = std::cos(1.5f * pi / 180.f);
+    std::vector<glm::vec3> pixels(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++)
+    {
+        float theta = pi * (y + .5f) / height;
+        for (int x = 0; x < width; x++)
+        {
+            float phi = 2.f * pi * (x + .5f) / width - pi;
+            glm::vec3 d{ std::sin(theta) * std::sin(phi), std::cos(theta), -std::sin(theta) * std::cos(phi) };
+            glm::vec3 color = d.y > 0.f ? glm::vec3{ .3f, .5f, 1.f } * (1.f - .5f * d.y) : glm::vec3{ .1f, .09f, .08f };
+            if (glm::dot(d, sun_direction) > sun_cos) color = glm::vec3{ 1000.f, 950.f, 850.f };
+            pixels[static_cast<size_t>(y) * width + x] = color;
+        }
+    }
+    return std::make_shared<EnvironmentMap>(width, height, std::move(pixels));
+}
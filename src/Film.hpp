@@ -0,0 +1,317 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// 图像上的矩形区域 [x0, x1) x [y0, y1)
+struct Region
+{
+    int _x0{0};
+    int _y0{0};
+    int _x1{0};
+    int _y1{0};
+    inline int width() const { return _x1 - _x0; }
+    inline int height() const { return _y1 - _y0; }
+    inline bool contains(int x, int y) const { return x >= _x0 && x < _x1 && y >= _y0 && y < _y1; }
+};
+
+// 断点续渲的进度：已完成的样本数、目标样本数、每轮样本数、采样器类型与场景设置的指纹
+struct CheckpointState
+{
+    std::uint32_t _samples_done{0};
+    std::uint32_t _samples_total{0};
+    std::uint32_t _pass_samples{0};
+    std::uint32_t _sampler{0};
+    std::uint64_t _fingerprint{0};
+};
+
+// 场景与渲染设置描述串的 64 位 FNV-1a 散列，用于判断断点是否属于同一场景
+inline std::uint64_t checkpoint_fingerprint(const std::string& description)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : description)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief 浮点累加缓冲：逐像素保存线性辐射度之和与样本数
+ *
+ * 不同进程/不同样本区间的结果直接相加即可合并，色调映射推迟到 Camera::develop。
+ */
+class Film
+{
+    int _width{0};
+    int _height{0};
+    std::vector<glm::vec3> _sum;
+    std::vector<std::uint32_t> _count;
+
+    static constexpr char PARTIAL_MAGIC[4] = {'S', 'R', 'T', 'P'};
+    static constexpr std::uint32_t PARTIAL_VERSION = 1;
+    static constexpr char CHECKPOINT_MAGIC[4] = {'S', 'R', 'T', 'C'};
+    static constexpr std::uint32_t CHECKPOINT_VERSION = 2;
+
+    struct PartialHeader
+    {
+        char _magic[4];
+        std::uint32_t _version;
+        std::int32_t _width;
+        std::int32_t _height;
+        std::int32_t _region[4];
+        std::uint32_t _sample_begin;
+        std::uint32_t _sample_end;
+    };
+
+    struct CheckpointHeader
+    {
+        char _magic[4];
+        std::uint32_t _version;
+        std::int32_t _width;
+        std::int32_t _height;
+        CheckpointState _state;
+    };
+
+    // 文件长度是否恰好为头部加上 region 内逐像素的辐射度和与样本数，在按头部分配内存之前检查
+    static bool payload_matches(const std::string& filename, size_t header_size, const Region& region)
+    {
+        std::error_code error;
+        auto size = std::filesystem::file_size(filename, error);
+        size_t pixels = static_cast<size_t>(region.width()) * static_cast<size_t>(region.height());
+        return !error && size == header_size + pixels * (sizeof(glm::vec3) + sizeof(std::uint32_t));
+    }
+
+    void write_rows(std::ostream& out, const Region& region) const
+    {
+        for (int y = region._y0; y < region._y1; y++)
+        {
+            out.write(reinterpret_cast<const char*>(&_sum[index(region._x0, y)]), sizeof(glm::vec3) * region.width());
+            out.write(reinterpret_cast<const char*>(&_count[index(region._x0, y)]), sizeof(std::uint32_t) * region.width());
+        }
+    }
+
+    // 读取区域内逐行的辐射度和与样本数并累加
+    bool read_rows(std::istream& in, const Region& region)
+    {
+        std::vector<glm::vec3> sums(region.width());
+        std::vector<std::uint32_t> counts(region.width());
+        for (int y = region._y0; y < region._y1; y++)
+        {
+            in.read(reinterpret_cast<char*>(sums.data()), sizeof(glm::vec3) * region.width());
+            in.read(reinterpret_cast<char*>(counts.data()), sizeof(std::uint32_t) * region.width());
+            if (!in.good()) return false;
+            for (int x = 0; x < region.width(); x++) add(region._x0 + x, y, sums[x], counts[x]);
+        }
+        return true;
+    }
+
+public:
+    static constexpr int MAX_DIMENSION = 16384; // 从文件创建缓冲时允许的最大边长
+
+    Film() = default;
+    Film(int width, int height) : _width{width}, _height{height}, 
+        _sum(static_cast<size_t>(width) * height, glm::vec3{0.f, 0.f, 0.f}), 
+        _count(static_cast<size_t>(width) * height, 0) {}
+
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline Region full_region() const { return { 0, 0, _width, _height }; }
+    inline size_t index(int x, int y) const { return static_cast<size_t>(y) * _width + x; }
+
+    inline void add(int x, int y, const glm::vec3& sum, std::uint32_t samples)
+    {
+        _sum[index(x, y)] += sum;
+        _count[index(x, y)] += samples;
+    }
+    inline const glm::vec3& sum(int x, int y) const { return _sum[index(x, y)]; }
+    inline std::uint32_t count(int x, int y) const { return _count[index(x, y)]; }
+    inline glm::vec3 mean(int x, int y) const
+    {
+        auto n = count(x, y);
+        return n ? sum(x, y) * (1.f / n) : glm::vec3{0.f, 0.f, 0.f};
+    }
+
+    // 包含 region 以及区域外所有非零像素的最小矩形，光子路径会把贡献写到渲染区域之外
+    Region bounds(const Region& region) const
+    {
+        Region bounds = region;
+        for (int y = 0; y < _height; y++)
+        {
+            for (int x = 0; x < _width; x++)
+            {
+                if (bounds.contains(x, y) || (_count[index(x, y)] == 0 && _sum[index(x, y)] == glm::vec3{0.f, 0.f, 0.f})) continue;
+                bounds._x0 = std::min(bounds._x0, x);
+                bounds._y0 = std::min(bounds._y0, y);
+                bounds._x1 = std::max(bounds._x1, x + 1);
+                bounds._y1 = std::max(bounds._y1, y + 1);
+            }
+        }
+        return bounds;
+    }
+
+    void clear()
+    {
+        std::fill(_sum.begin(), _sum.end(), glm::vec3{0.f, 0.f, 0.f});
+        std::fill(_count.begin(), _count.end(), 0u);
+    }
+
+    /**
+     * @brief 写出部分渲染结果：区域内逐像素的辐射度和（3 x float）与样本数（uint32）
+     */
+    bool write_partial(const std::string& filename, const Region& region, std::uint32_t sample_begin, std::uint32_t sample_end) const
+    {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out.is_open())
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        PartialHeader header{};
+        std::memcpy(header._magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC));
+        header._version = PARTIAL_VERSION;
+        header._width = _width;
+        header._height = _height;
+        header._region[0] = region._x0;
+        header._region[1] = region._y0;
+        header._region[2] = region._x1;
+        header._region[3] = region._y1;
+        header._sample_begin = sample_begin;
+        header._sample_end = sample_end;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_rows(out, region);
+        return out.good();
+    }
+
+    /**
+     * @brief 读取部分渲染结果并累加到本缓冲，缓冲为空时按文件中的图像尺寸创建
+     */
+    bool merge_partial(const std::string& filename)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open())
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        PartialHeader header{};
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in.good() || std::memcmp(header._magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC)) != 0 || 
+            header._version != PARTIAL_VERSION || header._width <= 0 || header._height <= 0)
+        {
+            std::cerr << "bad partial file " << filename << "\n";
+            return false;
+        }
+        Region region{ header._region[0], header._region[1], header._region[2], header._region[3] };
+        // 空缓冲按头部的尺寸创建，先检查尺寸上限、区域与文件长度，损坏的头部不会触发巨大的分配
+        int width = _sum.empty() ? header._width : _width;
+        int height = _sum.empty() ? header._height : _height;
+        if (header._width != width || header._height != height || width > MAX_DIMENSION || height > MAX_DIMENSION || 
+            region._x0 < 0 || region._y0 < 0 || region._x1 > width || region._y1 > height || region.width() < 0 || region.height() < 0)
+        {
+            std::cerr << "partial file " << filename << " does not match the image\n";
+            return false;
+        }
+        if (!payload_matches(filename, sizeof(header), region))
+        {
+            std::cerr << "bad partial file " << filename << "\n";
+            return false;
+        }
+        if (_sum.empty()) *this = Film{width, height};
+        if (!read_rows(in, region))
+        {
+            std::cerr << "an error occured while reading " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 写出断点：整幅图像的辐射度和、样本数与渲染进度
+     *
+     * 先写入临时文件再重命名覆盖，进程在写入途中被杀死时旧的断点仍然完整
+     */
+    bool write_checkpoint(const std::string& filename, const CheckpointState& state) const
+    {
+        std::string temp = filename + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary);
+            if (!out.is_open())
+            {
+                std::cerr << "can't open file " << temp << "\n";
+                return false;
+            }
+            CheckpointHeader header{};
+            std::memcpy(header._magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+            header._version = CHECKPOINT_VERSION;
+            header._width = _width;
+            header._height = _height;
+            header._state = state;
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            write_rows(out, full_region());
+            out.flush();
+            if (!out.good())
+            {
+                std::cerr << "an error occured while writing " << temp << "\n";
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temp, filename, error);
+        if (error)
+        {
+            std::cerr << "can't replace " << filename << ": " << error.message() << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 读取断点，成功时替换本缓冲的全部内容
+     *
+     * 断点的分辨率必须是 width x height，文件长度须与头部一致，两者都在分配内存之前检查
+     */
+    bool read_checkpoint(const std::string& filename, int width, int height, CheckpointState& state)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in.is_open())
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        CheckpointHeader header{};
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in.good() || std::memcmp(header._magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || 
+            header._version != CHECKPOINT_VERSION || header._width <= 0 || header._height <= 0)
+        {
+            std::cerr << "bad checkpoint file " << filename << "\n";
+            return false;
+        }
+        if (header._width != width || header._height != height)
+        {
+            std::cerr << "checkpoint " << filename << " does not match the current resolution, remove it or choose another file\n";
+            return false;
+        }
+        if (!payload_matches(filename, sizeof(header), { 0, 0, width, height }))
+        {
+            std::cerr << "bad checkpoint file " << filename << "\n";
+            return false;
+        }
+        Film film{header._width, header._height};
+        if (!film.read_rows(in, film.full_region()))
+        {
+            std::cerr << "an error occured while reading " << filename << "\n";
+            return false;
+        }
+        *this = std::move(film);
+        state = header._state;
+        return true;
+    }
+};
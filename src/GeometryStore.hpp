@@ -0,0 +1,770 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "HitTable.hpp"
+#include "Transform.hpp"
+#include "AABB.hpp"
+#include "QuadPacket.hpp"
+#include "BVHTopology.hpp"
+
+// 绕 Y 轴旋转加平移的刚体变换，Translate/RotateY 的任意嵌套都可以合并为一个
+struct RigidTransformY
+{
+    float _cos{1.f};
+    float _sin{0.f};
+    glm::vec3 _offset{0.f, 0.f, 0.f};
+
+    inline bool rotated() const { return _sin != 0.f || _cos != 1.f; }
+    glm::vec3 vector(const glm::vec3& v) const { return { _cos * v.x + _sin * v.z, v.y, -_sin * v.x + _cos * v.z }; }
+    glm::vec3 point(const glm::vec3& p) const { return vector(p) + _offset; }
+    // this ∘ inner：先做 inner 再做 this
+    RigidTransformY then(const RigidTransformY& inner) const
+    {
+        return { _cos * inner._cos - _sin * inner._sin, _sin * inner._cos + _cos * inner._sin, point(inner._offset) };
+    }
+};
+
+/**
+ * @brief 按图元类型分别连续存储的几何库，自带 BVH
+ *
+ * Sphere 与 Quad 各自保存在独立数组中，按 BVH 叶节点顺序重排，每个叶节点对每种类型
+ * 引用一段连续区间。叶节点内按类型调用编译期确定的求交函数（两者均为 final，可内联），
+ * 其余 HitTable 作为通用图元通过虚函数求交。叶节点中的 Quad 另外打包成 QuadPacket，
+ * 整包一次完成求交。整个几何库本身也是一个 HitTable。
+ */
+class GeometryStore : public HitTable
+{
+public:
+    enum PrimitiveType : std::uint8_t { SPHERE, QUAD, GENERIC, TYPE_COUNT };
+    // BVH 构建策略：质心中位数划分、SAH 物体划分、SAH 物体划分与空间划分（SBVH）
+    enum Builder : std::uint8_t { MEDIAN, SAH, SPATIAL };
+
+private:
+    static constexpr std::uint32_t NO_LEAF = 0xffffffffu;
+    // 叶节点容量与 Quad 打包宽度一致，纯 Quad 叶节点恰好一包
+    static constexpr size_t MAX_LEAF_SIZE = QuadPacket::WIDTH;
+    static constexpr int STACK_SIZE = 64;
+    // SAH 构建的深度上限，保证遍历栈不会溢出
+    static constexpr int MAX_DEPTH = STACK_SIZE - 8;
+    static constexpr float TRAVERSAL_COST = 2.f;
+    static constexpr float INTERSECTION_COST = 1.f;
+    static constexpr int SAH_BINS = 32;
+    // 物体划分的子节点重叠面积超过根节点面积的这一比例时才尝试空间划分
+    static constexpr float SPATIAL_OVERLAP = 1e-5f;
+    static constexpr float SPLIT_BUDGET = .3f;
+
+    struct Node
+    {
+        float _min[3];
+        float _max[3];
+        std::uint32_t _child; // 内部节点的两个子节点位于 _child 与 _child + 1
+        std::uint32_t _leaf;  // 叶节点在 _leaves 中的下标，内部节点为 NO_LEAF
+    };
+
+    // 空间划分可能把同一个 Quad 放入多个叶节点，求交只经由 QuadPacket 引用 Quad，
+    // _begin/_end[QUAD] 是在该叶节点首次出现的 Quad
+    struct Leaf
+    {
+        std::uint32_t _begin[TYPE_COUNT];
+        std::uint32_t _end[TYPE_COUNT];
+        std::uint32_t _packet_begin;
+        std::uint32_t _packet_end;
+    };
+
+    struct PrimitiveRef
+    {
+        PrimitiveType _type;
+        std::uint32_t _index;
+        AABB _box;
+        glm::vec3 _centroid;
+    };
+
+    std::vector<Sphere> _spheres;
+    std::vector<Quad> _quads;
+    HitTablePtrs _generic;
+    std::vector<Node> _nodes;
+    std::vector<Leaf> _leaves;
+    std::vector<QuadPacket> _packets;
+    Builder _builder{SPATIAL};
+    float _split_budget{SPLIT_BUDGET};
+    size_t _references{0}; // 叶节点中的图元引用总数，空间划分切开的图元计入多次
+
+    template<PrimitiveType T>
+    auto& storage()
+    {
+        if constexpr (T == SPHERE) return _spheres;
+        else if constexpr (T == QUAD) return _quads;
+        else return _generic;
+    }
+
+    // 变换下的子树能否展开为类型化图元；旋转会改变球面 UV 的朝向，因此旋转下的球保持原样
+    static bool flattenable(const HitTablePtr& object, bool rotated)
+    {
+        if (std::dynamic_pointer_cast<Quad>(object)) return true;
+        if (std::dynamic_pointer_cast<Sphere>(object)) return !rotated;
+        if (auto translate = std::dynamic_pointer_cast<Translate>(object)) return flattenable(translate->object(), rotated);
+        if (auto rotate = std::dynamic_pointer_cast<RotateY>(object)) return flattenable(rotate->object(), true);
+        if (auto list = std::dynamic_pointer_cast<HitTableList>(object))
+        {
+            const HitTablePtrs& children = *list;
+            return std::all_of(children.begin(), children.end(), [rotated](const HitTablePtr& child) { return flattenable(child, rotated); });
+        }
+        return false;
+    }
+
+    void flatten(const HitTablePtr& object, const RigidTransformY& xf)
+    {
+        if (auto quad = std::dynamic_pointer_cast<Quad>(object))
+        {
+            _quads.emplace_back(xf.point(quad->origin()), xf.vector(quad->edge_u()), xf.vector(quad->edge_v()), quad->material());
+        }
+        else if (auto sphere = std::dynamic_pointer_cast<Sphere>(object))
+        {
+            _spheres.emplace_back(xf.point(sphere->center()), sphere->radius());
+            _spheres.back()._material = sphere->_material;
+        }
+        else if (auto translate = std::dynamic_pointer_cast<Translate>(object))
+        {
+            flatten(translate->object(), xf.then({ 1.f, 0.f, translate->offset() }));
+        }
+        else if (auto rotate = std::dynamic_pointer_cast<RotateY>(object))
+        {
+            glm::vec3 x_axis = rotate->rotate(glm::vec3{ 1.f, 0.f, 0.f });
+            flatten(rotate->object(), xf.then({ x_axis.x, -x_axis.z, glm::vec3{ 0.f, 0.f, 0.f } }));
+        }
+        else if (auto list = std::dynamic_pointer_cast<HitTableList>(object))
+        {
+            const HitTablePtrs& children = *list;
+            for (const auto& child : children) flatten(child, xf);
+        }
+    }
+
+    template<PrimitiveType T>
+    AABB primitive_aabb(std::uint32_t index)
+    {
+        if constexpr (T == GENERIC) return _generic[index]->get_aabb();
+        else return storage<T>()[index].get_aabb();
+    }
+
+    template<PrimitiveType T>
+    void collect_refs(std::vector<PrimitiveRef>& refs)
+    {
+        for (std::uint32_t i = 0; i < storage<T>().size(); i++)
+        {
+            AABB box = primitive_aabb<T>(i);
+            glm::vec3 centroid
+            {
+                (box.get_slab_x()._min + box.get_slab_x()._max) * .5f,
+                (box.get_slab_y()._min + box.get_slab_y()._max) * .5f,
+                (box.get_slab_z()._min + box.get_slab_z()._max) * .5f
+            };
+            refs.push_back({ T, i, box, centroid });
+        }
+    }
+
+    // 构建时按叶节点顺序重排的图元数组
+    struct Ordered
+    {
+        std::vector<Sphere> _spheres;
+        std::vector<Quad> _quads;
+        HitTablePtrs _generic;
+        std::vector<std::uint32_t> _quad_slot; // 原 Quad 下标到重排后下标的映射，尚未放入叶节点时为 NO_LEAF
+        size_t _split_budget{0};               // 空间划分还能新增的引用数
+    };
+
+    // SAH 划分方案：以 _axis 上 _lo + _bin_width * _plane 处的分段边界为界，物体划分按质心、空间划分按图元切分
+    struct Split
+    {
+        float _cost{ std::numeric_limits<float>::max() };
+        int _axis{0};
+        int _plane{0};
+        float _lo{0.f};
+        float _bin_width{0.f};
+        bool _spatial{false};
+        AABB _left;
+        AABB _right;
+
+        inline float position() const { return _lo + _bin_width * _plane; }
+        inline int bin(float v) const { return std::clamp(static_cast<int>((v - _lo) / _bin_width), 0, SAH_BINS - 1); }
+    };
+
+    void set_bounds(std::uint32_t index, const AABB& box)
+    {
+        Node& node = _nodes[index];
+        for (int a = 0; a < 3; a++)
+        {
+            node._min[a] = box.get_slab(a)._min;
+            node._max[a] = box.get_slab(a)._max;
+        }
+    }
+
+    // 把 [first, last) 中的引用写成叶节点；同一个 Quad 可被空间划分放入多个叶节点，只在首次出现时放入数组
+    void make_leaf(const PrimitiveRef* first, const PrimitiveRef* last, std::uint32_t index, Ordered& out)
+    {
+        Leaf leaf;
+        auto fill = [&](PrimitiveType type, auto& ordered, auto& source)
+        {
+            leaf._begin[type] = static_cast<std::uint32_t>(ordered.size());
+            for (auto ref = first; ref != last; ref++)
+            {
+                if (ref->_type == type) ordered.push_back(source[ref->_index]);
+            }
+            leaf._end[type] = static_cast<std::uint32_t>(ordered.size());
+        };
+        fill(SPHERE, out._spheres, _spheres);
+        fill(GENERIC, out._generic, _generic);
+        leaf._begin[QUAD] = static_cast<std::uint32_t>(out._quads.size());
+        std::vector<std::uint32_t> slots;
+        for (auto ref = first; ref != last; ref++)
+        {
+            if (ref->_type != QUAD) continue;
+            std::uint32_t& slot = out._quad_slot[ref->_index];
+            if (slot == NO_LEAF)
+            {
+                slot = static_cast<std::uint32_t>(out._quads.size());
+                out._quads.push_back(_quads[ref->_index]);
+            }
+            slots.push_back(slot);
+        }
+        leaf._end[QUAD] = static_cast<std::uint32_t>(out._quads.size());
+        leaf._packet_begin = static_cast<std::uint32_t>(_packets.size());
+        pack_quads(out._quads, slots, _packets);
+        leaf._packet_end = static_cast<std::uint32_t>(_packets.size());
+        _references += static_cast<size_t>(last - first);
+        _nodes[index]._leaf = static_cast<std::uint32_t>(_leaves.size());
+        _nodes[index]._child = 0;
+        _leaves.push_back(leaf);
+    }
+
+    // 沿质心包围盒最长轴取中位数划分，与 BVHnode 的策略一致
+    void build_median(std::vector<PrimitiveRef>& refs, size_t begin, size_t end, std::uint32_t index, Ordered& out)
+    {
+        AABB box, centroid_box;
+        for (size_t i = begin; i != end; i++)
+        {
+            box = refs[i]._box + box;
+            centroid_box = AABB{refs[i]._centroid, refs[i]._centroid} + centroid_box;
+        }
+        set_bounds(index, box);
+        if (end - begin <= MAX_LEAF_SIZE)
+        {
+            make_leaf(refs.data() + begin, refs.data() + end, index, out);
+            return;
+        }
+        int axis = static_cast<int>(centroid_box.longest_axis());
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end, 
+            [axis](const PrimitiveRef& a, const PrimitiveRef& b) { return a._centroid[axis] < b._centroid[axis]; });
+        auto child = static_cast<std::uint32_t>(_nodes.size());
+        _nodes[index]._leaf = NO_LEAF;
+        _nodes[index]._child = child;
+        _nodes.emplace_back();
+        _nodes.emplace_back();
+        build_median(refs, begin, mid, child, out);
+        build_median(refs, mid, end, child + 1, out);
+    }
+
+    /**
+     * @brief 沿 axis 把 [lo, lo + extent) 等分为 SAH_BINS 段统计各段的包围盒与引用数，扫描所有分段边界
+     *
+     * bin_box(ref, bins, enter, exit) 负责把一个引用计入各段，结果写入 best（代价更低时）
+     */
+    template<typename BinBox>
+    static void sweep_bins(const std::vector<PrimitiveRef>& refs, int axis, float lo, float extent, float area, bool spatial, Split& best, BinBox bin_box)
+    {
+        if (!(extent > 0.f)) return;
+        Split candidate;
+        candidate._axis = axis;
+        candidate._lo = lo;
+        candidate._bin_width = extent / SAH_BINS;
+        candidate._spatial = spatial;
+        AABB bounds[SAH_BINS];
+        size_t enter[SAH_BINS] = {};
+        size_t exit[SAH_BINS] = {};
+        for (const auto& ref : refs) bin_box(ref, candidate, bounds, enter, exit);
+        float right_area[SAH_BINS];
+        size_t right_count[SAH_BINS];
+        AABB right;
+        size_t count = 0;
+        for (int bin = SAH_BINS - 1; bin > 0; bin--)
+        {
+            right = bounds[bin] + right;
+            count += exit[bin];
+            right_area[bin] = right.area();
+            right_count[bin] = count;
+        }
+        AABB left;
+        count = 0;
+        bool improved = false;
+        for (int plane = 1; plane < SAH_BINS; plane++)
+        {
+            left = bounds[plane - 1] + left;
+            count += enter[plane - 1];
+            if (count == 0 || right_count[plane] == 0) continue;
+            float cost = TRAVERSAL_COST + INTERSECTION_COST * (left.area() * count + right_area[plane] * right_count[plane]) / area;
+            if (cost < best._cost)
+            {
+                best = candidate;
+                best._cost = cost;
+                best._plane = plane;
+                best._left = left;
+                improved = true;
+            }
+        }
+        if (improved)
+        {
+            best._right = AABB{};
+            for (int bin = best._plane; bin < SAH_BINS; bin++) best._right = bounds[bin] + best._right;
+        }
+    }
+
+    // 按质心分段统计，返回 SAH 代价最低的物体划分；质心全部重合时 _plane 为 0
+    Split find_object_split(const std::vector<PrimitiveRef>& refs, float area) const
+    {
+        Split best;
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = std::numeric_limits<float>::max();
+            hi[a] = std::numeric_limits<float>::lowest();
+        }
+        for (const auto& ref : refs)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::fmin(lo[a], ref._centroid[a]);
+                hi[a] = std::fmax(hi[a], ref._centroid[a]);
+            }
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sweep_bins(refs, axis, lo[axis], hi[axis] - lo[axis], area, false, best, 
+                [](const PrimitiveRef& ref, const Split& split, AABB* bounds, size_t* enter, size_t* exit)
+            {
+                int bin = split.bin(ref._centroid[split._axis]);
+                bounds[bin] = ref._box + bounds[bin];
+                enter[bin]++;
+                exit[bin]++;
+            });
+        }
+        return best;
+    }
+
+    // 按物体划分分配引用，质心全部重合时按数量对半分
+    static void partition_object(std::vector<PrimitiveRef>& refs, const Split& split, std::vector<PrimitiveRef>& left, std::vector<PrimitiveRef>& right)
+    {
+        if (split._plane == 0)
+        {
+            left.assign(refs.begin(), refs.begin() + refs.size() / 2);
+            right.assign(refs.begin() + refs.size() / 2, refs.end());
+            return;
+        }
+        for (const auto& ref : refs) (split.bin(ref._centroid[split._axis]) < split._plane ? left : right).push_back(ref);
+    }
+
+    // 把 Quad 引用在 axis = position 平面处切成两半，各自的包围盒再与原引用的包围盒求交
+    void split_reference(const PrimitiveRef& ref, int axis, float position, PrimitiveRef& left, PrimitiveRef& right, bool& has_left, bool& has_right) const
+    {
+        const Quad& quad = _quads[ref._index];
+        const glm::vec3 corners[4]
+        {
+            quad.origin(), quad.origin() + quad.edge_u(), quad.origin() + quad.edge_u() + quad.edge_v(), quad.origin() + quad.edge_v()
+        };
+        glm::vec3 left_min{ std::numeric_limits<float>::max() }, left_max{ std::numeric_limits<float>::lowest() };
+        glm::vec3 right_min = left_min, right_max = left_max;
+        has_left = has_right = false;
+        auto grow = [](glm::vec3& lo, glm::vec3& hi, bool& has, const glm::vec3& p)
+        {
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+            has = true;
+        };
+        for (int e = 0; e < 4; e++)
+        {
+            const glm::vec3& v0 = corners[e];
+            const glm::vec3& v1 = corners[(e + 1) % 4];
+            if (v0[axis] <= position) grow(left_min, left_max, has_left, v0);
+            if (v0[axis] >= position) grow(right_min, right_max, has_right, v0);
+            if ((v0[axis] < position && v1[axis] > position) || (v0[axis] > position && v1[axis] < position))
+            {
+                glm::vec3 p = v0 + (v1 - v0) * ((position - v0[axis]) / (v1[axis] - v0[axis]));
+                p[axis] = position;
+                grow(left_min, left_max, has_left, p);
+                grow(right_min, right_max, has_right, p);
+            }
+        }
+        auto clipped = [&ref](const AABB& box, PrimitiveRef& out)
+        {
+            out = ref;
+            out._box = intersection(box, ref._box);
+            for (int a = 0; a < 3; a++) out._centroid[a] = (out._box.get_slab(a)._min + out._box.get_slab(a)._max) * .5f;
+        };
+        if (has_left) clipped(AABB{left_min, left_max}, left);
+        if (has_right) clipped(AABB{right_min, right_max}, right);
+    }
+
+    // 只有 Quad 能按平面切分，其他图元在空间划分中按质心整体归入一侧
+    inline static bool splittable(const PrimitiveRef& ref) { return ref._type == QUAD; }
+
+    // 把节点包围盒沿每个轴等分为 SAH_BINS 段，Quad 引用按跨越的段切分后统计，返回代价最低的分段边界
+    Split find_spatial_split(const std::vector<PrimitiveRef>& refs, const AABB& box, float area) const
+    {
+        Split best;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sweep_bins(refs, axis, box.get_slab(axis)._min, box.get_slab(axis).length(), area, true, best, 
+                [this](const PrimitiveRef& ref, const Split& split, AABB* bounds, size_t* enter, size_t* exit)
+            {
+                if (!splittable(ref))
+                {
+                    int bin = split.bin(ref._centroid[split._axis]);
+                    bounds[bin] = ref._box + bounds[bin];
+                    enter[bin]++;
+                    exit[bin]++;
+                    return;
+                }
+                int first = split.bin(ref._box.get_slab(split._axis)._min);
+                int last = split.bin(ref._box.get_slab(split._axis)._max);
+                PrimitiveRef rest = ref;
+                bool clipped_away = false;
+                for (int bin = first; bin < last && !clipped_away; bin++)
+                {
+                    PrimitiveRef left, right;
+                    bool has_left, has_right;
+                    split_reference(rest, split._axis, split._lo + split._bin_width * (bin + 1), left, right, has_left, has_right);
+                    if (has_left) bounds[bin] = left._box + bounds[bin];
+                    if (has_right) rest = right;
+                    else clipped_away = true;
+                }
+                if (!clipped_away) bounds[last] = rest._box + bounds[last];
+                enter[first]++;
+                exit[last]++;
+            });
+        }
+        return best;
+    }
+
+    /**
+     * @brief 按空间划分平面分配引用，跨越平面的 Quad 被切成两半分别放入两侧
+     *
+     * 跨越平面的引用若整体放入一侧的代价更低则不切分（reference unsplitting），
+     * 新增引用数超过预算后剩余的跨越引用也整体放入代价较低的一侧。
+     * 
+     * @return 两侧都非空时返回 true
+     */
+    bool partition_spatial(const std::vector<PrimitiveRef>& refs, const Split& split, std::vector<PrimitiveRef>& left, std::vector<PrimitiveRef>& right, Ordered& out) const
+    {
+        const int axis = split._axis;
+        const float position = split.position();
+        std::vector<const PrimitiveRef*> straddling;
+        AABB left_box, right_box;
+        for (const auto& ref : refs)
+        {
+            const Interval slab = ref._box.get_slab(axis);
+            bool to_left = splittable(ref) ? slab._max <= position : ref._centroid[axis] < position;
+            bool to_right = splittable(ref) ? slab._min >= position : !to_left;
+            if (to_left)
+            {
+                left.push_back(ref);
+                left_box = ref._box + left_box;
+            }
+            else if (to_right)
+            {
+                right.push_back(ref);
+                right_box = ref._box + right_box;
+            }
+            else straddling.push_back(&ref);
+        }
+        for (const PrimitiveRef* ref : straddling)
+        {
+            PrimitiveRef left_part, right_part;
+            bool has_left, has_right;
+            split_reference(*ref, axis, position, left_part, right_part, has_left, has_right);
+            if (!has_left || !has_right)
+            {
+                (has_left ? left : right).push_back(*ref);
+                (has_left ? left_box : right_box) = ref->_box + (has_left ? left_box : right_box);
+                continue;
+            }
+            float n_left = static_cast<float>(left.size()), n_right = static_cast<float>(right.size());
+            AABB split_left = left_part._box + left_box, split_right = right_part._box + right_box;
+            AABB whole_left = ref->_box + left_box, whole_right = ref->_box + right_box;
+            float split_cost = split_left.area() * (n_left + 1.f) + split_right.area() * (n_right + 1.f);
+            float left_cost = whole_left.area() * (n_left + 1.f) + right_box.area() * n_right;
+            float right_cost = left_box.area() * n_left + whole_right.area() * (n_right + 1.f);
+            if (n_right == 0.f) right_cost = std::numeric_limits<float>::max();
+            if (n_left == 0.f) left_cost = std::numeric_limits<float>::max();
+            if (out._split_budget > 0 && split_cost < left_cost && split_cost < right_cost)
+            {
+                out._split_budget--;
+                left.push_back(left_part);
+                right.push_back(right_part);
+                left_box = split_left;
+                right_box = split_right;
+            }
+            else if (left_cost <= right_cost)
+            {
+                left.push_back(*ref);
+                left_box = whole_left;
+            }
+            else
+            {
+                right.push_back(*ref);
+                right_box = whole_right;
+            }
+        }
+        return !left.empty() && !right.empty();
+    }
+
+    /**
+     * @brief 按 SAH 自顶向下构建，可选地考虑空间划分（SBVH）
+     *
+     * 物体划分的两个子节点重叠面积相对根节点超过 SPATIAL_OVERLAP 时，再尝试把节点切成等宽段的空间划分，
+     * 两者取代价较低者。引用数不超过叶节点容量且划分不比直接求交更省时生成叶节点。
+     */
+    void build_sah(std::vector<PrimitiveRef>& refs, std::uint32_t index, int depth, float root_area, Ordered& out)
+    {
+        AABB box;
+        for (const auto& ref : refs) box = ref._box + box;
+        set_bounds(index, box);
+        const size_t count = refs.size();
+        const float area = box.area();
+        if (count <= 1 || depth >= MAX_DEPTH || area <= 0.f)
+        {
+            make_leaf(refs.data(), refs.data() + count, index, out);
+            return;
+        }
+        Split split = find_object_split(refs, area);
+        if (_builder == SPATIAL && count > MAX_LEAF_SIZE && out._split_budget > 0 && overlap_area(split._left, split._right) > SPATIAL_OVERLAP * root_area)
+        {
+            Split spatial = find_spatial_split(refs, box, area);
+            if (spatial._cost < split._cost) split = spatial;
+        }
+        if (count <= MAX_LEAF_SIZE && INTERSECTION_COST * count <= split._cost)
+        {
+            make_leaf(refs.data(), refs.data() + count, index, out);
+            return;
+        }
+        std::vector<PrimitiveRef> left, right;
+        if (!split._spatial || !partition_spatial(refs, split, left, right, out))
+        {
+            // 空间划分未能分开时退回物体划分
+            if (split._spatial)
+            {
+                left.clear();
+                right.clear();
+                split = find_object_split(refs, area);
+            }
+            partition_object(refs, split, left, right);
+        }
+        refs.clear();
+        refs.shrink_to_fit();
+        auto child = static_cast<std::uint32_t>(_nodes.size());
+        _nodes[index]._leaf = NO_LEAF;
+        _nodes[index]._child = child;
+        _nodes.emplace_back();
+        _nodes.emplace_back();
+        build_sah(left, child, depth + 1, root_area, out);
+        build_sah(right, child + 1, depth + 1, root_area, out);
+    }
+
+    std::uint32_t add_topology(BVHTopology& topology, std::uint32_t index)
+    {
+        const Node& node = _nodes[index];
+        std::uint32_t result = topology.add_node(AABB{ glm::vec3{ node._min[0], node._min[1], node._min[2] }, glm::vec3{ node._max[0], node._max[1], node._max[2] } });
+        if (node._leaf != NO_LEAF)
+        {
+            const Leaf& leaf = _leaves[node._leaf];
+            for (auto i = leaf._begin[SPHERE]; i != leaf._end[SPHERE]; i++) topology.add_primitive(&_spheres[i]);
+            for (auto i = leaf._packet_begin; i != leaf._packet_end; i++)
+            {
+                for (int lane = 0; lane < QuadPacket::WIDTH; lane++)
+                {
+                    if (_packets[i].valid(lane)) topology.add_primitive(&_quads[_packets[i]._index[lane]]);
+                }
+            }
+            for (auto i = leaf._begin[GENERIC]; i != leaf._end[GENERIC]; i++) topology.add_primitive(_generic[i].get());
+            return result;
+        }
+        for (std::uint32_t c = 0; c < 2; c++)
+        {
+            std::uint32_t child = add_topology(topology, node._child + c);
+            topology._nodes[result]._child[c] = child;
+        }
+        return result;
+    }
+
+    // 对叶节点中某一类型的连续区间求交，类型在编译期确定
+    template<PrimitiveType T>
+    void hit_range(const Leaf& leaf, Ray& r, HitRecord& record, bool& hit_anything)
+    {
+        if constexpr (T == GENERIC)
+        {
+            for (auto i = leaf._begin[T]; i != leaf._end[T]; i++)
+            {
+                if (_generic[i]->hit(r, record)) hit_anything = true;
+            }
+        }
+        else if constexpr (T == QUAD)
+        {
+            float t = 0.f, alpha = 0.f, beta = 0.f;
+            for (auto i = leaf._packet_begin; i != leaf._packet_end; i++)
+            {
+                const QuadPacket& packet = _packets[i];
+                int lane = packet.intersect(r, t, alpha, beta);
+                if (lane < 0) continue;
+                // 命中后收紧 t_max，后续的包只会接受更近的命中
+                _quads[packet._index[lane]].record_hit(r, t, alpha, beta, record);
+                hit_anything = true;
+            }
+        }
+        else
+        {
+            auto& primitives = storage<T>();
+            for (auto i = leaf._begin[T]; i != leaf._end[T]; i++)
+            {
+                if (primitives[i].hit(r, record)) hit_anything = true;
+            }
+        }
+    }
+
+public:
+    GeometryStore() = default;
+    GeometryStore(const HitTablePtrs& objects, Builder builder = SPATIAL) : _builder{builder}
+    {
+        for (const auto& object : objects) add(object);
+        build();
+    }
+
+    // 添加物体：可展开的子树被拆成类型化图元，其余保持为通用图元
+    void add(const HitTablePtr& object)
+    {
+        if (flattenable(object, false)) flatten(object, RigidTransformY{});
+        else _generic.push_back(object);
+    }
+
+    // 选择 BVH 构建策略，split_budget 为空间划分最多新增的引用数与图元数之比，下次 build 时生效
+    void set_builder(Builder builder, float split_budget = SPLIT_BUDGET)
+    {
+        _builder = builder;
+        _split_budget = split_budget;
+    }
+
+    // 构建 BVH 并按叶节点顺序重排各类型数组
+    void build()
+    {
+        std::vector<PrimitiveRef> refs;
+        collect_refs<SPHERE>(refs);
+        collect_refs<QUAD>(refs);
+        collect_refs<GENERIC>(refs);
+        _nodes.clear();
+        _leaves.clear();
+        _packets.clear();
+        _references = 0;
+        _box = AABB{};
+        if (refs.empty()) return;
+        for (const auto& ref : refs) _box = ref._box + _box;
+        Ordered out;
+        out._spheres.reserve(_spheres.size());
+        out._quads.reserve(_quads.size());
+        out._generic.reserve(_generic.size());
+        out._quad_slot.assign(_quads.size(), NO_LEAF);
+        out._split_budget = static_cast<size_t>(_split_budget * refs.size());
+        _nodes.emplace_back();
+        if (_builder == MEDIAN) build_median(refs, 0, refs.size(), 0, out);
+        else build_sah(refs, 0, 0, _box.area(), out);
+        _spheres = std::move(out._spheres);
+        _quads = std::move(out._quads);
+        _generic = std::move(out._generic);
+    }
+
+    virtual void collect_quads(std::vector<Quad*>& quads) override
+    {
+        for (auto& quad : _quads) quads.push_back(&quad);
+        for (const auto& object : _generic) object->collect_quads(quads);
+    }
+
+    virtual bool collect_raster(std::vector<Quad*>& quads, std::vector<Sphere*>& spheres) override
+    {
+        for (auto& quad : _quads) quads.push_back(&quad);
+        for (auto& sphere : _spheres) spheres.push_back(&sphere);
+        bool complete = true;
+        for (const auto& object : _generic) complete &= object->collect_raster(quads, spheres);
+        return complete;
+    }
+
+    inline size_t primitive_count(PrimitiveType type) const
+    {
+        return type == SPHERE ? _spheres.size() : (type == QUAD ? _quads.size() : _generic.size());
+    }
+    inline size_t node_count() const { return _nodes.size(); }
+    inline size_t packet_count() const { return _packets.size(); }
+    inline size_t reference_count() const { return _references; }
+
+    // 叶节点中的 Quad 按包内的有效通道逐个列出
+    BVHTopology topology()
+    {
+        BVHTopology topology;
+        topology._node_count = node_count();
+        topology._bytes = memory_footprint();
+        if (!_nodes.empty()) add_topology(topology, 0);
+        return topology;
+    }
+    // 节点、叶节点与 Quad 包数组占用的字节数
+    inline size_t memory_footprint() const
+    {
+        return _nodes.size() * sizeof(Node) + _leaves.size() * sizeof(Leaf) + _packets.size() * sizeof(QuadPacket);
+    }
+
+    virtual bool hit(Ray& r, HitRecord& record) override
+    {
+        if (_nodes.empty()) return false;
+        const glm::vec3 orig = r.origin();
+        const glm::vec3 dir = r.direction();
+        const glm::vec3 inv_dir{ 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+        std::uint32_t stack[STACK_SIZE];
+        int top = 0;
+        float t_enter;
+        if (!slab_test(_nodes[0]._min, _nodes[0]._max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), t_enter)) return false;
+        stack[top++] = 0;
+        bool hit_anything = false;
+        while (top > 0)
+        {
+            const Node& node = _nodes[stack[--top]];
+            if (node._leaf != NO_LEAF)
+            {
+                const Leaf& leaf = _leaves[node._leaf];
+                hit_range<SPHERE>(leaf, r, record, hit_anything);
+                hit_range<QUAD>(leaf, r, record, hit_anything);
+                hit_range<GENERIC>(leaf, r, record, hit_anything);
+                continue;
+            }
+            float t[2];
+            bool child_hit[2];
+            for (int c = 0; c < 2; c++)
+            {
+                const Node& child = _nodes[node._child + c];
+                child_hit[c] = slab_test(child._min, child._max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), t[c]);
+            }
+            // 先压入较远的子节点，使较近者先出栈
+            if (child_hit[0] && child_hit[1])
+            {
+                bool left_first = t[0] <= t[1];
+                if (top + 2 > STACK_SIZE) continue;
+                stack[top++] = node._child + (left_first ? 1 : 0);
+                stack[top++] = node._child + (left_first ? 0 : 1);
+            }
+            else if (child_hit[0] || child_hit[1])
+            {
+                if (top + 1 > STACK_SIZE) continue;
+                stack[top++] = node._child + (child_hit[0] ? 0 : 1);
+            }
+        }
+        return hit_anything;
+    }
+};
@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.hpp"
+#include "Utility.hpp"
+
+/**
+ * @brief 方向四叉树：在等面积的 (cosθ, φ) 单位正方形上分段常数地近似入射光的方向分布
+ *
+ * 每个节点保存四个象限的能量和，子节点下标为 0 表示该象限是叶子（根节点不会作为子节点）。
+ * 渲染过程中树结构不变，只用 omp atomic 累加能量，因此可以无锁并发写入。
+ */
+class DTree
+{
+    struct Node
+    {
+        float _sum[4]{0.f, 0.f, 0.f, 0.f};
+        std::uint32_t _child[4]{0, 0, 0, 0};
+    };
+    std::vector<Node> _nodes{1};
+
+    static constexpr int MAX_DEPTH = 20;
+
+    static glm::vec2 to_square(const glm::vec3& d)
+    {
+        float cos_theta = std::clamp(d.z, -1.f, 1.f);
+        float phi = std::atan2(d.y, d.x);
+        if (phi < 0.f) phi += 2.f * pi;
+        return { std::min((cos_theta + 1.f) * .5f, 0x1.fffffep-1f), std::min(phi / (2.f * pi), 0x1.fffffep-1f) };
+    }
+
+    static glm::vec3 to_direction(const glm::vec2& p)
+    {
+        float cos_theta = 2.f * p.x - 1.f;
+        float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+        float phi = 2.f * pi * p.y;
+        return { sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta };
+    }
+
+    static inline float node_total(const Node& node) { return node._sum[0] + node._sum[1] + node._sum[2] + node._sum[3]; }
+    static inline int quadrant(glm::vec2& p)
+    {
+        int x = p.x >= .5f ? 1 : 0;
+        int y = p.y >= .5f ? 1 : 0;
+        p = glm::vec2{ p.x * 2.f - x, p.y * 2.f - y };
+        return x + 2 * y;
+    }
+
+    void refine(std::uint32_t index, const DTree& energy, std::uint32_t source, const float sums[4], float total, float threshold, int depth)
+    {
+        for (int q = 0; q < 4; q++)
+        {
+            if (sums[q] <= total * threshold || depth >= MAX_DEPTH) continue;
+            // 已有子节点时沿用其能量分布，否则假设能量在四个子象限中均匀分布
+            float child_sums[4];
+            std::uint32_t child_source = source != NO_SOURCE ? energy._nodes[source]._child[q] : 0;
+            for (int c = 0; c < 4; c++) child_sums[c] = child_source ? energy._nodes[child_source]._sum[c] : sums[q] * .25f;
+            auto child = static_cast<std::uint32_t>(_nodes.size());
+            _nodes.emplace_back();
+            _nodes[index]._child[q] = child;
+            refine(child, energy, child_source ? child_source : NO_SOURCE, child_sums, total, threshold, depth + 1);
+        }
+    }
+    static constexpr std::uint32_t NO_SOURCE = 0xffffffffu;
+
+public:
+    inline float total() const { return node_total(_nodes[0]); }
+    inline bool ready() const { return total() > 0.f; }
+    inline size_t node_count() const { return _nodes.size(); }
+
+    // 沿方向 direction 记录一个估计值（已除以采样 PDF），可在渲染线程中并发调用
+    void record(const glm::vec3& direction, float value)
+    {
+        if (!(value > 0.f) || !std::isfinite(value)) return;
+        glm::vec2 p = to_square(direction);
+        std::uint32_t index = 0;
+        while (true)
+        {
+            int q = quadrant(p);
+            float& sum = _nodes[index]._sum[q];
+#pragma omp atomic
+            sum += value;
+            index = _nodes[index]._child[q];
+            if (index == 0) break;
+        }
+    }
+
+    // 立体角 PDF
+    float pdf(const glm::vec3& direction) const
+    {
+        if (!ready()) return 0.f;
+        glm::vec2 p = to_square(direction);
+        float result = 1.f;
+        std::uint32_t index = 0;
+        while (true)
+        {
+            const Node& node = _nodes[index];
+            float t = node_total(node);
+            if (t <= 0.f) return 0.f;
+            int q = quadrant(p);
+            result *= 4.f * node._sum[q] / t;
+            index = node._child[q];
+            if (index == 0) break;
+        }
+        return result / (4.f * pi);
+    }
+
+    // 分层变形采样：每层先按列、再按行选象限，u 在各层重新映射
+    glm::vec3 sample() const
+    {
+        float u = RANDOM.get_float(0.f, 1.f);
+        float v = RANDOM.get_float(0.f, 1.f);
+        glm::vec2 origin{ 0.f, 0.f };
+        float size = 1.f;
+        std::uint32_t index = 0;
+        while (true)
+        {
+            const Node& node = _nodes[index];
+            float t = node_total(node);
+            float left = node._sum[0] + node._sum[2];
+            float p_left = t > 0.f ? left / t : .5f;
+            int x;
+            if (u < p_left) { u = std::min(u / p_left, 0x1.fffffep-1f); x = 0; }
+            else { u = std::min((u - p_left) / (1.f - p_left), 0x1.fffffep-1f); x = 1; }
+            float column = node._sum[x] + node._sum[x + 2];
+            float p_low = column > 0.f ? node._sum[x] / column : .5f;
+            int y;
+            if (v < p_low) { v = std::min(v / p_low, 0x1.fffffep-1f); y = 0; }
+            else { v = std::min((v - p_low) / (1.f - p_low), 0x1.fffffep-1f); y = 1; }
+            size *= .5f;
+            origin += glm::vec2{ x * size, y * size };
+            index = node._child[x + 2 * y];
+            if (index == 0) break;
+        }
+        return to_direction(origin + glm::vec2{ u, v } * size);
+    }
+
+    // 按本树的能量分布细分：能量占比超过 threshold 的象限继续细分，返回能量清零的新树
+    DTree refined(float threshold = .01f) const
+    {
+        DTree result;
+        float t = total();
+        if (t > 0.f) result.refine(0, *this, 0, _nodes[0]._sum, t, threshold, 1);
+        return result;
+    }
+};
+
+// 空间树叶节点：上一轮学到的用于采样的分布与本轮正在累加的分布
+struct GuidingCell
+{
+    DTree _sampling;
+    DTree _building;
+    std::uint64_t _records{0};
+};
+
+/**
+ * @brief SD-tree 路径引导：空间二叉树，每个叶节点挂一棵方向四叉树
+ *
+ * 每轮渲染中各线程把采样方向上的 Li·cos 估计无锁地累加到所在叶节点的 _building 树，
+ * 两轮之间调用 update：记录数过多的空间叶节点对半细分，_building 成为下一轮的 _sampling，
+ * 并按其能量分布细分出新的 _building。
+ */
+class GuidingField
+{
+    static constexpr std::uint32_t NO_CELL = 0xffffffffu;
+    static constexpr double SPLIT_THRESHOLD = 12000.;
+
+    struct Node
+    {
+        std::uint32_t _child{0}; // 内部节点的两个子节点位于 _child 与 _child + 1
+        std::uint32_t _cell{NO_CELL};
+        std::uint8_t _axis{0};
+    };
+
+    glm::vec3 _min;
+    glm::vec3 _max;
+    std::vector<Node> _nodes;
+    std::vector<GuidingCell> _cells;
+    int _iteration{0};
+
+    void split(std::uint32_t index, int depth)
+    {
+        std::uint32_t cell = _nodes[index]._cell;
+        auto child = static_cast<std::uint32_t>(_nodes.size());
+        _nodes[index]._child = child;
+        _nodes[index]._cell = NO_CELL;
+        _nodes[index]._axis = static_cast<std::uint8_t>(depth % 3);
+        GuidingCell copy = _cells[cell];
+        copy._records /= 2;
+        _cells[cell] = copy;
+        auto other = static_cast<std::uint32_t>(_cells.size());
+        _cells.push_back(copy);
+        _nodes.push_back({ 0, cell, 0 });
+        _nodes.push_back({ 0, other, 0 });
+    }
+
+    void refine_space(std::uint32_t index, int depth, double threshold)
+    {
+        if (_nodes[index]._cell != NO_CELL)
+        {
+            if (depth >= 60 || _cells[_nodes[index]._cell]._records <= threshold) return;
+            split(index, depth);
+        }
+        auto child = _nodes[index]._child;
+        refine_space(child, depth + 1, threshold);
+        refine_space(child + 1, depth + 1, threshold);
+    }
+
+public:
+    explicit GuidingField(const AABB& box)
+    {
+        glm::vec3 lo{ box.get_slab_x()._min, box.get_slab_y()._min, box.get_slab_z()._min };
+        glm::vec3 hi{ box.get_slab_x()._max, box.get_slab_y()._max, box.get_slab_z()._max };
+        // 取立方体包围盒，使交替按轴对半划分得到的格子接近正方体
+        glm::vec3 center = (lo + hi) * .5f;
+        glm::vec3 half_size = hi - lo;
+        float half = std::max(half_size.x, std::max(half_size.y, half_size.z)) * .5f * 1.001f + 1e-4f;
+        _min = center - glm::vec3{ half, half, half };
+        _max = center + glm::vec3{ half, half, half };
+        _nodes.push_back({ 0, 0, 0 });
+        _cells.emplace_back();
+    }
+
+    GuidingCell& lookup(const glm::vec3& p)
+    {
+        glm::vec3 lo = _min, hi = _max;
+        std::uint32_t index = 0;
+        while (_nodes[index]._cell == NO_CELL)
+        {
+            int axis = _nodes[index]._axis;
+            float mid = (lo[axis] + hi[axis]) * .5f;
+            if (p[axis] < mid)
+            {
+                hi[axis] = mid;
+                index = _nodes[index]._child;
+            }
+            else
+            {
+                lo[axis] = mid;
+                index = _nodes[index]._child + 1;
+            }
+        }
+        return _cells[_nodes[index]._cell];
+    }
+
+    static void count(GuidingCell& cell)
+    {
+#pragma omp atomic
+        cell._records++;
+    }
+
+    // 两轮渲染之间调用，不能与 record 并发
+    void update()
+    {
+        refine_space(0, 0, SPLIT_THRESHOLD * std::sqrt(std::pow(2., _iteration)));
+        for (auto& cell : _cells)
+        {
+            if (cell._building.ready()) cell._sampling = cell._building;
+            cell._building = cell._sampling.refined();
+            cell._records = 0;
+        }
+        _iteration++;
+    }
+
+    inline int iteration() const { return _iteration; }
+    inline size_t cell_count() const { return _cells.size(); }
+};
@@ -1,5 +1,8 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <glm/detail/qualifier.hpp>
 #include <glm/fwd.hpp>
 #include <glm/geometric.hpp>
@@ -7,19 +10,34 @@
 #include <vector>
 
 #include "AABB.hpp"
+#include "Arena.hpp"
 #include "Interval.hpp"
 
 class Material;
 using MaterialPtr = std::shared_ptr<Material>;
+class Quad;
+class Sphere;
+class HitTable;
 
+/**
+ * @brief 命中记录
+ *
+ * 求交遍历期间只记录 _t、命中的图元 _object 与图元内的参数坐标（_primitive、_coords），
+ * 交点、法线、UV 与材质等表面属性在遍历结束后由 resolve 对最近命中计算一次。
+ */
 struct HitRecord
 {
+    const HitTable* _object{nullptr}; // 表面属性尚未计算的最近命中图元，为空表示已计算
+    std::uint32_t _primitive{0};      // 图元集合内的下标
+    glm::vec2 _coords;                // 图元上的参数坐标，如 Quad 的 (α, β)
     glm::vec3 _point;
     glm::vec3 _normal;
     glm::vec2 _uv;
     MaterialPtr _material;
-    float _t;
-    bool _is_front;
+    float _t{0.f};
+    float _footprint{0.f}; // 像素足迹在UV空间中的宽度，纹理据此选择 mipmap 层级
+    int _light{-1};        // 命中的面光源在 LightBVH 中的下标，不是可采样光源时为 -1
+    bool _is_front{true};
 
     void set_face_normal(const Ray& r, const glm::vec3& outward_normal)
     {
@@ -28,6 +46,15 @@ struct HitRecord
         _normal = glm::normalize(_normal);
     }
 
+    // uv_scale 为单位UV对应的世界空间边长，需在 set_face_normal 之后调用
+    void set_footprint(const Ray& r, float uv_scale)
+    {
+        float cos_theta = std::fabs(glm::dot(glm::normalize(r.direction()), _normal));
+        _footprint = r.get_cone_width(_t) / (uv_scale * std::max(cos_theta, .1f));
+    }
+
+    // 为最近命中计算表面属性，r 为求交时所用的光线
+    inline void resolve(const Ray& r);
 };
 
 class HitTable
@@ -38,13 +65,21 @@ public:
     /**
      * @brief 判断光线与物体相交
      * 
-     * @param r 光线 若命中则必须更新内部区间最大值为击中时的t值
-     * @param record 纪录 若命中则必须更新内部所以数据 顶点、UV、材质等
+     * @param r 光线 只接受 t 在其区间内的命中，若命中则必须更新区间最大值为击中时的t值
+     * @param record 纪录 若命中则只需更新 _t 与 _object 等求交数据，表面属性留待 HitRecord::resolve
      * @return true 命中且数据更新
      * @return false 未命中，数组不发生改变
      */
     virtual bool hit(Ray& r, HitRecord& record) = 0;
+    // 由 hit 记录的求交数据计算交点、法线、UV 与材质，只有记录自己为 _object 的图元需要实现
+    virtual void surface(const Ray& r, HitRecord& record) const {}
     virtual AABB get_aabb() const { return _box; }
+    // 子物体或变换参数改变后自底向上重新计算包围盒，静态图元无需处理
+    virtual void refit() {}
+    // 收集世界空间中直接可见的 Quad（变换节点之下的不收集），用于建立光源层次
+    virtual void collect_quads(std::vector<Quad*>& quads) {}
+    // 收集世界空间中的 Quad 与球供光栅化主可见性使用，子树中含有无法光栅化的物体（变换节点等）时返回 false
+    virtual bool collect_raster(std::vector<Quad*>& quads, std::vector<Sphere*>& spheres) { return false; }
 };
 using HitTablePtr = std::shared_ptr<HitTable>;
 using HitTablePtrs = std::vector<HitTablePtr>;
@@ -65,6 +100,35 @@ public:
         _list.insert(_list.end(), objects.begin(), objects.end());
     }
     
+    virtual void refit() override
+    {
+        _box = AABB{};
+        for (const auto& obj : _list)
+        {
+            obj->refit();
+            _box = _box + obj->get_aabb();
+        }
+    }
+
+    // 子对象已各自更新过包围盒时（如 BVHnode::update），只重新合并列表自身的包围盒
+    void update_bounds()
+    {
+        _box = AABB{};
+        for (const auto& obj : _list) _box = _box + obj->get_aabb();
+    }
+
+    virtual void collect_quads(std::vector<Quad*>& quads) override
+    {
+        for (const auto& obj : _list) obj->collect_quads(quads);
+    }
+
+    virtual bool collect_raster(std::vector<Quad*>& quads, std::vector<Sphere*>& spheres) override
+    {
+        bool complete = true;
+        for (const auto& obj : _list) complete &= obj->collect_raster(quads, spheres);
+        return complete;
+    }
+
     virtual bool hit(Ray& r, HitRecord& record) override
     {
         bool hit_anything = false;
@@ -85,11 +149,21 @@ public:
 
 };
 
-class Sphere : public HitTable
+inline void HitRecord::resolve(const Ray& r)
+{
+    if (!_object) return;
+    const HitTable* object = _object;
+    _object = nullptr;
+    object->surface(r, *this);
+}
+
+class Sphere final : public HitTable
 {
     glm::vec3 _center;
     float _radius;
+    float _uv_scale; // 经纬度参数化下 u 跨 2πr、v 跨 πr，取几何平均
 
+public:
     static glm::vec2 get_sphere_uv(const glm::vec3& p) 
     {
         // p: a given point on the sphere of radius one, centered at the origin.
@@ -103,13 +177,20 @@ class Sphere : public HitTable
         return glm::vec2{ phi / (2.f * pi), theta / pi };
     }    
 
-public:
-    Sphere(glm::vec3 center, float radius) : _center{center}, _radius{radius} 
+    Sphere(glm::vec3 center, float radius) : _center{center}, _radius{radius}, _uv_scale{std::sqrt(2.f) * pi * radius}
     {
         glm::vec3 r = glm::vec3(radius);
         _box.set(center - r, center + r);
     }
     MaterialPtr _material;
+
+    inline const glm::vec3& center() const { return _center; }
+    inline float radius() const { return _radius; }
+    virtual bool collect_raster(std::vector<Quad*>& quads, std::vector<Sphere*>& spheres) override
+    {
+        spheres.push_back(this);
+        return true;
+    }
     
     virtual bool hit(Ray& r, HitRecord& record) override
     {
@@ -124,16 +205,23 @@ public:
         if (!r.valid_t(root)) return false;
         r.update_t_max(root);
         record._t = root;
+        record._object = this;
+        return true;
+    }
+
+    virtual void surface(const Ray& r, HitRecord& record) const override
+    {
         record._point = r.at(record._t);
         auto outer_vec = record._point - _center;
         record.set_face_normal(r, outer_vec);
-        record._uv = get_sphere_uv(outer_vec);
+        record._uv = get_sphere_uv(outer_vec / _radius);
+        record.set_footprint(r, _uv_scale);
         record._material = _material;
-        return true;
+        record._light = -1;
     }
 };
 
-class Quad : public HitTable
+class Quad final : public HitTable
 {
     glm::vec3 _Q;
     glm::vec3 _u;
@@ -141,7 +229,9 @@ class Quad : public HitTable
     glm::vec3 _w;
     float _D;
     glm::vec3 _normal;
+    float _uv_scale;
     MaterialPtr _material;
+    int _light{-1};
 public:
     Quad(const glm::vec3& Q, const glm::vec3& u, const glm::vec3& v, MaterialPtr material = nullptr) 
     : _Q{Q}, _u {u}, _v{v}, _material{material}
@@ -150,15 +240,33 @@ public:
         _normal = glm::normalize(n);
         _D = glm::dot(_normal, Q);
         _w = n / glm::dot(n, n);
+        _uv_scale = std::sqrt(glm::length(n));
         _box = AABB{Q, Q + u + v} + AABB{Q + u, Q + v};
     }
 
-    bool is_interior(float a, float b, HitRecord& rec) const 
+    inline const glm::vec3& origin() const { return _Q; }
+    inline const glm::vec3& edge_u() const { return _u; }
+    inline const glm::vec3& edge_v() const { return _v; }
+    inline const MaterialPtr& material() const { return _material; }
+    inline const glm::vec3& normal() const { return _normal; }
+    inline float area() const { return glm::length(glm::cross(_u, _v)); }
+    inline int light_index() const { return _light; }
+    inline void set_light_index(int light) { _light = light; }
+    virtual void collect_quads(std::vector<Quad*>& quads) override { quads.push_back(this); }
+    virtual bool collect_raster(std::vector<Quad*>& quads, std::vector<Sphere*>& spheres) override
     {
-        static const Interval unit_interval{ 0.f, 1.f };
-        if (!unit_interval.contains(a) || !unit_interval.contains(b)) return false;
-        rec._uv = { a, b };
+        quads.push_back(this);
         return true;
+    }
+    inline float plane_offset() const { return _D; }
+    // 平面局部坐标的投影向量：α = (P - Q) · (v × w)，β = (P - Q) · (w × u)
+    inline glm::vec3 alpha_axis() const { return glm::cross(_v, _w); }
+    inline glm::vec3 beta_axis() const { return glm::cross(_w, _u); }
+
+    static bool is_interior(float a, float b)
+    {
+        static const Interval unit_interval{ 0.f, 1.f };
+        return unit_interval.contains(a) && unit_interval.contains(b);
     }    
 
     virtual bool hit(Ray& r, HitRecord& record) override
@@ -177,15 +285,30 @@ public:
         float alpha = glm::dot(_w, glm::cross(P_Q, _v));// α = _w · ((P - _Q) × _v)
         float beta = glm::dot(_w, glm::cross(_u, P_Q));// β = _w · (_u × (P - _Q))
         // 非法坐标 说明这一点值不在区间内
-        if (!is_interior(alpha, beta, record)) return false;
+        if (!is_interior(alpha, beta)) return false;
         // 更新命中点
+        record_hit(r, t, alpha, beta, record);
+        return true;
+    }
+
+    // 已确认命中后记录求交数据，标量与打包求交共用
+    void record_hit(Ray& r, float t, float alpha, float beta, HitRecord& record) const
+    {
         r.update_t_max(t);
         record._t = t;
-        record._point = P;
+        record._object = this;
+        record._coords = { alpha, beta };
+    }
+
+    virtual void surface(const Ray& r, HitRecord& record) const override
+    {
+        record._point = r.at(record._t);
+        record._uv = record._coords;
         record._material = _material;
+        record._light = _light;
         record.set_face_normal(r, _normal);
-        return true;
-    }    
+        record.set_footprint(r, _uv_scale);
+    }
 };
 
 inline HitTablePtr create_box(float x_len, float y_height, float z_depth, MaterialPtr material)
@@ -196,7 +319,7 @@ inline HitTablePtr create_box(float x_len, float y_height, float z_depth, Materi
     float hz = z_depth / 2.0f;
 
     // 左面 (x = -hx), 法向量 (-1, 0, 0)
-    box.add(std::make_shared<Quad>(
+    box.add(make_object<Quad>(
         glm::vec3(-hx, -hy, -hz),
         glm::vec3(0, 0, z_depth),
         glm::vec3(0, y_height, 0),
@@ -204,7 +327,7 @@ inline HitTablePtr create_box(float x_len, float y_height, float z_depth, Materi
     ));
 
     // 右面 (x = +hx), 法向量 (+1, 0, 0)
-    box.add(std::make_shared<Quad>(
+    box.add(make_object<Quad>(
         glm::vec3(hx, -hy, -hz),
         glm::vec3(0, y_height, 0),
         glm::vec3(0, 0, z_depth),
@@ -212,7 +335,7 @@ inline HitTablePtr create_box(float x_len, float y_height, float z_depth, Materi
     ));
 
     // 下面 (y = -hy), 法向量 (0, -1, 0)
-    box.add(std::make_shared<Quad>(
+    box.add(make_object<Quad>(
         glm::vec3(-hx, -hy, -hz),
         glm::vec3(x_len, 0, 0),
         glm::vec3(0, 0, z_depth),
@@ -220,7 +343,7 @@ inline HitTablePtr create_box(float x_len, float y_height, float z_depth, Materi
     ));
 
     // 上面 (y = +hy), 法向量 (0, +1, 0)
-    box.add(std::make_shared<Quad>(
+    box.add(make_object<Quad>(
         glm::vec3(-hx, hy, -hz),
         glm::vec3(0, 0, z_depth),
         glm::vec3(x_len, 0, 0),
@@ -228,7 +351,7 @@ inline HitTablePtr create_box(float x_len, float y_height, float z_depth, Materi
     ));
 
     // 后面 (z = -hz), 法向量 (0, 0, -1)
-    box.add(std::make_shared<Quad>(
+    box.add(make_object<Quad>(
         glm::vec3(-hx, -hy, -hz),
         glm::vec3(x_len, 0, 0),
         glm::vec3(0, y_height, 0),
@@ -236,12 +359,12 @@ inline HitTablePtr create_box(float x_len, float y_height, float z_depth, Materi
     ));
 
     // 前面 (z = +hz), 法向量 (0, 0, +1)
-    box.add(std::make_shared<Quad>(
+    box.add(make_object<Quad>(
         glm::vec3(-hx, -hy, hz),
         glm::vec3(0, y_height, 0),
         glm::vec3(x_len, 0, 0),
         material
     ));
 
-    return std::make_shared<HitTableList>(box);
+    return make_object<HitTableList>(box);
 }
\ No newline at end of file
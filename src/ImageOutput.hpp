@@ -0,0 +1,252 @@
+#pragma once
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include <cctype>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Film.hpp"
+#include "tgaimage.hpp"
+
+enum class ImageFormat { TGA, PNG, PFM };
+
+inline bool parse_image_format(const std::string& name, ImageFormat& format)
+{
+    if (name == "tga") format = ImageFormat::TGA;
+    else if (name == "png") format = ImageFormat::PNG;
+    else if (name == "pfm") format = ImageFormat::PFM;
+    else return false;
+    return true;
+}
+
+inline const char* image_extension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::PNG: return "png";
+    case ImageFormat::PFM: return "pfm";
+    default: return "tga";
+    }
+}
+
+// 根据文件扩展名确定输出格式
+inline bool image_format_from_path(const std::string& file, ImageFormat& format)
+{
+    auto dot = file.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string extension = file.substr(dot + 1);
+    for (auto& c : extension) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return parse_image_format(extension, format);
+}
+
+// 色调映射与 gamma 校正，只作用于 8 位输出格式
+struct ToneMap
+{
+    bool _hdr{true};
+    bool _gamma{true};
+
+    glm::vec3 operator()(glm::vec3 color) const
+    {
+        if (_hdr) color = glm::vec3(color.x/(1.f+color.x), color.y/(1.f+color.y), color.z/(1.f+color.z));
+        if (_gamma) color = glm::pow(color, glm::vec3(1.0f / 2.2f));
+        return color;
+    }
+};
+
+inline std::uint8_t to_byte(float v)
+{
+    return static_cast<std::uint8_t>(glm::clamp(v, 0.f, 1.f) * 255.f + .5f);
+}
+
+/**
+ * @brief 将 film 的均值按扩展名对应的格式写出
+ *
+ * TGA 与 PNG 为色调映射后的 8 位图像，PFM 直接保存线性辐射度（小端 float，自下而上逐行）
+ */
+inline bool write_image(const std::string& file, const Film& film, const ToneMap& tone)
+{
+    ImageFormat format;
+    if (!image_format_from_path(file, format))
+    {
+        std::cerr << "unknown image format: " << file << "\n";
+        return false;
+    }
+    const int width = film.width();
+    const int height = film.height();
+    if (format == ImageFormat::TGA)
+    {
+        TGAImage image(width, height, TGAImage::RGB);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                image.set(x, y, tone(film.mean(x, y)));
+        return image.write_tga_file(file);
+    }
+    if (format == ImageFormat::PNG)
+    {
+        std::vector<std::uint8_t> pixels(static_cast<size_t>(width) * height * 3);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                glm::vec3 color = tone(film.mean(x, y));
+                std::uint8_t* p = &pixels[film.index(x, y) * 3];
+                p[0] = to_byte(color.x);
+                p[1] = to_byte(color.y);
+                p[2] = to_byte(color.z);
+            }
+        }
+        if (!stbi_write_png(file.c_str(), width, height, 3, pixels.data(), width * 3))
+        {
+            std::cerr << "can't write " << file << "\n";
+            return false;
+        }
+        return true;
+    }
+    std::ofstream out(file, std::ios::binary);
+    if (!out)
+    {
+        std::cerr << "can't open file " << file << "\n";
+        return false;
+    }
+    // 比例因子为负表示小端字节序
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+    std::vector<float> row(static_cast<size_t>(width) * 3);
+    for (int y = height - 1; y >= 0; y--)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            glm::vec3 color = film.mean(x, y);
+            row[x * 3 + 0] = color.x;
+            row[x * 3 + 1] = color.y;
+            row[x * 3 + 2] = color.z;
+        }
+        out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+    }
+    if (!out)
+    {
+        std::cerr << "can't write " << file << "\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 读取 write_image 写出的 PFM（小端 RGB float）到 film，每像素记一个样本
+ */
+inline bool read_pfm(const std::string& file, Film& film)
+{
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "can't open file " << file << "\n";
+        return false;
+    }
+    std::string magic;
+    int width = 0, height = 0;
+    float scale = 0.f;
+    in >> magic >> width >> height >> scale;
+    in.get();
+    if (!in || magic != "PF" || width <= 0 || height <= 0 || scale >= 0.f)
+    {
+        std::cerr << "unsupported pfm file " << file << " (expected little-endian RGB)\n";
+        return false;
+    }
+    film = Film{width, height};
+    std::vector<float> row(static_cast<size_t>(width) * 3);
+    for (int y = height - 1; y >= 0; y--)
+    {
+        in.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+        if (!in)
+        {
+            std::cerr << "an error occured while reading " << file << "\n";
+            return false;
+        }
+        for (int x = 0; x < width; x++) film.add(x, y, glm::vec3{ row[x * 3 + 0], row[x * 3 + 1], row[x * 3 + 2] }, 1);
+    }
+    return true;
+}
+
+/**
+ * @brief 后台输出线程：编码与写盘在独立线程中进行，渲染线程提交后即可开始下一帧
+ *
+ * 队列容量有限，写盘跟不上时 submit 会阻塞，避免积压过多帧占用内存。
+ * 析构时写完队列中剩余的帧。
+ */
+class ImageWriter
+{
+    struct Job
+    {
+        std::string _file;
+        Film _film;
+        ToneMap _tone;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<Job> _jobs;
+    size_t _capacity;
+    size_t _failures{0};
+    bool _busy{false};
+    bool _stopping{false};
+    std::thread _thread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        while (true)
+        {
+            _changed.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+            if (_jobs.empty()) return;
+            Job job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _busy = true;
+            _changed.notify_all();
+            lock.unlock();
+            bool ok = write_image(job._file, job._film, job._tone);
+            lock.lock();
+            _busy = false;
+            if (!ok) _failures++;
+            _changed.notify_all();
+        }
+    }
+
+public:
+    explicit ImageWriter(size_t capacity = 2) : _capacity{capacity ? capacity : 1}, _thread{[this] { run(); }} {}
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    ~ImageWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stopping = true;
+        }
+        _changed.notify_all();
+        _thread.join();
+    }
+
+    void submit(const std::string& file, Film film, const ToneMap& tone)
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _changed.wait(lock, [this] { return _jobs.size() < _capacity; });
+        _jobs.push_back({ file, std::move(film), tone });
+        _changed.notify_all();
+    }
+
+    // 等待已提交的帧全部写完，返回至今写出失败的帧数
+    size_t flush()
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _changed.wait(lock, [this] { return _jobs.empty() && !_busy; });
+        return _failures;
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <memory>
+
+#include "Camera.hpp"
+#include "Environment.hpp"
+#include "Film.hpp"
+#include "HitTable.hpp"
+#include "LightBVH.hpp"
+
+/**
+ * @brief 积分器：由相机与场景估计每个像素的辐射度
+ *
+ * 与 Camera::render 的约定相同，render 把区域内编号为 [sample_begin, sample_end) 的样本累加到 film，
+ * 样本的随机数只取决于 (像素, 样本编号, 维度)。相机只负责生成主光线与像素网格
+ */
+class Integrator
+{
+protected:
+    // render 期间相机的光源层次、环境光与路径最大段数，由 LightingScope 设置
+    LightBVHPtr _lights;
+    EnvironmentPtr _environment;
+    int _max_depth{0};
+
+    /**
+     * @brief 在 render 的作用域内从相机取得光照设置，离开时释放
+     *
+     * 光源引用的材质可能分配在场景的 arena 中，积分器不能比场景活得更久地持有它们
+     */
+    class LightingScope
+    {
+        Integrator& _integrator;
+    public:
+        LightingScope(Integrator& integrator, const Camera& camera) : _integrator{integrator}
+        {
+            integrator._lights = camera.get_lights();
+            integrator._environment = camera.get_environment();
+            integrator._max_depth = camera.get_max_depth();
+        }
+        ~LightingScope()
+        {
+            _integrator._lights = nullptr;
+            _integrator._environment = nullptr;
+        }
+        LightingScope(const LightingScope&) = delete;
+        LightingScope& operator=(const LightingScope&) = delete;
+    };
+
+public:
+    virtual ~Integrator() = default;
+    virtual void render(Camera& camera, Film& film, const Region& region, int sample_begin, int sample_end, HitTable& world) = 0;
+
+    // 能否在多个线程中同时对不相交的区域调用 render；保存每次渲染状态或把贡献写到区域外的积分器不能
+    virtual bool concurrent() const { return false; }
+
+    Film render(Camera& camera, HitTable& world)
+    {
+        Film film{camera.get_image_width(), camera.get_image_height()};
+        render(camera, film, film.full_region(), 0, camera.get_samples_per_pixel(), world);
+        return film;
+    }
+};
+using IntegratorPtr = std::shared_ptr<Integrator>;
+
+// 单向路径追踪：光源与环境光采样与 BSDF 采样按幂启发式做 MIS，即 Camera::render
+class PathIntegrator : public Integrator
+{
+public:
+    using Integrator::render;
+    virtual void render(Camera& camera, Film& film, const Region& region, int sample_begin, int sample_end, HitTable& world) override
+    {
+        camera.render(film, region, sample_begin, sample_end, world);
+    }
+    virtual bool concurrent() const override { return true; }
+};
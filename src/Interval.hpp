@@ -5,7 +5,7 @@
 struct Interval
 {
     float _min{ std::numeric_limits<float>::max() };
-    float _max{ std::numeric_limits<float>::min() };
+    float _max{ std::numeric_limits<float>::lowest() }; // 空区间，与任意区间合并都得到后者
     Interval() = default;
     Interval(float min_val, float max_val) : _min{min_val}, _max{max_val} {}
     inline bool contains(float val) const { return _max >= val && _min <= val; }
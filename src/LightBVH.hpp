@@ -0,0 +1,501 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "HitTable.hpp"
+#include "Material.hpp"
+#include "Environment.hpp"
+#include "Utility.hpp"
+
+// 世界空间中的自发光 Quad
+struct AreaLight
+{
+    glm::vec3 _Q;
+    glm::vec3 _u;
+    glm::vec3 _v;
+    glm::vec3 _normal;
+    float _area;
+    MaterialPtr _material;
+};
+
+struct LightSample
+{
+    glm::vec3 _direction; // 从着色点指向光源上采样点的单位向量
+    float _distance{0.f};
+    glm::vec3 _radiance;
+    float _pdf{0.f};      // 立体角 PDF，已乘以光源的选择概率
+};
+
+// 单位向量的八面体编码，两个分量各 16 位
+inline std::uint32_t encode_octahedral(const glm::vec3& v)
+{
+    float l1 = std::fabs(v.x) + std::fabs(v.y) + std::fabs(v.z);
+    float x = v.x / l1;
+    float y = v.y / l1;
+    if (v.z < 0.f)
+    {
+        float fx = (1.f - std::fabs(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - std::fabs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+    auto quantize = [](float f) { return static_cast<std::uint32_t>(std::lround((std::clamp(f, -1.f, 1.f) * .5f + .5f) * 65535.f)); };
+    return quantize(x) | (quantize(y) << 16);
+}
+
+inline glm::vec3 decode_octahedral(std::uint32_t code)
+{
+    float x = (code & 0xffffu) / 65535.f * 2.f - 1.f;
+    float y = (code >> 16) / 65535.f * 2.f - 1.f;
+    float z = 1.f - std::fabs(x) - std::fabs(y);
+    if (z < 0.f)
+    {
+        float fx = (1.f - std::fabs(y)) * (x >= 0.f ? 1.f : -1.f);
+        float fy = (1.f - std::fabs(x)) * (y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+    return glm::normalize(glm::vec3{ x, y, z });
+}
+
+// cos(max(0, a - b)) 与 sin(max(0, a - b))，角度以正余弦给出
+inline float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    return cos_a > cos_b ? 1.f : cos_a * cos_b + sin_a * sin_b;
+}
+inline float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b)
+{
+    return cos_a > cos_b ? 0.f : sin_a * cos_b - cos_a * sin_b;
+}
+inline float safe_sqrt(float x) { return std::sqrt(std::max(x, 0.f)); }
+
+/**
+ * @brief 一簇光源的包围信息：空间包围盒、法线方向锥与总功率
+ *
+ * DiffuseLight 双面发光，因此方向锥是双向的：锥轴取正负号均可，半角 π/2 即覆盖所有方向。
+ * 每个面光源自身向半球发光（θe = π/2）。
+ */
+struct LightBounds
+{
+    glm::vec3 _min{ std::numeric_limits<float>::max() };
+    glm::vec3 _max{ std::numeric_limits<float>::lowest() };
+    glm::vec3 _axis{ 0.f, 0.f, 1.f };
+    float _cos_theta_o{1.f};
+    float _phi{0.f};
+    bool _valid{false};
+
+    static LightBounds merge(const LightBounds& a, const LightBounds& b)
+    {
+        if (!a._valid) return b;
+        if (!b._valid) return a;
+        LightBounds result;
+        result._valid = true;
+        result._min = glm::min(a._min, b._min);
+        result._max = glm::max(a._max, b._max);
+        result._phi = a._phi + b._phi;
+        merge_cone(a._axis, a._cos_theta_o, b._axis, b._cos_theta_o, result._axis, result._cos_theta_o);
+        return result;
+    }
+
+    static void merge_cone(const glm::vec3& axis_a, float cos_a, glm::vec3 axis_b, float cos_b, glm::vec3& axis, float& cos_o)
+    {
+        if (glm::dot(axis_a, axis_b) < 0.f) axis_b = -1.f * axis_b;
+        float theta_a = std::acos(std::clamp(cos_a, -1.f, 1.f));
+        float theta_b = std::acos(std::clamp(cos_b, -1.f, 1.f));
+        float theta_d = std::acos(std::clamp(glm::dot(axis_a, axis_b), -1.f, 1.f));
+        // 一个锥已包含另一个
+        if (theta_d + theta_b <= theta_a) { axis = axis_a; cos_o = cos_a; return; }
+        if (theta_d + theta_a <= theta_b) { axis = axis_b; cos_o = cos_b; return; }
+        float theta_o = (theta_a + theta_d + theta_b) * .5f;
+        glm::vec3 k = glm::cross(axis_a, axis_b);
+        if (theta_o >= pi * .5f || glm::dot(k, k) < 1e-12f)
+        {
+            axis = axis_a;
+            cos_o = 0.f;
+            return;
+        }
+        // 将 axis_a 朝 axis_b 旋转 θo - θa（Rodrigues 公式，k ⊥ axis_a）
+        k = glm::normalize(k);
+        float theta_r = theta_o - theta_a;
+        axis = glm::normalize(axis_a * std::cos(theta_r) + glm::cross(k, axis_a) * std::sin(theta_r));
+        cos_o = std::cos(theta_o);
+    }
+
+    float surface_area() const
+    {
+        glm::vec3 d = _max - _min;
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // 着色点 p（法线 n，可为零向量）处这一簇光源贡献的保守估计
+    float importance(const glm::vec3& p, const glm::vec3& n) const
+    {
+        glm::vec3 center = (_min + _max) * .5f;
+        glm::vec3 half = (_max - _min) * .5f;
+        float r2 = glm::dot(half, half);
+        glm::vec3 offset = p - center;
+        float dist2 = glm::dot(offset, offset);
+        glm::vec3 w = dist2 > 0.f ? offset * (1.f / std::sqrt(dist2)) : _axis;
+        // 包围球对 p 的张角 θb，p 在包围球内时为 π
+        float sin_b = 0.f, cos_b = -1.f;
+        if (dist2 > r2)
+        {
+            float sin2 = r2 / dist2;
+            sin_b = std::sqrt(sin2);
+            cos_b = safe_sqrt(1.f - sin2);
+        }
+        // θ' = max(0, θw - θo - θb)，超过 θe = π/2 时不可能有贡献
+        float cos_w = std::fabs(glm::dot(_axis, w));
+        float sin_w = safe_sqrt(1.f - cos_w * cos_w);
+        float sin_o = safe_sqrt(1.f - _cos_theta_o * _cos_theta_o);
+        float cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, _cos_theta_o);
+        float sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, _cos_theta_o);
+        float cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+        if (cos_p <= 0.f) return 0.f;
+        float result = _phi * cos_p / std::max(dist2, r2);
+        if (n.x != 0.f || n.y != 0.f || n.z != 0.f)
+        {
+            float cos_i = std::fabs(glm::dot(w, n));
+            float sin_i = safe_sqrt(1.f - cos_i * cos_i);
+            result *= cos_sub_clamped(sin_i, cos_i, sin_b, cos_b);
+        }
+        return result;
+    }
+};
+
+/**
+ * @brief 面光源层次结构：按位置、朝向锥与功率聚类，在着色点按重要性随机下降选择光源
+ *
+ * 节点按深度优先顺序存放，左子节点紧随父节点，子树大小由光源数唯一确定（n 个光源占 2n - 1 个节点），
+ * 因而左右子树可以并行构建。每个光源记录从根到叶的左右选择位串，用于 MIS 时反查选择概率。
+ * 采样与查询概率的代价都与树高成正比，即光源数的对数。
+ */
+class LightBVH
+{
+    static constexpr std::uint32_t LEAF_FLAG = 0x80000000u;
+    static constexpr int BUCKET_COUNT = 12;
+    static constexpr size_t PARALLEL_THRESHOLD = 4096;
+    static constexpr int MAX_DEPTH = 64;
+
+    struct Node
+    {
+        float _min[3];
+        float _max[3];
+        std::uint32_t _axis;  // 八面体编码的方向锥轴
+        float _cos_theta_o;
+        float _phi;
+        std::uint32_t _child; // 叶节点为 LEAF_FLAG | 光源下标，内部节点为右子节点下标
+    };
+
+    struct BuildLight
+    {
+        LightBounds _bounds;
+        glm::vec3 _centroid;
+        std::uint32_t _index;
+    };
+
+    std::vector<AreaLight> _lights;
+    std::vector<Node> _nodes;
+    std::vector<std::uint64_t> _trails;
+
+    static LightBounds bounds(const Node& node)
+    {
+        LightBounds b;
+        b._valid = true;
+        b._min = glm::vec3{ node._min[0], node._min[1], node._min[2] };
+        b._max = glm::vec3{ node._max[0], node._max[1], node._max[2] };
+        b._axis = decode_octahedral(node._axis);
+        b._cos_theta_o = node._cos_theta_o;
+        b._phi = node._phi;
+        return b;
+    }
+
+    static Node make_node(const LightBounds& b, std::uint32_t child)
+    {
+        Node node;
+        for (int i = 0; i < 3; i++)
+        {
+            node._min[i] = b._min[i];
+            node._max[i] = b._max[i];
+        }
+        node._axis = encode_octahedral(b._axis);
+        node._cos_theta_o = b._cos_theta_o;
+        node._phi = b._phi;
+        node._child = child;
+        return node;
+    }
+
+    // 表面积-朝向启发式（SAOH）中一簇光源的代价
+    static float cost(const LightBounds& b, float kr)
+    {
+        float theta_o = std::acos(std::clamp(b._cos_theta_o, -1.f, 1.f));
+        float theta_w = std::min(theta_o + pi * .5f, pi);
+        float sin_o = std::sin(theta_o);
+        float m_omega = 2.f * pi * (1.f - b._cos_theta_o) +
+            pi * .5f * (2.f * theta_w * sin_o - std::cos(theta_o - 2.f * theta_w) - 2.f * theta_o * sin_o + b._cos_theta_o);
+        return b._phi * m_omega * b.surface_area() * kr;
+    }
+
+    void build(std::vector<BuildLight>& refs, size_t begin, size_t end, std::uint32_t index, std::uint64_t trail, int depth)
+    {
+        if (end - begin == 1)
+        {
+            _nodes[index] = make_node(refs[begin]._bounds, LEAF_FLAG | refs[begin]._index);
+            _trails[refs[begin]._index] = trail;
+            return;
+        }
+        LightBounds total;
+        glm::vec3 centroid_min{ std::numeric_limits<float>::max() };
+        glm::vec3 centroid_max{ std::numeric_limits<float>::lowest() };
+        for (size_t i = begin; i != end; i++)
+        {
+            total = LightBounds::merge(total, refs[i]._bounds);
+            centroid_min = glm::min(centroid_min, refs[i]._centroid);
+            centroid_max = glm::max(centroid_max, refs[i]._centroid);
+        }
+
+        // 在三个轴上分桶评估 SAOH，取代价最小的划分
+        glm::vec3 extent = total._max - total._min;
+        float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1, best_bucket = -1;
+        for (int axis = 0; axis < 3 && depth < MAX_DEPTH - 1; axis++)
+        {
+            float lo = centroid_min[axis], hi = centroid_max[axis];
+            if (hi <= lo) continue;
+            LightBounds buckets[BUCKET_COUNT];
+            for (size_t i = begin; i != end; i++)
+            {
+                int b = std::min(static_cast<int>((refs[i]._centroid[axis] - lo) / (hi - lo) * BUCKET_COUNT), BUCKET_COUNT - 1);
+                buckets[b] = LightBounds::merge(buckets[b], refs[i]._bounds);
+            }
+            float kr = extent[axis] > 0.f ? max_extent / extent[axis] : 1.f;
+            for (int split = 0; split < BUCKET_COUNT - 1; split++)
+            {
+                LightBounds left, right;
+                for (int b = 0; b <= split; b++) left = LightBounds::merge(left, buckets[b]);
+                for (int b = split + 1; b < BUCKET_COUNT; b++) right = LightBounds::merge(right, buckets[b]);
+                if (!left._valid || !right._valid) continue;
+                float c = cost(left, kr) + cost(right, kr);
+                if (c < best_cost)
+                {
+                    best_cost = c;
+                    best_axis = axis;
+                    best_bucket = split;
+                }
+            }
+        }
+
+        size_t mid;
+        if (best_axis >= 0)
+        {
+            float lo = centroid_min[best_axis], hi = centroid_max[best_axis];
+            auto it = std::partition(refs.begin() + begin, refs.begin() + end, [&](const BuildLight& l)
+            {
+                int b = std::min(static_cast<int>((l._centroid[best_axis] - lo) / (hi - lo) * BUCKET_COUNT), BUCKET_COUNT - 1);
+                return b <= best_bucket;
+            });
+            mid = static_cast<size_t>(it - refs.begin());
+        }
+        else
+        {
+            // 质心重合或树过深时按数量对半划分
+            glm::vec3 c = centroid_max - centroid_min;
+            int axis = c.x > c.y ? (c.x > c.z ? 0 : 2) : (c.y > c.z ? 1 : 2);
+            mid = begin + (end - begin) / 2;
+            std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                [axis](const BuildLight& a, const BuildLight& b) { return a._centroid[axis] < b._centroid[axis]; });
+        }
+
+        auto left = index + 1;
+        auto right = static_cast<std::uint32_t>(index + 2 * (mid - begin));
+        _nodes[index] = make_node(total, right);
+#pragma omp task default(shared) if (end - begin > PARALLEL_THRESHOLD)
+        build(refs, begin, mid, left, trail, depth + 1);
+        build(refs, mid, end, right, trail | (std::uint64_t{1} << depth), depth + 1);
+#pragma omp taskwait
+    }
+
+public:
+    explicit LightBVH(HitTable& world)
+    {
+        std::vector<Quad*> quads;
+        world.collect_quads(quads);
+        std::vector<BuildLight> refs;
+        for (Quad* quad : quads)
+        {
+            quad->set_light_index(-1);
+            if (!quad->material() || !quad->material()->is_emissive()) continue;
+            AreaLight light{ quad->origin(), quad->edge_u(), quad->edge_v(), quad->normal(), quad->area(), quad->material() };
+            glm::vec3 center = light._Q + .5f * (light._u + light._v);
+            float phi = luminance(light._material->emitted({ .5f, .5f }, center, 0.f)) * light._area;
+            if (!(phi > 0.f)) continue;
+            auto index = static_cast<std::uint32_t>(_lights.size());
+            quad->set_light_index(static_cast<int>(index));
+            _lights.push_back(light);
+
+            BuildLight ref;
+            AABB box = quad->get_aabb();
+            ref._bounds._valid = true;
+            ref._bounds._min = glm::vec3{ box.get_slab_x()._min, box.get_slab_y()._min, box.get_slab_z()._min };
+            ref._bounds._max = glm::vec3{ box.get_slab_x()._max, box.get_slab_y()._max, box.get_slab_z()._max };
+            ref._bounds._axis = light._normal;
+            ref._bounds._cos_theta_o = 1.f;
+            ref._bounds._phi = phi;
+            ref._centroid = center;
+            ref._index = index;
+            refs.push_back(ref);
+        }
+        if (refs.empty()) return;
+        _nodes.resize(2 * refs.size() - 1);
+        _trails.resize(refs.size());
+#pragma omp parallel
+#pragma omp single
+        build(refs, 0, refs.size(), 0, 0, 0);
+    }
+
+    inline bool empty() const { return _lights.empty(); }
+    inline size_t size() const { return _lights.size(); }
+    inline const AreaLight& light(std::uint32_t index) const { return _lights[index]; }
+    inline size_t memory_footprint() const { return _nodes.size() * sizeof(Node) + _trails.size() * sizeof(std::uint64_t); }
+
+    // 自根向下按两子节点的重要性随机选择，u 在每层重新映射到 [0, 1)
+    bool select(const glm::vec3& p, const glm::vec3& n, float u, std::uint32_t& light, float& pmf) const
+    {
+        if (_nodes.empty()) return false;
+        std::uint32_t index = 0;
+        pmf = 1.f;
+        while (!(_nodes[index]._child & LEAF_FLAG))
+        {
+            const Node& node = _nodes[index];
+            float left = bounds(_nodes[index + 1]).importance(p, n);
+            float right = bounds(_nodes[node._child]).importance(p, n);
+            if (left + right <= 0.f) return false;
+            float p_left = left / (left + right);
+            if (u < p_left)
+            {
+                u = std::min(u / p_left, 0x1.fffffep-1f);
+                pmf *= p_left;
+                index = index + 1;
+            }
+            else
+            {
+                u = std::min((u - p_left) / (1.f - p_left), 0x1.fffffep-1f);
+                pmf *= right / (left + right);
+                index = node._child;
+            }
+        }
+        // 根节点即叶节点时只有一个光源，直接选中
+        if (index == 0 && bounds(_nodes[0]).importance(p, n) <= 0.f) return false;
+        light = _nodes[index]._child & ~LEAF_FLAG;
+        return true;
+    }
+
+    // 在 (p, n) 处 select 选中指定光源的概率
+    float pmf(const glm::vec3& p, const glm::vec3& n, std::uint32_t light) const
+    {
+        if (light >= _trails.size()) return 0.f;
+        std::uint64_t trail = _trails[light];
+        std::uint32_t index = 0;
+        float result = 1.f;
+        for (int depth = 0; !(_nodes[index]._child & LEAF_FLAG); depth++)
+        {
+            const Node& node = _nodes[index];
+            float left = bounds(_nodes[index + 1]).importance(p, n);
+            float right = bounds(_nodes[node._child]).importance(p, n);
+            if (left + right <= 0.f) return 0.f;
+            bool go_right = (trail >> depth) & 1;
+            result *= (go_right ? right : left) / (left + right);
+            index = go_right ? node._child : index + 1;
+        }
+        if (index == 0 && bounds(_nodes[0]).importance(p, n) <= 0.f) return 0.f;
+        return result;
+    }
+
+    // 选择光源并在其上均匀采样一点
+    LightSample sample(const glm::vec3& p, const glm::vec3& n) const
+    {
+        LightSample result;
+        std::uint32_t index;
+        float pmf;
+        float u = RANDOM.get_float(0.f, 1.f);
+        float a = RANDOM.get_float(0.f, 1.f);
+        float b = RANDOM.get_float(0.f, 1.f);
+        if (!select(p, n, u, index, pmf)) return result;
+        const AreaLight& light = _lights[index];
+        glm::vec3 point = light._Q + a * light._u + b * light._v;
+        glm::vec3 offset = point - p;
+        float dist2 = glm::dot(offset, offset);
+        if (dist2 <= 0.f) return result;
+        result._distance = std::sqrt(dist2);
+        result._direction = offset * (1.f / result._distance);
+        float cos_light = std::fabs(glm::dot(light._normal, result._direction));
+        if (cos_light <= 1e-6f) return result;
+        result._radiance = light._material->emitted({ a, b }, point, 0.f);
+        result._pdf = pmf * dist2 / (cos_light * light._area);
+        return result;
+    }
+
+    // 从 p 出发命中光源上 point 一点的立体角 PDF，与 sample 对应
+    float pdf(const glm::vec3& p, const glm::vec3& n, std::uint32_t index, const glm::vec3& point) const
+    {
+        if (index >= _lights.size()) return 0.f;
+        const AreaLight& light = _lights[index];
+        glm::vec3 offset = point - p;
+        float dist2 = glm::dot(offset, offset);
+        if (dist2 <= 0.f) return 0.f;
+        float cos_light = std::fabs(glm::dot(light._normal, offset)) / std::sqrt(dist2);
+        if (cos_light <= 1e-6f) return 0.f;
+        return pmf(p, n, index) * dist2 / (cos_light * light._area);
+    }
+};
+using LightBVHPtr = std::shared_ptr<LightBVH>;
+
+/**
+ * @brief 按功率在 LightBVH 的面光源之间选择，用于从光源出发的光子子路径与光子
+ *
+ * 功率取光源中心的辐射亮度乘以面积，总功率为 0 时为空
+ */
+class LightPowerDistribution
+{
+    std::vector<float> _cdf; // 末项为 1
+
+public:
+    void build(const LightBVH* lights)
+    {
+        _cdf.clear();
+        if (!lights) return;
+        float total = 0.f;
+        for (std::uint32_t i = 0; i < lights->size(); i++)
+        {
+            const AreaLight& light = lights->light(i);
+            glm::vec3 center = light._Q + .5f * (light._u + light._v);
+            total += luminance(light._material->emitted({ .5f, .5f }, center, 0.f)) * light._area;
+            _cdf.push_back(total);
+        }
+        if (!(total > 0.f))
+        {
+            _cdf.clear();
+            return;
+        }
+        for (float& c : _cdf) c /= total;
+        _cdf.back() = 1.f;
+    }
+
+    inline bool empty() const { return _cdf.empty(); }
+
+    std::uint32_t sample(float u, float& pmf) const
+    {
+        auto index = static_cast<std::uint32_t>(std::upper_bound(_cdf.begin(), _cdf.end(), u) - _cdf.begin());
+        index = std::min(index, static_cast<std::uint32_t>(_cdf.size() - 1));
+        pmf = this->pmf(static_cast<int>(index));
+        return index;
+    }
+
+    inline float pmf(int index) const { return _cdf[index] - (index > 0 ? _cdf[index - 1] : 0.f); }
+};
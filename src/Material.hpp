@@ -3,6 +3,8 @@
 #include <glm/common.hpp>
 #include <glm/fwd.hpp>
 #include <glm/geometric.hpp>
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include "Ray.hpp"
 #include "Utility.hpp"
@@ -13,26 +15,54 @@ struct ScatterResult
 {
     explicit operator bool() { return _has_scatter; }
     bool _has_scatter = false;
-    glm::vec3 _attenuation;
+    glm::vec3 _attenuation;  // f * |cos| / pdf
     Ray _scattered_ray;
+    float _pdf{0.f};         // 采样方向的立体角 PDF，镜面等 delta 分布记为 0
 };
 
 class Material
 {
 public:
     virtual ScatterResult scatter(const Ray& ray_in, const HitRecord& record) const { return { false }; };
-    virtual glm::vec3 emitted(const glm::vec2 uv, const glm::vec3& p) const { return glm::vec3{ 0.f, 0.f, 0.f}; };
+    virtual glm::vec3 emitted(const glm::vec2 uv, const glm::vec3& p, float footprint) const { return glm::vec3{ 0.f, 0.f, 0.f}; };
+    // 给定出射方向 direction 的 BSDF 值乘以 |cos|，供光源采样与 MIS 使用
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const { return glm::vec3{ 0.f, 0.f, 0.f }; }
+    // scatter 采样到 direction 的立体角 PDF
+    virtual float pdf(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const { return 0.f; }
+    // 是否自发光，自发光的 Quad 会被加入光源层次参与光源采样
+    virtual bool is_emissive() const { return false; }
+    // 是否只能经 scatter 采样方向（镜面反射、折射等不提供 eval 的材质），这样的顶点无法与其他顶点连接
+    virtual bool is_specular() const { return false; }
 };
 using MaterialPtr = std::shared_ptr<Material>;
 
 class Lambertian : public Material
 {
-    glm::vec3 _albedo;
+    TexturePtr _texture;
 public:    
-    Lambertian(const glm::vec3& albedo) : _albedo(albedo) {}
+    Lambertian(const glm::vec3& albedo) : _texture{make_object<SolidColor>(albedo)} {}
+    Lambertian(TexturePtr texture) : _texture{texture} {}
     virtual ScatterResult scatter(const Ray& ray_in, const HitRecord& record) const override
     {
-        return { true, _albedo, {record._point, RANDOM.cosine_weighted_random_hemisphere(record._normal)} };
+        glm::vec3 albedo = _texture->value(record._uv, record._point, record._footprint);
+        glm::vec3 dir = RANDOM.cosine_weighted_random_hemisphere(record._normal);
+        return { true, albedo, {record._point, dir}, std::max(glm::dot(dir, record._normal), 0.f) / pi };
+    }
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const override
+    {
+        float cos_theta = glm::dot(glm::normalize(direction), facing(ray_in, record));
+        if (cos_theta <= 0.f) return glm::vec3{ 0.f, 0.f, 0.f };
+        return _texture->value(record._uv, record._point, record._footprint) * (cos_theta / pi);
+    }
+    virtual float pdf(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const override
+    {
+        return std::max(glm::dot(glm::normalize(direction), facing(ray_in, record)), 0.f) / pi;
+    }
+private:
+    // 朝向入射光线一侧的法线；双向路径追踪的连接边可能从 record 法线的背面到达
+    static glm::vec3 facing(const Ray& ray_in, const HitRecord& record)
+    {
+        return glm::dot(ray_in.direction(), record._normal) <= 0.f ? record._normal : -record._normal;
     }
 };
 
@@ -48,6 +78,7 @@ public:
         reflected = glm::normalize(reflected + _fuzz * RANDOM.get_unit_vec3());
         return ScatterResult{ true, _albedo, { record._point, reflected }};
     }
+    virtual bool is_specular() const override { return true; }
 
 };
 
@@ -69,23 +100,254 @@ public:
         float f0 = pow((1.f - eta_ratio) / (1.f + eta_ratio), 2);
         // 计算真实反射率
         float reflect_prob = schlick_approximation_fresnel(f0, cos_theta);
-        // 判断是发生反射还是折射并计算结果
-        glm::vec3 dir = !has_refract && reflect_prob > RANDOM.get_float(0, 1) ? 
+        // 全反射或按菲涅耳概率选中反射时反射，否则折射
+        glm::vec3 dir = !has_refract || reflect_prob > RANDOM.get_float(0, 1) ? 
         glm::reflect(I, record._normal) : glm::refract(I, record._normal, eta_ratio);
         return ScatterResult{ true, {1.f, 1.f, 1.f}, { record._point, dir } };
     }
+    virtual bool is_specular() const override { return true; }
     
 };
 
+// ---------------- GGX / Trowbridge-Reitz 微表面模型 ----------------
+// 以下函数都在局部坐标系中计算，z 轴为几何外法线
+
+inline float ggx_d(const glm::vec3& m, float alpha)
+{
+    float cos2 = m.z * m.z;
+    if (cos2 <= 0.f) return 0.f;
+    float tan2 = (1.f - cos2) / cos2;
+    float a2 = alpha * alpha;
+    float e = 1.f + tan2 / a2;
+    return 1.f / (pi * a2 * cos2 * cos2 * e * e);
+}
+
+inline float ggx_lambda(const glm::vec3& w, float alpha)
+{
+    float cos2 = w.z * w.z;
+    if (cos2 <= 0.f) return 0.f;
+    float tan2 = std::max(0.f, 1.f - cos2) / cos2;
+    return (std::sqrt(1.f + alpha * alpha * tan2) - 1.f) * .5f;
+}
+
+inline float ggx_g1(const glm::vec3& w, float alpha) { return 1.f / (1.f + ggx_lambda(w, alpha)); }
+
+// 高度相关的 Smith 遮蔽-阴影项
+inline float ggx_g2(const glm::vec3& wo, const glm::vec3& wi, float alpha) { return 1.f / (1.f + ggx_lambda(wo, alpha) + ggx_lambda(wi, alpha)); }
+
+// 可见法线分布 D_wo(m) = G1(wo) * max(0, wo·m) * D(m) / |wo.z|
+inline float ggx_visible_d(const glm::vec3& wo, const glm::vec3& m, float alpha)
+{
+    return ggx_g1(wo, alpha) / std::abs(wo.z) * ggx_d(m, alpha) * std::abs(glm::dot(wo, m));
+}
+
+// 可见法线采样（Heitz 2018），wo 位于下半球时按对称的上半球处理
+inline glm::vec3 ggx_sample_visible_normal(const glm::vec3& wo, float alpha, float u1, float u2)
+{
+    glm::vec3 wh = glm::normalize(glm::vec3{ alpha * wo.x, alpha * wo.y, wo.z });
+    if (wh.z < 0.f) wh = -wh;
+    glm::vec3 t1 = wh.z < .99999f ? glm::normalize(glm::cross(glm::vec3{ 0.f, 0.f, 1.f }, wh)) : glm::vec3{ 1.f, 0.f, 0.f };
+    glm::vec3 t2 = glm::cross(wh, t1);
+    float r = std::sqrt(u1);
+    float phi = 2.f * pi * u2;
+    float px = r * std::cos(phi);
+    float py = r * std::sin(phi);
+    float h = std::sqrt(1.f - px * px);
+    float s = (1.f + wh.z) * .5f;
+    py = (1.f - s) * h + s * py;
+    float pz = std::sqrt(std::max(0.f, 1.f - px * px - py * py));
+    glm::vec3 nh = px * t1 + py * t2 + pz * wh;
+    return glm::normalize(glm::vec3{ alpha * nh.x, alpha * nh.y, std::max(1e-6f, nh.z) });
+}
+
+// 电介质的精确菲涅耳反射率，eta 为内/外折射率之比，cos_theta 相对外法线
+inline float fresnel_dielectric(float cos_theta, float eta)
+{
+    cos_theta = std::clamp(cos_theta, -1.f, 1.f);
+    if (cos_theta < 0.f)
+    {
+        eta = 1.f / eta;
+        cos_theta = -cos_theta;
+    }
+    float sin2_t = (1.f - cos_theta * cos_theta) / (eta * eta);
+    if (sin2_t >= 1.f) return 1.f;
+    float cos_t = std::sqrt(1.f - sin2_t);
+    float r_parl = (eta * cos_theta - cos_t) / (eta * cos_theta + cos_t);
+    float r_perp = (cos_theta - eta * cos_t) / (cos_theta + eta * cos_t);
+    return (r_parl * r_parl + r_perp * r_perp) * .5f;
+}
+
+// 沿法线 m 折射，m 与 w 同侧时使用 eta，否则使用 1/eta；全反射返回 false
+inline bool refract_local(const glm::vec3& w, glm::vec3 m, float eta, glm::vec3& wt, float& etap)
+{
+    float cos_i = glm::dot(m, w);
+    if (cos_i < 0.f)
+    {
+        eta = 1.f / eta;
+        cos_i = -cos_i;
+        m = -m;
+    }
+    float sin2_t = std::max(0.f, 1.f - cos_i * cos_i) / (eta * eta);
+    if (sin2_t >= 1.f) return false;
+    float cos_t = std::sqrt(1.f - sin2_t);
+    wt = -w / eta + (cos_i / eta - cos_t) * m;
+    etap = eta;
+    return true;
+}
+
+// 以几何外法线建立局部坐标系，wo 为指向观察者的单位向量
+struct ShadingFrame
+{
+    Onb _onb;
+    glm::vec3 _wo;
+    ShadingFrame(const Ray& ray_in, const HitRecord& record) 
+    : _onb{ record._is_front ? record._normal : -record._normal }, 
+      _wo{ _onb.to_local(-glm::normalize(ray_in.direction())) } {}
+};
+
+class GGXConductor : public Material
+{
+    glm::vec3 _f0;   // 法向入射反射率
+    float _alpha;
+
+    glm::vec3 fresnel(float cos_theta) const
+    {
+        float k = std::pow(1.f - std::clamp(cos_theta, 0.f, 1.f), 5.f);
+        return _f0 + (glm::vec3(1.f) - _f0) * k;
+    }
+
+public:
+    GGXConductor(const glm::vec3& f0, float roughness) : _f0{f0}, _alpha{std::max(roughness * roughness, 1e-3f)} {}
+
+    virtual ScatterResult scatter(const Ray& ray_in, const HitRecord& record) const override
+    {
+        ShadingFrame frame{ray_in, record};
+        glm::vec3 wo = frame._wo;
+        if (wo.z <= 0.f) return { false };
+        glm::vec3 m = ggx_sample_visible_normal(wo, _alpha, RANDOM.get_float(0.f, 1.f), RANDOM.get_float(0.f, 1.f));
+        glm::vec3 wi = glm::reflect(-wo, m);
+        if (wi.z <= 0.f) return { false };
+        float wo_m = glm::dot(wo, m);
+        // f·cos/pdf 化简为 F · G2 / G1
+        glm::vec3 weight = fresnel(wo_m) * (ggx_g2(wo, wi, _alpha) / ggx_g1(wo, _alpha));
+        float pdf = ggx_visible_d(wo, m, _alpha) / (4.f * wo_m);
+        return { true, weight, { record._point, frame._onb.to_world(wi) }, pdf };
+    }
+
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const override
+    {
+        ShadingFrame frame{ray_in, record};
+        glm::vec3 wo = frame._wo;
+        glm::vec3 wi = frame._onb.to_local(glm::normalize(direction));
+        if (wo.z <= 0.f || wi.z <= 0.f) return glm::vec3{ 0.f, 0.f, 0.f };
+        glm::vec3 m = glm::normalize(wo + wi);
+        return fresnel(glm::dot(wo, m)) * (ggx_d(m, _alpha) * ggx_g2(wo, wi, _alpha) / (4.f * wo.z));
+    }
+
+    virtual float pdf(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const override
+    {
+        ShadingFrame frame{ray_in, record};
+        glm::vec3 wo = frame._wo;
+        glm::vec3 wi = frame._onb.to_local(glm::normalize(direction));
+        if (wo.z <= 0.f || wi.z <= 0.f) return 0.f;
+        glm::vec3 m = glm::normalize(wo + wi);
+        return ggx_visible_d(wo, m, _alpha) / (4.f * glm::dot(wo, m));
+    }
+};
+
+/**
+ * @brief 粗糙电介质：按菲涅耳概率在反射与折射之间选择，两者都采样可见法线
+ * 
+ * 与 Dielectric 一致，折射不做 1/eta² 的辐射度缩放
+ */
+class GGXDielectric : public Material
+{
+    float _eta;   // 介质与空气折射率比值
+    float _alpha;
+
+    // 给定宏观方向对计算半程向量、BSDF·|cos| 与 PDF
+    bool evaluate(const glm::vec3& wo, const glm::vec3& wi, float& value, float& pdf) const
+    {
+        if (wo.z == 0.f || wi.z == 0.f) return false;
+        bool reflect = wo.z * wi.z > 0.f;
+        float etap = reflect ? 1.f : (wo.z > 0.f ? _eta : 1.f / _eta);
+        glm::vec3 m = wi * etap + wo;
+        if (glm::dot(m, m) == 0.f) return false;
+        m = glm::normalize(m);
+        if (m.z < 0.f) m = -m;
+        // 丢弃背向微表面
+        if (glm::dot(m, wi) * wi.z < 0.f || glm::dot(m, wo) * wo.z < 0.f) return false;
+        float F = fresnel_dielectric(glm::dot(wo, m), _eta);
+        if (reflect)
+        {
+            value = ggx_d(m, _alpha) * ggx_g2(wo, wi, _alpha) * F / (4.f * std::abs(wo.z));
+            pdf = ggx_visible_d(wo, m, _alpha) / (4.f * std::abs(glm::dot(wo, m))) * F;
+        }
+        else
+        {
+            float denom = glm::dot(wi, m) + glm::dot(wo, m) / etap;
+            denom *= denom;
+            float dm_dwi = std::abs(glm::dot(wi, m)) / denom;
+            value = ggx_d(m, _alpha) * ggx_g2(wo, wi, _alpha) * (1.f - F) * 
+                std::abs(glm::dot(wi, m) * glm::dot(wo, m) / (wo.z * denom));
+            pdf = ggx_visible_d(wo, m, _alpha) * dm_dwi * (1.f - F);
+        }
+        return true;
+    }
+
+public:
+    GGXDielectric(float refraction_index, float roughness) : _eta{refraction_index}, _alpha{std::max(roughness * roughness, 1e-3f)} {}
+
+    virtual ScatterResult scatter(const Ray& ray_in, const HitRecord& record) const override
+    {
+        ShadingFrame frame{ray_in, record};
+        glm::vec3 wo = frame._wo;
+        if (wo.z == 0.f) return { false };
+        glm::vec3 m = ggx_sample_visible_normal(wo, _alpha, RANDOM.get_float(0.f, 1.f), RANDOM.get_float(0.f, 1.f));
+        float F = fresnel_dielectric(glm::dot(wo, m), _eta);
+        glm::vec3 wi;
+        if (RANDOM.get_float(0.f, 1.f) < F)
+        {
+            wi = glm::reflect(-wo, m);
+            if (wo.z * wi.z <= 0.f) return { false };
+        }
+        else
+        {
+            float etap;
+            if (!refract_local(wo, m, _eta, wi, etap) || wo.z * wi.z >= 0.f) return { false };
+        }
+        float value = 0.f, pdf = 0.f;
+        if (!evaluate(wo, wi, value, pdf) || pdf <= 0.f) return { false };
+        return { true, glm::vec3(value / pdf), { record._point, frame._onb.to_world(wi) }, pdf };
+    }
+
+    virtual glm::vec3 eval(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const override
+    {
+        ShadingFrame frame{ray_in, record};
+        float value = 0.f, pdf = 0.f;
+        if (!evaluate(frame._wo, frame._onb.to_local(glm::normalize(direction)), value, pdf)) return glm::vec3{ 0.f, 0.f, 0.f };
+        return glm::vec3(value);
+    }
+
+    virtual float pdf(const Ray& ray_in, const HitRecord& record, const glm::vec3& direction) const override
+    {
+        ShadingFrame frame{ray_in, record};
+        float value = 0.f, pdf = 0.f;
+        if (!evaluate(frame._wo, frame._onb.to_local(glm::normalize(direction)), value, pdf)) return 0.f;
+        return pdf;
+    }
+};
+
 class DiffuseLight : public Material
 {
 private:
     TexturePtr _texture;
 public:
     DiffuseLight(TexturePtr texture) : _texture{texture} {}
-    DiffuseLight(const glm::vec3& color) : _texture{std::make_shared<SolidColor>(color)} {}
-    virtual glm::vec3 emitted(const glm::vec2 uv, const glm::vec3& p) const override 
+    DiffuseLight(const glm::vec3& color) : _texture{make_object<SolidColor>(color)} {}
+    virtual bool is_emissive() const override { return true; }
+    virtual glm::vec3 emitted(const glm::vec2 uv, const glm::vec3& p, float footprint) const override 
     {
-        return _texture->value(uv, p);
+        return _texture->value(uv, p, footprint);
     }
 };
\ No newline at end of file
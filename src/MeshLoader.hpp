@@ -0,0 +1,991 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Material.hpp"
+
+/**
+ * @brief 只读映射整个文件，生命周期内映射保持有效
+ */
+class MappedFile
+{
+    int _fd{-1};
+    void* _data{nullptr};
+    size_t _size{0};
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+        if (_data) ::munmap(_data, _size);
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    static std::shared_ptr<MappedFile> open(const std::string& filename)
+    {
+        auto file = std::make_shared<MappedFile>();
+        file->_fd = ::open(filename.c_str(), O_RDONLY);
+        struct stat info;
+        if (file->_fd < 0 || ::fstat(file->_fd, &info) != 0)
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return nullptr;
+        }
+        file->_size = static_cast<size_t>(info.st_size);
+        if (file->_size == 0) return file;
+        void* data = ::mmap(nullptr, file->_size, PROT_READ, MAP_PRIVATE, file->_fd, 0);
+        if (data == MAP_FAILED)
+        {
+            std::cerr << "can't map file " << filename << "\n";
+            return nullptr;
+        }
+        file->_data = data;
+        return file;
+    }
+
+    inline const char* data() const { return static_cast<const char*>(_data); }
+    inline size_t size() const { return _size; }
+};
+using MappedFilePtr = std::shared_ptr<MappedFile>;
+
+// threads 为 0 时使用全部硬件线程
+inline int loader_threads(int threads)
+{
+    return threads > 0 ? threads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+/**
+ * @brief 加载得到的索引三角网格
+ *
+ * 顶点位置与三角形索引都以带步长的视图访问：二进制 PLY 的布局合适时视图直接指向映射的文件（零拷贝），
+ * 否则指向自有的 _positions 与 _indices。视图可能指向自身的数组，因此不可复制。
+ */
+struct MeshData
+{
+    MappedFilePtr _file;
+    const char* _vertex_data{nullptr}; // 第 i 个顶点的 xyz 为 _vertex_data + i * _vertex_stride 处的 3 个 float
+    size_t _vertex_stride{0};
+    size_t _vertex_count{0};
+    const char* _index_data{nullptr};  // 第 t 个三角形的 3 个 uint32 顶点下标位于 _index_data + t * _index_stride
+    size_t _index_stride{0};
+    size_t _triangle_count{0};
+    std::vector<glm::vec3> _positions;
+    std::vector<std::uint32_t> _indices;
+    std::vector<std::uint16_t> _face_material; // 每个三角形在 _materials 中的下标，为空表示全部使用 _materials[0]
+    std::vector<MaterialPtr> _materials;       // 0 号为未指定材质的面使用的默认材质
+
+    MeshData() = default;
+    MeshData(const MeshData&) = delete;
+    MeshData& operator=(const MeshData&) = delete;
+    MeshData(MeshData&&) = default;
+    MeshData& operator=(MeshData&&) = default;
+
+    // 文件中的数据可能未按 4 字节对齐，统一经 memcpy 读取
+    inline glm::vec3 position(size_t i) const
+    {
+        float p[3];
+        std::memcpy(p, _vertex_data + i * _vertex_stride, sizeof(p));
+        return { p[0], p[1], p[2] };
+    }
+
+    inline void triangle(size_t t, std::uint32_t v[3]) const
+    {
+        std::memcpy(v, _index_data + t * _index_stride, 3 * sizeof(std::uint32_t));
+    }
+
+    inline std::uint16_t material(size_t t) const { return _face_material.empty() ? 0 : _face_material[t]; }
+
+    inline bool vertices_mapped() const { return _file && _vertex_data != reinterpret_cast<const char*>(_positions.data()); }
+    inline bool indices_mapped() const { return _file && _index_data != reinterpret_cast<const char*>(_indices.data()); }
+
+    // 视图改为指向自有数组
+    void use_owned_positions()
+    {
+        _vertex_data = reinterpret_cast<const char*>(_positions.data());
+        _vertex_stride = sizeof(glm::vec3);
+        _vertex_count = _positions.size();
+    }
+
+    void use_owned_indices()
+    {
+        _index_data = reinterpret_cast<const char*>(_indices.data());
+        _index_stride = 3 * sizeof(std::uint32_t);
+        _triangle_count = _indices.size() / 3;
+    }
+
+    // 所有顶点下标都在范围内时返回 true
+    bool validate(int threads) const
+    {
+        bool valid = true;
+        const long long count = static_cast<long long>(_triangle_count);
+#pragma omp parallel for num_threads(threads) schedule(static) reduction(&&:valid)
+        for (long long t = 0; t < count; t++)
+        {
+            std::uint32_t v[3];
+            triangle(static_cast<size_t>(t), v);
+            valid = valid && v[0] < _vertex_count && v[1] < _vertex_count && v[2] < _vertex_count;
+        }
+        return valid;
+    }
+
+    void bounds(glm::vec3& lo, glm::vec3& hi, int threads = 0) const
+    {
+        float lx = std::numeric_limits<float>::max(), ly = lx, lz = lx;
+        float hx = -lx, hy = -lx, hz = -lx;
+        const long long count = static_cast<long long>(_vertex_count);
+#pragma omp parallel for num_threads(loader_threads(threads)) reduction(min:lx, ly, lz) reduction(max:hx, hy, hz)
+        for (long long i = 0; i < count; i++)
+        {
+            glm::vec3 p = position(static_cast<size_t>(i));
+            lx = std::min(lx, p.x);
+            ly = std::min(ly, p.y);
+            lz = std::min(lz, p.z);
+            hx = std::max(hx, p.x);
+            hy = std::max(hy, p.y);
+            hz = std::max(hz, p.z);
+        }
+        lo = { lx, ly, lz };
+        hi = { hx, hy, hz };
+    }
+};
+
+// 文本解析：不分配内存、不依赖 locale，调用者保证 p 指向数字的第一个字符
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+inline bool is_space(char c) { return is_blank(c) || c == '\n'; }
+
+inline bool parse_int(const char*& p, const char* end, std::int64_t& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p >= end || !is_digit(*p)) return false;
+    std::int64_t v = 0;
+    while (p < end && is_digit(*p)) v = v * 10 + (*p++ - '0');
+    value = negative ? -v : v;
+    return true;
+}
+
+/**
+ * @brief 解析十进制浮点数
+ *
+ * 最多累积 19 位有效数字到整数尾数，10 的幂不超过 22 时直接乘除双精度的精确值，更大的指数才调用 std::pow；
+ * 转换为 float 后与 strtof 的结果至多相差 1 ulp。
+ */
+inline bool parse_float(const char*& p, const char* end, float& value)
+{
+    static constexpr double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    std::uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; p < end && is_digit(*p); p++, any = true)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        }
+        else exponent++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && is_digit(*p); p++, any = true)
+        {
+            if (digits >= 19) continue;
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+            exponent--;
+        }
+    }
+    if (!any) return false;
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        std::int64_t e;
+        if (!parse_int(++p, end, e)) return false;
+        exponent += static_cast<int>(std::clamp<std::int64_t>(e, -1000, 1000));
+    }
+    double v = static_cast<double>(mantissa);
+    if (exponent >= 0 && exponent <= 22) v *= POW10[exponent];
+    else if (exponent < 0 && exponent >= -22) v /= POW10[-exponent];
+    else if (mantissa) v *= std::pow(10., exponent);
+    value = static_cast<float>(negative ? -v : v);
+    return true;
+}
+
+/**
+ * @brief 按 MTL 参数选择最接近的已有材质
+ *
+ * 有自发光（Ke）的为 DiffuseLight；透明（illum 4/6/7、d < 1 或 Tr > 0）的为 Dielectric；
+ * illum 3 或高光系数强于漫反射的为 Metal，粗糙度由 Phong 指数换算；其余为 Lambertian。
+ */
+inline MaterialPtr mtl_material(const glm::vec3& kd, const glm::vec3& ks, const glm::vec3& ke, float ns, float ni, float dissolve, int illum)
+{
+    auto max_component = [](const glm::vec3& c) { return std::max(c.x, std::max(c.y, c.z)); };
+    if (max_component(ke) > 0.f) return make_object<DiffuseLight>(ke);
+    if (illum == 4 || illum == 6 || illum == 7 || dissolve < 1.f) return make_object<Dielectric>(ni > 1.f ? ni : 1.5f);
+    if (illum == 3 || (illum != 1 && max_component(ks) > max_component(kd)))
+    {
+        return make_object<Metal>(ks, std::sqrt(2.f / (std::max(ns, 0.f) + 2.f)));
+    }
+    return make_object<Lambertian>(kd);
+}
+
+inline bool load_mtl(const std::string& filename, std::unordered_map<std::string, MaterialPtr>& materials)
+{
+    std::ifstream in(filename);
+    if (!in)
+    {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    std::string name;
+    glm::vec3 kd{ .73f }, ks{ 0.f }, ke{ 0.f };
+    float ns = 0.f, ni = 1.5f, dissolve = 1.f;
+    int illum = 2;
+    auto flush = [&]()
+    {
+        if (!name.empty()) materials[name] = mtl_material(kd, ks, ke, ns, ni, dissolve, illum);
+    };
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) continue;
+        if (key == "newmtl")
+        {
+            flush();
+            std::getline(fields >> std::ws, name);
+            while (!name.empty() && is_space(name.back())) name.pop_back();
+            kd = glm::vec3{ .73f };
+            ks = ke = glm::vec3{ 0.f };
+            ns = 0.f;
+            ni = 1.5f;
+            dissolve = 1.f;
+            illum = 2;
+        }
+        else if (key == "Kd") fields >> kd.x >> kd.y >> kd.z;
+        else if (key == "Ks") fields >> ks.x >> ks.y >> ks.z;
+        else if (key == "Ke") fields >> ke.x >> ke.y >> ke.z;
+        else if (key == "Ns") fields >> ns;
+        else if (key == "Ni") fields >> ni;
+        else if (key == "d") fields >> dissolve;
+        else if (key == "Tr")
+        {
+            float tr = 0.f;
+            fields >> tr;
+            dissolve = 1.f - tr;
+        }
+        else if (key == "illum") fields >> illum;
+    }
+    flush();
+    return true;
+}
+
+/**
+ * @brief 并行解析 OBJ 的一段按行对齐的文本
+ *
+ * 只读取 v、f、usemtl 与 mtllib，多边形按扇形就地三角化。正下标是全局的，直接存为从 0 开始的下标；
+ * 负下标相对于此前的顶点数，而前面各段的顶点数要等全部解析完才知道，因此先以 RELATIVE 为偏置记录段内位置，
+ * 合并时再加上本段的顶点偏移。
+ */
+struct ObjChunk
+{
+    static constexpr std::int64_t RELATIVE = std::int64_t{1} << 40;
+
+    std::vector<glm::vec3> _positions;
+    std::vector<std::int64_t> _indices;
+    std::vector<std::pair<std::uint32_t, std::string>> _switches; // usemtl 生效的段内三角形序号与材质名
+    std::string _library;
+    std::string _error;
+
+    void parse(const char* begin, const char* end, const char* file_begin)
+    {
+        auto fail = [&](const char* what, const char* where)
+        {
+            if (_error.empty()) _error = std::string(what) + " at byte " + std::to_string(where - file_begin);
+        };
+        auto rest_of_line = [](const char* p, const char* line_end)
+        {
+            while (p < line_end && is_blank(*p)) p++;
+            const char* last = line_end;
+            while (last > p && is_blank(last[-1])) last--;
+            return std::string(p, last);
+        };
+        for (const char* p = begin; p < end;)
+        {
+            const char* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!line_end) line_end = end;
+            const char* line = p;
+            p = line_end + 1;
+            while (line < line_end && is_blank(*line)) line++;
+            if (line_end - line < 2) continue;
+            if (line[0] == 'v' && is_blank(line[1]))
+            {
+                glm::vec3 v;
+                const char* q = line + 1;
+                for (int a = 0; a < 3; a++)
+                {
+                    while (q < line_end && is_blank(*q)) q++;
+                    if (!parse_float(q, line_end, v[a]))
+                    {
+                        fail("malformed vertex", line);
+                        return;
+                    }
+                }
+                _positions.push_back(v);
+            }
+            else if (line[0] == 'f' && is_blank(line[1]))
+            {
+                std::int64_t first = 0, previous = 0;
+                int corners = 0;
+                for (const char* q = line + 1;;)
+                {
+                    while (q < line_end && is_blank(*q)) q++;
+                    if (q >= line_end) break;
+                    std::int64_t index;
+                    if (!parse_int(q, line_end, index) || index == 0)
+                    {
+                        fail("malformed face", line);
+                        return;
+                    }
+                    // 跳过纹理坐标与法线下标
+                    while (q < line_end && !is_blank(*q)) q++;
+                    std::int64_t v = index > 0 ? index - 1 : RELATIVE + static_cast<std::int64_t>(_positions.size()) + index;
+                    if (corners == 0) first = v;
+                    else if (corners >= 2)
+                    {
+                        _indices.push_back(first);
+                        _indices.push_back(previous);
+                        _indices.push_back(v);
+                    }
+                    previous = v;
+                    corners++;
+                }
+                if (corners < 3)
+                {
+                    fail("face with fewer than 3 vertices", line);
+                    return;
+                }
+            }
+            else if (line_end - line > 7 && std::memcmp(line, "usemtl", 6) == 0 && is_blank(line[6]))
+            {
+                _switches.emplace_back(static_cast<std::uint32_t>(_indices.size() / 3), rest_of_line(line + 6, line_end));
+            }
+            else if (_library.empty() && line_end - line > 7 && std::memcmp(line, "mtllib", 6) == 0 && is_blank(line[6]))
+            {
+                _library = rest_of_line(line + 6, line_end);
+            }
+        }
+    }
+};
+
+/**
+ * @brief 映射 OBJ 文件，按行对齐切成若干段并行解析，再并行合并为预先分配好的顶点与下标数组
+ *
+ * 段数为线程数的 4 倍，动态调度平衡各段的顶点与面的比例差异。
+ */
+inline bool load_obj(const std::string& filename, MeshData& mesh, int threads = 0)
+{
+    threads = loader_threads(threads);
+    auto file = MappedFile::open(filename);
+    if (!file) return false;
+    const char* data = file->data();
+    const size_t size = file->size();
+    const size_t chunk_count = std::max<size_t>(1, std::min<size_t>(threads * 4, size / 4096));
+    std::vector<const char*> bounds(chunk_count + 1, data + size);
+    bounds[0] = data;
+    for (size_t k = 1; k < chunk_count; k++)
+    {
+        const char* p = std::max(bounds[k - 1], data + size * k / chunk_count);
+        const char* newline = p < data + size ? static_cast<const char*>(std::memchr(p, '\n', data + size - p)) : nullptr;
+        bounds[k] = newline ? newline + 1 : data + size;
+    }
+
+    std::vector<ObjChunk> chunks(chunk_count);
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+    for (long long k = 0; k < static_cast<long long>(chunk_count); k++)
+    {
+        chunks[k].parse(bounds[k], bounds[k + 1], data);
+    }
+
+    // 各段的顶点与三角形偏移
+    std::vector<size_t> vertex_offset(chunk_count + 1, 0), triangle_offset(chunk_count + 1, 0);
+    std::string library;
+    bool has_switches = false;
+    for (size_t k = 0; k < chunk_count; k++)
+    {
+        if (!chunks[k]._error.empty())
+        {
+            std::cerr << filename << ": " << chunks[k]._error << "\n";
+            return false;
+        }
+        vertex_offset[k + 1] = vertex_offset[k] + chunks[k]._positions.size();
+        triangle_offset[k + 1] = triangle_offset[k] + chunks[k]._indices.size() / 3;
+        if (library.empty()) library = chunks[k]._library;
+        has_switches |= !chunks[k]._switches.empty();
+    }
+    if (vertex_offset[chunk_count] > 0xffffffffu)
+    {
+        std::cerr << filename << " has more than 2^32 vertices\n";
+        return false;
+    }
+
+    mesh = MeshData{};
+    mesh._materials.push_back(make_object<Lambertian>(glm::vec3(.73f, .73f, .73f)));
+    // 材质名按出现顺序编号，每段开头沿用上一段最后生效的材质
+    std::vector<std::uint16_t> chunk_material(chunk_count, 0);
+    std::vector<std::vector<std::uint16_t>> switch_material(chunk_count);
+    if (has_switches)
+    {
+        std::unordered_map<std::string, MaterialPtr> library_materials;
+        if (!library.empty())
+        {
+            auto slash = filename.find_last_of('/');
+            std::string directory = slash == std::string::npos ? std::string{} : filename.substr(0, slash + 1);
+            load_mtl(directory + library, library_materials);
+        }
+        std::unordered_map<std::string, std::uint16_t> ids;
+        std::uint16_t current = 0;
+        for (size_t k = 0; k < chunk_count; k++)
+        {
+            chunk_material[k] = current;
+            for (const auto& [triangle, name] : chunks[k]._switches)
+            {
+                auto found = ids.find(name);
+                if (found == ids.end())
+                {
+                    auto material = library_materials.find(name);
+                    if (material == library_materials.end())
+                    {
+                        std::cerr << filename << ": material " << name << " not found, using the default\n";
+                        found = ids.emplace(name, 0).first;
+                    }
+                    else
+                    {
+                        if (mesh._materials.size() >= 65536)
+                        {
+                            std::cerr << filename << " uses more than 65536 materials\n";
+                            return false;
+                        }
+                        found = ids.emplace(name, static_cast<std::uint16_t>(mesh._materials.size())).first;
+                        mesh._materials.push_back(material->second);
+                    }
+                }
+                current = found->second;
+                switch_material[k].push_back(current);
+            }
+        }
+        mesh._face_material.resize(triangle_offset[chunk_count]);
+    }
+
+    mesh._positions.resize(vertex_offset[chunk_count]);
+    mesh._indices.resize(triangle_offset[chunk_count] * 3);
+    const std::int64_t vertex_count = static_cast<std::int64_t>(vertex_offset[chunk_count]);
+    bool valid = true;
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1) reduction(&&:valid)
+    for (long long k = 0; k < static_cast<long long>(chunk_count); k++)
+    {
+        const ObjChunk& chunk = chunks[k];
+        std::copy(chunk._positions.begin(), chunk._positions.end(), mesh._positions.begin() + vertex_offset[k]);
+        std::uint32_t* indices = mesh._indices.data() + triangle_offset[k] * 3;
+        const std::int64_t offset = static_cast<std::int64_t>(vertex_offset[k]);
+        bool chunk_valid = true;
+        for (size_t i = 0; i < chunk._indices.size(); i++)
+        {
+            std::int64_t v = chunk._indices[i];
+            if (v >= ObjChunk::RELATIVE / 2) v = v - ObjChunk::RELATIVE + offset;
+            chunk_valid &= v >= 0 && v < vertex_count;
+            indices[i] = static_cast<std::uint32_t>(v);
+        }
+        valid = valid && chunk_valid;
+        if (mesh._face_material.empty()) continue;
+        std::uint16_t* materials = mesh._face_material.data() + triangle_offset[k];
+        const size_t triangles = chunk._indices.size() / 3;
+        std::uint16_t current = chunk_material[k];
+        size_t t = 0;
+        for (size_t s = 0; s <= chunk._switches.size(); s++)
+        {
+            size_t until = s < chunk._switches.size() ? chunk._switches[s].first : triangles;
+            std::fill(materials + t, materials + until, current);
+            t = until;
+            if (s < chunk._switches.size()) current = switch_material[k][s];
+        }
+    }
+    if (!valid)
+    {
+        std::cerr << filename << " has a face referencing a missing vertex\n";
+        return false;
+    }
+    mesh.use_owned_positions();
+    mesh.use_owned_indices();
+    return true;
+}
+
+// PLY 头部中的一个属性，_list 为真时先是 _count 类型的个数，再是该个数的 _kind/_size 类型的值
+struct PlyProperty
+{
+    std::string _name;
+    char _kind{'f'}; // f 浮点、i 有符号整数、u 无符号整数
+    int _size{4};
+    bool _list{false};
+    char _count_kind{'u'};
+    int _count_size{1};
+};
+
+struct PlyElement
+{
+    std::string _name;
+    size_t _count{0};
+    std::vector<PlyProperty> _properties;
+
+    // 每项的字节数，含列表属性时为 0
+    size_t stride() const
+    {
+        size_t bytes = 0;
+        for (const auto& p : _properties)
+        {
+            if (p._list) return 0;
+            bytes += p._size;
+        }
+        return bytes;
+    }
+
+    int find(const std::string& name) const
+    {
+        for (size_t i = 0; i < _properties.size(); i++) if (_properties[i]._name == name) return static_cast<int>(i);
+        return -1;
+    }
+};
+
+inline bool ply_type(const std::string& name, char& kind, int& size)
+{
+    static const std::unordered_map<std::string, std::pair<char, int>> types{
+        { "char", { 'i', 1 } }, { "int8", { 'i', 1 } }, { "uchar", { 'u', 1 } }, { "uint8", { 'u', 1 } },
+        { "short", { 'i', 2 } }, { "int16", { 'i', 2 } }, { "ushort", { 'u', 2 } }, { "uint16", { 'u', 2 } },
+        { "int", { 'i', 4 } }, { "int32", { 'i', 4 } }, { "uint", { 'u', 4 } }, { "uint32", { 'u', 4 } },
+        { "float", { 'f', 4 } }, { "float32", { 'f', 4 } }, { "double", { 'f', 8 } }, { "float64", { 'f', 8 } } };
+    auto found = types.find(name);
+    if (found == types.end()) return false;
+    kind = found->second.first;
+    size = found->second.second;
+    return true;
+}
+
+// 读取一个小端二进制标量（与本机字节序相同）
+inline double read_ply_value(const char* p, char kind, int size)
+{
+    switch (size)
+    {
+    case 1: return kind == 'i' ? double(static_cast<std::int8_t>(*p)) : double(static_cast<std::uint8_t>(*p));
+    case 2:
+    {
+        std::uint16_t v;
+        std::memcpy(&v, p, 2);
+        return kind == 'i' ? double(static_cast<std::int16_t>(v)) : double(v);
+    }
+    case 4:
+    {
+        if (kind == 'f')
+        {
+            float f;
+            std::memcpy(&f, p, 4);
+            return f;
+        }
+        std::uint32_t v;
+        std::memcpy(&v, p, 4);
+        return kind == 'i' ? double(static_cast<std::int32_t>(v)) : double(v);
+    }
+    default:
+    {
+        double d;
+        std::memcpy(&d, p, 8);
+        return d;
+    }
+    }
+}
+
+inline bool parse_ply_header(const char* data, size_t size, std::string& format, std::vector<PlyElement>& elements, size_t& body)
+{
+    static const char END[] = "end_header";
+    const char* end = data + size;
+    if (size < 4 || std::memcmp(data, "ply", 3) != 0) return false;
+    for (const char* p = data; p < end;)
+    {
+        const char* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!line_end) return false;
+        std::string line(p, line_end);
+        p = line_end + 1;
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) continue;
+        if (key == END)
+        {
+            body = p - data;
+            return true;
+        }
+        if (key == "format") fields >> format;
+        else if (key == "element")
+        {
+            elements.emplace_back();
+            if (!(fields >> elements.back()._name >> elements.back()._count)) return false;
+        }
+        else if (key == "property")
+        {
+            if (elements.empty()) return false;
+            PlyProperty property;
+            std::string type;
+            fields >> type;
+            if (type == "list")
+            {
+                std::string count_type;
+                property._list = true;
+                fields >> count_type >> type;
+                if (!ply_type(count_type, property._count_kind, property._count_size) || property._count_kind == 'f') return false;
+            }
+            if (!ply_type(type, property._kind, property._size) || !(fields >> property._name)) return false;
+            elements.back()._properties.push_back(property);
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 读取二进制小端 PLY
+ *
+ * 顶点的 x、y、z 是连续的 float 时顶点视图直接指向映射的文件；面元素只有一个 4 字节下标的列表属性且全是三角形时，
+ * 三角形视图也直接指向文件（步长为个数字段加 12 字节），否则转换到自有数组，多边形按扇形三角化。
+ */
+inline bool load_binary_ply(const std::string& filename, const MappedFilePtr& file, const std::vector<PlyElement>& elements,
+                            size_t body, MeshData& mesh, int threads)
+{
+    const char* data = file->data();
+    const char* end = data + file->size();
+    const char* p = data + body;
+    auto truncated = [&filename]()
+    {
+        std::cerr << filename << " is truncated\n";
+        return false;
+    };
+    bool has_vertices = false, has_faces = false;
+    for (const PlyElement& element : elements)
+    {
+        const size_t stride = element.stride();
+        if (element._name == "vertex")
+        {
+            int axis[3] = { element.find("x"), element.find("y"), element.find("z") };
+            if (stride == 0 || axis[0] < 0 || axis[1] < 0 || axis[2] < 0)
+            {
+                std::cerr << filename << ": vertices need fixed-size x, y and z\n";
+                return false;
+            }
+            if (static_cast<size_t>(end - p) / stride < element._count) return truncated();
+            size_t offset[3] = {};
+            for (int a = 0; a < 3; a++)
+            {
+                for (int i = 0; i < axis[a]; i++) offset[a] += element._properties[i]._size;
+            }
+            bool packed = true;
+            for (int a = 0; a < 3; a++)
+            {
+                const PlyProperty& property = element._properties[axis[a]];
+                packed &= property._kind == 'f' && property._size == 4 && offset[a] == offset[0] + 4 * a;
+            }
+            if (packed)
+            {
+                mesh._vertex_data = p + offset[0];
+                mesh._vertex_stride = stride;
+                mesh._vertex_count = element._count;
+            }
+            else
+            {
+                mesh._positions.resize(element._count);
+                const char* base = p;
+#pragma omp parallel for num_threads(threads) schedule(static)
+                for (long long i = 0; i < static_cast<long long>(element._count); i++)
+                {
+                    const char* item = base + i * stride;
+                    for (int a = 0; a < 3; a++)
+                    {
+                        const PlyProperty& property = element._properties[axis[a]];
+                        mesh._positions[i][a] = static_cast<float>(read_ply_value(item + offset[a], property._kind, property._size));
+                    }
+                }
+                mesh.use_owned_positions();
+            }
+            p += stride * element._count;
+            has_vertices = true;
+            continue;
+        }
+        int list = element._name == "face" ? element.find("vertex_indices") : -1;
+        if (element._name == "face" && list < 0) list = element.find("vertex_index");
+        if (list >= 0 && element._properties[list]._list && element._properties[list]._kind != 'f')
+        {
+            const PlyProperty& property = element._properties[list];
+            const size_t face_stride = property._count_size + 3 * sizeof(std::uint32_t);
+            bool triangles = element._properties.size() == 1 && property._size == 4 &&
+                             static_cast<size_t>(end - p) / face_stride >= element._count;
+            if (triangles)
+            {
+                // 每个面的个数都是 3 时所有面都位于固定步长处，否则退回逐面解析
+                const char* base = p;
+#pragma omp parallel for num_threads(threads) schedule(static) reduction(&&:triangles)
+                for (long long f = 0; f < static_cast<long long>(element._count); f++)
+                {
+                    triangles = triangles && read_ply_value(base + f * face_stride, property._count_kind, property._count_size) == 3.;
+                }
+            }
+            if (triangles)
+            {
+                mesh._index_data = p + property._count_size;
+                mesh._index_stride = face_stride;
+                mesh._triangle_count = element._count;
+                p += face_stride * element._count;
+                has_faces = true;
+                continue;
+            }
+            mesh._indices.reserve(element._count * 3);
+            for (size_t f = 0; f < element._count; f++)
+            {
+                for (size_t i = 0; i < element._properties.size(); i++)
+                {
+                    const PlyProperty& item = element._properties[i];
+                    if (!item._list)
+                    {
+                        if (end - p < item._size) return truncated();
+                        p += item._size;
+                        continue;
+                    }
+                    if (end - p < item._count_size) return truncated();
+                    auto n = static_cast<size_t>(read_ply_value(p, item._count_kind, item._count_size));
+                    p += item._count_size;
+                    if (static_cast<size_t>(end - p) / item._size < n) return truncated();
+                    if (static_cast<int>(i) == list)
+                    {
+                        if (n < 3)
+                        {
+                            std::cerr << filename << ": face with fewer than 3 vertices\n";
+                            return false;
+                        }
+                        auto index = [&](size_t c) { return read_ply_value(p + c * item._size, item._kind, item._size); };
+                        for (size_t c = 2; c < n; c++)
+                        {
+                            for (double v : { index(0), index(c - 1), index(c) })
+                            {
+                                mesh._indices.push_back(v < 0. || v > 4294967295. ? 0xffffffffu : static_cast<std::uint32_t>(v));
+                            }
+                        }
+                    }
+                    p += n * item._size;
+                }
+            }
+            mesh.use_owned_indices();
+            has_faces = true;
+            continue;
+        }
+        // 跳过其他元素
+        if (stride > 0)
+        {
+            if (static_cast<size_t>(end - p) / stride < element._count) return truncated();
+            p += stride * element._count;
+            continue;
+        }
+        for (size_t i = 0; i < element._count; i++)
+        {
+            for (const PlyProperty& item : element._properties)
+            {
+                size_t bytes = item._size;
+                if (item._list)
+                {
+                    if (end - p < item._count_size) return truncated();
+                    bytes = item._count_size + static_cast<size_t>(read_ply_value(p, item._count_kind, item._count_size)) * item._size;
+                }
+                if (static_cast<size_t>(end - p) < bytes) return truncated();
+                p += bytes;
+            }
+        }
+    }
+    if (!has_vertices || !has_faces)
+    {
+        std::cerr << filename << " has no vertex or face element\n";
+        return false;
+    }
+    return true;
+}
+
+// ASCII PLY 按空白分隔的记号顺序解析，不要求每项占一行
+inline bool load_ascii_ply(const std::string& filename, const MappedFilePtr& file, const std::vector<PlyElement>& elements,
+                           size_t body, MeshData& mesh)
+{
+    const char* end = file->data() + file->size();
+    const char* p = file->data() + body;
+    auto number = [&](float& value)
+    {
+        while (p < end && is_space(*p)) p++;
+        return parse_float(p, end, value);
+    };
+    auto integer = [&](std::int64_t& value)
+    {
+        while (p < end && is_space(*p)) p++;
+        return parse_int(p, end, value);
+    };
+    auto malformed = [&]()
+    {
+        std::cerr << filename << ": malformed data at byte " << p - file->data() << "\n";
+        return false;
+    };
+    for (const PlyElement& element : elements)
+    {
+        int axis[3] = { element.find("x"), element.find("y"), element.find("z") };
+        const bool vertices = element._name == "vertex";
+        int list = element._name == "face" ? element.find("vertex_indices") : -1;
+        if (element._name == "face" && list < 0) list = element.find("vertex_index");
+        if (vertices) mesh._positions.reserve(element._count);
+        for (size_t i = 0; i < element._count; i++)
+        {
+            glm::vec3 position{ 0.f };
+            for (int k = 0; k < static_cast<int>(element._properties.size()); k++)
+            {
+                const PlyProperty& property = element._properties[k];
+                float value;
+                if (!property._list)
+                {
+                    if (!number(value)) return malformed();
+                    for (int a = 0; a < 3; a++) if (k == axis[a]) position[a] = value;
+                    continue;
+                }
+                std::int64_t n;
+                if (!integer(n) || n < 0) return malformed();
+                if (k != list)
+                {
+                    for (std::int64_t c = 0; c < n; c++) if (!number(value)) return malformed();
+                    continue;
+                }
+                if (n < 3) return malformed();
+                std::int64_t first, previous, v;
+                if (!integer(first) || !integer(previous)) return malformed();
+                for (std::int64_t c = 2; c < n; c++)
+                {
+                    if (!integer(v)) return malformed();
+                    for (std::int64_t index : { first, previous, v })
+                    {
+                        mesh._indices.push_back(index < 0 || index > 0xffffffffll ? 0xffffffffu : static_cast<std::uint32_t>(index));
+                    }
+                    previous = v;
+                }
+            }
+            if (vertices) mesh._positions.push_back(position);
+        }
+    }
+    mesh.use_owned_positions();
+    mesh.use_owned_indices();
+    return true;
+}
+
+inline bool load_ply(const std::string& filename, MeshData& mesh, int threads = 0)
+{
+    threads = loader_threads(threads);
+    auto file = MappedFile::open(filename);
+    if (!file) return false;
+    std::string format;
+    std::vector<PlyElement> elements;
+    size_t body = 0;
+    if (!parse_ply_header(file->data(), file->size(), format, elements, body))
+    {
+        std::cerr << "bad PLY header in " << filename << "\n";
+        return false;
+    }
+    mesh = MeshData{};
+    mesh._file = file;
+    mesh._materials.push_back(make_object<Lambertian>(glm::vec3(.73f, .73f, .73f)));
+    bool loaded;
+    if (format == "binary_little_endian") loaded = load_binary_ply(filename, file, elements, body, mesh, threads);
+    else if (format == "ascii") loaded = load_ascii_ply(filename, file, elements, body, mesh);
+    else
+    {
+        std::cerr << filename << ": PLY format " << format << " is not supported\n";
+        return false;
+    }
+    if (!loaded) return false;
+    if (!mesh.validate(threads))
+    {
+        std::cerr << filename << " has a face referencing a missing vertex\n";
+        return false;
+    }
+    // 两个视图都不指向文件时不再保留映射
+    if (!mesh.vertices_mapped() && !mesh.indices_mapped()) mesh._file.reset();
+    return true;
+}
+
+// 按扩展名加载 OBJ 或 PLY
+inline bool load_mesh(const std::string& filename, MeshData& mesh, int threads = 0)
+{
+    auto dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? std::string{} : filename.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (extension == "obj") return load_obj(filename, mesh, threads);
+    if (extension == "ply") return load_ply(filename, mesh, threads);
+    std::cerr << "unknown mesh format " << filename << "\n";
+    return false;
+}
+
+/**
+ * @brief 以 1 到全部硬件线程分别加载同一个文件，报告加载时间与吞吐
+ *
+ * 每种线程数取 3 次中最快的一次，第一次之前先完整加载一遍使文件进入页缓存。
+ */
+inline bool report_mesh_load(const std::string& filename, std::ostream& out)
+{
+    MeshData mesh;
+    if (!load_mesh(filename, mesh)) return false;
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    const double file_megabytes = static_cast<double>(in.tellg()) / 1048576.;
+    out << filename << ": " << std::fixed << std::setprecision(1) << file_megabytes << " MB, " << mesh._vertex_count << " vertices, "
+        << mesh._triangle_count << " triangles, " << mesh._materials.size() << " materials, vertices "
+        << (mesh.vertices_mapped() ? "zero-copy" : "copied") << ", indices " << (mesh.indices_mapped() ? "zero-copy" : "copied") << "\n";
+    const int hardware = loader_threads(0);
+    std::vector<int> counts;
+    for (int t = 1; t < hardware; t *= 2) counts.push_back(t);
+    counts.push_back(hardware);
+    double single = 0.;
+    for (int threads : counts)
+    {
+        double best = 0.;
+        for (int run = 0; run < 3; run++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            MeshData loaded;
+            if (!load_mesh(filename, loaded, threads)) return false;
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            if (run == 0 || seconds < best) best = seconds;
+        }
+        if (threads == 1) single = best;
+        out << std::setw(4) << threads << " threads " << std::setprecision(3) << std::setw(8) << best * 1e3 << " ms  "
+            << std::setprecision(1) << std::setw(8) << file_megabytes / best << " MB/s  speedup " << std::setprecision(2)
+            << single / best << "\n";
+    }
+    return true;
+}
@@ -0,0 +1,746 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "HitTable.hpp"
+#include "GeometryStore.hpp"
+#include "QuadPacket.hpp"
+
+/**
+ * 外存分页几何
+ *
+ * 场景的 Quad 按空间划分为若干块（chunk），每块连同自己的底层 BVH 与打包好的 QuadPacket
+ * 作为一段连续字节写入文件。渲染时只有块的包围盒与由它们建立的顶层树常驻内存，
+ * 块按需由后台线程读入容量受限的 LRU 缓存，缓存中的块可以直接求交而无需反序列化。
+ * 材质无法序列化，以调色板形式常驻内存，块中只保存 16 位材质下标。
+ *
+ * 文件布局：FileHeader | PagedChunkRecord[chunk_count] | 各块数据
+ * 块数据布局（均按 32 字节对齐）：ChunkHeader | PagedNode[node_count] | QuadPacket[packet_count] | PagedQuad[quad_count]
+ */
+struct PagedNode
+{
+    float _min[3];
+    float _max[3];
+    std::uint32_t _first; // 内部节点的两个子节点位于 _first 与 _first + 1，叶节点为首个元素的下标
+    std::uint32_t _count; // 叶节点中元素的个数，内部节点为 0
+};
+
+// 只在计算表面属性时用到的逐 Quad 数据，求交所需的部分都在 QuadPacket 中
+struct PagedQuad
+{
+    float _normal[3];
+    float _uv_scale;
+    std::uint32_t _material;
+};
+
+struct PagedChunkRecord
+{
+    float _min[3];
+    float _max[3];
+    std::uint64_t _offset;
+    std::uint64_t _bytes;
+};
+
+// 已读入内存的块中各数组的位置
+struct PagedChunk
+{
+    const PagedNode* _nodes{nullptr};
+    const QuadPacket* _packets{nullptr};
+    const PagedQuad* _quads{nullptr};
+    std::uint32_t _node_count{0};
+};
+
+struct PagedFormat
+{
+    static constexpr char MAGIC[4] = {'S', 'R', 'T', 'G'};
+    static constexpr std::uint32_t VERSION = 1;
+    static constexpr size_t ALIGNMENT = 32;
+    // 每块的 Quad 数上限，命中记录中的图元编号为 块 * MAX_CHUNK_QUADS + 块内下标
+    static constexpr std::uint32_t MAX_CHUNK_QUADS = 4096;
+
+    struct FileHeader
+    {
+        char _magic[4];
+        std::uint32_t _version;
+        std::uint32_t _packet_width; // QuadPacket::WIDTH，AVX2 与标量构建的块互不兼容
+        std::uint32_t _chunk_count;
+        std::uint32_t _material_count;
+        std::uint32_t _reserved;
+    };
+
+    struct ChunkHeader
+    {
+        std::uint32_t _node_count;
+        std::uint32_t _packet_count;
+        std::uint32_t _quad_count;
+        std::uint32_t _reserved[5];
+    };
+
+    static size_t align(size_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+};
+
+// 按元素中心沿最长轴取中位数递归划分，叶节点不超过 leaf_size 个元素；order 在划分后即为叶节点顺序
+template<typename Bounds>
+void build_median_tree(std::vector<PagedNode>& nodes, std::vector<std::uint32_t>& order, size_t begin, size_t end, std::uint32_t index,
+                       size_t leaf_size, const Bounds& bounds)
+{
+    glm::vec3 lo{ std::numeric_limits<float>::max() }, hi{ -std::numeric_limits<float>::max() };
+    glm::vec3 c_lo = lo, c_hi = hi;
+    for (size_t i = begin; i != end; i++)
+    {
+        glm::vec3 b_lo, b_hi;
+        bounds(order[i], b_lo, b_hi);
+        lo = glm::min(lo, b_lo);
+        hi = glm::max(hi, b_hi);
+        glm::vec3 c = (b_lo + b_hi) * .5f;
+        c_lo = glm::min(c_lo, c);
+        c_hi = glm::max(c_hi, c);
+    }
+    for (int a = 0; a < 3; a++)
+    {
+        nodes[index]._min[a] = lo[a];
+        nodes[index]._max[a] = hi[a];
+    }
+    if (end - begin <= leaf_size)
+    {
+        nodes[index]._first = static_cast<std::uint32_t>(begin);
+        nodes[index]._count = static_cast<std::uint32_t>(end - begin);
+        return;
+    }
+    glm::vec3 extent = c_hi - c_lo;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&bounds, axis](std::uint32_t a, std::uint32_t b)
+    {
+        glm::vec3 a_lo, a_hi, b_lo, b_hi;
+        bounds(a, a_lo, a_hi);
+        bounds(b, b_lo, b_hi);
+        return a_lo[axis] + a_hi[axis] < b_lo[axis] + b_hi[axis];
+    });
+    auto child = static_cast<std::uint32_t>(nodes.size());
+    nodes[index]._first = child;
+    nodes[index]._count = 0;
+    nodes.emplace_back();
+    nodes.emplace_back();
+    build_median_tree(nodes, order, begin, mid, child, leaf_size, bounds);
+    build_median_tree(nodes, order, mid, end, child + 1, leaf_size, bounds);
+}
+
+/**
+ * @brief 收集场景中的 Quad 并写出分页几何文件
+ *
+ * 变换节点先经 GeometryStore 展开到世界空间；球等其他图元不支持分页，会被跳过。
+ * 写出时整个 Quad 列表仍在内存中，超出内存的资产需要分批调用 add 之前先在外部切分。
+ */
+class PagedGeometryWriter
+{
+    std::vector<Quad> _quads;
+    std::vector<std::uint16_t> _materials;
+    std::vector<MaterialPtr> _palette;
+    std::unordered_map<const Material*, std::uint16_t> _palette_index;
+
+    static void quad_bounds(const Quad& quad, glm::vec3& lo, glm::vec3& hi)
+    {
+        AABB box = quad.get_aabb();
+        lo = { box.get_slab_x()._min, box.get_slab_y()._min, box.get_slab_z()._min };
+        hi = { box.get_slab_x()._max, box.get_slab_y()._max, box.get_slab_z()._max };
+    }
+
+    // 把 [begin, end) 内的 Quad 组织为一块：底层 BVH 每个叶节点恰好一个 QuadPacket
+    std::vector<std::byte> build_chunk(const std::vector<std::uint32_t>& members, glm::vec3& lo, glm::vec3& hi) const
+    {
+        std::vector<std::uint32_t> order(members.size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::vector<PagedNode> nodes(1);
+        build_median_tree(nodes, order, 0, order.size(), 0, QuadPacket::WIDTH,
+            [&](std::uint32_t i, glm::vec3& b_lo, glm::vec3& b_hi) { quad_bounds(_quads[members[i]], b_lo, b_hi); });
+        lo = { nodes[0]._min[0], nodes[0]._min[1], nodes[0]._min[2] };
+        hi = { nodes[0]._max[0], nodes[0]._max[1], nodes[0]._max[2] };
+
+        std::vector<QuadPacket> packets;
+        std::vector<PagedQuad> quads(order.size());
+        for (auto& node : nodes)
+        {
+            if (node._count == 0) continue;
+            QuadPacket packet;
+            for (std::uint32_t lane = 0; lane < node._count; lane++)
+            {
+                std::uint32_t local = node._first + lane;
+                const Quad& quad = _quads[members[order[local]]];
+                packet.set(static_cast<int>(lane), quad, local);
+                glm::vec3 n = glm::cross(quad.edge_u(), quad.edge_v());
+                quads[local] = { { quad.normal().x, quad.normal().y, quad.normal().z }, std::sqrt(glm::length(n)), _materials[members[order[local]]] };
+            }
+            node._first = static_cast<std::uint32_t>(packets.size());
+            node._count = 1;
+            packets.push_back(packet);
+        }
+
+        PagedFormat::ChunkHeader header{};
+        header._node_count = static_cast<std::uint32_t>(nodes.size());
+        header._packet_count = static_cast<std::uint32_t>(packets.size());
+        header._quad_count = static_cast<std::uint32_t>(quads.size());
+        size_t nodes_offset = PagedFormat::align(sizeof(PagedFormat::ChunkHeader));
+        size_t packets_offset = PagedFormat::align(nodes_offset + nodes.size() * sizeof(PagedNode));
+        size_t quads_offset = PagedFormat::align(packets_offset + packets.size() * sizeof(QuadPacket));
+        std::vector<std::byte> blob(PagedFormat::align(quads_offset + quads.size() * sizeof(PagedQuad)));
+        std::memcpy(blob.data(), &header, sizeof(header));
+        std::memcpy(blob.data() + nodes_offset, nodes.data(), nodes.size() * sizeof(PagedNode));
+        std::memcpy(blob.data() + packets_offset, packets.data(), packets.size() * sizeof(QuadPacket));
+        std::memcpy(blob.data() + quads_offset, quads.data(), quads.size() * sizeof(PagedQuad));
+        return blob;
+    }
+
+public:
+    bool add(const HitTablePtr& object)
+    {
+        GeometryStore store;
+        store.add(object);
+        size_t skipped = store.primitive_count(GeometryStore::SPHERE) + store.primitive_count(GeometryStore::GENERIC);
+        if (skipped) std::cerr << "paged geometry only stores quads, " << skipped << " other primitives skipped\n";
+        std::vector<Quad*> quads;
+        store.collect_quads(quads);
+        // 通用图元内部的 Quad 不在世界空间，只取展开后的部分
+        quads.resize(store.primitive_count(GeometryStore::QUAD));
+        for (const Quad* quad : quads)
+        {
+            const Material* key = quad->material().get();
+            auto found = _palette_index.find(key);
+            if (found == _palette_index.end())
+            {
+                if (_palette.size() >= 65536)
+                {
+                    std::cerr << "paged geometry supports at most 65536 materials\n";
+                    return false;
+                }
+                found = _palette_index.emplace(key, static_cast<std::uint16_t>(_palette.size())).first;
+                _palette.push_back(quad->material());
+            }
+            _quads.push_back(*quad);
+            _materials.push_back(found->second);
+        }
+        return true;
+    }
+
+    inline size_t size() const { return _quads.size(); }
+    // 读取文件时须传入同一调色板
+    inline const std::vector<MaterialPtr>& palette() const { return _palette; }
+
+    /**
+     * @brief 按空间划分为每块不超过 chunk_quads 个 Quad 的块并写出
+     */
+    bool write(const std::string& filename, std::uint32_t chunk_quads = PagedFormat::MAX_CHUNK_QUADS) const
+    {
+        chunk_quads = std::clamp<std::uint32_t>(chunk_quads, QuadPacket::WIDTH, PagedFormat::MAX_CHUNK_QUADS);
+        std::ofstream out(filename, std::ios::binary);
+        if (!out.is_open())
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        // 先按块大小划分空间，得到各块的成员
+        std::vector<std::uint32_t> order(_quads.size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::vector<PagedNode> top(1);
+        if (!order.empty())
+        {
+            build_median_tree(top, order, 0, order.size(), 0, chunk_quads,
+                [this](std::uint32_t i, glm::vec3& lo, glm::vec3& hi) { quad_bounds(_quads[i], lo, hi); });
+        }
+        std::vector<const PagedNode*> leaves;
+        for (const auto& node : top)
+        {
+            if (node._count > 0) leaves.push_back(&node);
+        }
+
+        PagedFormat::FileHeader header{};
+        std::memcpy(header._magic, PagedFormat::MAGIC, sizeof(PagedFormat::MAGIC));
+        header._version = PagedFormat::VERSION;
+        header._packet_width = QuadPacket::WIDTH;
+        header._chunk_count = static_cast<std::uint32_t>(leaves.size());
+        header._material_count = static_cast<std::uint32_t>(_palette.size());
+        std::vector<PagedChunkRecord> records(leaves.size());
+        size_t offset = PagedFormat::align(sizeof(PagedFormat::FileHeader) + records.size() * sizeof(PagedChunkRecord));
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(PagedChunkRecord)));
+        out.seekp(static_cast<std::streamoff>(offset));
+        for (size_t c = 0; c < leaves.size(); c++)
+        {
+            std::vector<std::uint32_t> members(order.begin() + leaves[c]->_first, order.begin() + leaves[c]->_first + leaves[c]->_count);
+            glm::vec3 lo, hi;
+            auto blob = build_chunk(members, lo, hi);
+            records[c] = { { lo.x, lo.y, lo.z }, { hi.x, hi.y, hi.z }, offset, blob.size() };
+            out.write(reinterpret_cast<const char*>(blob.data()), static_cast<std::streamsize>(blob.size()));
+            offset += blob.size();
+        }
+        // 块表在写完各块之后才知道偏移与大小，回填
+        out.seekp(sizeof(PagedFormat::FileHeader));
+        out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(PagedChunkRecord)));
+        if (!out.good())
+        {
+            std::cerr << "an error occured while writing " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 容量受限的块缓存：后台线程用 pread 异步读入，淘汰最久未用且未被占用的块
+ *
+ * 求交期间块被 pin 住，不会被淘汰；所有块都被占用时允许暂时超出容量。
+ * 命中驻留块的路径只有原子操作：先加 pin 再检查状态，淘汰方先改状态再检查 pin，两者不会同时成功。
+ * 最近使用时间记为读入计数，只在读入时推进，不在每次访问时争用同一缓存行。
+ */
+class ChunkCache
+{
+public:
+    struct Stats
+    {
+        size_t _loads{0};
+        size_t _evictions{0};
+        size_t _waits{0};          // 求交线程阻塞等待读入的次数
+        size_t _peak_bytes{0};
+    };
+
+private:
+    enum class State : std::uint8_t { ABSENT, QUEUED, RESIDENT };
+    struct alignas(PagedFormat::ALIGNMENT) Block { std::byte _bytes[PagedFormat::ALIGNMENT]; };
+
+    struct Entry
+    {
+        std::atomic<State> _state{State::ABSENT};
+        std::atomic<int> _pins{0};
+        std::atomic<std::uint64_t> _used{0};
+        std::vector<Block> _data;
+        PagedChunk _chunk;
+    };
+
+    int _fd;
+    const std::vector<PagedChunkRecord>& _records;
+    size_t _budget;
+    size_t _resident_bytes{0};
+    std::unique_ptr<Entry[]> _entries;
+    std::vector<std::uint32_t> _resident;
+    std::deque<std::uint32_t> _queue;
+    std::atomic<std::uint64_t> _clock{0};
+    Stats _stats;
+    bool _stopping{false};
+    std::mutex _mutex;
+    std::condition_variable _arrived;
+    std::condition_variable _pending;
+    std::vector<std::thread> _loaders;
+
+    // 调用时须持有 _mutex
+    void request(std::uint32_t chunk)
+    {
+        if (_entries[chunk]._state.load() != State::ABSENT) return;
+        _entries[chunk]._state.store(State::QUEUED);
+        _queue.push_back(chunk);
+        _pending.notify_one();
+    }
+
+    const PagedChunk* try_pin(std::uint32_t chunk)
+    {
+        Entry& entry = _entries[chunk];
+        entry._pins.fetch_add(1);
+        if (entry._state.load() == State::RESIDENT)
+        {
+            entry._used.store(_clock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return &entry._chunk;
+        }
+        entry._pins.fetch_sub(1);
+        return nullptr;
+    }
+
+    // 读取失败的块当作空块驻留，光线直接穿过
+    bool read(std::uint32_t chunk, std::vector<Block>& data, PagedChunk& view) const
+    {
+        const PagedChunkRecord& record = _records[chunk];
+        data.resize((record._bytes + PagedFormat::ALIGNMENT - 1) / PagedFormat::ALIGNMENT);
+        auto bytes = reinterpret_cast<std::byte*>(data.data());
+        size_t done = 0;
+        while (done < record._bytes)
+        {
+            ssize_t n = pread(_fd, bytes + done, record._bytes - done, static_cast<off_t>(record._offset + done));
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        PagedFormat::ChunkHeader header;
+        std::memcpy(&header, bytes, sizeof(header));
+        size_t nodes_offset = PagedFormat::align(sizeof(PagedFormat::ChunkHeader));
+        size_t packets_offset = PagedFormat::align(nodes_offset + header._node_count * sizeof(PagedNode));
+        size_t quads_offset = PagedFormat::align(packets_offset + header._packet_count * sizeof(QuadPacket));
+        if (quads_offset + header._quad_count * sizeof(PagedQuad) > record._bytes) return false;
+        view._nodes = reinterpret_cast<const PagedNode*>(bytes + nodes_offset);
+        view._packets = reinterpret_cast<const QuadPacket*>(bytes + packets_offset);
+        view._quads = reinterpret_cast<const PagedQuad*>(bytes + quads_offset);
+        view._node_count = header._node_count;
+        return true;
+    }
+
+    // 按最近使用时间从旧到新淘汰未被占用的块，直到放得下 bytes；调用时须持有 _mutex
+    void make_room(size_t bytes)
+    {
+        if (_resident_bytes + bytes <= _budget) return;
+        std::sort(_resident.begin(), _resident.end(), [this](std::uint32_t a, std::uint32_t b)
+        {
+            return _entries[a]._used.load(std::memory_order_relaxed) < _entries[b]._used.load(std::memory_order_relaxed);
+        });
+        size_t kept = 0;
+        for (size_t i = 0; i < _resident.size(); i++)
+        {
+            Entry& victim = _entries[_resident[i]];
+            if (_resident_bytes + bytes > _budget)
+            {
+                victim._state.store(State::ABSENT);
+                if (victim._pins.load() == 0)
+                {
+                    _resident_bytes -= victim._data.size() * sizeof(Block);
+                    std::vector<Block>{}.swap(victim._data);
+                    victim._chunk = PagedChunk{};
+                    _stats._evictions++;
+                    continue;
+                }
+                victim._state.store(State::RESIDENT);
+            }
+            _resident[kept++] = _resident[i];
+        }
+        _resident.resize(kept);
+    }
+
+    void load_loop()
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        while (true)
+        {
+            _pending.wait(lock, [this] { return _stopping || !_queue.empty(); });
+            if (_stopping) return;
+            std::uint32_t chunk = _queue.front();
+            _queue.pop_front();
+            lock.unlock();
+            std::vector<Block> data;
+            PagedChunk view;
+            if (!read(chunk, data, view))
+            {
+                std::cerr << "can't read geometry chunk " << chunk << "\n";
+                data.clear();
+                view = PagedChunk{};
+            }
+            size_t bytes = data.size() * sizeof(Block);
+            lock.lock();
+            make_room(bytes);
+            Entry& entry = _entries[chunk];
+            entry._data = std::move(data);
+            entry._chunk = view;
+            entry._used.store(_clock.fetch_add(1) + 1, std::memory_order_relaxed);
+            entry._state.store(State::RESIDENT);
+            _resident.push_back(chunk);
+            _resident_bytes += bytes;
+            _stats._loads++;
+            _stats._peak_bytes = std::max(_stats._peak_bytes, _resident_bytes);
+            _arrived.notify_all();
+        }
+    }
+
+public:
+    ChunkCache(int fd, const std::vector<PagedChunkRecord>& records, size_t budget, int loaders)
+        : _fd{fd}, _records{records}, _budget{budget}, _entries{new Entry[records.size()]}
+    {
+        for (int i = 0; i < std::max(loaders, 1); i++) _loaders.emplace_back(&ChunkCache::load_loop, this);
+    }
+    ~ChunkCache()
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stopping = true;
+        }
+        _pending.notify_all();
+        for (auto& loader : _loaders) loader.join();
+    }
+    ChunkCache(const ChunkCache&) = delete;
+    ChunkCache& operator=(const ChunkCache&) = delete;
+
+    // 块已驻留时占用并返回，否则发起异步读入并返回空
+    const PagedChunk* try_acquire(std::uint32_t chunk)
+    {
+        if (auto resident = try_pin(chunk)) return resident;
+        std::lock_guard<std::mutex> lock{_mutex};
+        request(chunk);
+        return nullptr;
+    }
+
+    // 阻塞直到块驻留并占用
+    const PagedChunk* acquire(std::uint32_t chunk)
+    {
+        if (auto resident = try_pin(chunk)) return resident;
+        std::unique_lock<std::mutex> lock{_mutex};
+        _stats._waits++;
+        while (true)
+        {
+            // 淘汰只在持锁时进行，这里加 pin 后块不会被换出
+            if (_entries[chunk]._state.load() == State::RESIDENT)
+            {
+                _entries[chunk]._pins.fetch_add(1);
+                return &_entries[chunk]._chunk;
+            }
+            request(chunk);
+            _arrived.wait(lock);
+        }
+    }
+
+    void release(std::uint32_t chunk)
+    {
+        _entries[chunk]._pins.fetch_sub(1);
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _stats;
+    }
+    size_t resident_bytes()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _resident_bytes;
+    }
+};
+
+/**
+ * @brief 分页几何的 HitTable：常驻的只有块表与块包围盒上的顶层树
+ *
+ * 遍历顶层树时，已驻留的块立即求交；未驻留的块发起异步读入并排入本光线的等待队列。
+ * 驻留块处理完后按进入距离依次处理队列：此时 t_max 往往已被收紧，许多块无需再读入就被剔除，
+ * 其余的块才阻塞等待。分页几何中的 Quad 不参与光源层次的构建。
+ */
+class PagedGeometry : public HitTable
+{
+    static constexpr int STACK_SIZE = 64;
+
+    int _fd{-1};
+    std::vector<PagedChunkRecord> _records;
+    std::vector<PagedNode> _top;
+    std::vector<std::uint32_t> _chunk_order;
+    std::vector<MaterialPtr> _palette;
+    std::unique_ptr<ChunkCache> _cache;
+    std::atomic<size_t> _deferred{0};
+    std::atomic<size_t> _culled{0};
+
+    PagedGeometry() = default;
+
+    // 由近及远遍历 nodes 上的树，对射线进入的叶节点调用 leaf(node, t_enter)；弹出时按已收紧的 t_max 剔除
+    template<typename Leaf>
+    static void traverse(const PagedNode* nodes, const Ray& r, const glm::vec3& inv_dir, Leaf&& leaf)
+    {
+        const glm::vec3 orig = r.origin();
+        struct Entry { std::uint32_t _node; float _t; };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        float t_enter;
+        if (!slab_test(nodes[0]._min, nodes[0]._max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), t_enter)) return;
+        stack[top++] = { 0, t_enter };
+        while (top > 0)
+        {
+            const Entry entry = stack[--top];
+            if (entry._t >= r.get_t_max()) continue;
+            const PagedNode& node = nodes[entry._node];
+            if (node._count > 0)
+            {
+                leaf(node, entry._t);
+                continue;
+            }
+            float t[2];
+            bool child_hit[2];
+            for (int c = 0; c < 2; c++)
+            {
+                const PagedNode& child = nodes[node._first + c];
+                child_hit[c] = slab_test(child._min, child._max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), t[c]);
+            }
+            // 先压入较远的子节点，使较近者先出栈
+            if (child_hit[0] && child_hit[1])
+            {
+                int near = t[0] <= t[1] ? 0 : 1;
+                if (top + 2 > STACK_SIZE) continue;
+                stack[top++] = { node._first + 1 - near, t[1 - near] };
+                stack[top++] = { node._first + near, t[near] };
+            }
+            else if (child_hit[0] || child_hit[1])
+            {
+                int c = child_hit[0] ? 0 : 1;
+                if (top + 1 > STACK_SIZE) continue;
+                stack[top++] = { node._first + c, t[c] };
+            }
+        }
+    }
+
+    bool hit_chunk(const PagedChunk& chunk, std::uint32_t index, Ray& r, HitRecord& record, const glm::vec3& inv_dir) const
+    {
+        if (chunk._node_count == 0) return false;
+        bool hit_anything = false;
+        traverse(chunk._nodes, r, inv_dir, [&](const PagedNode& node, float)
+        {
+            float t = 0.f, alpha = 0.f, beta = 0.f;
+            for (auto i = node._first; i != node._first + node._count; i++)
+            {
+                const QuadPacket& packet = chunk._packets[i];
+                int lane = packet.intersect(r, t, alpha, beta);
+                if (lane < 0) continue;
+                r.update_t_max(t);
+                record._t = t;
+                record._object = this;
+                record._primitive = index * PagedFormat::MAX_CHUNK_QUADS + packet._index[lane];
+                record._coords = { alpha, beta };
+                hit_anything = true;
+            }
+        });
+        return hit_anything;
+    }
+
+public:
+    ~PagedGeometry()
+    {
+        _cache.reset();
+        if (_fd >= 0) close(_fd);
+    }
+
+    /**
+     * @brief 打开分页几何文件
+     *
+     * @param palette 写出文件时 PagedGeometryWriter 的调色板
+     * @param cache_bytes 块缓存的容量
+     * @param loaders 后台读取线程数
+     */
+    static std::shared_ptr<PagedGeometry> open(const std::string& filename, const std::vector<MaterialPtr>& palette, size_t cache_bytes, int loaders = 2)
+    {
+        std::shared_ptr<PagedGeometry> geometry{new PagedGeometry};
+        geometry->_fd = ::open(filename.c_str(), O_RDONLY);
+        if (geometry->_fd < 0)
+        {
+            std::cerr << "can't open file " << filename << "\n";
+            return nullptr;
+        }
+        PagedFormat::FileHeader header{};
+        if (pread(geometry->_fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+            std::memcmp(header._magic, PagedFormat::MAGIC, sizeof(PagedFormat::MAGIC)) != 0 || header._version != PagedFormat::VERSION)
+        {
+            std::cerr << "bad paged geometry file " << filename << "\n";
+            return nullptr;
+        }
+        if (header._packet_width != QuadPacket::WIDTH || header._material_count != palette.size())
+        {
+            std::cerr << filename << " was written with packet width " << header._packet_width << " and " << header._material_count
+                      << " materials, expected " << QuadPacket::WIDTH << " and " << palette.size() << "\n";
+            return nullptr;
+        }
+        auto& records = geometry->_records;
+        records.resize(header._chunk_count);
+        auto table_bytes = static_cast<ssize_t>(records.size() * sizeof(PagedChunkRecord));
+        if (pread(geometry->_fd, records.data(), static_cast<size_t>(table_bytes), sizeof(header)) != table_bytes)
+        {
+            std::cerr << "an error occured while reading " << filename << "\n";
+            return nullptr;
+        }
+        geometry->_palette = palette;
+        if (!records.empty())
+        {
+            auto& order = geometry->_chunk_order;
+            order.resize(records.size());
+            std::iota(order.begin(), order.end(), 0u);
+            geometry->_top.resize(1);
+            build_median_tree(geometry->_top, order, 0, order.size(), 0, 1, [&records](std::uint32_t i, glm::vec3& lo, glm::vec3& hi)
+            {
+                lo = { records[i]._min[0], records[i]._min[1], records[i]._min[2] };
+                hi = { records[i]._max[0], records[i]._max[1], records[i]._max[2] };
+            });
+            const PagedNode& root = geometry->_top[0];
+            geometry->_box.set(glm::vec3{ root._min[0], root._min[1], root._min[2] }, glm::vec3{ root._max[0], root._max[1], root._max[2] });
+        }
+        geometry->_cache = std::make_unique<ChunkCache>(geometry->_fd, geometry->_records, cache_bytes, loaders);
+        return geometry;
+    }
+
+    virtual bool hit(Ray& r, HitRecord& record) override
+    {
+        if (_top.empty()) return false;
+        const glm::vec3 dir = r.direction();
+        const glm::vec3 inv_dir{ 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+        struct Deferred { float _t; std::uint32_t _chunk; };
+        std::vector<Deferred> deferred;
+        bool hit_anything = false;
+        traverse(_top.data(), r, inv_dir, [&](const PagedNode& node, float t_enter)
+        {
+            for (auto i = node._first; i != node._first + node._count; i++)
+            {
+                std::uint32_t chunk = _chunk_order[i];
+                const PagedChunk* resident = _cache->try_acquire(chunk);
+                if (!resident)
+                {
+                    deferred.push_back({ t_enter, chunk });
+                    continue;
+                }
+                hit_anything |= hit_chunk(*resident, chunk, r, record, inv_dir);
+                _cache->release(chunk);
+            }
+        });
+        if (deferred.empty()) return hit_anything;
+        _deferred += deferred.size();
+        std::sort(deferred.begin(), deferred.end(), [](const Deferred& a, const Deferred& b) { return a._t < b._t; });
+        for (const auto& entry : deferred)
+        {
+            // 驻留块中更近的命中已收紧 t_max，位于其后的块不必等待读入
+            if (entry._t >= r.get_t_max())
+            {
+                _culled++;
+                continue;
+            }
+            const PagedChunk* chunk = _cache->acquire(entry._chunk);
+            hit_anything |= hit_chunk(*chunk, entry._chunk, r, record, inv_dir);
+            _cache->release(entry._chunk);
+        }
+        return hit_anything;
+    }
+
+    virtual void surface(const Ray& r, HitRecord& record) const override
+    {
+        std::uint32_t chunk = record._primitive / PagedFormat::MAX_CHUNK_QUADS;
+        const PagedQuad& quad = _cache->acquire(chunk)->_quads[record._primitive % PagedFormat::MAX_CHUNK_QUADS];
+        glm::vec3 normal{ quad._normal[0], quad._normal[1], quad._normal[2] };
+        float uv_scale = quad._uv_scale;
+        record._material = _palette[quad._material];
+        _cache->release(chunk);
+        record._point = r.at(record._t);
+        record._uv = record._coords;
+        record._light = -1;
+        record.set_face_normal(r, normal);
+        record.set_footprint(r, uv_scale);
+    }
+
+    inline size_t chunk_count() const { return _records.size(); }
+    inline ChunkCache::Stats cache_stats() const { return _cache->stats(); }
+    inline size_t resident_bytes() const { return _cache->resident_bytes(); }
+    // 排入等待队列的块数与其中因 t_max 收紧而无需读入的块数
+    inline size_t deferred_chunks() const { return _deferred; }
+    inline size_t culled_chunks() const { return _culled; }
+    // 常驻内存的部分：块表、顶层树与调色板
+    inline size_t resident_index_bytes() const
+    {
+        return _records.size() * (sizeof(PagedChunkRecord) + sizeof(std::uint32_t)) + _top.size() * sizeof(PagedNode) + _palette.size() * sizeof(MaterialPtr);
+    }
+};
+using PagedGeometryPtr = std::shared_ptr<PagedGeometry>;
@@ -0,0 +1,429 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Integrator.hpp"
+#include "Camera.hpp"
+#include "Environment.hpp"
+#include "LightBVH.hpp"
+#include "Material.hpp"
+
+struct Photon
+{
+    glm::vec3 _position;
+    glm::vec3 _direction;    // 指向光子来处的单位向量
+    glm::vec3 _power;        // 光通量，已除以本轮发射的光子数
+    std::uint32_t _axis{0};  // 作为 kd 树节点时的划分轴
+};
+
+/**
+ * @brief 平衡 kd 树组织的光子图
+ *
+ * 隐式布局：区间 [begin, end) 的中位数 (begin + end) / 2 是该子树的根，左右子树分别为 [begin, mid) 与 [mid + 1, end)，
+ * 不需要额外的指针。沿区间包围盒最长轴取中位数，较浅的层级把左子树作为 OpenMP 任务并行构建。
+ */
+class PhotonMap
+{
+    static constexpr int TASK_DEPTH = 8;
+    static constexpr int STACK_SIZE = 64;
+
+    struct Range
+    {
+        std::uint32_t _begin;
+        std::uint32_t _end;
+        float _distance2; // 到父节点划分平面的距离平方，k 近邻据此剪枝
+    };
+
+    std::vector<Photon> _photons;
+
+    void build(std::uint32_t begin, std::uint32_t end, int depth)
+    {
+        if (end - begin <= 1) return;
+        glm::vec3 lo = _photons[begin]._position, hi = lo;
+        for (auto i = begin + 1; i != end; i++)
+        {
+            lo = glm::min(lo, _photons[i]._position);
+            hi = glm::max(hi, _photons[i]._position);
+        }
+        glm::vec3 extent = hi - lo;
+        std::uint32_t axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        std::uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(_photons.begin() + begin, _photons.begin() + mid, _photons.begin() + end,
+            [axis](const Photon& a, const Photon& b) { return a._position[axis] < b._position[axis]; });
+        _photons[mid]._axis = axis;
+        if (depth < TASK_DEPTH)
+        {
+#pragma omp task default(shared)
+            build(begin, mid, depth + 1);
+            build(mid + 1, end, depth + 1);
+#pragma omp taskwait
+        }
+        else
+        {
+            build(begin, mid, depth + 1);
+            build(mid + 1, end, depth + 1);
+        }
+    }
+
+public:
+    void build(std::vector<Photon>&& photons)
+    {
+        _photons = std::move(photons);
+#pragma omp parallel
+#pragma omp single
+        build(0, static_cast<std::uint32_t>(_photons.size()), 0);
+    }
+
+    inline size_t size() const { return _photons.size(); }
+    inline bool empty() const { return _photons.empty(); }
+    inline const Photon& photon(size_t index) const { return _photons[index]; }
+
+    // 对到 p 的距离平方小于 radius2 的每个光子调用 visit
+    template<typename Visit>
+    void gather(const glm::vec3& p, float radius2, Visit&& visit) const
+    {
+        if (_photons.empty()) return;
+        Range stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, static_cast<std::uint32_t>(_photons.size()), 0.f };
+        while (top > 0)
+        {
+            Range range = stack[--top];
+            std::uint32_t mid = range._begin + (range._end - range._begin) / 2;
+            const Photon& photon = _photons[mid];
+            glm::vec3 d = p - photon._position;
+            if (glm::dot(d, d) < radius2) visit(photon);
+            if (range._end - range._begin == 1) continue;
+            float delta = d[photon._axis];
+            // 球与划分平面相交时两侧都要访问，否则只访问 p 所在的一侧
+            if (delta < 0.f || delta * delta < radius2)
+            {
+                if (mid > range._begin) stack[top++] = { range._begin, mid, 0.f };
+            }
+            if (delta >= 0.f || delta * delta < radius2)
+            {
+                if (mid + 1 < range._end) stack[top++] = { mid + 1, range._end, 0.f };
+            }
+        }
+    }
+
+    /**
+     * @brief 查找距 p 最近的至多 k 个光子（距离平方小于 max_radius2）
+     *
+     * neighbors 为以距离平方为键的最大堆，存放光子下标。先访问 p 所在的一侧，另一侧在出栈时按当前第 k 近的距离剪枝。
+     * 返回第 k 近的距离平方，不足 k 个时返回 max_radius2
+     */
+    float nearest(const glm::vec3& p, size_t k, float max_radius2, std::vector<std::pair<float, std::uint32_t>>& neighbors) const
+    {
+        neighbors.clear();
+        float radius2 = max_radius2;
+        if (_photons.empty() || k == 0) return radius2;
+        Range stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, static_cast<std::uint32_t>(_photons.size()), 0.f };
+        while (top > 0)
+        {
+            Range range = stack[--top];
+            if (range._distance2 >= radius2) continue;
+            std::uint32_t mid = range._begin + (range._end - range._begin) / 2;
+            const Photon& photon = _photons[mid];
+            glm::vec3 d = p - photon._position;
+            float distance2 = glm::dot(d, d);
+            if (distance2 < radius2)
+            {
+                if (neighbors.size() == k)
+                {
+                    std::pop_heap(neighbors.begin(), neighbors.end());
+                    neighbors.back() = { distance2, mid };
+                }
+                else neighbors.push_back({ distance2, mid });
+                std::push_heap(neighbors.begin(), neighbors.end());
+                if (neighbors.size() == k) radius2 = neighbors.front().first;
+            }
+            if (range._end - range._begin == 1) continue;
+            float delta = d[photon._axis];
+            Range left{ range._begin, mid, delta < 0.f ? 0.f : delta * delta };
+            Range right{ mid + 1, range._end, delta < 0.f ? delta * delta : 0.f };
+            // 较远的一侧先入栈
+            const Range& near = delta < 0.f ? left : right;
+            const Range& far = delta < 0.f ? right : left;
+            if (far._begin < far._end) stack[top++] = far;
+            if (near._begin < near._end) stack[top++] = near;
+        }
+        return radius2;
+    }
+};
+
+/**
+ * @brief 焦散光子图 + 路径追踪（Jensen 1996），半径按渐进式光子映射逐轮缩小（Knaus & Zwicker 2011）
+ *
+ * 每个样本编号对应一轮：先从面光源发射 _photons_per_pass 个光子，只在经过至少一次镜面散射后到达的第一个非镜面表面存下光子
+ * （L S+ D 路径），再为所有像素追踪该编号的相机路径。相机路径在每个非镜面顶点处以固定半径收集光子估计焦散，
+ * 并且不再计入从该顶点经镜面到达可采样光源的贡献，其余光照与 PathIntegrator 相同，由光源采样与 BSDF 采样按幂启发式 MIS 得到。
+ * 第 i 轮的半径平方为 r₁² ∏(k + α) / (k + 1)（k = 1..i-1），各轮估计的平均值随轮数收敛。
+ * r₁ 取第 0 轮光子图中光子到第 RADIUS_NEIGHBORS 个近邻距离的中位数。
+ *
+ * 光子按编号分块发射，每块写入独立的缓冲后按块的顺序合并，光子图只取决于 (轮次, 光子编号)，与线程数无关；
+ * 任意切分的区域与样本区间合并后与整体渲染一致。初始半径与最多 MAX_CACHED_PASSES 轮的光子图在首次用到时生成并缓存，
+ * 同一实例对各区域的 render 共用，因此一个实例只用于一个场景（场景对象改变时缓存作废）。
+ */
+class PhotonIntegrator : public Integrator
+{
+    static constexpr size_t BLOCK_SIZE = 4096;
+    static constexpr float ALPHA = 2.f / 3.f;
+    static constexpr size_t RADIUS_NEIGHBORS = 16;
+    static constexpr size_t RADIUS_SAMPLES = 1024;
+    static constexpr size_t MAX_CACHED_PASSES = 64;
+
+    size_t _photons_per_pass;
+    LightPowerDistribution _power;
+    float _initial_radius2{0.f};
+    const HitTable* _cached_world{nullptr};  // 缓存的半径与光子图所属的场景
+    std::map<int, PhotonMap> _maps;          // 各轮的光子图
+
+    // 第 pass 轮（从 0 开始）的收集半径平方
+    float radius2(int pass) const
+    {
+        double i = pass + 1.;
+        return static_cast<float>(_initial_radius2 * std::exp(std::lgamma(i + ALPHA) - std::lgamma(1. + ALPHA) - std::lgamma(i + 1.)));
+    }
+
+    // 发射编号为 index 的光子，到达经镜面散射后的第一个非镜面表面时存入 photons
+    void trace_photon(HitTable& world, int pass, size_t index, std::vector<Photon>& photons) const
+    {
+        RANDOM.start_sample(pass, -1, static_cast<std::uint32_t>(index));
+        float pmf;
+        const AreaLight& light = _lights->light(_power.sample(RANDOM.get_float(0.f, 1.f), pmf));
+        float a = RANDOM.get_float(0.f, 1.f);
+        float b = RANDOM.get_float(0.f, 1.f);
+        glm::vec3 point = light._Q + a * light._u + b * light._v;
+        glm::vec3 side = RANDOM.get_float(0.f, 1.f) < .5f ? light._normal : -light._normal;
+        glm::vec3 direction = glm::normalize(RANDOM.cosine_weighted_random_hemisphere(side));
+        float cos_theta = std::fabs(glm::dot(light._normal, direction));
+        // 位置 PDF 为 pmf / 面积，双面余弦分布的方向 PDF 为 cosθ / 2π
+        if (cos_theta <= 0.f) return;
+        glm::vec3 power = light._material->emitted({ a, b }, point, 0.f) * (light._area * 2.f * pi / (pmf * _photons_per_pass));
+        Ray ray{ point, direction };
+        bool specular = false;
+        for (int bounces = 0; bounces < _max_depth; bounces++)
+        {
+            HitRecord record;
+            if (!world.hit(ray, record)) return;
+            record.resolve(ray);
+            if (!record._material->is_specular())
+            {
+                if (specular) photons.push_back({ record._point, -glm::normalize(ray.direction()), power });
+                return;
+            }
+            auto scatter = record._material->scatter(ray, record);
+            if (!scatter) return;
+            power *= scatter._attenuation;
+            if (is_zero_vec(power)) return;
+            specular = true;
+            ray = scatter._scattered_ray;
+        }
+    }
+
+    // 第 pass 轮的焦散光子图，各块的缓冲按块的顺序合并
+    PhotonMap trace_photons(HitTable& world, int pass) const
+    {
+        PhotonMap map;
+        if (_power.empty()) return map;
+        const size_t blocks = (_photons_per_pass + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        std::vector<std::vector<Photon>> buffers(blocks);
+#pragma omp parallel for schedule(dynamic, 1)
+        for (long long block = 0; block < static_cast<long long>(blocks); block++)
+        {
+            size_t end = std::min<size_t>(_photons_per_pass, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++) trace_photon(world, pass, i, buffers[block]);
+        }
+        std::vector<size_t> offsets(blocks + 1, 0);
+        for (size_t block = 0; block < blocks; block++) offsets[block + 1] = offsets[block] + buffers[block].size();
+        std::vector<Photon> photons(offsets[blocks]);
+#pragma omp parallel for schedule(static)
+        for (long long block = 0; block < static_cast<long long>(blocks); block++)
+        {
+            std::copy(buffers[block].begin(), buffers[block].end(), photons.begin() + offsets[block]);
+        }
+        map.build(std::move(photons));
+        return map;
+    }
+
+    // 第 pass 轮的光子图：已缓存时直接返回，缓存未满时发射后存入缓存，否则发射到 scratch
+    const PhotonMap& photon_map(HitTable& world, int pass, PhotonMap& scratch)
+    {
+        auto found = _maps.find(pass);
+        if (found != _maps.end()) return found->second;
+        if (_maps.size() < MAX_CACHED_PASSES) return _maps.emplace(pass, trace_photons(world, pass)).first->second;
+        scratch = trace_photons(world, pass);
+        return scratch;
+    }
+
+    // 由第 0 轮光子图取初始半径：抽样光子到第 RADIUS_NEIGHBORS 个近邻的距离平方的中位数
+    void estimate_radius(HitTable& world)
+    {
+        AABB box = world.get_aabb();
+        glm::vec3 diagonal{ box.get_slab_x().length(), box.get_slab_y().length(), box.get_slab_z().length() };
+        float max_radius2 = glm::dot(diagonal, diagonal) * 1e-4f;
+        _initial_radius2 = max_radius2 * .01f;
+        PhotonMap scratch;
+        const PhotonMap& pilot = photon_map(world, 0, scratch);
+        if (pilot.size() <= RADIUS_NEIGHBORS) return;
+        size_t stride = std::max<size_t>(1, pilot.size() / RADIUS_SAMPLES);
+        std::vector<float> radii;
+        std::vector<std::pair<float, std::uint32_t>> neighbors;
+        for (size_t i = 0; i < pilot.size(); i += stride)
+        {
+            radii.push_back(pilot.nearest(pilot.photon(i)._position, RADIUS_NEIGHBORS, max_radius2, neighbors));
+        }
+        std::nth_element(radii.begin(), radii.begin() + radii.size() / 2, radii.end());
+        _initial_radius2 = radii[radii.size() / 2];
+    }
+
+    // 在非镜面顶点对光源与环境光做显式采样，按幂启发式与 BSDF 采样做 MIS
+    glm::vec3 direct_lighting(const Ray& ray, const HitRecord& record, HitTable& world) const
+    {
+        glm::vec3 direct{ 0.f, 0.f, 0.f };
+        if (_environment->importance_sampled())
+        {
+            glm::vec3 direction;
+            float light_pdf;
+            glm::vec3 radiance = _environment->sample(direction, light_pdf);
+            glm::vec3 f = light_pdf > 0.f ? record._material->eval(ray, record, direction) : glm::vec3{ 0.f, 0.f, 0.f };
+            Ray shadow{ record._point, direction };
+            HitRecord occluder;
+            if (!is_zero_vec(radiance) && !is_zero_vec(f) && !world.hit(shadow, occluder))
+            {
+                direct += f * radiance * (power_heuristic(light_pdf, record._material->pdf(ray, record, direction)) / light_pdf);
+            }
+        }
+        if (_lights)
+        {
+            LightSample sample = _lights->sample(record._point, record._normal);
+            glm::vec3 f = sample._pdf > 0.f ? record._material->eval(ray, record, sample._direction) : glm::vec3{ 0.f, 0.f, 0.f };
+            Ray shadow{ record._point, sample._direction };
+            shadow.update_t_max(sample._distance * (1.f - 1e-3f));
+            HitRecord occluder;
+            if (!is_zero_vec(sample._radiance) && !is_zero_vec(f) && !world.hit(shadow, occluder))
+            {
+                direct += f * sample._radiance * (power_heuristic(sample._pdf, record._material->pdf(ray, record, sample._direction)) / sample._pdf);
+            }
+        }
+        return direct;
+    }
+
+    // 以半径平方 radius2 内的光子估计 record 处朝 -ray 方向的反射辐射度
+    glm::vec3 caustics(const Ray& ray, const HitRecord& record, const PhotonMap& map, float radius2) const
+    {
+        glm::vec3 flux{ 0.f, 0.f, 0.f };
+        map.gather(record._point, radius2, [&](const Photon& photon)
+        {
+            float cos_theta = std::fabs(glm::dot(record._normal, photon._direction));
+            if (cos_theta > 1e-6f) flux += record._material->eval(ray, record, photon._direction) / cos_theta * photon._power;
+        });
+        return flux / (pi * radius2);
+    }
+
+    glm::vec3 radiance(Ray ray, HitTable& world, const PhotonMap& map, float radius2) const
+    {
+        glm::vec3 result{ 0.f, 0.f, 0.f };
+        glm::vec3 beta{ 1.f, 1.f, 1.f };
+        float scatter_pdf = 0.f;
+        glm::vec3 from_normal{ 0.f, 0.f, 0.f };
+        bool diffuse = false;  // 已经过非镜面顶点
+        bool caustic = false;  // 最近的非镜面顶点之后经过了镜面顶点，且只经过了镜面顶点
+        for (int depth = 0; depth < _max_depth; depth++)
+        {
+            HitRecord record;
+            if (!world.hit(ray, record))
+            {
+                glm::vec3 direction = glm::normalize(ray.direction());
+                glm::vec3 radiance = _environment->eval(direction);
+                if (scatter_pdf > 0.f && _environment->importance_sampled()) radiance *= power_heuristic(scatter_pdf, _environment->pdf(direction));
+                result += beta * radiance;
+                break;
+            }
+            record.resolve(ray);
+            // 非镜面顶点经镜面到达光源的路径已由该顶点处的光子估计
+            if (!caustic || record._light < 0)
+            {
+                glm::vec3 emitted = record._material->emitted(record._uv, record._point, record._footprint);
+                if (scatter_pdf > 0.f && record._light >= 0 && _lights)
+                {
+                    emitted *= power_heuristic(scatter_pdf, _lights->pdf(ray.origin(), from_normal, static_cast<std::uint32_t>(record._light), record._point));
+                }
+                result += beta * emitted;
+            }
+            auto scatter = record._material->scatter(ray, record);
+            if (!scatter) break;
+            if (record._material->is_specular())
+            {
+                scatter_pdf = 0.f;
+                caustic = diffuse;
+            }
+            else
+            {
+                caustic = false;
+                diffuse = true;
+                result += beta * caustics(ray, record, map, radius2);
+                if (scatter._pdf <= 0.f) break;
+                result += beta * direct_lighting(ray, record, world);
+                scatter_pdf = scatter._pdf;
+                from_normal = record._normal;
+            }
+            beta *= scatter._attenuation;
+            if (is_zero_vec(beta)) break;
+            scatter._scattered_ray.set_cone(ray.get_cone_width(record._t), ray.get_cone_spread() + bounce_cone_spread);
+            ray = scatter._scattered_ray;
+        }
+        return result;
+    }
+
+public:
+    using Integrator::render;
+
+    explicit PhotonIntegrator(size_t photons_per_pass = 25000) : _photons_per_pass{photons_per_pass} {}
+
+    virtual void render(Camera& camera, Film& film, const Region& region, int sample_begin, int sample_end, HitTable& world) override
+    {
+        LightingScope lighting{*this, camera};
+        _power.build(_lights.get());
+        if (_cached_world != &world)
+        {
+            _maps.clear();
+            _cached_world = &world;
+            estimate_radius(world);
+        }
+        const int width = region._x1 - region._x0;
+        std::vector<glm::vec3> sums(static_cast<size_t>(width) * (region._y1 - region._y0), glm::vec3{ 0.f, 0.f, 0.f });
+        for (int pass = sample_begin; pass < sample_end; pass++)
+        {
+            PhotonMap scratch;
+            const PhotonMap& map = photon_map(world, pass, scratch);
+            const float r2 = radius2(pass);
+#pragma omp parallel for schedule(dynamic, 1)
+            for (int y = region._y0; y < region._y1; y++)
+            {
+                for (int x = region._x0; x < region._x1; x++)
+                {
+                    RANDOM.start_sample(x, y, pass);
+                    Ray r = camera.get_ray(static_cast<float>(x), static_cast<float>(y));
+                    sums[static_cast<size_t>(y - region._y0) * width + (x - region._x0)] += radiance(r, world, map, r2);
+                }
+            }
+        }
+        for (int y = region._y0; y < region._y1; y++)
+        {
+            for (int x = region._x0; x < region._x1; x++)
+            {
+                film.add(x, y, sums[static_cast<size_t>(y - region._y0) * width + (x - region._x0)], sample_end - sample_begin);
+            }
+        }
+    }
+};
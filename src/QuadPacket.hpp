@@ -0,0 +1,190 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "HitTable.hpp"
+
+#if defined(__AVX2__)
+// 在 valid 掩码选中的通道中找出 t 最小的一个，valid 不能为空
+inline int nearest_lane(__m256 t, __m256 valid)
+{
+    // 无效通道置为无穷大后做水平最小值归约，再用掩码找出取得最小值的通道
+    __m256 masked = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), t, valid);
+    __m256 lowest = _mm256_min_ps(masked, _mm256_permute2f128_ps(masked, masked, 0x01));
+    lowest = _mm256_min_ps(lowest, _mm256_shuffle_ps(lowest, lowest, 0x4e));
+    lowest = _mm256_min_ps(lowest, _mm256_shuffle_ps(lowest, lowest, 0xb1));
+    int nearest_bits = _mm256_movemask_ps(_mm256_cmp_ps(masked, lowest, _CMP_EQ_OQ)) & _mm256_movemask_ps(valid);
+    int lane = 0;
+    while (!((nearest_bits >> lane) & 1)) lane++;
+    return lane;
+}
+#endif
+
+/**
+ * @brief 以 SoA 方式打包的一组 Quad，一次求交测试整组
+ *
+ * 每个 Quad 预先展开为平面 (n, D)、原点 Q 以及两条局部坐标投影轴 A = v × w、B = w × u，
+ * 求交只需点积，不再计算叉积。开启 AVX2 时每包 8 个并用一次 256 位运算完成测试，
+ * 否则每包 4 个，逐通道标量计算（编译器通常能将其向量化）。空余通道法向量为零，恒不相交。
+ */
+struct QuadPacket
+{
+#if defined(__AVX2__)
+    static constexpr int WIDTH = 8;
+#else
+    static constexpr int WIDTH = 4;
+#endif
+
+    alignas(32) float _nx[WIDTH];
+    alignas(32) float _ny[WIDTH];
+    alignas(32) float _nz[WIDTH];
+    alignas(32) float _d[WIDTH];
+    alignas(32) float _qx[WIDTH];
+    alignas(32) float _qy[WIDTH];
+    alignas(32) float _qz[WIDTH];
+    alignas(32) float _ax[WIDTH];
+    alignas(32) float _ay[WIDTH];
+    alignas(32) float _az[WIDTH];
+    alignas(32) float _bx[WIDTH];
+    alignas(32) float _by[WIDTH];
+    alignas(32) float _bz[WIDTH];
+    std::uint32_t _index[WIDTH]; // 各通道对应 Quad 在所属数组中的下标
+
+    QuadPacket()
+    {
+        for (int i = 0; i < WIDTH; i++)
+        {
+            _nx[i] = _ny[i] = _nz[i] = _d[i] = 0.f;
+            _qx[i] = _qy[i] = _qz[i] = 0.f;
+            _ax[i] = _ay[i] = _az[i] = 0.f;
+            _bx[i] = _by[i] = _bz[i] = 0.f;
+            _index[i] = 0;
+        }
+    }
+
+    // 空余通道法向量为零
+    inline bool valid(int lane) const { return _nx[lane] != 0.f || _ny[lane] != 0.f || _nz[lane] != 0.f; }
+
+    void set(int lane, const Quad& quad, std::uint32_t index)
+    {
+        const glm::vec3& n = quad.normal();
+        const glm::vec3& q = quad.origin();
+        glm::vec3 a = quad.alpha_axis();
+        glm::vec3 b = quad.beta_axis();
+        _nx[lane] = n.x; _ny[lane] = n.y; _nz[lane] = n.z; _d[lane] = quad.plane_offset();
+        _qx[lane] = q.x; _qy[lane] = q.y; _qz[lane] = q.z;
+        _ax[lane] = a.x; _ay[lane] = a.y; _az[lane] = a.z;
+        _bx[lane] = b.x; _by[lane] = b.y; _bz[lane] = b.z;
+        _index[lane] = index;
+    }
+
+    // 整包求交，返回最近有效命中的通道（无命中返回 -1），并输出其 t 与平面局部坐标
+    int intersect(const Ray& r, float& t_hit, float& alpha_hit, float& beta_hit) const
+    {
+        const glm::vec3& o = r.origin();
+        const glm::vec3& dir = r.direction();
+        const float t_min = r.get_t_range()._min;
+        const float t_max = r.get_t_max();
+#if defined(__AVX2__)
+        const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+        const __m256 dx = _mm256_set1_ps(dir.x), dy = _mm256_set1_ps(dir.y), dz = _mm256_set1_ps(dir.z);
+        const __m256 nx = _mm256_load_ps(_nx), ny = _mm256_load_ps(_ny), nz = _mm256_load_ps(_nz);
+        // 法向量在光线方向上的投影，平行（或空余通道）时为零
+        __m256 denom = _mm256_mul_ps(nx, dx);
+        denom = _mm256_fmadd_ps(ny, dy, denom);
+        denom = _mm256_fmadd_ps(nz, dz, denom);
+        __m256 n_dot_o = _mm256_mul_ps(nx, ox);
+        n_dot_o = _mm256_fmadd_ps(ny, oy, n_dot_o);
+        n_dot_o = _mm256_fmadd_ps(nz, oz, n_dot_o);
+        __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_load_ps(_d), n_dot_o), denom);
+        // 交点相对 Q 的偏移 P - Q = (O - Q) + t·D
+        __m256 px = _mm256_fmadd_ps(t, dx, _mm256_sub_ps(ox, _mm256_load_ps(_qx)));
+        __m256 py = _mm256_fmadd_ps(t, dy, _mm256_sub_ps(oy, _mm256_load_ps(_qy)));
+        __m256 pz = _mm256_fmadd_ps(t, dz, _mm256_sub_ps(oz, _mm256_load_ps(_qz)));
+        __m256 alpha = _mm256_mul_ps(px, _mm256_load_ps(_ax));
+        alpha = _mm256_fmadd_ps(py, _mm256_load_ps(_ay), alpha);
+        alpha = _mm256_fmadd_ps(pz, _mm256_load_ps(_az), alpha);
+        __m256 beta = _mm256_mul_ps(px, _mm256_load_ps(_bx));
+        beta = _mm256_fmadd_ps(py, _mm256_load_ps(_by), beta);
+        beta = _mm256_fmadd_ps(pz, _mm256_load_ps(_bz), beta);
+
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 valid = _mm256_cmp_ps(_mm256_and_ps(denom, abs_mask), _mm256_set1_ps(1e-8f), _CMP_GE_OQ);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_min), _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(alpha, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(alpha, one, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(beta, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(beta, one, _CMP_LE_OQ));
+        if (_mm256_movemask_ps(valid) == 0) return -1;
+        int lane = nearest_lane(t, valid);
+
+        alignas(32) float t_lanes[WIDTH], alpha_lanes[WIDTH], beta_lanes[WIDTH];
+        _mm256_store_ps(t_lanes, t);
+        _mm256_store_ps(alpha_lanes, alpha);
+        _mm256_store_ps(beta_lanes, beta);
+        t_hit = t_lanes[lane];
+        alpha_hit = alpha_lanes[lane];
+        beta_hit = beta_lanes[lane];
+        return lane;
+#else
+        int lane = -1;
+        float nearest = t_max;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            float denom = _nx[i] * dir.x + _ny[i] * dir.y + _nz[i] * dir.z;
+            float t = (_d[i] - (_nx[i] * o.x + _ny[i] * o.y + _nz[i] * o.z)) / denom;
+            float px = o.x - _qx[i] + t * dir.x;
+            float py = o.y - _qy[i] + t * dir.y;
+            float pz = o.z - _qz[i] + t * dir.z;
+            float alpha = px * _ax[i] + py * _ay[i] + pz * _az[i];
+            float beta = px * _bx[i] + py * _by[i] + pz * _bz[i];
+            bool valid = std::fabs(denom) >= 1e-8f && t > t_min && t < nearest
+                && alpha >= 0.f && alpha <= 1.f && beta >= 0.f && beta <= 1.f;
+            if (valid)
+            {
+                lane = i;
+                nearest = t;
+                alpha_hit = alpha;
+                beta_hit = beta;
+            }
+        }
+        if (lane >= 0) t_hit = nearest;
+        return lane;
+#endif
+    }
+};
+
+// 将 [begin, end) 区间内的 Quad 依次打包，末尾不足一包的部分以空通道补齐
+inline void pack_quads(const std::vector<Quad>& quads, std::uint32_t begin, std::uint32_t end, std::vector<QuadPacket>& packets)
+{
+    for (std::uint32_t i = begin; i < end; i += QuadPacket::WIDTH)
+    {
+        QuadPacket packet;
+        for (int lane = 0; lane < QuadPacket::WIDTH && i + lane < end; lane++)
+        {
+            packet.set(lane, quads[i + lane], i + lane);
+        }
+        packets.push_back(packet);
+    }
+}
+
+// 按下标列表打包，同一个 Quad 可以出现在多个包中
+inline void pack_quads(const std::vector<Quad>& quads, const std::vector<std::uint32_t>& indices, std::vector<QuadPacket>& packets)
+{
+    for (size_t i = 0; i < indices.size(); i += QuadPacket::WIDTH)
+    {
+        QuadPacket packet;
+        for (size_t lane = 0; lane < QuadPacket::WIDTH && i + lane < indices.size(); lane++)
+        {
+            packet.set(static_cast<int>(lane), quads[indices[i + lane]], indices[i + lane]);
+        }
+        packets.push_back(packet);
+    }
+}
@@ -0,0 +1,229 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "HitTable.hpp"
+#include "AABB.hpp"
+#include "BVHnode.hpp"
+#include "BVHTopology.hpp"
+
+/**
+ * @brief 压缩 BVH：子节点包围盒以 8/16 位定点数相对父节点包围盒存储，索引为 32 位
+ *
+ * 量化时始终向外取整，解码后的包围盒必定包含原始包围盒，因此只会多测而不会漏测。
+ * 子包围盒在父节点"解码后"的包围盒上量化，遍历时沿栈逐层解码即可还原。
+ *
+ * @tparam Q 量化类型 uint8_t 或 uint16_t
+ */
+template<typename Q>
+class QuantizedBVH : public HitTable
+{
+    static_assert(std::is_same_v<Q, std::uint8_t> || std::is_same_v<Q, std::uint16_t>, "QuantizedBVH supports 8 or 16 bit nodes");
+    static constexpr float QMAX = static_cast<float>(std::numeric_limits<Q>::max());
+    static constexpr std::uint32_t LEAF_FLAG = 0x80000000u;
+    static constexpr int STACK_SIZE = 64;
+
+    struct Box { float _min[3]; float _max[3]; };
+
+    struct Node
+    {
+        Q _min[2][3];
+        Q _max[2][3];
+        std::uint32_t _child[2]; // 最高位置 1 表示图元索引，否则为节点索引
+    };
+
+    std::vector<Node> _nodes;
+    HitTablePtrs _primitives;
+    Box _root;
+
+    static float decode(float origin, float extent, Q q) { return origin + extent * (q / QMAX); }
+
+    // 向外取整量化，并用与遍历相同的解码公式校正浮点误差
+    static void quantize(const Box& parent, const Box& child, Q q_min[3], Q q_max[3])
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            float extent = parent._max[a] - parent._min[a];
+            if (extent <= 0.f)
+            {
+                q_min[a] = 0;
+                q_max[a] = static_cast<Q>(QMAX);
+                continue;
+            }
+            float lo = std::floor((child._min[a] - parent._min[a]) / extent * QMAX);
+            float hi = std::ceil((child._max[a] - parent._min[a]) / extent * QMAX);
+            int qlo = static_cast<int>(std::clamp(lo, 0.f, QMAX));
+            int qhi = static_cast<int>(std::clamp(hi, 0.f, QMAX));
+            while (qlo > 0 && decode(parent._min[a], extent, static_cast<Q>(qlo)) > child._min[a]) qlo--;
+            while (qhi < QMAX && decode(parent._min[a], extent, static_cast<Q>(qhi)) < child._max[a]) qhi++;
+            q_min[a] = static_cast<Q>(qlo);
+            q_max[a] = static_cast<Q>(qhi);
+        }
+    }
+
+    static Box decode_box(const Box& parent, const Q q_min[3], const Q q_max[3])
+    {
+        Box box;
+        for (int a = 0; a < 3; a++)
+        {
+            float extent = parent._max[a] - parent._min[a];
+            box._min[a] = decode(parent._min[a], extent, q_min[a]);
+            box._max[a] = decode(parent._min[a], extent, q_max[a]);
+        }
+        return box;
+    }
+
+    static Box to_box(const AABB& aabb)
+    {
+        return Box
+        {
+            { aabb.get_slab_x()._min, aabb.get_slab_y()._min, aabb.get_slab_z()._min },
+            { aabb.get_slab_x()._max, aabb.get_slab_y()._max, aabb.get_slab_z()._max }
+        };
+    }
+
+    static AABB range_aabb(const HitTablePtrs& objects, size_t begin, size_t end)
+    {
+        AABB box;
+        for (size_t i = begin; i != end; i++) box = objects[i]->get_aabb() + box;
+        return box;
+    }
+
+    // 与 BVHnode 相同的划分策略：沿最长轴排序后取中位数
+    std::uint32_t build(HitTablePtrs& objects, size_t begin, size_t end, const Box& decoded)
+    {
+        std::uint32_t index = static_cast<std::uint32_t>(_nodes.size());
+        _nodes.emplace_back();
+        size_t span = end - begin;
+        size_t ranges[2][2] = { { begin, begin + 1 }, { begin + 1, end } };
+        if (span == 1)
+        {
+            ranges[1][0] = begin;
+            ranges[1][1] = begin + 1;
+        }
+        else if (span > 2)
+        {
+            auto axis = range_aabb(objects, begin, end).longest_axis();
+            box_compare compare = axis == AXIS::X_AXIS ? box_x_compare : (axis == AXIS::Y_AXIS ? box_y_compare : box_z_compare);
+            std::sort(objects.begin() + begin, objects.begin() + end, compare);
+            size_t mid = begin + span / 2;
+            ranges[0][1] = mid;
+            ranges[1][0] = mid;
+        }
+        for (int c = 0; c < 2; c++)
+        {
+            Box child = to_box(range_aabb(objects, ranges[c][0], ranges[c][1]));
+            Q q_min[3], q_max[3];
+            quantize(decoded, child, q_min, q_max);
+            std::uint32_t child_index;
+            if (ranges[c][1] - ranges[c][0] == 1)
+            {
+                child_index = static_cast<std::uint32_t>(ranges[c][0]) | LEAF_FLAG;
+            }
+            else
+            {
+                child_index = build(objects, ranges[c][0], ranges[c][1], decode_box(decoded, q_min, q_max));
+            }
+            Node& node = _nodes[index];
+            std::copy(q_min, q_min + 3, node._min[c]);
+            std::copy(q_max, q_max + 3, node._max[c]);
+            node._child[c] = child_index;
+        }
+        return index;
+    }
+
+    static AABB to_aabb(const Box& box)
+    {
+        return AABB{ glm::vec3{ box._min[0], box._min[1], box._min[2] }, glm::vec3{ box._max[0], box._max[1], box._max[2] } };
+    }
+
+    // 子节点包围盒按解码后的结果写入快照，图元子节点是只含一个图元的叶节点
+    void add_topology(BVHTopology& topology, std::uint32_t parent, std::uint32_t index, const Box& decoded) const
+    {
+        const Node& node = _nodes[index];
+        for (int c = 0; c < 2; c++)
+        {
+            Box child_box = decode_box(decoded, node._min[c], node._max[c]);
+            std::uint32_t child = topology.add_node(to_aabb(child_box));
+            topology._nodes[parent]._child[c] = child;
+            if (node._child[c] & LEAF_FLAG) topology.add_primitive(_primitives[node._child[c] & ~LEAF_FLAG].get());
+            else add_topology(topology, child, node._child[c], child_box);
+        }
+    }
+
+public:
+    QuantizedBVH(HitTablePtrs objects) : _primitives{objects}
+    {
+        if (_primitives.empty()) return;
+        _box = range_aabb(_primitives, 0, _primitives.size());
+        _root = to_box(_box);
+        if (_primitives.size() >= LEAF_FLAG) throw std::runtime_error("QuantizedBVH : too many primitives");
+        build(_primitives, 0, _primitives.size(), _root);
+    }
+
+    inline size_t node_count() const { return _nodes.size(); }
+    // 节点数组占用的字节数，与 BVHnode::memory_footprint 口径一致（不含图元）
+    inline size_t memory_footprint() const { return _nodes.size() * sizeof(Node); }
+
+    BVHTopology topology() const
+    {
+        BVHTopology topology;
+        topology._node_count = node_count();
+        topology._bytes = memory_footprint();
+        if (_nodes.empty()) return topology;
+        add_topology(topology, topology.add_node(to_aabb(_root)), 0, _root);
+        return topology;
+    }
+
+    virtual bool hit(Ray& r, HitRecord& record) override
+    {
+        if (_nodes.empty()) return false;
+        const glm::vec3 orig = r.origin();
+        const glm::vec3 dir = r.direction();
+        const glm::vec3 inv_dir{ 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+        float t_enter;
+        if (!slab_test(_root._min, _root._max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), t_enter)) return false;
+
+        struct Entry { std::uint32_t _node; Box _box; };
+        Entry stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, _root };
+        bool hit_anything = false;
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node& node = _nodes[entry._node];
+            Box child_box[2];
+            float child_t[2];
+            bool child_hit[2];
+            for (int c = 0; c < 2; c++)
+            {
+                child_box[c] = decode_box(entry._box, node._min[c], node._max[c]);
+                child_hit[c] = slab_test(child_box[c]._min, child_box[c]._max, orig, inv_dir, r.get_t_range()._min, r.get_t_max(), child_t[c]);
+            }
+            // 先压入较远的子节点，使较近者先出栈
+            int order[2] = { 0, 1 };
+            if (child_hit[0] && child_hit[1] && child_t[0] < child_t[1]) std::swap(order[0], order[1]);
+            for (int c : order)
+            {
+                if (!child_hit[c]) continue;
+                std::uint32_t child = node._child[c];
+                if (child & LEAF_FLAG)
+                {
+                    if (_primitives[child & ~LEAF_FLAG]->hit(r, record)) hit_anything = true;
+                }
+                else if (top < STACK_SIZE)
+                {
+                    stack[top++] = { child, child_box[c] };
+                }
+            }
+        }
+        return hit_anything;
+    }
+};
+using QuantizedBVH8 = QuantizedBVH<std::uint8_t>;
+using QuantizedBVH16 = QuantizedBVH<std::uint16_t>;
@@ -0,0 +1,312 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "HitTable.hpp"
+#include "Film.hpp"
+
+// 针孔相机的像素网格：像素坐标 (x, y) 处的主光线方向为 _pixel00 + x·_delta_u + y·_delta_v - _center
+struct PinholeFrame
+{
+    glm::vec3 _center;
+    glm::vec3 _pixel00;
+    glm::vec3 _delta_u;
+    glm::vec3 _delta_v;
+
+    inline glm::vec3 direction(const glm::vec2& p) const { return p.x * _delta_u + p.y * _delta_v + _pixel00 - _center; }
+
+    // 把点投影到像素坐标，direction 的逆映射；位于相机平面之后时返回 false
+    bool project(const glm::vec3& point, glm::vec2& screen) const
+    {
+        glm::vec3 normal = glm::cross(_delta_u, _delta_v);
+        float plane = glm::dot(_pixel00 - _center, normal);
+        float depth = glm::dot(point - _center, normal);
+        if (depth * plane <= 0.f) return false;
+        glm::vec3 q = (point - _center) * (plane / depth) + _center - _pixel00;
+        screen = { glm::dot(q, _delta_u) / glm::dot(_delta_u, _delta_u), glm::dot(q, _delta_v) / glm::dot(_delta_v, _delta_v) };
+        return true;
+    }
+};
+
+// G-buffer 中一个子像素样本的主可见性：最近图元的编号、光线参数 t 与图元内参数坐标
+struct GSample
+{
+    float _t;
+    std::uint32_t _id;
+    glm::vec2 _coords;
+};
+
+/**
+ * @brief 每像素若干子像素样本的 G-buffer
+ *
+ * 样本位置由相机按样本编号从采样器取得后写入，光栅化只负责填写可见性，
+ * 因此与逐光线追踪的主光线完全对应。
+ */
+class GBuffer
+{
+    int _width{0};
+    int _height{0};
+    int _samples{0};
+    std::vector<glm::vec2> _positions; // 像素坐标系中的样本位置
+    std::vector<GSample> _visibility;
+
+public:
+    static constexpr std::uint32_t MISS = std::numeric_limits<std::uint32_t>::max();
+
+    GBuffer(int width, int height, int samples) { reset(width, height, samples); }
+
+    void reset(int width, int height, int samples)
+    {
+        _width = width;
+        _height = height;
+        _samples = samples;
+        size_t count = static_cast<size_t>(width) * height * samples;
+        _positions.resize(count);
+        _visibility.resize(count);
+    }
+
+    inline size_t index(int x, int y, int s) const { return (static_cast<size_t>(y) * _width + x) * _samples + s; }
+    inline glm::vec2& position(int x, int y, int s) { return _positions[index(x, y, s)]; }
+    inline const glm::vec2& position(int x, int y, int s) const { return _positions[index(x, y, s)]; }
+    inline GSample& at(int x, int y, int s) { return _visibility[index(x, y, s)]; }
+    inline const GSample& at(int x, int y, int s) const { return _visibility[index(x, y, s)]; }
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline int samples() const { return _samples; }
+    inline size_t memory_footprint() const { return _positions.size() * sizeof(glm::vec2) + _visibility.size() * sizeof(GSample); }
+};
+
+/**
+ * @brief 分块多线程软件光栅化器，为 G-buffer 计算主可见性
+ *
+ * 场景中的 Quad 与球在世界空间收集一次。每帧先把图元投影到屏幕并按 16×16 像素的 tile 分箱，
+ * 再并行处理各 tile：每个样本只与本 tile 的图元做深度测试。Quad 的深度与参数坐标按齐次光栅化
+ * 写成样本位置的线性函数之比（透视校正），球按二次曲面逐样本求解。
+ * 只支持针孔相机，场景中含有变换节点、粒子云等无法光栅化的物体时 complete() 为 false。
+ */
+class Rasterizer
+{
+    static constexpr int TILE_SIZE = 16;
+
+    // Quad 在当前帧的设置：分母、α 与 β 的分子均为样本位置 (x, y) 的线性函数
+    struct QuadSetup
+    {
+        glm::vec3 _denom;   // n · d(x, y)
+        glm::vec3 _alpha;   // A · d(x, y)
+        glm::vec3 _beta;    // B · d(x, y)
+        float _numerator;   // D - n · C
+        float _alpha0;      // (C - Q) · A
+        float _beta0;       // (C - Q) · B
+    };
+
+    std::vector<Quad*> _quads;
+    std::vector<Sphere*> _spheres;
+    bool _complete;
+    PinholeFrame _frame{};
+    std::vector<QuadSetup> _setup;
+    std::vector<std::vector<std::uint32_t>> _bins;
+    size_t _binned{0};
+
+    static inline float eval(const glm::vec3& plane, const glm::vec2& p) { return plane.x + plane.y * p.x + plane.z * p.y; }
+
+    // 把图元编号放入其投影范围覆盖的 tile；有顶点在相机平面之后时保守地覆盖整个屏幕
+    void bin(std::uint32_t id, const glm::vec3* corners, int corner_count, int width, int height, int tiles_x)
+    {
+        glm::vec2 lo{ std::numeric_limits<float>::max() }, hi{ -std::numeric_limits<float>::max() };
+        bool visible = true;
+        for (int i = 0; i < corner_count && visible; i++)
+        {
+            glm::vec2 screen;
+            visible = _frame.project(corners[i], screen);
+            lo = glm::min(lo, screen);
+            hi = glm::max(hi, screen);
+        }
+        // 像素 px 的样本落在 [px - .5, px + .5]，多留一个像素抵消舍入误差
+        int x0 = 0, y0 = 0, x1 = width - 1, y1 = height - 1;
+        if (visible)
+        {
+            if (hi.x < -1.5f || hi.y < -1.5f || lo.x > width + .5f || lo.y > height + .5f) return;
+            x0 = std::max(0, static_cast<int>(std::ceil(lo.x - 1.5f)));
+            y0 = std::max(0, static_cast<int>(std::ceil(lo.y - 1.5f)));
+            x1 = std::min(width - 1, static_cast<int>(std::floor(hi.x + 1.5f)));
+            y1 = std::min(height - 1, static_cast<int>(std::floor(hi.y + 1.5f)));
+        }
+        for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ty++)
+        {
+            for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; tx++)
+            {
+                _bins[static_cast<size_t>(ty) * tiles_x + tx].push_back(id);
+                _binned++;
+            }
+        }
+    }
+
+    void setup(int width, int height)
+    {
+        int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+        _bins.assign(static_cast<size_t>(tiles_x) * tiles_y, {});
+        _binned = 0;
+        _setup.resize(_quads.size());
+        const glm::vec3 base = _frame._pixel00 - _frame._center;
+        for (size_t i = 0; i < _quads.size(); i++)
+        {
+            const Quad& quad = *_quads[i];
+            glm::vec3 n = quad.normal();
+            glm::vec3 a = quad.alpha_axis();
+            glm::vec3 b = quad.beta_axis();
+            glm::vec3 cq = _frame._center - quad.origin();
+            _setup[i] =
+            {
+                { glm::dot(n, base), glm::dot(n, _frame._delta_u), glm::dot(n, _frame._delta_v) },
+                { glm::dot(a, base), glm::dot(a, _frame._delta_u), glm::dot(a, _frame._delta_v) },
+                { glm::dot(b, base), glm::dot(b, _frame._delta_u), glm::dot(b, _frame._delta_v) },
+                quad.plane_offset() - glm::dot(n, _frame._center),
+                glm::dot(cq, a),
+                glm::dot(cq, b)
+            };
+            const glm::vec3& q = quad.origin();
+            glm::vec3 corners[4] = { q, q + quad.edge_u(), q + quad.edge_v(), q + quad.edge_u() + quad.edge_v() };
+            bin(static_cast<std::uint32_t>(i), corners, 4, width, height, tiles_x);
+        }
+        for (size_t i = 0; i < _spheres.size(); i++)
+        {
+            glm::vec3 r{ _spheres[i]->radius() };
+            glm::vec3 lo = _spheres[i]->center() - r, hi = _spheres[i]->center() + r;
+            glm::vec3 corners[8];
+            for (int c = 0; c < 8; c++) corners[c] = { c & 1 ? hi.x : lo.x, c & 2 ? hi.y : lo.y, c & 4 ? hi.z : lo.z };
+            bin(static_cast<std::uint32_t>(_quads.size() + i), corners, 8, width, height, tiles_x);
+        }
+    }
+
+    // 样本 p 与图元 id 做深度测试，更近时写入 sample
+    void test(std::uint32_t id, const glm::vec2& p, GSample& sample) const
+    {
+        static const Interval t_range = Ray{}.get_t_range();
+        if (id < _quads.size())
+        {
+            const QuadSetup& quad = _setup[id];
+            float denom = eval(quad._denom, p);
+            if (std::fabs(denom) < 1e-8) return;
+            float t = quad._numerator / denom;
+            if (!(t > t_range._min && t < sample._t)) return;
+            float alpha = quad._alpha0 + t * eval(quad._alpha, p);
+            float beta = quad._beta0 + t * eval(quad._beta, p);
+            if (!Quad::is_interior(alpha, beta)) return;
+            sample = { t, id, { alpha, beta } };
+            return;
+        }
+        // 与 Sphere::hit 相同的求解方式
+        const Sphere& sphere = *_spheres[id - _quads.size()];
+        glm::vec3 dir = _frame.direction(p);
+        glm::vec3 orign = _frame._center - sphere.center();
+        float a = glm::dot(dir, dir);
+        float b = 2.f * glm::dot(orign, dir);
+        float c = glm::dot(orign, orign) - sphere.radius() * sphere.radius();
+        float delta = b * b - 4 * a * c;
+        if (delta < 0) return;
+        float root = (-1.f * b - std::sqrt(delta)) / (2.f * a);
+        if (!(root > t_range._min && root < sample._t)) root = (-1.f * b + std::sqrt(delta)) / (2.f * a);
+        if (!(root > t_range._min && root < sample._t)) return;
+        sample = { root, id, { 0.f, 0.f } };
+    }
+
+public:
+    explicit Rasterizer(HitTable& world)
+    {
+        _complete = world.collect_raster(_quads, _spheres);
+    }
+
+    // 场景中的所有物体都能被光栅化
+    inline bool complete() const { return _complete; }
+    inline size_t primitive_count() const { return _quads.size() + _spheres.size(); }
+    // 最近一帧分箱后各 tile 图元编号的总数
+    inline size_t binned_count() const { return _binned; }
+
+    /**
+     * @brief 为 gbuffer 中已写入位置的全部样本计算主可见性
+     */
+    void draw(const PinholeFrame& frame, GBuffer& gbuffer)
+    {
+        _frame = frame;
+        const int width = gbuffer.width();
+        const int height = gbuffer.height();
+        setup(width, height);
+        const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+        const int tile_count = static_cast<int>(_bins.size());
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int tile = 0; tile < tile_count; tile++)
+        {
+            const auto& bin = _bins[tile];
+            int x0 = tile % tiles_x * TILE_SIZE, y0 = tile / tiles_x * TILE_SIZE;
+            for (int y = y0; y < std::min(y0 + TILE_SIZE, height); y++)
+            {
+                for (int x = x0; x < std::min(x0 + TILE_SIZE, width); x++)
+                {
+                    for (int s = 0; s < gbuffer.samples(); s++)
+                    {
+                        GSample& sample = gbuffer.at(x, y, s);
+                        sample = { Interval::f_max, GBuffer::MISS, { 0.f, 0.f } };
+                        const glm::vec2& p = gbuffer.position(x, y, s);
+                        for (auto id : bin) test(id, p, sample);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief 把 G-buffer 样本还原为命中记录，与主光线遍历场景后的记录相同
+     *
+     * @return false 样本未命中任何物体
+     */
+    bool fetch(const GSample& sample, Ray& r, HitRecord& record) const
+    {
+        if (sample._id == GBuffer::MISS) return false;
+        r.update_t_max(sample._t);
+        record._t = sample._t;
+        record._coords = sample._coords;
+        if (sample._id < _quads.size()) record._object = _quads[sample._id];
+        else record._object = _spheres[sample._id - _quads.size()];
+        return true;
+    }
+
+    /**
+     * @brief 把 G-buffer 中各样本的几何法线与到相机的距离按像素平均后累加到 normal 与 depth，供降噪作特征输入
+     *
+     * 未命中的样本法线为 0、距离为 0。
+     */
+    void features(const GBuffer& gbuffer, Film& normal, Film& depth) const
+    {
+#pragma omp parallel for schedule(dynamic, 32)
+        for (int y = 0; y < gbuffer.height(); y++)
+        {
+            for (int x = 0; x < gbuffer.width(); x++)
+            {
+                glm::vec3 normal_sum{ 0.f, 0.f, 0.f };
+                float depth_sum = 0.f;
+                for (int s = 0; s < gbuffer.samples(); s++)
+                {
+                    const GSample& sample = gbuffer.at(x, y, s);
+                    if (sample._id == GBuffer::MISS) continue;
+                    glm::vec3 dir = _frame.direction(gbuffer.position(x, y, s));
+                    depth_sum += sample._t * glm::length(dir);
+                    if (sample._id < _quads.size()) normal_sum += _quads[sample._id]->normal();
+                    else
+                    {
+                        const Sphere& sphere = *_spheres[sample._id - _quads.size()];
+                        normal_sum += (_frame._center + sample._t * dir - sphere.center()) / sphere.radius();
+                    }
+                }
+                auto count = static_cast<std::uint32_t>(gbuffer.samples());
+                normal.add(x, y, normal_sum, count);
+                depth.add(x, y, glm::vec3{ depth_sum }, count);
+            }
+        }
+    }
+};
@@ -8,6 +8,8 @@ class Ray
     glm::vec3 _origin;
     glm::vec3 _direction; // 方向单位向量
     Interval _t_range{ .001f, Interval::f_max };
+    float _cone_width{0.f};  // 光锥在起点处的宽度
+    float _cone_spread{0.f}; // 光锥的扩散角（弧度），用于估计纹理采样足迹
 public:
     Ray() = default;
     Ray(const glm::vec3& origin, const glm::vec3& direction) : _origin{origin}, _direction{direction} {}
@@ -18,4 +20,7 @@ public:
     void update_t_max(float t) { _t_range._max = t; }
     float get_t_max() const { return _t_range._max; }
     bool valid_t(float t) const { return _t_range.surrounds(t); }
+    void set_cone(float width, float spread) { _cone_width = width; _cone_spread = spread; }
+    float get_cone_spread() const { return _cone_spread; }
+    float get_cone_width(float t) const { return _cone_width + _cone_spread * t * glm::length(_direction); }
 };
\ No newline at end of file
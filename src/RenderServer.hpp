@@ -0,0 +1,529 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Arena.hpp"
+#include "BDPT.hpp"
+#include "Camera.hpp"
+#include "Film.hpp"
+#include "ImageOutput.hpp"
+#include "LightBVH.hpp"
+#include "Scene.hpp"
+
+/**
+ * 常驻渲染服务
+ *
+ * 场景连同其 BVH 与光源层次按场景名常驻内存，OpenMP 线程组在请求之间保持存活，
+ * 省去每次渲染重新启动进程、建场景与建加速结构的开销。请求来自标准输入或本地 Unix 套接字，
+ * 协议为按行的文本：
+ *   客户端 -> 服务 : "load <scene>"
+ *                    "render <job> <scene> <width> <height> <spp> <output|-> [lookfrom x y z] [lookat x y z] [fov deg] [tile n]"
+ *                    "cancel <job>" / "quit"（断开本连接）/ "shutdown"（完成已有任务后退出服务）
+ *   服务 -> 客户端 : "loaded <scene> <seconds>" / "accepted <job> <tiles>"
+ *                    "tile <job> x0 y0 x1 y1 <bytes>"，其后紧跟 bytes 字节的逐行线性辐射度均值（3 x float）
+ *                    "done <job> <output> <seconds>" / "fail <job> <reason>"
+ * 标准输入读到 EOF 或 quit 时，服务完成已接受的任务后退出；套接字连接断开时取消该连接的任务。
+ */
+struct ServerClient
+{
+    static constexpr size_t MAX_PENDING = size_t{64} << 20; // 积压的输出超过该字节数时断开该连接
+
+    int _in{-1};
+    int _out{-1};
+    bool _console{false};          // 标准输入输出，断开即意味着服务收尾退出
+    std::atomic<bool> _closed{false};
+    std::string _pending;          // 尚未写出的输出，只由主循环访问
+    size_t _written{0};            // _pending 中已写出的字节数
+
+    ServerClient(int in, int out, bool console) : _in{in}, _out{out}, _console{console} {}
+    ~ServerClient()
+    {
+        if (!_console) close(_in);
+    }
+    ServerClient(const ServerClient&) = delete;
+    ServerClient& operator=(const ServerClient&) = delete;
+
+    inline bool has_pending() const { return _written < _pending.size() && !_closed; }
+
+    /**
+     * @brief 尽量写出积压的输出，套接字写满时立即返回，剩余部分留到下次
+     *
+     * 套接字以 MSG_DONTWAIT 写入，不改变读线程共用的文件描述符的阻塞属性；标准输出仍为阻塞写入。
+     * 写入失败（对端已关闭）后不再尝试写入
+     */
+    void flush()
+    {
+        while (has_pending())
+        {
+            const char* bytes = _pending.data() + _written;
+            size_t size = _pending.size() - _written;
+            ssize_t n = _console ? write(_out, bytes, size) : ::send(_out, bytes, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n <= 0) _closed = true;
+            else _written += static_cast<size_t>(n);
+        }
+        if (_written == _pending.size() || _closed)
+        {
+            _pending.clear();
+            _written = 0;
+        }
+        else if (_written > _pending.size() / 2)
+        {
+            _pending.erase(0, _written);
+            _written = 0;
+        }
+    }
+
+    // 追加到输出队列并尽量写出；不读取输出的客户端积压超过 MAX_PENDING 后被断开，其任务随之取消
+    bool send(const void* data, size_t size)
+    {
+        if (_closed) return false;
+        _pending.append(static_cast<const char*>(data), size);
+        if (_pending.size() - _written > MAX_PENDING && !_console)
+        {
+            std::cerr << "dropping a client with " << (_pending.size() - _written) << " bytes of unread output\n";
+            _closed = true;
+            shutdown(_in, SHUT_RDWR);
+        }
+        flush();
+        return !_closed;
+    }
+    bool send(const std::string& line) { return send(line.data(), line.size()); }
+};
+using ServerClientPtr = std::shared_ptr<ServerClient>;
+
+class RenderServer
+{
+    // 常驻的场景：对象都分配在自己的 arena 中，成员按声明的逆序销毁，arena 最后释放
+    struct Scene
+    {
+        Arena _arena;
+        HitTableList _world;
+        LightBVHPtr _lights;
+        IntegratorPtr _integrator; // 每个场景一个实例，积分器的缓存只属于该场景
+    };
+
+    struct Job
+    {
+        std::string _id;
+        ServerClientPtr _client;
+        Scene* _scene{nullptr};
+        Camera _camera;
+        Film _film;
+        std::string _output;
+        std::vector<Region> _tiles;
+        size_t _next{0};       // 下一个待分发的 tile
+        size_t _finished{0};
+        std::chrono::high_resolution_clock::time_point _start;
+    };
+
+    struct Request
+    {
+        ServerClientPtr _client;
+        std::string _line;
+        bool _disconnect{false};
+    };
+
+    static constexpr std::chrono::milliseconds FLUSH_INTERVAL{10};
+    static constexpr std::chrono::seconds DRAIN_TIMEOUT{5};
+
+    Camera _base;                                        // 新任务的相机从它复制，携带采样数与环境光等全局设置
+    std::string _integrator;                             // 积分器名称，每个场景创建自己的实例
+    std::map<std::string, std::unique_ptr<Scene>> _scenes;
+    std::vector<std::unique_ptr<Job>> _jobs;             // 声明在 _scenes 之后，先于场景销毁
+    size_t _turn{0};                                     // 轮转分发 tile 的起始任务
+    bool _stopping{false};
+
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::deque<Request> _requests;
+    std::vector<std::thread> _readers;
+    std::vector<std::weak_ptr<ServerClient>> _clients;
+    std::thread _acceptor;
+    int _listen{-1};
+
+    void push(Request request)
+    {
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _requests.push_back(std::move(request));
+        }
+        _ready.notify_one();
+    }
+
+    // 读线程：把收到的每一行交给主循环，连接断开或收到 quit/shutdown 后结束
+    void read_requests(ServerClientPtr client)
+    {
+        std::string buffer;
+        char chunk[4096];
+        bool reading = true;
+        while (reading)
+        {
+            ssize_t n = read(client->_in, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            buffer.append(chunk, static_cast<size_t>(n));
+            size_t start = 0, end;
+            while (reading && (end = buffer.find('\n', start)) != std::string::npos)
+            {
+                std::string line = buffer.substr(start, end - start);
+                start = end + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.empty()) continue;
+                reading = line != "quit";
+                push({ client, line });
+                if (line == "shutdown") reading = false;
+            }
+            buffer.erase(0, start);
+        }
+        push({ client, "", true });
+    }
+
+    void start_reader(ServerClientPtr client)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        _clients.push_back(client);
+        _readers.emplace_back(&RenderServer::read_requests, this, client);
+    }
+
+    static void reply(const ServerClientPtr& client, const std::string& line) { client->send(line + "\n"); }
+
+    // 写出各连接积压的输出，返回是否仍有未写完的连接
+    bool flush_clients()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        bool pending = false;
+        for (auto& weak : _clients)
+        {
+            if (auto client = weak.lock())
+            {
+                client->flush();
+                pending |= client->has_pending();
+            }
+        }
+        return pending;
+    }
+
+    Scene* load(const std::string& name, double* seconds = nullptr)
+    {
+        auto found = _scenes.find(name);
+        if (found != _scenes.end()) return found->second.get();
+        auto t1 = std::chrono::high_resolution_clock::now();
+        auto scene = std::make_unique<Scene>();
+        {
+            ArenaScope scope{scene->_arena};
+            if (!named_scene(name, scene->_world)) return nullptr;
+            auto lights = std::make_shared<LightBVH>(scene->_world);
+            scene->_lights = lights->empty() ? nullptr : lights;
+        }
+        scene->_integrator = make_integrator(_integrator);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration<double>(t2 - t1).count();
+        if (seconds) *seconds = elapsed;
+        std::cerr << "scene " << name << " loaded in " << std::fixed << std::setprecision(3) << elapsed << " s\n";
+        return _scenes.emplace(name, std::move(scene)).first->second.get();
+    }
+
+    bool parse_render(std::istringstream& in, Job& job, std::string& error)
+    {
+        std::string scene;
+        int width = 0, height = 0, spp = 0, tile = 32;
+        in >> job._id >> scene >> width >> height >> spp >> job._output;
+        if (in.fail())
+        {
+            error = "expected: render <job> <scene> <width> <height> <spp> <output>";
+            return false;
+        }
+        if (width <= 0 || height <= 0 || width > Film::MAX_DIMENSION || height > Film::MAX_DIMENSION || spp <= 0)
+        {
+            error = "bad resolution or spp";
+            return false;
+        }
+        glm::vec3 lookfrom{ 0.f, 0.f, 0.f }, lookat{ 0.f, 0.f, -3.f };
+        float fov = 45.f;
+        std::string key;
+        while (in >> key)
+        {
+            if (key == "lookfrom") in >> lookfrom.x >> lookfrom.y >> lookfrom.z;
+            else if (key == "lookat") in >> lookat.x >> lookat.y >> lookat.z;
+            else if (key == "fov") in >> fov;
+            else if (key == "tile") in >> tile;
+            else in.setstate(std::ios::failbit);
+            if (in.fail())
+            {
+                error = "bad option " + key;
+                return false;
+            }
+        }
+        if (tile <= 0 || fov <= 0.f || fov >= 180.f || lookfrom == lookat)
+        {
+            error = "bad tile size or view";
+            return false;
+        }
+        ImageFormat format;
+        if (job._output != "-" && !image_format_from_path(job._output, format))
+        {
+            error = "unknown image format " + job._output;
+            return false;
+        }
+        if (_jobs.end() != std::find_if(_jobs.begin(), _jobs.end(), [&](const auto& other) { return other->_id == job._id && other->_client == job._client; }))
+        {
+            error = "duplicate job id";
+            return false;
+        }
+        job._scene = load(scene);
+        if (!job._scene)
+        {
+            error = "unknown scene " + scene;
+            return false;
+        }
+        job._camera = _base;
+        job._camera.set_resolution(width, height);
+        job._camera.set_view(lookfrom, lookat, fov);
+        job._camera.set_samples_per_pixel(spp);
+        job._camera.set_lights(job._scene->_lights);
+        job._film = Film{ width, height };
+        for (int y = 0; y < height; y += tile)
+        {
+            for (int x = 0; x < width; x += tile)
+            {
+                job._tiles.push_back({ x, y, std::min(x + tile, width), std::min(y + tile, height) });
+            }
+        }
+        return true;
+    }
+
+    void cancel_jobs(const ServerClientPtr& client, const std::string& id = "")
+    {
+        _jobs.erase(std::remove_if(_jobs.begin(), _jobs.end(), [&](const auto& job)
+        {
+            return job->_client == client && (id.empty() || job->_id == id);
+        }), _jobs.end());
+    }
+
+    void handle(const Request& request)
+    {
+        const auto& client = request._client;
+        if (request._disconnect)
+        {
+            if (client->_console) _stopping = true;
+            else cancel_jobs(client);
+            return;
+        }
+        std::istringstream in{request._line};
+        std::string command;
+        in >> command;
+        if (command == "load")
+        {
+            std::string name;
+            in >> name;
+            double seconds = 0.;
+            bool cached = _scenes.count(name) > 0;
+            if (!load(name, &seconds)) reply(client, "fail - unknown scene " + name);
+            else reply(client, "loaded " + name + " " + std::to_string(cached ? 0. : seconds));
+        }
+        else if (command == "render")
+        {
+            auto job = std::make_unique<Job>();
+            job->_client = client;
+            std::string error;
+            if (_stopping) reply(client, "fail - server is shutting down");
+            else if (!parse_render(in, *job, error)) reply(client, "fail " + (job->_id.empty() ? std::string{"-"} : job->_id) + " " + error);
+            else
+            {
+                job->_start = std::chrono::high_resolution_clock::now();
+                reply(client, "accepted " + job->_id + " " + std::to_string(job->_tiles.size()));
+                _jobs.push_back(std::move(job));
+            }
+        }
+        else if (command == "cancel")
+        {
+            std::string id;
+            in >> id;
+            cancel_jobs(client, id);
+        }
+        else if (command == "shutdown") _stopping = true;
+        else if (command != "quit") reply(client, "fail - unknown command " + command);
+    }
+
+    // 流式返回一个 tile 的线性辐射度均值
+    static void send_tile(Job& job, const Region& region)
+    {
+        std::vector<glm::vec3> pixels;
+        pixels.reserve(static_cast<size_t>(region.width()) * region.height());
+        for (int y = region._y0; y < region._y1; y++)
+        {
+            for (int x = region._x0; x < region._x1; x++) pixels.push_back(job._film.mean(x, y));
+        }
+        std::ostringstream header;
+        header << "tile " << job._id << ' ' << region._x0 << ' ' << region._y0 << ' ' << region._x1 << ' ' << region._y1 << ' '
+               << pixels.size() * sizeof(glm::vec3) << '\n';
+        job._client->send(header.str());
+        job._client->send(pixels.data(), pixels.size() * sizeof(glm::vec3));
+    }
+
+    void finish(Job& job)
+    {
+        bool ok = job._output == "-" || write_image(job._output, job._film, job._camera.tone_map());
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - job._start).count();
+        if (ok) reply(job._client, "done " + job._id + " " + job._output + " " + std::to_string(seconds));
+        else reply(job._client, "fail " + job._id + " can't write " + job._output);
+    }
+
+    /**
+     * @brief 从所有进行中的任务轮流取 tile 组成一批并行渲染，渲染完后流式返回并结束已完成的任务
+     *
+     * 积分器可并发时批次按 tile 并行，Camera::render 内层的 parallel for 处于嵌套区域中只用一个线程；
+     * 否则逐个 tile 渲染，由积分器自己在 tile 内并行。BDPT 会把贡献写到 tile 之外，流式返回的 tile 只是中间结果，
+     * 完成时写出的图像才包含全部贡献。每批只有约两倍线程数个 tile，批次之间处理新请求，新任务最迟在一批之后就能分到线程。
+     */
+    void render_batch()
+    {
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t capacity = std::max<size_t>(2 * threads, _jobs.size());
+        std::vector<std::pair<Job*, Region>> batch;
+        for (bool progress = true; progress && batch.size() < capacity;)
+        {
+            progress = false;
+            for (size_t k = 0; k < _jobs.size() && batch.size() < capacity; k++)
+            {
+                Job& job = *_jobs[(_turn + k) % _jobs.size()];
+                if (job._next >= job._tiles.size()) continue;
+                batch.push_back({ &job, job._tiles[job._next++] });
+                progress = true;
+            }
+        }
+        _turn++;
+        int count = static_cast<int>(batch.size());
+        bool concurrent = std::all_of(batch.begin(), batch.end(), [](const auto& item) { return item.first->_scene->_integrator->concurrent(); });
+#pragma omp parallel for schedule(dynamic, 1) if(concurrent)
+        for (int i = 0; i < count; i++)
+        {
+            Job& job = *batch[i].first;
+            job._scene->_integrator->render(job._camera, job._film, batch[i].second, 0, job._camera.get_samples_per_pixel(), job._scene->_world);
+        }
+        for (auto& [job, region] : batch)
+        {
+            send_tile(*job, region);
+            job->_finished++;
+        }
+        _jobs.erase(std::remove_if(_jobs.begin(), _jobs.end(), [this](const auto& job)
+        {
+            if (job->_client->_closed && !job->_client->_console) return true;
+            if (job->_finished < job->_tiles.size()) return false;
+            finish(*job);
+            return true;
+        }), _jobs.end());
+    }
+
+    bool listen_on(const std::string& path)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "socket path too long: " << path << "\n";
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        // 只清理上次遗留的套接字文件，不覆盖其他文件
+        std::error_code error;
+        if (std::filesystem::is_socket(path, error)) unlink(path.c_str());
+        _listen = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listen < 0 || bind(_listen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(_listen, 16) != 0)
+        {
+            std::cerr << "can't listen on " << path << ": " << std::strerror(errno) << "\n";
+            return false;
+        }
+        _acceptor = std::thread([this]()
+        {
+            while (true)
+            {
+                int fd = accept(_listen, nullptr, nullptr);
+                if (fd < 0 && errno == EINTR) continue;
+                if (fd < 0) break;
+                start_reader(std::make_shared<ServerClient>(fd, fd, false));
+            }
+        });
+        std::cerr << "listening on " << path << "\n";
+        return true;
+    }
+
+    void stop_listening(const std::string& path)
+    {
+        if (_listen < 0) return;
+        shutdown(_listen, SHUT_RDWR);
+        if (_acceptor.joinable()) _acceptor.join();
+        close(_listen);
+        _listen = -1;
+        unlink(path.c_str());
+    }
+
+public:
+    RenderServer(const Camera& base, std::string integrator) : _base{base}, _integrator{std::move(integrator)} {}
+    ~RenderServer()
+    {
+        for (auto& reader : _readers)
+        {
+            if (reader.joinable()) reader.join();
+        }
+    }
+
+    /**
+     * @brief 运行服务直至收到 shutdown（套接字）或标准输入结束
+     *
+     * @param socket_path 为空时从标准输入读取请求、向标准输出应答，否则在该路径监听 Unix 套接字
+     */
+    int run(const std::string& socket_path)
+    {
+        std::signal(SIGPIPE, SIG_IGN);
+        if (socket_path.empty()) start_reader(std::make_shared<ServerClient>(STDIN_FILENO, STDOUT_FILENO, true));
+        else if (!listen_on(socket_path)) return 1;
+        while (!_stopping || !_jobs.empty())
+        {
+            bool pending = flush_clients();
+            std::deque<Request> requests;
+            {
+                std::unique_lock<std::mutex> lock{_mutex};
+                // 没有进行中的任务时等待请求，仍有积压的输出时定期醒来继续写出
+                auto ready = [this] { return !_requests.empty(); };
+                if (_jobs.empty() && pending) _ready.wait_for(lock, FLUSH_INTERVAL, ready);
+                else if (_jobs.empty()) _ready.wait(lock, ready);
+                requests.swap(_requests);
+            }
+            for (const auto& request : requests) handle(request);
+            if (!_jobs.empty()) render_batch();
+        }
+        // 退出前给积压的输出有限的时间写完
+        auto deadline = std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+        while (flush_clients() && std::chrono::steady_clock::now() < deadline) std::this_thread::sleep_for(FLUSH_INTERVAL);
+        stop_listening(socket_path);
+        // 唤醒仍阻塞在读取上的连接，读线程随后结束
+        std::lock_guard<std::mutex> lock{_mutex};
+        for (auto& weak : _clients)
+        {
+            if (auto client = weak.lock(); client && !client->_console) shutdown(client->_in, SHUT_RDWR);
+        }
+        return 0;
+    }
+};
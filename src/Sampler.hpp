@@ -0,0 +1,359 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// SplitMix64 混合函数，把 (像素, 样本) 等整数键打散为种子
+inline std::uint64_t mix_seed(std::uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// PCG32 随机数发生器，状态仅 16 字节，可以廉价地按样本重新播种
+class Pcg32
+{
+    std::uint64_t _state{0x853c49e6748fea9bull};
+    std::uint64_t _inc{0xda3e39cb94b95bdbull};
+public:
+    using result_type = std::uint32_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xffffffffu; }
+
+    void seed(std::uint64_t state, std::uint64_t sequence)
+    {
+        _state = 0;
+        _inc = (sequence << 1u) | 1u;
+        (*this)();
+        _state += state;
+        (*this)();
+    }
+
+    result_type operator()()
+    {
+        std::uint64_t old = _state;
+        _state = old * 6364136223846793005ull + _inc;
+        auto xorshifted = static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+        auto rot = static_cast<std::uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+    }
+};
+
+/**
+ * 采样器：为 (像素, 样本编号, 维度) 提供 [0,1) 内的样本值
+ *
+ * 每个样本开始时调用 start，之后每次 get_1d 取下一维。所有随机决策（像素抖动、
+ * 半球采样、菲涅耳选择……）按调用顺序依次占用维度，因此靠前的维度质量最好。
+ */
+enum class SamplerType { UNIFORM, SOBOL, HALTON, BLUE_NOISE };
+
+inline bool parse_sampler_type(const std::string& name, SamplerType& type)
+{
+    if (name == "uniform") type = SamplerType::UNIFORM;
+    else if (name == "sobol") type = SamplerType::SOBOL;
+    else if (name == "halton") type = SamplerType::HALTON;
+    else if (name == "bluenoise") type = SamplerType::BLUE_NOISE;
+    else return false;
+    return true;
+}
+
+// 32 位整数转为 [0,1) 浮点
+inline float u32_to_unit_float(std::uint32_t x)
+{
+    return std::min(x * 0x1p-32f, 0x1.fffffep-1f);
+}
+
+inline std::uint32_t reverse_bits(std::uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Laine-Karras 置换，配合位反转即为嵌套均匀（Owen）扰乱，见 Burley 2020
+inline std::uint32_t nested_uniform_scramble(std::uint32_t x, std::uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// Sobol 序列的前两维：第 0 维为 van der Corput，第 1 维的方向数由 v_i = v_{i-1} ^ (v_{i-1} >> 1) 递推
+inline std::uint32_t sobol_2d(std::uint32_t index, int component)
+{
+    if (component == 0) return reverse_bits(index);
+    std::uint32_t result = 0;
+    for (std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1u) result ^= v;
+    }
+    return result;
+}
+
+/**
+ * @brief Owen 扰乱的 Sobol 采样：每两维组成一对 2D Sobol 点，
+ * 以 (像素, 维度对) 为种子打乱样本顺序并扰乱数值，高维之间互不相关
+ */
+inline float owen_sobol(std::uint32_t index, std::uint32_t dimension, std::uint64_t seed)
+{
+    auto pair = dimension >> 1;
+    auto hash = mix_seed(seed ^ mix_seed(pair));
+    std::uint32_t shuffled = nested_uniform_scramble(index, static_cast<std::uint32_t>(hash));
+    std::uint32_t value = sobol_2d(shuffled, dimension & 1);
+    return u32_to_unit_float(nested_uniform_scramble(value, static_cast<std::uint32_t>(hash >> 32) + (dimension & 1)));
+}
+
+class Sampler
+{
+protected:
+    std::uint32_t _dimension{0};
+public:
+    virtual ~Sampler() = default;
+    // 开始像素 (x, y) 的第 sample 个样本，维度计数归零
+    virtual void start(int x, int y, std::uint32_t sample) = 0;
+    // 取下一维样本值，范围 [0,1)
+    virtual float get_1d() = 0;
+    glm::vec2 get_2d()
+    {
+        float u = get_1d();
+        return { u, get_1d() };
+    }
+};
+using SamplerPtr = std::unique_ptr<Sampler>;
+
+// 独立均匀随机数，按 (像素, 样本) 播种
+class UniformSampler : public Sampler
+{
+    Pcg32 _gen;
+public:
+    virtual void start(int x, int y, std::uint32_t sample) override
+    {
+        auto pixel = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(y)) << 32) | static_cast<std::uint32_t>(x);
+        _gen.seed(mix_seed(pixel), mix_seed(sample));
+        _dimension = 0;
+    }
+    virtual float get_1d() override
+    {
+        _dimension++;
+        return u32_to_unit_float(_gen());
+    }
+};
+
+class SobolSampler : public Sampler
+{
+    std::uint64_t _seed{0};
+    std::uint32_t _index{0};
+public:
+    virtual void start(int x, int y, std::uint32_t sample) override
+    {
+        _seed = mix_seed((static_cast<std::uint64_t>(static_cast<std::uint32_t>(y)) << 32) | static_cast<std::uint32_t>(x));
+        _index = sample;
+        _dimension = 0;
+    }
+    virtual float get_1d() override { return owen_sobol(_index, _dimension++, _seed); }
+};
+
+/**
+ * @brief Halton 序列，第 d 维以第 d 个素数为底，每像素每维做一次 Cranley-Patterson 旋转；
+ * 超出素数表的维度退化为哈希得到的均匀随机数
+ */
+class HaltonSampler : public Sampler
+{
+    static constexpr std::array<std::uint32_t, 48> PRIMES
+    {
+        2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+        59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+        137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223
+    };
+    std::uint64_t _seed{0};
+    std::uint32_t _index{0};
+
+    static float radical_inverse(std::uint32_t index, std::uint32_t base)
+    {
+        double inv_base = 1.0 / base;
+        double factor = inv_base;
+        double result = 0.0;
+        while (index)
+        {
+            result += (index % base) * factor;
+            index /= base;
+            factor *= inv_base;
+        }
+        return static_cast<float>(result);
+    }
+
+public:
+    virtual void start(int x, int y, std::uint32_t sample) override
+    {
+        _seed = mix_seed((static_cast<std::uint64_t>(static_cast<std::uint32_t>(y)) << 32) | static_cast<std::uint32_t>(x));
+        _index = sample;
+        _dimension = 0;
+    }
+    virtual float get_1d() override
+    {
+        auto dimension = _dimension++;
+        auto hash = mix_seed(_seed ^ mix_seed(dimension));
+        if (dimension >= PRIMES.size()) return u32_to_unit_float(static_cast<std::uint32_t>(mix_seed(hash ^ _index)));
+        float value = radical_inverse(_index, PRIMES[dimension]) + u32_to_unit_float(static_cast<std::uint32_t>(hash));
+        return std::min(value - std::floor(value), 0x1.fffffep-1f);
+    }
+};
+
+/**
+ * @brief 64x64 的蓝噪声阈值图，用 void-and-cluster 算法在首次使用时生成
+ */
+class BlueNoiseMask
+{
+public:
+    static constexpr int SIZE = 64;
+    static constexpr int MASK = SIZE - 1;
+
+    static const BlueNoiseMask& get()
+    {
+        static const BlueNoiseMask mask;
+        return mask;
+    }
+
+    // 返回 [0,1) 内的阈值
+    inline float value(int x, int y) const { return _rank[(y & MASK) * SIZE + (x & MASK)] * (1.f / (SIZE * SIZE)); }
+
+private:
+    std::vector<std::uint32_t> _rank;
+
+    BlueNoiseMask() : _rank(SIZE * SIZE, 0)
+    {
+        constexpr int N = SIZE * SIZE;
+        constexpr float sigma = 1.5f;
+        // 环绕距离下的高斯核
+        std::vector<float> kernel(N);
+        for (int dy = 0; dy < SIZE; dy++)
+        {
+            for (int dx = 0; dx < SIZE; dx++)
+            {
+                int tx = std::min(dx, SIZE - dx);
+                int ty = std::min(dy, SIZE - dy);
+                kernel[dy * SIZE + dx] = std::exp(-(tx * tx + ty * ty) / (2.f * sigma * sigma));
+            }
+        }
+        std::vector<char> bits(N, 0);
+        std::vector<float> energy(N, 0.f);
+        auto splat = [&](int p, float sign)
+        {
+            int px = p % SIZE, py = p / SIZE;
+            for (int y = 0; y < SIZE; y++)
+            {
+                const float* row = &kernel[((y - py) & MASK) * SIZE];
+                float* e = &energy[y * SIZE];
+                for (int x = 0; x < SIZE; x++) e[x] += sign * row[(x - px) & MASK];
+            }
+        };
+        auto tightest_cluster = [&]()
+        {
+            int best = -1;
+            for (int p = 0; p < N; p++) if (bits[p] && (best < 0 || energy[p] > energy[best])) best = p;
+            return best;
+        };
+        auto largest_void = [&]()
+        {
+            int best = -1;
+            for (int p = 0; p < N; p++) if (!bits[p] && (best < 0 || energy[p] < energy[best])) best = p;
+            return best;
+        };
+
+        // 初始随机图案，约 1/10 的像素为 1
+        int ones = 0;
+        std::uint64_t state = 0x5eedull;
+        while (ones < N / 10)
+        {
+            int p = static_cast<int>(mix_seed(state++) % N);
+            if (bits[p]) continue;
+            bits[p] = 1;
+            splat(p, 1.f);
+            ones++;
+        }
+        // 把最紧的簇移动到最大的空洞，直到图案稳定
+        for (int iteration = 0; iteration < N; iteration++)
+        {
+            int cluster = tightest_cluster();
+            bits[cluster] = 0;
+            splat(cluster, -1.f);
+            int hole = largest_void();
+            bits[hole] = 1;
+            splat(hole, 1.f);
+            if (hole == cluster) break;
+        }
+        // 阶段一：逐个移除最紧的簇，给初始图案中的点赋秩
+        std::vector<char> initial = bits;
+        std::vector<float> initial_energy = energy;
+        for (int rank = ones - 1; rank >= 0; rank--)
+        {
+            int cluster = tightest_cluster();
+            bits[cluster] = 0;
+            splat(cluster, -1.f);
+            _rank[cluster] = rank;
+        }
+        // 阶段二：从初始图案出发不断填充最大空洞直到填满
+        bits = initial;
+        energy = initial_energy;
+        for (int rank = ones; rank < N; rank++)
+        {
+            int hole = largest_void();
+            bits[hole] = 1;
+            splat(hole, 1.f);
+            _rank[hole] = rank;
+        }
+    }
+};
+
+/**
+ * @brief 蓝噪声抖动的 Sobol：所有像素共享同一条 Owen 扰乱的 Sobol 序列，
+ * 每个像素按蓝噪声阈值图做 Cranley-Patterson 平移，使像素间误差呈蓝噪声分布
+ */
+class BlueNoiseSampler : public Sampler
+{
+    int _x{0};
+    int _y{0};
+    std::uint32_t _index{0};
+public:
+    virtual void start(int x, int y, std::uint32_t sample) override
+    {
+        _x = x;
+        _y = y;
+        _index = sample;
+        _dimension = 0;
+    }
+    virtual float get_1d() override
+    {
+        auto dimension = _dimension++;
+        auto hash = mix_seed(0xb1eull ^ mix_seed(dimension));
+        // 每一维对阈值图做不同的环绕平移以去相关
+        float shift = BlueNoiseMask::get().value(_x + static_cast<int>(hash & 0xffff), _y + static_cast<int>((hash >> 16) & 0xffff));
+        float value = owen_sobol(_index, dimension, 0x5eedull) + shift;
+        return std::min(value - std::floor(value), 0x1.fffffep-1f);
+    }
+};
+
+inline SamplerPtr make_sampler(SamplerType type)
+{
+    switch (type)
+    {
+    case SamplerType::SOBOL: return std::make_unique<SobolSampler>();
+    case SamplerType::HALTON: return std::make_unique<HaltonSampler>();
+    case SamplerType::BLUE_NOISE: return std::make_unique<BlueNoiseSampler>();
+    default: return std::make_unique<UniformSampler>();
+    }
+}
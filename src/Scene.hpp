@@ -4,15 +4,53 @@
 #include "Material.hpp"
 #include "Transform.hpp"
 #include "BVHnode.hpp"
+#include "GeometryStore.hpp"
+#include "SphereCloud.hpp"
+#include "TriangleMesh.hpp"
+#include <cstdint>
 #include <memory>
+#include <string>
 
-inline HitTableList cornell_box()
+/**
+ * @brief 内置场景随机布局使用的生成器
+ *
+ * 每个场景以固定种子构造自己的 PCG32，不读写线程局部的 RANDOM，
+ * 同一场景在命令行、分布式 worker 与渲染服务中得到相同的几何，与采样器类型和之前的渲染无关
+ */
+class SceneRandom
 {
-    HitTableList world;
-    auto red = std::make_shared<Lambertian>(glm::vec3(.65f, .05f, .05f));
-    auto white = std::make_shared<Lambertian>(glm::vec3(.73f, .73f, .73f));
-    auto green = std::make_shared<Lambertian>(glm::vec3(.12f, .45f, .15f));
-    auto light = std::make_shared<DiffuseLight>(glm::vec3(15.f, 15.f, 15.f));
+    Pcg32 _pcg;
+public:
+    explicit SceneRandom(std::uint64_t seed) { _pcg.seed(seed, 0); }
+
+    inline float get_float(float min, float max) { return min + (max - min) * u32_to_unit_float(_pcg()); }
+    inline glm::vec3 get_color() { return { get_float(0.f, 1.f), get_float(0.f, 1.f), get_float(0.f, 1.f) }; }
+
+    // 拒绝采样单位球面上的均匀方向
+    glm::vec3 get_unit_vec3()
+    {
+        while (true)
+        {
+            glm::vec3 p{ get_float(-1.f, 1.f), get_float(-1.f, 1.f), get_float(-1.f, 1.f) };
+            float len2 = glm::dot(p, p);
+            if (len2 > 0.f && len2 < 1.f) return glm::normalize(p);
+        }
+    }
+};
+
+// Cornell box 中可动画物体的句柄
+struct CornellBoxHandles
+{
+    std::shared_ptr<Translate> _tall_box;          // 高盒子的平移
+    std::shared_ptr<RotateY> _short_box_rotation;  // 矮盒子的旋转
+};
+
+// Cornell box 的五面墙与顶灯
+inline void add_cornell_room(HitTableList& world, const MaterialPtr& white)
+{
+    auto red = make_object<Lambertian>(glm::vec3(.65f, .05f, .05f));
+    auto green = make_object<Lambertian>(glm::vec3(.12f, .45f, .15f));
+    auto light = make_object<DiffuseLight>(glm::vec3(15.f, 15.f, 15.f));
 
     auto depth = -15.f;
     auto length = -7.f;
@@ -20,32 +58,284 @@ inline HitTableList cornell_box()
     auto light_length = -2.5f;
     auto half_light_length = 1.25f;
     auto light_depth = -10.f;
+    // 光源与天花板的间隙须大于光线的最小 t，否则从光源发出的光子子路径会穿过间隙漏进房间
+    auto light_gap = 2e-3f;
 
-    world.add(std::make_shared<Quad>(
+    world.add(make_object<Quad>(
         glm::vec3(half_length, half_length, depth), glm::vec3(length, 0.f, 0.f), glm::vec3(0.f, length, 0.f), white));
-    world.add(std::make_shared<Quad>(
+    world.add(make_object<Quad>(
         glm::vec3(half_length, half_length, depth), glm::vec3(length, 0.f, 0.f), glm::vec3(0.f, 0.f, -length), white));  
-    world.add(std::make_shared<Quad>(
+    world.add(make_object<Quad>(
         glm::vec3(-half_length, -half_length, depth), glm::vec3(-length, 0.f, 0.f), glm::vec3(0.f, 0.f, -length), white));                
-    world.add(std::make_shared<Quad>(
+    world.add(make_object<Quad>(
         glm::vec3(half_length, half_length, depth), glm::vec3(0.f, length, 0.f), glm::vec3(0.f, 0.f, -length), red));         
-    world.add(std::make_shared<Quad>(
+    world.add(make_object<Quad>(
         glm::vec3(-half_length, -half_length, depth), glm::vec3(0.f, -length, 0.f), glm::vec3(0.f, 0.f, -length), green));         
-    world.add(std::make_shared<Quad>(
-        glm::vec3(-0.5f, 1e-4 - half_length, light_depth), glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, 0.f, -1.f), light));  
+    world.add(make_object<Quad>(
+        glm::vec3(-0.5f, light_gap - half_length, light_depth), glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, 0.f, -1.f), light));  
+}
+
+inline HitTableList cornell_box(CornellBoxHandles* handles = nullptr)
+{
+    HitTableList world;
+    auto white = make_object<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    add_cornell_room(world, white);
+    auto half_length = 3.5f;
 
     float w1 = 1.65f;        
     auto box1 = create_box(w1, w1 * 2, w1, white);
     box1 = transform<RotateY>(box1, 15.f);
     box1 = transform<Translate>(box1, glm::vec3(-1.3f, half_length - w1, -11.4f));
     world.add(box1);
+    if (handles) handles->_tall_box = std::dynamic_pointer_cast<Translate>(box1);
 
     float w2 = 1.65f;        
     auto box2 = create_box(w2, w2, w2, white);
     box2 = transform<RotateY>(box2, -18.f);
+    if (handles) handles->_short_box_rotation = std::dynamic_pointer_cast<RotateY>(box2);
     box2 = transform<Translate>(box2, glm::vec3(1.3f, half_length - w2 / 2, -10.4f));
     world.add(box2);    
 
     return world;
 
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 用加载的模型代替 Cornell box 中的两个盒子
+ *
+ * 模型按 y 轴向上摆放：等比缩放到最长边为 4.5，底面中心放在地面中央。场景的 y 轴朝下，因此 y 取反。
+ */
+inline HitTableList cornell_box_model(const MeshData& mesh)
+{
+    HitTableList world;
+    add_cornell_room(world, make_object<Lambertian>(glm::vec3(.73f, .73f, .73f)));
+    glm::vec3 lo, hi;
+    mesh.bounds(lo, hi);
+    glm::vec3 extent = hi - lo;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    float s = size > 0.f ? 4.5f / size : 1.f;
+    glm::vec3 center = (lo + hi) / 2.f;
+    auto model = make_object<TriangleMesh>(mesh, glm::vec3(s, -s, s), glm::vec3(-center.x * s, 3.5f + lo.y * s, -11.5f - center.z * s));
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    scene.add(model);
+    return scene;
+}
+
+// 构建 Cornell box 并转换为按类型存储、带 BVH 的几何库，作为渲染入口使用的场景
+inline HitTableList cornell_box_bvh()
+{
+    auto world = cornell_box();
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    return scene;
+}
+
+// 封闭的房间只在天花板上开一个小天窗，光源位于房间外，室内几乎都只能被天窗下的亮斑间接照亮，用于测试路径引导
+inline HitTableList cornell_box_skylight()
+{
+    HitTableList world;
+    auto red = make_object<Lambertian>(glm::vec3(.65f, .05f, .05f));
+    auto white = make_object<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    auto green = make_object<Lambertian>(glm::vec3(.12f, .45f, .15f));
+    auto light = make_object<DiffuseLight>(glm::vec3(40.f, 40.f, 40.f));
+
+    float h = 3.5f;
+    float back = -15.f, front = -8.f;
+    float hole = .35f;
+    glm::vec3 hole_center{ 0.f, -h, -11.5f };
+    world.add(make_object<Quad>(glm::vec3(h, h, back), glm::vec3(-2.f * h, 0.f, 0.f), glm::vec3(0.f, -2.f * h, 0.f), white));
+    world.add(make_object<Quad>(glm::vec3(h, h, back), glm::vec3(-2.f * h, 0.f, 0.f), glm::vec3(0.f, 0.f, front - back), white));
+    world.add(make_object<Quad>(glm::vec3(h, h, back), glm::vec3(0.f, -2.f * h, 0.f), glm::vec3(0.f, 0.f, front - back), red));
+    world.add(make_object<Quad>(glm::vec3(-h, h, back), glm::vec3(0.f, -2.f * h, 0.f), glm::vec3(0.f, 0.f, front - back), green));
+    // 天花板由天窗四周的四块组成
+    world.add(make_object<Quad>(glm::vec3(-h, -h, back), glm::vec3(2.f * h, 0.f, 0.f), glm::vec3(0.f, 0.f, hole_center.z - hole - back), white));
+    world.add(make_object<Quad>(glm::vec3(-h, -h, hole_center.z + hole), glm::vec3(2.f * h, 0.f, 0.f), glm::vec3(0.f, 0.f, front - hole_center.z - hole), white));
+    world.add(make_object<Quad>(glm::vec3(-h, -h, hole_center.z - hole), glm::vec3(h - hole, 0.f, 0.f), glm::vec3(0.f, 0.f, 2.f * hole), white));
+    world.add(make_object<Quad>(glm::vec3(hole, -h, hole_center.z - hole), glm::vec3(h - hole, 0.f, 0.f), glm::vec3(0.f, 0.f, 2.f * hole), white));
+    world.add(make_object<Quad>(glm::vec3(-1.5f, -h - 1.f, hole_center.z + 1.5f), glm::vec3(3.f, 0.f, 0.f), glm::vec3(0.f, 0.f, -3.f), light));
+
+    auto box = create_box(1.65f, 3.3f, 1.65f, white);
+    box = transform<RotateY>(box, 15.f);
+    box = transform<Translate>(box, glm::vec3(-1.3f, h - 1.65f, -12.4f));
+    world.add(box);
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    return scene;
+}
+
+// 焦散场景：Cornell box 的小光源下放一个玻璃球，地面上的焦散只能经镜面折射到达，路径追踪只能靠 BSDF 采样碰巧命中光源
+inline HitTableList cornell_box_caustics()
+{
+    HitTableList world;
+    auto red = make_object<Lambertian>(glm::vec3(.65f, .05f, .05f));
+    auto white = make_object<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    auto green = make_object<Lambertian>(glm::vec3(.12f, .45f, .15f));
+    // 边长为 Cornell box 光源的 1/5，总功率相同
+    auto light = make_object<DiffuseLight>(glm::vec3(375.f, 375.f, 375.f));
+
+    float h = 3.5f;
+    float back = -15.f, front = -8.f;
+    world.add(make_object<Quad>(glm::vec3(h, h, back), glm::vec3(-2.f * h, 0.f, 0.f), glm::vec3(0.f, -2.f * h, 0.f), white));
+    world.add(make_object<Quad>(glm::vec3(h, h, back), glm::vec3(-2.f * h, 0.f, 0.f), glm::vec3(0.f, 0.f, front - back), white));
+    world.add(make_object<Quad>(glm::vec3(-h, -h, back), glm::vec3(2.f * h, 0.f, 0.f), glm::vec3(0.f, 0.f, front - back), white));
+    world.add(make_object<Quad>(glm::vec3(h, h, back), glm::vec3(0.f, -2.f * h, 0.f), glm::vec3(0.f, 0.f, front - back), red));
+    world.add(make_object<Quad>(glm::vec3(-h, h, back), glm::vec3(0.f, -2.f * h, 0.f), glm::vec3(0.f, 0.f, front - back), green));
+    world.add(make_object<Quad>(glm::vec3(-.1f, 2e-3f - h, -10.4f), glm::vec3(.2f, 0.f, 0.f), glm::vec3(0.f, 0.f, -.2f), light));
+
+    auto box = create_box(1.65f, 3.3f, 1.65f, white);
+    box = transform<RotateY>(box, 15.f);
+    box = transform<Translate>(box, glm::vec3(-1.6f, h - 1.65f, -12.4f));
+    world.add(box);
+    auto glass = make_object<Sphere>(glm::vec3(.9f, h - 1.2f, -10.4f), 1.2f);
+    glass->_material = make_object<Dielectric>(1.5f);
+    world.add(glass);
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    return scene;
+}
+
+// 室外场景：地面上的漫反射、金属与玻璃球，光照完全来自环境光
+inline HitTableList outdoor_spheres()
+{
+    HitTableList world;
+    auto ground = make_object<Lambertian>(glm::vec3(.5f, .5f, .5f));
+    world.add(make_object<Quad>(glm::vec3(-50.f, -1.f, 10.f), glm::vec3(100.f, 0.f, 0.f), glm::vec3(0.f, 0.f, -100.f), ground));
+    auto add_sphere = [&world](const glm::vec3& center, float radius, MaterialPtr material)
+    {
+        auto sphere = make_object<Sphere>(center, radius);
+        sphere->_material = material;
+        world.add(sphere);
+    };
+    add_sphere(glm::vec3(-2.2f, 0.f, -9.f), 1.f, make_object<Lambertian>(glm::vec3(.7f, .3f, .2f)));
+    add_sphere(glm::vec3(0.f, 0.f, -10.f), 1.f, make_object<GGXConductor>(glm::vec3(.95f, .64f, .54f), .3f));
+    add_sphere(glm::vec3(2.2f, 0.f, -9.f), 1.f, make_object<GGXDielectric>(1.5f, .1f));
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    return scene;
+}
+
+// 粒子场景：地面上方由 count 个小球组成的粒子团，密度由中心向外衰减，光照完全来自环境光
+inline HitTableList particle_cloud(int count)
+{
+    SceneRandom random{1};
+    HitTableList world;
+    auto ground = make_object<Lambertian>(glm::vec3(.5f, .5f, .5f));
+    world.add(make_object<Quad>(glm::vec3(-50.f, -1.f, 10.f), glm::vec3(100.f, 0.f, 0.f), glm::vec3(0.f, 0.f, -100.f), ground));
+    std::vector<MaterialPtr> palette;
+    for (int i = 0; i < 7; i++) palette.push_back(make_object<Lambertian>(random.get_color()));
+    palette.push_back(make_object<GGXConductor>(glm::vec3(.95f, .64f, .54f), .3f));
+    auto cloud = make_object<SphereCloud>();
+    cloud->reserve(static_cast<size_t>(count));
+    const glm::vec3 center{ 0.f, 1.2f, -10.f };
+    for (int i = 0; i < count; i++)
+    {
+        // 半径取均匀数的立方，粒子向中心聚集
+        float u = random.get_float(0.f, 1.f);
+        glm::vec3 p = center + random.get_unit_vec3() * (2.2f * u * u * u + .2f * u);
+        float radius = random.get_float(.004f, .012f);
+        cloud->add(p, radius, palette[static_cast<size_t>(random.get_float(0.f, 1.f) * palette.size()) % palette.size()]);
+    }
+    cloud->build();
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    scene.add(cloud);
+    return scene;
+}
+
+// 多光源场景：天花板上 rows x cols 块亮度与颜色各异的小发光面板，照亮地面上的几个物体
+inline HitTableList light_panels(int rows, int cols)
+{
+    SceneRandom random{2};
+    HitTableList world;
+    auto ground = make_object<Lambertian>(glm::vec3(.6f, .6f, .6f));
+    world.add(make_object<Quad>(glm::vec3(-20.f, -1.f, 5.f), glm::vec3(40.f, 0.f, 0.f), glm::vec3(0.f, 0.f, -40.f), ground));
+    float width = 16.f, depth = 16.f, height = 4.f;
+    float cell_x = width / cols, cell_z = depth / rows;
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < cols; c++)
+        {
+            // 少数面板很亮，其余较暗，模拟亮度差异很大的招牌与灯带
+            float power = random.get_float(0.f, 1.f) < .05f ? 200.f : random.get_float(.5f, 5.f);
+            glm::vec3 color = random.get_color() * power;
+            glm::vec3 corner{ -width * .5f + c * cell_x, height, -2.f - r * cell_z };
+            world.add(make_object<Quad>(corner, glm::vec3(cell_x * .3f, 0.f, 0.f), glm::vec3(0.f, 0.f, -cell_z * .3f), make_object<DiffuseLight>(color)));
+        }
+    }
+    auto white = make_object<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    auto box = transform<Translate>(transform<RotateY>(create_box(1.5f, 3.f, 1.5f, white), 25.f), glm::vec3(-1.5f, .5f, -9.f));
+    world.add(box);
+    auto sphere = make_object<Sphere>(glm::vec3(1.8f, 0.f, -8.f), 1.f);
+    sphere->_material = make_object<GGXConductor>(glm::vec3(.9f, .9f, .9f), .25f);
+    world.add(sphere);
+    HitTableList scene;
+    scene.add(make_object<GeometryStore>(world));
+    return scene;
+}
+
+// 在边长为 extent 的立方体内随机摆放 count 个旋转过的盒子，用于测试大场景的构建与遍历
+inline HitTableList box_field(int count, float extent = 100.f)
+{
+    SceneRandom random{3};
+    HitTableList world;
+    auto white = make_object<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    for (int i = 0; i < count; i++)
+    {
+        auto box = create_box(random.get_float(.2f, 2.f), random.get_float(.2f, 2.f), random.get_float(.2f, 2.f), white);
+        box = transform<RotateY>(box, random.get_float(0.f, 360.f));
+        box = transform<Translate>(box, glm::vec3(random.get_float(0.f, extent), random.get_float(0.f, extent), random.get_float(0.f, extent)));
+        world.add(box);
+    }
+    return world;
+}
+
+/**
+ * @brief 多层楼房：每层一块整层楼板，贯通整栋楼的纵横隔墙，房间里的小家具与斜穿房间的楼梯，外立面上斜跨整层的支撑
+ *
+ * 楼板、长墙与斜向构件的包围盒远大于其自身，是只做物体划分的 BVH 难以处理的建筑类场景。
+ */
+inline HitTableList apartment_block(int floors, int rooms)
+{
+    SceneRandom random{4};
+    HitTableList world;
+    auto white = make_object<Lambertian>(glm::vec3(.73f, .73f, .73f));
+    const float room = 4.f, height = 3.f, width = room * rooms;
+    for (int f = 0; f < floors; f++)
+    {
+        float y = f * height;
+        world.add(make_object<Quad>(glm::vec3(0.f, y, 0.f), glm::vec3(width, 0.f, 0.f), glm::vec3(0.f, 0.f, width), white));
+        for (int i = 0; i <= rooms; i++)
+        {
+            world.add(make_object<Quad>(glm::vec3(i * room, y, 0.f), glm::vec3(0.f, 0.f, width), glm::vec3(0.f, height, 0.f), white));
+            world.add(make_object<Quad>(glm::vec3(0.f, y, i * room), glm::vec3(0.f, height, 0.f), glm::vec3(width, 0.f, 0.f), white));
+        }
+        // 外立面上斜跨整层的细长支撑
+        world.add(make_object<Quad>(glm::vec3(0.f, y, -.2f), glm::vec3(width, height, 0.f), glm::vec3(0.f, 0.f, -.2f), white));
+        world.add(make_object<Quad>(glm::vec3(width + .2f, y, 0.f), glm::vec3(0.f, height, width), glm::vec3(.2f, 0.f, 0.f), white));
+        for (int r = 0; r < rooms * rooms; r++)
+        {
+            glm::vec3 corner{ (r % rooms) * room, y, (r / rooms) * room };
+            // 从房间一角斜穿到对角的楼梯
+            world.add(make_object<Quad>(corner, glm::vec3(room, height, room), glm::vec3(.6f, 0.f, -.6f), white));
+            auto box = create_box(random.get_float(.4f, 1.2f), random.get_float(.4f, 1.f), random.get_float(.4f, 1.2f), white);
+            box = transform<RotateY>(box, random.get_float(0.f, 360.f));
+            box = transform<Translate>(box, corner + glm::vec3(random.get_float(1.f, 3.f), .5f, random.get_float(1.f, 3.f)));
+            world.add(box);
+        }
+    }
+    return world;
+}
+
+// 按名称构建内置场景，名称未知时返回 false
+inline bool named_scene(const std::string& name, HitTableList& scene)
+{
+    if (name == "cornell") scene = cornell_box_bvh();
+    else if (name == "outdoor") scene = outdoor_spheres();
+    else if (name == "lights") scene = light_panels(32, 32);
+    else if (name == "skylight") scene = cornell_box_skylight();
+    else if (name == "caustics") scene = cornell_box_caustics();
+    else if (name == "particles") scene = particle_cloud(1000000);
+    else return false;
+    return true;
+}
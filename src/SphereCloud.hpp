@@ -0,0 +1,308 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+#include "HitTable.hpp"
+#include "QuadPacket.hpp"
+
+/**
+ * @brief 海量小球（粒子、分子、点云溅射）的紧凑表示，自带 BVH
+ *
+ * 球心、半径与材质编号以 SoA 数组保存，材质本身放在调色板中，每个球只占 18 字节，
+ * 加上 BVH 节点平均约 26 字节（单独的 Sphere 对象连同 shared_ptr 与包围盒约 80 字节，还不含 BVH）。
+ * 叶节点最多 WIDTH 个球，一次向量化求交；遍历只保留最近命中的下标与 t，
+ * 法向量、UV 与足迹在遍历结束后只为最终命中计算一次。
+ */
+class SphereCloud : public HitTable
+{
+public:
+    static constexpr int WIDTH = QuadPacket::WIDTH;
+    static constexpr size_t MAX_MATERIALS = 65536;
+
+private:
+    static constexpr std::uint32_t NO_HIT = 0xffffffffu;
+    static constexpr int STACK_SIZE = 64;
+
+    struct Node
+    {
+        float _min[3];
+        float _max[3];
+        std::uint32_t _first; // 内部节点的两个子节点位于 _first 与 _first + 1，叶节点为首个球的下标
+        std::uint32_t _count; // 叶节点中球的个数，内部节点为 0
+    };
+
+    // 末尾额外补齐 WIDTH 个元素，叶节点可以直接整段加载而不越界
+    std::vector<float> _cx;
+    std::vector<float> _cy;
+    std::vector<float> _cz;
+    std::vector<float> _radius;
+    std::vector<std::uint16_t> _material;
+    std::vector<MaterialPtr> _palette;
+    std::unordered_map<const Material*, std::uint16_t> _palette_index;
+    std::vector<Node> _nodes;
+    size_t _count{0};
+
+    void build(std::vector<std::uint32_t>& order, size_t begin, size_t end, std::uint32_t index)
+    {
+        glm::vec3 lo{ std::numeric_limits<float>::max() }, hi{ -std::numeric_limits<float>::max() };
+        glm::vec3 c_lo = lo, c_hi = hi;
+        for (size_t i = begin; i != end; i++)
+        {
+            auto s = order[i];
+            glm::vec3 c{ _cx[s], _cy[s], _cz[s] };
+            glm::vec3 r{ _radius[s] };
+            lo = glm::min(lo, c - r);
+            hi = glm::max(hi, c + r);
+            c_lo = glm::min(c_lo, c);
+            c_hi = glm::max(c_hi, c);
+        }
+        for (int a = 0; a < 3; a++)
+        {
+            _nodes[index]._min[a] = lo[a];
+            _nodes[index]._max[a] = hi[a];
+        }
+        if (end - begin <= static_cast<size_t>(WIDTH))
+        {
+            _nodes[index]._first = static_cast<std::uint32_t>(begin);
+            _nodes[index]._count = static_cast<std::uint32_t>(end - begin);
+            return;
+        }
+        // 沿球心包围盒最长轴取中位数划分，与 GeometryStore 的策略一致
+        glm::vec3 extent = c_hi - c_lo;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        const std::vector<float>& key = axis == 0 ? _cx : (axis == 1 ? _cy : _cz);
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&key](std::uint32_t a, std::uint32_t b) { return key[a] < key[b]; });
+        auto child = static_cast<std::uint32_t>(_nodes.size());
+        _nodes[index]._first = child;
+        _nodes[index]._count = 0;
+        _nodes.emplace_back();
+        _nodes.emplace_back();
+        build(order, begin, mid, child);
+        build(order, mid, end, child + 1);
+    }
+
+    template<typename T>
+    static void reorder(std::vector<T>& values, const std::vector<std::uint32_t>& order)
+    {
+        std::vector<T> sorted(order.size() + WIDTH, T{});
+        for (size_t i = 0; i < order.size(); i++) sorted[i] = values[order[i]];
+        values = std::move(sorted);
+    }
+
+    // 叶节点整体求交，返回比 t_max 更近的最近命中在叶节点内的偏移（无命中返回 -1）
+    int intersect_leaf(const Node& leaf, const glm::vec3& o, const glm::vec3& d, float a, float t_min, float t_max, float& t_hit) const
+    {
+        const std::uint32_t first = leaf._first;
+#if defined(__AVX2__)
+        const __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(o.x), _mm256_loadu_ps(&_cx[first]));
+        const __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(o.y), _mm256_loadu_ps(&_cy[first]));
+        const __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(o.z), _mm256_loadu_ps(&_cz[first]));
+        const __m256 r = _mm256_loadu_ps(&_radius[first]);
+        // 半 b 形式 t = (-b ± sqrt(Δ)) / a，Δ = b² - a·c 改写为 a·(r² - |oc - (b/a)·d|²)，
+        // 避免远处小球的 b² 与 a·c 几乎相等时相减的精度损失
+        const __m256 dx = _mm256_set1_ps(d.x), dy = _mm256_set1_ps(d.y), dz = _mm256_set1_ps(d.z);
+        __m256 b = _mm256_mul_ps(ocx, dx);
+        b = _mm256_fmadd_ps(ocy, dy, b);
+        b = _mm256_fmadd_ps(ocz, dz, b);
+        const __m256 inv_a = _mm256_set1_ps(1.f / a);
+        const __m256 s = _mm256_mul_ps(b, inv_a);
+        const __m256 fx = _mm256_fnmadd_ps(s, dx, ocx);
+        const __m256 fy = _mm256_fnmadd_ps(s, dy, ocy);
+        const __m256 fz = _mm256_fnmadd_ps(s, dz, ocz);
+        __m256 f2 = _mm256_mul_ps(fx, fx);
+        f2 = _mm256_fmadd_ps(fy, fy, f2);
+        f2 = _mm256_fmadd_ps(fz, fz, f2);
+        __m256 disc = _mm256_mul_ps(_mm256_set1_ps(a), _mm256_fmsub_ps(r, r, f2));
+        const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(leaf._count)),
+                                                                      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+        __m256 valid = _mm256_and_ps(lanes, _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ));
+        if (_mm256_movemask_ps(valid) == 0) return -1;
+        const __m256 root = _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps()));
+        const __m256 lower = _mm256_set1_ps(t_min);
+        __m256 t_near = _mm256_mul_ps(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(b, root)), inv_a);
+        __m256 t_far = _mm256_mul_ps(_mm256_sub_ps(root, b), inv_a);
+        __m256 t = _mm256_blendv_ps(t_far, t_near, _mm256_cmp_ps(t_near, lower, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, lower, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+        if (_mm256_movemask_ps(valid) == 0) return -1;
+        int lane = nearest_lane(t, valid);
+        alignas(32) float t_lanes[WIDTH];
+        _mm256_store_ps(t_lanes, t);
+        t_hit = t_lanes[lane];
+        return lane;
+#else
+        int lane = -1;
+        float nearest = t_max;
+        for (std::uint32_t i = 0; i < leaf._count; i++)
+        {
+            const std::uint32_t s = first + i;
+            float ocx = o.x - _cx[s], ocy = o.y - _cy[s], ocz = o.z - _cz[s];
+            float b = ocx * d.x + ocy * d.y + ocz * d.z;
+            float fx = ocx - b / a * d.x, fy = ocy - b / a * d.y, fz = ocz - b / a * d.z;
+            float disc = a * (_radius[s] * _radius[s] - (fx * fx + fy * fy + fz * fz));
+            if (disc < 0.f) continue;
+            float root = std::sqrt(disc);
+            float t = (-b - root) / a;
+            if (t <= t_min) t = (root - b) / a;
+            if (t > t_min && t < nearest)
+            {
+                lane = static_cast<int>(i);
+                nearest = t;
+            }
+        }
+        if (lane >= 0) t_hit = nearest;
+        return lane;
+#endif
+    }
+
+public:
+    SphereCloud() = default;
+
+    // 添加一个球，材质按指针去重后存入调色板，调色板已满时返回 false
+    bool add(const glm::vec3& center, float radius, const MaterialPtr& material)
+    {
+        auto found = _palette_index.find(material.get());
+        std::uint16_t id;
+        if (found != _palette_index.end()) id = found->second;
+        else
+        {
+            if (_palette.size() >= MAX_MATERIALS)
+            {
+                std::cerr << "sphere cloud supports at most " << MAX_MATERIALS << " materials\n";
+                return false;
+            }
+            id = static_cast<std::uint16_t>(_palette.size());
+            _palette.push_back(material);
+            _palette_index.emplace(material.get(), id);
+        }
+        // 上一次 build 在末尾补齐的元素先去掉
+        _cx.resize(_count);
+        _cy.resize(_count);
+        _cz.resize(_count);
+        _radius.resize(_count);
+        _material.resize(_count);
+        _cx.push_back(center.x);
+        _cy.push_back(center.y);
+        _cz.push_back(center.z);
+        _radius.push_back(radius);
+        _material.push_back(id);
+        _count++;
+        return true;
+    }
+
+    inline void reserve(size_t count)
+    {
+        _cx.reserve(count + WIDTH);
+        _cy.reserve(count + WIDTH);
+        _cz.reserve(count + WIDTH);
+        _radius.reserve(count + WIDTH);
+        _material.reserve(count + WIDTH);
+    }
+
+    // 构建 BVH 并按叶节点顺序重排各数组，添加完所有球后调用
+    void build()
+    {
+        _nodes.clear();
+        _box = AABB{};
+        if (_count == 0) return;
+        std::vector<std::uint32_t> order(_count);
+        std::iota(order.begin(), order.end(), 0u);
+        _nodes.reserve(_count / WIDTH * 2 + 1);
+        _nodes.emplace_back();
+        build(order, 0, _count, 0);
+        reorder(_cx, order);
+        reorder(_cy, order);
+        reorder(_cz, order);
+        reorder(_radius, order);
+        reorder(_material, order);
+        _box.set(glm::vec3{ _nodes[0]._min[0], _nodes[0]._min[1], _nodes[0]._min[2] },
+                 glm::vec3{ _nodes[0]._max[0], _nodes[0]._max[1], _nodes[0]._max[2] });
+    }
+
+    inline size_t size() const { return _count; }
+    inline size_t node_count() const { return _nodes.size(); }
+    // SoA 数组、BVH 节点与调色板占用的字节数
+    inline size_t memory_footprint() const
+    {
+        return _cx.capacity() * sizeof(float) * 4 + _material.capacity() * sizeof(std::uint16_t) +
+               _nodes.capacity() * sizeof(Node) + _palette.capacity() * sizeof(MaterialPtr);
+    }
+
+    virtual bool hit(Ray& r, HitRecord& record) override
+    {
+        if (_nodes.empty()) return false;
+        const glm::vec3 orig = r.origin();
+        const glm::vec3 dir = r.direction();
+        const glm::vec3 inv_dir{ 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+        const float a = glm::dot(dir, dir);
+        const float t_min = r.get_t_range()._min;
+        std::uint32_t stack[STACK_SIZE];
+        int top = 0;
+        float t_enter;
+        if (!slab_test(_nodes[0]._min, _nodes[0]._max, orig, inv_dir, t_min, r.get_t_max(), t_enter)) return false;
+        stack[top++] = 0;
+        std::uint32_t nearest = NO_HIT;
+        float nearest_t = 0.f;
+        while (top > 0)
+        {
+            const Node& node = _nodes[stack[--top]];
+            if (node._count > 0)
+            {
+                float t;
+                int lane = intersect_leaf(node, orig, dir, a, t_min, r.get_t_max(), t);
+                if (lane < 0) continue;
+                r.update_t_max(t);
+                nearest = node._first + static_cast<std::uint32_t>(lane);
+                nearest_t = t;
+                continue;
+            }
+            float t[2];
+            bool child_hit[2];
+            for (int c = 0; c < 2; c++)
+            {
+                const Node& child = _nodes[node._first + c];
+                child_hit[c] = slab_test(child._min, child._max, orig, inv_dir, t_min, r.get_t_max(), t[c]);
+            }
+            // 先压入较远的子节点，使较近者先出栈
+            if (child_hit[0] && child_hit[1])
+            {
+                bool left_first = t[0] <= t[1];
+                if (top + 2 > STACK_SIZE) continue;
+                stack[top++] = node._first + (left_first ? 1 : 0);
+                stack[top++] = node._first + (left_first ? 0 : 1);
+            }
+            else if (child_hit[0] || child_hit[1])
+            {
+                if (top + 1 > STACK_SIZE) continue;
+                stack[top++] = node._first + (child_hit[0] ? 0 : 1);
+            }
+        }
+        if (nearest == NO_HIT) return false;
+        record._t = nearest_t;
+        record._object = this;
+        record._primitive = nearest;
+        return true;
+    }
+
+    virtual void surface(const Ray& r, HitRecord& record) const override
+    {
+        const std::uint32_t nearest = record._primitive;
+        const glm::vec3 center{ _cx[nearest], _cy[nearest], _cz[nearest] };
+        const float radius = _radius[nearest];
+        record._point = r.at(record._t);
+        glm::vec3 outward = (record._point - center) / radius;
+        record.set_face_normal(r, outward);
+        record._uv = Sphere::get_sphere_uv(glm::clamp(outward, glm::vec3{ -1.f }, glm::vec3{ 1.f }));
+        record.set_footprint(r, std::sqrt(2.f) * pi * radius);
+        record._material = _palette[_material[nearest]];
+        record._light = -1;
+    }
+};
+using SphereCloudPtr = std::shared_ptr<SphereCloud>;
@@ -1,8 +1,14 @@
 #pragma once
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include <algorithm>
+#include <cmath>
 #include <glm/fwd.hpp>
 #include <glm/glm.hpp>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <vector>
 
 class Texture
@@ -10,6 +16,8 @@ class Texture
 public:
     virtual ~Texture() = default;
     virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point) const = 0;
+    // footprint 为采样点在UV空间中的足迹宽度，支持滤波的纹理据此选择 LOD
+    virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point, float footprint) const { return value(uv, point); }
 };
 using TexturePtr = std::shared_ptr<Texture>;
 
@@ -20,39 +28,163 @@ public:
     virtual ~SolidColor() = default;
     SolidColor(const glm::vec3& albedo) : _albedo{albedo} {}
     virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point) const override { return _albedo; }
+    virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point, float footprint) const override { return _albedo; }
 };
 
-class ImgTexture : public Texture
+enum class WrapMode { REPEAT, CLAMP };
+
+// sRGB 编码的 8 位颜色转到线性空间，与 Camera 输出时的 1/2.2 gamma 对应
+inline float srgb_to_linear(unsigned char c)
+{
+    return std::pow(c / 255.f, 2.2f);
+}
+
+// 一层 mipmap，按 TILE x TILE 的块存储，双线性采样的 2x2 邻域大多落在同一块内
+class MipLevel
 {
-    std::vector<unsigned char> _data;
+    static constexpr int TILE_LOG2 = 3;
+    static constexpr int TILE = 1 << TILE_LOG2;
+    static constexpr int TILE_MASK = TILE - 1;
+
     int _width{0};
     int _height{0};
-    int _channel{0};
+    int _tiles_x{0};
+    std::vector<glm::vec3> _texels;
+
+    size_t index(int x, int y) const
+    {
+        size_t tile = static_cast<size_t>(y >> TILE_LOG2) * _tiles_x + (x >> TILE_LOG2);
+        return (tile << (2 * TILE_LOG2)) + ((y & TILE_MASK) << TILE_LOG2) + (x & TILE_MASK);
+    }
+
 public:
-    virtual ~ImgTexture() = default;
-    ImgTexture(std::string_view path)
+    MipLevel() = default;
+    MipLevel(int width, int height) : _width{width}, _height{height}
     {
-        unsigned char* data = stbi_load(path.data(), &_width, &_height, &_channel, 0);
-        if (!data) throw std::runtime_error(std::string{"Texture load error : "} + path.data());
-        _data.assign(data, data + static_cast<size_t>(_width) * _height * _channel);
-        stbi_image_free(data);
+        _tiles_x = (width + TILE_MASK) >> TILE_LOG2;
+        int tiles_y = (height + TILE_MASK) >> TILE_LOG2;
+        _texels.resize(static_cast<size_t>(_tiles_x) * tiles_y * TILE * TILE);
     }
-    virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point) const override
+
+    inline int width() const { return _width; }
+    inline int height() const { return _height; }
+    inline const glm::vec3& texel(int x, int y) const { return _texels[index(x, y)]; }
+    inline void set(int x, int y, const glm::vec3& c) { _texels[index(x, y)] = c; }
+
+    // 2x2 盒式滤波生成下一层，奇数尺寸时末行/列被重复使用
+    MipLevel downsample() const
     {
-        if (!_channel) return glm::vec3(0.f);
-        int x = static_cast<int>(uv[0] * (_width - 1));
-        int y = static_cast<int>((1.f - uv[1]) * (_height - 1));   
-        size_t pixel_index = (static_cast<size_t>(y) * _width + x) * _channel;
-        if (_channel >= 3) 
+        MipLevel next{ std::max(1, _width / 2), std::max(1, _height / 2) };
+        for (int y = 0; y < next._height; y++)
         {
-            return glm::vec3
+            int y0 = std::min(2 * y, _height - 1);
+            int y1 = std::min(2 * y + 1, _height - 1);
+            for (int x = 0; x < next._width; x++)
             {
-                _data[pixel_index + 0] / 255.0f,
-                _data[pixel_index + 1] / 255.0f,
-                _data[pixel_index + 2] / 255.0f,
-            };
-        } 
-        else if (_channel == 1) return glm::vec3(_data[pixel_index] / 255.0f);
-        return glm::vec3(0.0f);
-    }
-};
\ No newline at end of file
+                int x0 = std::min(2 * x, _width - 1);
+                int x1 = std::min(2 * x + 1, _width - 1);
+                next.set(x, y, (texel(x0, y0) + texel(x1, y0) + texel(x0, y1) + texel(x1, y1)) * .25f);
+            }
+        }
+        return next;
+    }
+};
+
+class ImgTexture : public Texture
+{
+    std::vector<MipLevel> _levels;
+    WrapMode _wrap{WrapMode::REPEAT};
+
+    int wrap(int i, int n) const
+    {
+        if (_wrap == WrapMode::CLAMP) return std::clamp(i, 0, n - 1);
+        i %= n;
+        return i < 0 ? i + n : i;
+    }
+
+    glm::vec3 bilinear(int level, const glm::vec2& uv) const
+    {
+        const MipLevel& mip = _levels[level];
+        // 纹素中心位于 (i + 0.5)，v 轴向下翻转与图片行序一致
+        float s = uv[0] * mip.width() - .5f;
+        float t = (1.f - uv[1]) * mip.height() - .5f;
+        float fs = std::floor(s);
+        float ft = std::floor(t);
+        float ds = s - fs;
+        float dt = t - ft;
+        int x0 = wrap(static_cast<int>(fs), mip.width());
+        int x1 = wrap(static_cast<int>(fs) + 1, mip.width());
+        int y0 = wrap(static_cast<int>(ft), mip.height());
+        int y1 = wrap(static_cast<int>(ft) + 1, mip.height());
+        glm::vec3 top = mip.texel(x0, y0) * (1.f - ds) + mip.texel(x1, y0) * ds;
+        glm::vec3 bottom = mip.texel(x0, y1) * (1.f - ds) + mip.texel(x1, y1) * ds;
+        return top * (1.f - dt) + bottom * dt;
+    }
+
+public:
+    virtual ~ImgTexture() = default;
+    ImgTexture(std::string_view path, WrapMode wrap_mode = WrapMode::REPEAT) : _wrap{wrap_mode}
+    {
+        std::string file{path};
+        int width = 0, height = 0, channel = 0;
+        MipLevel base;
+        // 加载时一次性转换为线性浮点，采样时不再做 /255 与 gamma 运算
+        if (stbi_is_hdr(file.c_str()))
+        {
+            float* data = stbi_loadf(file.c_str(), &width, &height, &channel, 0);
+            if (!data) throw std::runtime_error(std::string{"Texture load error : "} + file);
+            base = MipLevel{width, height};
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    const float* p = data + (static_cast<size_t>(y) * width + x) * channel;
+                    base.set(x, y, channel >= 3 ? glm::vec3{p[0], p[1], p[2]} : glm::vec3(p[0]));
+                }
+            }
+            stbi_image_free(data);
+        }
+        else
+        {
+            unsigned char* data = stbi_load(file.c_str(), &width, &height, &channel, 0);
+            if (!data) throw std::runtime_error(std::string{"Texture load error : "} + file);
+            base = MipLevel{width, height};
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    const unsigned char* p = data + (static_cast<size_t>(y) * width + x) * channel;
+                    base.set(x, y, channel >= 3 ? 
+                        glm::vec3{srgb_to_linear(p[0]), srgb_to_linear(p[1]), srgb_to_linear(p[2])} : 
+                        glm::vec3(srgb_to_linear(p[0])));
+                }
+            }
+            stbi_image_free(data);
+        }
+        _levels.push_back(std::move(base));
+        while (_levels.back().width() > 1 || _levels.back().height() > 1)
+        {
+            _levels.push_back(_levels.back().downsample());
+        }
+    }
+
+    inline size_t level_count() const { return _levels.size(); }
+
+    virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point) const override
+    {
+        return bilinear(0, uv);
+    }
+
+    // 三线性过滤：由UV足迹换算为纹素尺度选择 LOD，在相邻两层之间插值
+    virtual glm::vec3 value(const glm::vec2& uv, const glm::vec3& point, float footprint) const override
+    {
+        const MipLevel& base = _levels.front();
+        float texels = footprint * std::max(base.width(), base.height());
+        if (texels <= 1.f) return bilinear(0, uv);
+        float lod = std::min(std::log2(texels), static_cast<float>(_levels.size() - 1));
+        int level = static_cast<int>(lod);
+        if (level + 1 >= static_cast<int>(_levels.size())) return bilinear(level, uv);
+        float frac = lod - level;
+        return bilinear(level, uv) * (1.f - frac) + bilinear(level + 1, uv) * frac;
+    }
+};
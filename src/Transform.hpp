@@ -10,11 +10,29 @@ public:
     {
         _box = object->get_aabb() + offset;
     }    
+    inline const HitTablePtr& object() const { return _object; }
+    inline const glm::vec3& offset() const { return _offset; }
+    // 修改平移量后需对所在的 BVH 调用 refit
+    void set_offset(const glm::vec3& offset)
+    {
+        _offset = offset;
+        _box = _object->get_aabb() + _offset;
+    }
+    virtual void refit() override
+    {
+        _object->refit();
+        _box = _object->get_aabb() + _offset;
+    }
     virtual bool hit(Ray& r, HitRecord& record) override
     {
         Ray offset_r{r.origin() - _offset, r.direction()};
+        offset_r.set_cone(r.get_cone_width(0.f), r.get_cone_spread());
+        offset_r.update_t_max(r.get_t_max());
         if (!_object->hit(offset_r, record)) return false;
+        // 表面属性须在物体空间中计算，因此变换节点下的命中立即解析再变换回外部空间
+        record.resolve(offset_r);
         record._point += _offset;
+        r.update_t_max(record._t);
         return true;
     }
 };
@@ -28,11 +46,27 @@ class RotateY : public HitTable
 
 public:
     RotateY(const HitTablePtr& object, float angle_degrees) : _object(object)
+    {
+        set_angle(angle_degrees);
+    }
+
+    // 修改旋转角后需对所在的 BVH 调用 refit
+    void set_angle(float angle_degrees)
     {
         auto radians = glm::radians(angle_degrees);
         _sin_theta = std::sin(radians);
         _cos_theta = std::cos(radians);
+        update_box();
+    }
 
+    virtual void refit() override
+    {
+        _object->refit();
+        update_box();
+    }
+
+    void update_box()
+    {
         // 获取原始包围盒
         auto bbox = _object->get_aabb();
 
@@ -61,6 +95,14 @@ public:
         _box = AABB{min_p, max_p};
     }
 
+    inline const HitTablePtr& object() const { return _object; }
+
+    // 物体空间到世界空间的正向旋转
+    glm::vec3 rotate(const glm::vec3& v) const
+    {
+        return glm::vec3{ _cos_theta * v.x + _sin_theta * v.z, v.y, -_sin_theta * v.x + _cos_theta * v.z };
+    }
+
     virtual bool hit(Ray& r, HitRecord& record) override
     {
         // 将光线从世界空间变换到物体空间
@@ -87,7 +129,11 @@ public:
             _sin_theta * direction.x + _cos_theta * direction.z
         };
         Ray rotated_ray(new_origin, new_direction);
+        rotated_ray.set_cone(r.get_cone_width(0.f), r.get_cone_spread());
+        rotated_ray.update_t_max(r.get_t_max());
         if (!_object->hit(rotated_ray, record)) return false;
+        record.resolve(rotated_ray);
+        r.update_t_max(record._t);
         // 将命中点和法线从物体空间变换回世界空间
         glm::vec3 p = record._point;
         glm::vec3 normal = record._normal;
@@ -124,5 +170,5 @@ template<typename Transform, typename... Args>
 HitTablePtr transform(const HitTablePtr& obj, Args&&... args)
 {
     static_assert(is_allowed_transform_v<Transform>, "Transform type not allowed!");
-    return std::make_shared<Transform>(obj, std::forward<Args>(args)...);
+    return make_object<Transform>(obj, std::forward<Args>(args)...);
 }
\ No newline at end of file
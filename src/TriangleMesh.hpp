@@ -0,0 +1,218 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+#include "HitTable.hpp"
+#include "MeshLoader.hpp"
+
+/**
+ * @brief 索引三角网格，自带 BVH
+ *
+ * 顶点位置按缩放与平移变换到世界空间后保存一份，三角形的顶点下标与材质编号按叶节点顺序重排，
+ * 材质放在调色板中。叶节点最多 LEAF_SIZE 个三角形，用 Möller–Trumbore 逐个求交；
+ * 遍历只记录最近命中的三角形与重心坐标，法线与 UV 在遍历结束后计算一次。
+ * 网格上的自发光面可以被光线命中，但不加入 LightBVH，不参与光源采样。
+ */
+class TriangleMesh : public HitTable
+{
+    static constexpr std::uint32_t NO_HIT = 0xffffffffu;
+    static constexpr int STACK_SIZE = 64;
+    static constexpr size_t LEAF_SIZE = 4;
+
+    struct Node
+    {
+        float _min[3];
+        float _max[3];
+        std::uint32_t _first; // 内部节点的两个子节点位于 _first 与 _first + 1，叶节点为首个三角形的下标
+        std::uint32_t _count; // 叶节点中三角形的个数，内部节点为 0
+    };
+
+    std::vector<glm::vec3> _positions;
+    std::vector<std::uint32_t> _indices; // 每个三角形 3 个顶点下标
+    std::vector<std::uint16_t> _material;
+    std::vector<MaterialPtr> _palette;
+    std::vector<Node> _nodes;
+
+    void build(std::vector<std::uint32_t>& order, const std::vector<glm::vec3>& centroids, size_t begin, size_t end, std::uint32_t index)
+    {
+        glm::vec3 lo{ std::numeric_limits<float>::max() }, hi{ -std::numeric_limits<float>::max() };
+        glm::vec3 c_lo = lo, c_hi = hi;
+        for (size_t i = begin; i != end; i++)
+        {
+            auto t = order[i];
+            for (int k = 0; k < 3; k++)
+            {
+                lo = glm::min(lo, _positions[_indices[3 * t + k]]);
+                hi = glm::max(hi, _positions[_indices[3 * t + k]]);
+            }
+            c_lo = glm::min(c_lo, centroids[t]);
+            c_hi = glm::max(c_hi, centroids[t]);
+        }
+        for (int a = 0; a < 3; a++)
+        {
+            _nodes[index]._min[a] = lo[a];
+            _nodes[index]._max[a] = hi[a];
+        }
+        if (end - begin <= LEAF_SIZE)
+        {
+            _nodes[index]._first = static_cast<std::uint32_t>(begin);
+            _nodes[index]._count = static_cast<std::uint32_t>(end - begin);
+            return;
+        }
+        // 与 SphereCloud 相同，沿重心包围盒最长轴取中位数划分
+        glm::vec3 extent = c_hi - c_lo;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+            [&centroids, axis](std::uint32_t a, std::uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+        auto child = static_cast<std::uint32_t>(_nodes.size());
+        _nodes[index]._first = child;
+        _nodes[index]._count = 0;
+        _nodes.emplace_back();
+        _nodes.emplace_back();
+        build(order, centroids, begin, mid, child);
+        build(order, centroids, mid, end, child + 1);
+    }
+
+public:
+    /**
+     * @brief 由加载的网格构建，世界坐标为 scale * 顶点 + offset（逐分量）
+     */
+    TriangleMesh(const MeshData& mesh, const glm::vec3& scale = glm::vec3{ 1.f }, const glm::vec3& offset = glm::vec3{ 0.f })
+        : _palette{mesh._materials}
+    {
+        const size_t triangles = mesh._triangle_count;
+        _positions.resize(mesh._vertex_count);
+#pragma omp parallel for schedule(static)
+        for (long long i = 0; i < static_cast<long long>(mesh._vertex_count); i++)
+        {
+            _positions[i] = scale * mesh.position(static_cast<size_t>(i)) + offset;
+        }
+        _indices.resize(triangles * 3);
+        std::vector<glm::vec3> centroids(triangles);
+#pragma omp parallel for schedule(static)
+        for (long long t = 0; t < static_cast<long long>(triangles); t++)
+        {
+            mesh.triangle(static_cast<size_t>(t), &_indices[3 * t]);
+            centroids[t] = (_positions[_indices[3 * t]] + _positions[_indices[3 * t + 1]] + _positions[_indices[3 * t + 2]]) / 3.f;
+        }
+        if (triangles == 0) return;
+        std::vector<std::uint32_t> order(triangles);
+        std::iota(order.begin(), order.end(), 0u);
+        _nodes.reserve(triangles / LEAF_SIZE * 2 + 1);
+        _nodes.emplace_back();
+        build(order, centroids, 0, triangles, 0);
+
+        std::vector<std::uint32_t> indices(triangles * 3);
+        _material.resize(triangles);
+        for (size_t i = 0; i < triangles; i++)
+        {
+            std::copy_n(&_indices[3 * order[i]], 3, &indices[3 * i]);
+            _material[i] = mesh.material(order[i]);
+        }
+        _indices = std::move(indices);
+        _box.set(glm::vec3{ _nodes[0]._min[0], _nodes[0]._min[1], _nodes[0]._min[2] },
+                 glm::vec3{ _nodes[0]._max[0], _nodes[0]._max[1], _nodes[0]._max[2] });
+    }
+
+    inline size_t size() const { return _indices.size() / 3; }
+    inline size_t node_count() const { return _nodes.size(); }
+    inline size_t memory_footprint() const
+    {
+        return _positions.capacity() * sizeof(glm::vec3) + _indices.capacity() * sizeof(std::uint32_t) +
+               _material.capacity() * sizeof(std::uint16_t) + _nodes.capacity() * sizeof(Node) + _palette.capacity() * sizeof(MaterialPtr);
+    }
+
+    virtual bool hit(Ray& r, HitRecord& record) override
+    {
+        if (_nodes.empty()) return false;
+        const glm::vec3 orig = r.origin();
+        const glm::vec3 dir = r.direction();
+        const glm::vec3 inv_dir{ 1.f / dir.x, 1.f / dir.y, 1.f / dir.z };
+        const float t_min = r.get_t_range()._min;
+        std::uint32_t stack[STACK_SIZE];
+        int top = 0;
+        float t_enter;
+        if (!slab_test(_nodes[0]._min, _nodes[0]._max, orig, inv_dir, t_min, r.get_t_max(), t_enter)) return false;
+        stack[top++] = 0;
+        std::uint32_t nearest = NO_HIT;
+        glm::vec2 nearest_coords;
+        while (top > 0)
+        {
+            const Node& node = _nodes[stack[--top]];
+            if (node._count > 0)
+            {
+                for (std::uint32_t t = node._first; t != node._first + node._count; t++)
+                {
+                    // Möller–Trumbore，重心坐标 (u, v) 分别对应第 2、3 个顶点
+                    const glm::vec3& p0 = _positions[_indices[3 * t]];
+                    const glm::vec3 e1 = _positions[_indices[3 * t + 1]] - p0;
+                    const glm::vec3 e2 = _positions[_indices[3 * t + 2]] - p0;
+                    const glm::vec3 p = glm::cross(dir, e2);
+                    const float det = glm::dot(e1, p);
+                    if (std::fabs(det) < 1e-12f) continue;
+                    const float inv_det = 1.f / det;
+                    const glm::vec3 s = orig - p0;
+                    const float u = glm::dot(s, p) * inv_det;
+                    if (u < 0.f || u > 1.f) continue;
+                    const glm::vec3 q = glm::cross(s, e1);
+                    const float v = glm::dot(dir, q) * inv_det;
+                    if (v < 0.f || u + v > 1.f) continue;
+                    const float distance = glm::dot(e2, q) * inv_det;
+                    if (distance <= t_min || distance >= r.get_t_max()) continue;
+                    r.update_t_max(distance);
+                    record._t = distance;
+                    nearest = t;
+                    nearest_coords = { u, v };
+                }
+                continue;
+            }
+            float t[2];
+            bool child_hit[2];
+            for (int c = 0; c < 2; c++)
+            {
+                const Node& child = _nodes[node._first + c];
+                child_hit[c] = slab_test(child._min, child._max, orig, inv_dir, t_min, r.get_t_max(), t[c]);
+            }
+            // 先压入较远的子节点，使较近者先出栈
+            if (child_hit[0] && child_hit[1])
+            {
+                bool left_first = t[0] <= t[1];
+                if (top + 2 > STACK_SIZE) continue;
+                stack[top++] = node._first + (left_first ? 1 : 0);
+                stack[top++] = node._first + (left_first ? 0 : 1);
+            }
+            else if (child_hit[0] || child_hit[1])
+            {
+                if (top + 1 > STACK_SIZE) continue;
+                stack[top++] = node._first + (child_hit[0] ? 0 : 1);
+            }
+        }
+        if (nearest == NO_HIT) return false;
+        record._object = this;
+        record._primitive = nearest;
+        record._coords = nearest_coords;
+        return true;
+    }
+
+    virtual void surface(const Ray& r, HitRecord& record) const override
+    {
+        const std::uint32_t t = record._primitive;
+        const glm::vec3& p0 = _positions[_indices[3 * t]];
+        const glm::vec3 e1 = _positions[_indices[3 * t + 1]] - p0;
+        const glm::vec3 e2 = _positions[_indices[3 * t + 2]] - p0;
+        const glm::vec3 n = glm::cross(e1, e2);
+        const float area = glm::length(n);
+        record._point = r.at(record._t);
+        record.set_face_normal(r, n / area);
+        // 没有纹理坐标，以重心坐标作为 UV
+        record._uv = record._coords;
+        record.set_footprint(r, std::sqrt(area));
+        record._material = _palette[_material[t]];
+        record._light = -1;
+    }
+};
+using TriangleMeshPtr = std::shared_ptr<TriangleMesh>;
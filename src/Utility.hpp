@@ -2,7 +2,9 @@
 #include <glm/geometric.hpp>
 #include <glm/glm.hpp>
 #include <glm/common.hpp>
+#include <cstdint>
 #include <random>
+#include "Sampler.hpp"
 
 constexpr float pi = 3.14159265358979f;
 constexpr float epsilon = 1e-8;
@@ -22,14 +24,49 @@ private: \
     \
     ~ClassName() = default; \
 
+// 每个线程各持有一个实例
+#define THREAD_SINGLETON(ClassName) \
+public: \
+    static ClassName& getInstance() { \
+        static thread_local ClassName instance; \
+        return instance; \
+    } \
+    ClassName(const ClassName&) = delete; \
+    ClassName& operator=(const ClassName&) = delete; \
+    ClassName(ClassName&&) = delete; \
+    ClassName& operator=(ClassName&&) = delete; \
+private: \
+    ClassName() = default; \
+    \
+    ~ClassName() = default; \
+
 #define RANDOM Random::getInstance()
 class Random
 {
 public:    
+    // 所有线程使用的采样器类型，需在渲染开始前设置
+    static void set_sampler_type(SamplerType type) { _sampler_type = type; }
+    static SamplerType get_sampler_type() { return _sampler_type; }
+
+    /**
+     * @brief 开始像素 (x, y) 的第 sample 个样本
+     * 
+     * 样本值只由 (像素, 样本编号, 维度) 决定，任意切分的样本区间都能复现相同的结果
+     */
+    void start_sample(int x, int y, std::uint32_t sample)
+    {
+        if (_type != _sampler_type)
+        {
+            _type = _sampler_type;
+            _sampler = make_sampler(_type);
+        }
+        _sampler->start(x, y, sample);
+    }
+
+    // 从采样器取下一维并映射到 [min, max)
     float get_float(float min, float max)
     {
-        std::uniform_real_distribution<float> dis(min, max);
-        return dis(_gen);
+        return min + (max - min) * _sampler->get_1d();
     }
 
     // 生成随机颜色
@@ -80,9 +117,27 @@ public:
     }
     
 private:    
-    SINGLETON(Random);
-    std::random_device _rd;
-    std::mt19937 _gen;    
+    THREAD_SINGLETON(Random);
+    static inline SamplerType _sampler_type{SamplerType::SOBOL};
+    SamplerType _type{SamplerType::UNIFORM};
+    SamplerPtr _sampler{make_sampler(SamplerType::UNIFORM)};
+};
+
+// 以法线为 z 轴的正交基
+struct Onb
+{
+    glm::vec3 _t;
+    glm::vec3 _b;
+    glm::vec3 _n;
+    explicit Onb(const glm::vec3& normal)
+    {
+        _n = glm::normalize(normal);
+        glm::vec3 v = std::abs(_n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        _t = glm::normalize(glm::cross(v, _n));
+        _b = glm::cross(_n, _t);
+    }
+    glm::vec3 to_local(const glm::vec3& v) const { return { glm::dot(v, _t), glm::dot(v, _b), glm::dot(v, _n) }; }
+    glm::vec3 to_world(const glm::vec3& v) const { return v.x * _t + v.y * _b + v.z * _n; }
 };
 
 inline bool is_zero_vec(const glm::vec3& vec)
@@ -3,29 +3,379 @@
 #include <glm/detail/qualifier.hpp>
 #include <glm/fwd.hpp>
 #include <glm/geometric.hpp>
+#include <iomanip>
+#include <string>
+#include <vector>
 
 #include "tgaimage.hpp"
+#include "ImageOutput.hpp"
 #include "Camera.hpp"
 #include "Scene.hpp"
+#include "BVHReport.hpp"
+#include "Distributed.hpp"
+#include "RenderServer.hpp"
+#include "Convergence.hpp"
+#include "BDPT.hpp"
+#include "BVHInspector.hpp"
+#include "Sampler.hpp"
 
-int main()
+static int usage()
 {
-    Camera camera;
-    TGAImage framebuffer(camera.get_image_width(), camera.get_image_height(), TGAImage::RGB);
+    std::cerr << "usage:\n"
+              << "  soft_ray_tracing\n"
+              << "  soft_ray_tracing --bvh-report\n"
+              << "  soft_ray_tracing --bvh-inspect <cornell|apartment|boxes> <out.json> [obj prefix]  (BVH quality per builder, optional OBJ wireframes)\n"
+              << "  soft_ray_tracing --load-report <file.obj|ply>  (mesh load time per thread count)\n"
+              << "  soft_ray_tracing --arena-report [boxes]\n"
+              << "  soft_ray_tracing --paged-report <file> [boxes] [cache MB]  (out-of-core geometry vs resident)\n"
+              << "  soft_ray_tracing --render-partial <x0> <y0> <x1> <y1> <s0> <s1> <out.srtp>\n"
+              << "  soft_ray_tracing --coordinate <workers> <tile_size> <sample_splits> <out.tga>\n"
+              << "  soft_ray_tracing --merge <out.tga> <part.srtp>...\n"
+              << "  soft_ray_tracing --animate <frames> <prefix>\n"
+              << "  soft_ray_tracing --worker\n"
+              << "  soft_ray_tracing --make-reference <dir> <spp>  (reference renders for --convergence)\n"
+              << "  soft_ray_tracing --convergence <reference dir> <curves.csv> [baseline]  (error vs time, fails on efficiency regression)\n"
+              << "  soft_ray_tracing --serve [socket]  (resident server, requests on stdin or a Unix socket)\n"
+              << "options:\n"
+              << "  --sampler <uniform|sobol|halton|bluenoise>  (default sobol)\n"
+              << "  --spp <samples per pixel>\n"
+              << "  --format <tga|png|pfm>  (default tga, for outputs named by the program)\n"
+              << "  --scene <cornell|outdoor|lights|skylight|caustics|particles>  (default cornell)\n"
+              << "  --integrator <path|bdpt|photon>  (default render and convergence, default path; bdpt: bidirectional path tracing; photon: progressive caustic photon map)\n"
+              << "  --model <file.obj|ply>  (render the model in the Cornell box instead of --scene)\n"
+              << "  --envmap <file.hdr|sun>  (environment light, default gradient sky)\n"
+              << "  --checkpoint <file>  (default render: save progress and resume from it; refuses a file written for other settings)\n"
+              << "  --checkpoint-interval <seconds>  (default 60)\n"
+              << "  --guiding  (default render: learn an SD-tree over passes and guide sampling, not with --checkpoint)\n"
+              << "  --hybrid  (default render: rasterize primary visibility into a G-buffer, also writes gbuffer_normal/depth.pfm)\n";
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    // 全局选项从参数中取出，分布式渲染时原样转发给 worker
+    std::vector<std::string> options;
+    int spp = 0;
+    ImageFormat format = ImageFormat::TGA;
+    std::string checkpoint;
+    double checkpoint_interval = 60.;
+    std::string scene_name = "cornell";
+    std::string envmap;
+    bool guiding = false;
+    bool hybrid = false;
+    std::string integrator_name = "path";
+    std::string model;
+    for (size_t i = 0; i < args.size();)
+    {
+        if (args[i] == "--guiding")
+        {
+            guiding = true;
+            args.erase(args.begin() + i);
+            continue;
+        }
+        if (args[i] == "--hybrid")
+        {
+            hybrid = true;
+            args.erase(args.begin() + i);
+            continue;
+        }
+        if (args[i] != "--sampler" && args[i] != "--spp" && args[i] != "--format" && 
+            args[i] != "--checkpoint" && args[i] != "--checkpoint-interval" && args[i] != "--scene" && args[i] != "--envmap" && 
+            args[i] != "--integrator" && args[i] != "--model") 
+        {
+            i++;
+            continue;
+        }
+        if (i + 1 >= args.size()) return usage();
+        if (args[i] == "--sampler")
+        {
+            SamplerType type;
+            if (!parse_sampler_type(args[i + 1], type)) return usage();
+            Random::set_sampler_type(type);
+        }
+        else if (args[i] == "--format")
+        {
+            if (!parse_image_format(args[i + 1], format)) return usage();
+        }
+        else if (args[i] == "--checkpoint")
+        {
+            checkpoint = args[i + 1];
+        }
+        else if (args[i] == "--checkpoint-interval")
+        {
+            checkpoint_interval = std::stod(args[i + 1]);
+        }
+        else if (args[i] == "--scene")
+        {
+            if (args[i + 1] != "cornell" && args[i + 1] != "outdoor" && args[i + 1] != "lights" && args[i + 1] != "skylight" && 
+                args[i + 1] != "caustics" && args[i + 1] != "particles") return usage();
+            scene_name = args[i + 1];
+        }
+        else if (args[i] == "--envmap")
+        {
+            envmap = args[i + 1];
+        }
+        else if (args[i] == "--integrator")
+        {
+            if (!make_integrator(args[i + 1])) return usage();
+            integrator_name = args[i + 1];
+        }
+        else if (args[i] == "--model")
+        {
+            model = args[i + 1];
+        }
+        else
+        {
+            spp = std::stoi(args[i + 1]);
+        }
+        options.insert(options.end(), args.begin() + i, args.begin() + i + 2);
+        args.erase(args.begin() + i, args.begin() + i + 2);
+    }
+    IntegratorPtr integrator = make_integrator(integrator_name);
+    EnvironmentPtr environment;
+    if (!envmap.empty())
+    {
+        environment = envmap == "sun" ? sun_sky() : EnvironmentMap::load(envmap);
+        if (!environment) return 1;
+    }
+    auto make_camera = [spp, environment]()
+    {
+        Camera camera;
+        if (spp > 0) camera.set_samples_per_pixel(spp);
+        if (environment) camera.set_environment(environment);
+        return camera;
+    };
+    MeshData mesh;
+    if (!model.empty() && !load_mesh(model, mesh)) return 1;
+    auto make_scene = [&scene_name, &model, &mesh]()
+    {
+        HitTableList scene;
+        if (!model.empty()) scene = cornell_box_model(mesh);
+        else named_scene(scene_name, scene);
+        return scene;
+    };
+    if (!args.empty() && args[0] == "--bvh-report")
+    {
+        auto world = cornell_box();
+        report_bvh_layouts(world, 1000000, std::cout);
+        report_spatial_splits("cornell", world, 1000000, std::cout);
+        report_spatial_splits("apartment", apartment_block(10, 8), 1000000, std::cout);
+        report_quad_leaf(1000000, std::cout);
+        report_sphere_cloud(200000, 1000000, std::cout);
+        return 0;
+    }
+    if (!args.empty() && args[0] == "--bvh-inspect")
+    {
+        if (args.size() < 3 || args.size() > 4) return usage();
+        HitTableList world;
+        if (args[1] == "cornell") world = cornell_box();
+        else if (args[1] == "apartment") world = apartment_block(10, 8);
+        else if (args[1] == "boxes") world = box_field(20000);
+        else return usage();
+        std::ofstream json(args[2]);
+        if (!json)
+        {
+            std::cerr << "can't open file " << args[2] << "\n";
+            return 1;
+        }
+        return inspect_builders(args[1], world, 100000, args.size() > 3 ? args[3] : std::string{}, json) ? 0 : 1;
+    }
+    if (!args.empty() && args[0] == "--load-report")
+    {
+        if (args.size() != 2) return usage();
+        return report_mesh_load(args[1], std::cout) ? 0 : 1;
+    }
+    if (!args.empty() && args[0] == "--arena-report")
+    {
+        report_scene_allocation(args.size() > 1 ? std::stoi(args[1]) : 20000, 100000, std::cout);
+        return 0;
+    }
+    if (!args.empty() && args[0] == "--paged-report")
+    {
+        if (args.size() < 2 || args.size() > 4) return usage();
+        int boxes = args.size() > 2 ? std::stoi(args[2]) : 200000;
+        size_t cache_mb = args.size() > 3 ? std::stoul(args[3]) : 8;
+        return report_paged_geometry(args[1], boxes, cache_mb << 20, 65536, std::cout) ? 0 : 1;
+    }
+    // 分布式渲染与渲染服务按区域切分，逐轮学习的引导、整幅光栅化的混合主可见性与断点都不能切分
+    if (!args.empty() && (args[0] == "--worker" || args[0] == "--render-partial" || args[0] == "--coordinate" || args[0] == "--serve") && 
+        (guiding || hybrid || !checkpoint.empty())) return usage();
+    if (!args.empty() && args[0] == "--worker")
+    {
+        // 相机的光源层次引用场景中的材质，arena 须先于相机声明
+        Arena arena;
+        ArenaScope scope{arena};
+        Camera camera = make_camera();
+        auto scene = make_scene();
+        camera.set_lights(scene);
+        return run_worker(*integrator, camera, scene, std::cin, std::cout);
+    }
+    if (!args.empty() && (args[0] == "--make-reference" || args[0] == "--convergence"))
+    {
+        bool reference = args[0] == "--make-reference";
+        if (args.size() != 3 && (reference || args.size() != 4)) return usage();
+        // 收敛测试的标准场景，参考图为 <dir>/<场景名>.pfm
+        const std::vector<std::string> scenes{ "cornell", "caustics" };
+        std::map<std::string, double> efficiency;
+        std::ofstream csv;
+        if (!reference)
+        {
+            csv.open(args[2]);
+            if (!csv)
+            {
+                std::cerr << "can't open file " << args[2] << "\n";
+                return 1;
+            }
+            csv << "scene,spp,seconds,rmse,relmse,flip\n";
+        }
+        for (const auto& name : scenes)
+        {
+            Arena arena;
+            ArenaScope scope{arena};
+            Camera camera = make_camera();
+            camera.set_resolution(convergence_resolution, convergence_resolution);
+            HitTableList scene;
+            named_scene(name, scene);
+            camera.set_lights(scene);
+            // 每个场景使用新的积分器实例，光子图等缓存不会跨场景沿用
+            IntegratorPtr scene_integrator = make_integrator(integrator_name);
+            std::string file = args[1] + "/" + name + ".pfm";
+            if (reference)
+            {
+                if (!render_reference(*scene_integrator, camera, scene, std::stoi(args[2]), file)) return 1;
+                std::cout << "wrote " << file << std::endl;
+                continue;
+            }
+            Film expected;
+            if (!read_pfm(file, expected)) return 1;
+            if (expected.width() != convergence_resolution || expected.height() != convergence_resolution)
+            {
+                std::cerr << file << " is not " << convergence_resolution << "x" << convergence_resolution << "\n";
+                return 1;
+            }
+            auto points = measure_convergence(*scene_integrator, camera, scene, expected, convergence_budget, spp > 0 ? spp : convergence_max_spp);
+            for (const auto& point : points)
+            {
+                csv << name << ',' << point._spp << ',' << point._seconds << ',' << point._error._rmse << ',' << point._error._relmse << ',' << point._error._flip << '\n';
+                std::cout << name << " spp " << std::setw(5) << point._spp << std::fixed << std::setprecision(3) << " time " << point._seconds << " s"
+                          << std::scientific << " rmse " << point._error._rmse << " relMSE " << point._error._relmse
+                          << std::fixed << " FLIP " << point._error._flip << std::endl;
+            }
+            efficiency[name] = convergence_efficiency(points);
+        }
+        if (reference) return 0;
+        if (args.size() == 4 && !check_efficiency(args[3], efficiency, convergence_tolerance, std::cout)) return 1;
+        return csv.good() ? 0 : 1;
+    }
+    if (!args.empty() && args[0] == "--serve")
+    {
+        if (args.size() > 2) return usage();
+        RenderServer server{make_camera(), integrator_name};
+        return server.run(args.size() == 2 ? args[1] : "");
+    }
+    if (!args.empty() && args[0] == "--render-partial")
+    {
+        if (args.size() != 8) return usage();
+        Camera camera = make_camera();
+        auto scene = make_scene();
+        camera.set_lights(scene);
+        RenderTask task;
+        if (!parse_task("render " + args[1] + ' ' + args[2] + ' ' + args[3] + ' ' + args[4] + ' ' + args[5] + ' ' + args[6] + ' ' + args[7], task)) return usage();
+        Film film{camera.get_image_width(), camera.get_image_height()};
+        integrator->render(camera, film, task._region, task._sample_begin, task._sample_end, scene);
+        return film.write_partial(task._output, film.bounds(task._region), task._sample_begin, task._sample_end) ? 0 : 1;
+    }
+    if (!args.empty() && args[0] == "--coordinate")
+    {
+        if (args.size() != 5) return usage();
+        Camera camera = make_camera();
+        Film film;
+        if (!render_distributed(argv[0], camera, std::stoi(args[1]), std::stoi(args[2]), std::stoi(args[3]), args[4] + ".parts", film, options)) return 1;
+        return write_image(args[4], film, camera.tone_map()) ? 0 : 1;
+    }
+    if (!args.empty() && args[0] == "--animate")
+    {
+        if (args.size() != 3) return usage();
+        int frames = std::stoi(args[1]);
+        // 相机的光源层次引用场景中的材质，arena 须先于相机声明
+        Arena arena;
+        ArenaScope scope{arena};
+        Camera camera = make_camera();
+        CornellBoxHandles handles;
+        auto world = cornell_box(&handles);
+        auto bvh = make_object<BVHnode>(world);
+        HitTableList scene;
+        scene.add(bvh);
+        camera.set_lights(scene);
+        glm::vec3 base = handles._tall_box->offset();
+        // 第 f 帧写盘的同时渲染第 f + 1 帧
+        ImageWriter writer;
+        for (int f = 0; f < frames; f++)
+        {
+            float phase = static_cast<float>(f) / frames;
+            handles._tall_box->set_offset(base + glm::vec3(1.2f * std::sin(2.f * pi * phase), 0.f, 0.f));
+            handles._short_box_rotation->set_angle(-18.f + 360.f * phase);
 
-    auto world = cornell_box();
-    HitTablePtr node = std::make_shared<BVHnode>(world);
-    HitTableList scene;
-    scene.add(node);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            size_t rebuilt = bvh->update();
+            scene.update_bounds();
+            auto t2 = std::chrono::high_resolution_clock::now();
+            std::chrono::high_resolution_clock::time_point t3;
+            {
+                // 仅用于计时的完整重建不能留在 arena 中
+                ArenaScope heap{*std::pmr::new_delete_resource()};
+                HitTablePtrs objects = world;
+                BVHnode full{objects};
+                t3 = std::chrono::high_resolution_clock::now();
+            }
+
+            char name[32];
+            std::snprintf(name, sizeof(name), "_%03d.%s", f, image_extension(format));
+            writer.submit(args[2] + name, camera.render(scene), camera.tone_map());
+            std::cout << "frame " << f << std::fixed << std::setprecision(3)
+                      << " update: " << std::chrono::duration<double, std::micro>(t2 - t1).count() << " us"
+                      << " (rebuilt " << rebuilt << " subtrees, cost ratio " << bvh->cost() / bvh->build_cost() << ")"
+                      << " full rebuild: " << std::chrono::duration<double, std::micro>(t3 - t2).count() << " us" << std::endl;
+        }
+        return writer.flush() == 0 ? 0 : 1;
+    }
+    if (!args.empty() && args[0] == "--merge")
+    {
+        if (args.size() < 3) return usage();
+        Film film;
+        if (!merge_partials({ args.begin() + 2, args.end() }, film)) return 1;
+        Camera camera = make_camera();
+        return write_image(args[1], film, camera.tone_map()) ? 0 : 1;
+    }
+    // 引导、混合与断点渲染只用于路径追踪
+    if (!args.empty() || (guiding && !checkpoint.empty()) || (hybrid && (guiding || !checkpoint.empty())) || 
+        (integrator_name != "path" && (guiding || hybrid || !checkpoint.empty()))) return usage();
+
+    // 场景对象在 arena 中连续分配，arena 先于 scene 与 camera 声明因而后于其销毁
+    Arena arena;
+    ArenaScope scope{arena};
+    Camera camera = make_camera();
+    auto scene = make_scene();
+    camera.set_lights(scene);
     auto t1 = std::chrono::high_resolution_clock::now();
-    // camera.render(framebuffer, world);
-    camera.render(framebuffer, scene);
+    Film film;
+    Film normal, depth;
+    if (hybrid) film = camera.render_hybrid(scene, &normal, &depth);
+    else if (guiding) film = camera.render_guided(scene);
+    else if (checkpoint.empty()) film = integrator->render(camera, scene);
+    else
+    {
+        // 断点只能在同一场景、模型与环境光下续渲
+        std::uint64_t fingerprint = checkpoint_fingerprint("scene=" + (model.empty() ? scene_name : "model:" + model) + "\nenvmap=" + envmap);
+        if (!camera.render(film, scene, checkpoint, checkpoint_interval, fingerprint)) return 1;
+    }
     auto t2 = std::chrono::high_resolution_clock::now();
     
     auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t1).count();
     std::cout << "Rendering time: " << std::fixed << std::setprecision(3) << duration << " seconds" << std::endl;
     
-    framebuffer.write_tga_file("ray_trace.tga");
-    system("open ray_trace.tga");    
+    // G-buffer 特征以线性浮点写出，供降噪使用
+    if (normal.width() > 0 && (!write_image("gbuffer_normal.pfm", normal, camera.tone_map()) || !write_image("gbuffer_depth.pfm", depth, camera.tone_map()))) return 1;
+    return write_image(std::string("ray_trace.") + image_extension(format), film, camera.tone_map()) ? 0 : 1;
 }
-